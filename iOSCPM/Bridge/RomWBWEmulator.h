@@ -45,6 +45,7 @@ typedef NS_ENUM(NSInteger, RWBControlifyMode) {
 @interface RomWBWEmulator : NSObject
 
 @property (weak, nonatomic) id<RomWBWEmulatorDelegate> delegate;
+// Read from the emulator's atomic run state; safe from any thread
 @property (readonly, nonatomic) BOOL isRunning;
 @property (readonly, nonatomic) BOOL isWaitingForInput;
 
@@ -66,6 +67,58 @@ typedef NS_ENUM(NSInteger, RWBControlifyMode) {
 - (void)closeAllDisks;  // Close all disks before reconfiguring
 - (void)setDiskSliceCount:(int)unit slices:(int)slices;  // Set max slices (1-8)
 
+// Save state (ROM must already be loaded to restore).  Taken only while
+// the guest waits for input or is halted; nil otherwise.
+- (nullable NSData*)saveState;
+- (BOOL)loadState:(NSData*)data;
+- (BOOL)saveStateToPath:(NSString*)path;
+- (BOOL)loadStateFromPath:(NSString*)path;
+
+// Checkpoints (incremental rewind points; interval in guest instructions)
+- (void)enableCheckpointsEvery:(long long)instructions keep:(NSInteger)count memoryCap:(NSUInteger)bytes;
+- (void)disableCheckpoints;
+- (NSInteger)checkpointCount;
+- (BOOL)rewindToCheckpoint:(NSInteger)index;  // 0 = oldest
+
+// Record/replay (deterministic input log; replay starts from the recorded state)
+- (BOOL)startRecording;
+- (nullable NSData*)stopRecording;
+- (BOOL)startReplay:(NSData*)log;
+- (BOOL)isReplaying;
+- (long long)replayDivergedAt;  // -1 while the replay matches the recording
+
+// HBIOS call statistics, one dictionary per function code called:
+// name, function, calls, hostNanoseconds, guestInstructions, intervalInstructions
+- (void)setHBIOSCallStatsEnabled:(BOOL)enable;
+- (void)resetHBIOSCallStats;
+- (NSArray<NSDictionary<NSString*, id>*>*)hbiosCallStats;
+
+// Metrics snapshot keyed by the field names in hbios_metrics.h, plus mips.
+// Lock-free: does not pause the run loop and is safe from any thread.
+- (NSDictionary<NSString*, NSNumber*>*)metrics;
+
+// Host time per run-loop batch (default 2000); batches shrink below it
+// while console I/O is active
+- (void)setBatchTargetMicroseconds:(int)microseconds;
+
+// Periodic timer tick (0 = off, the default): interrupts plus the HBIOS
+// TIMER/SECS counters.  With it on, a guest HALT sleeps the run loop
+// until the next tick instead of stopping.
+- (void)setTimerInterruptHz:(int)hz im2Vector:(uint8_t)vector;
+// Pace ticks by guest instructions (deterministic) instead of host time
+- (void)setTicksFollowGuest:(BOOL)guest instructionsPerSecond:(long long)ips;
+
+// Keystroke latency histograms keyed read, output and frontend, each with
+// count, meanMicroseconds, p50, p90, p99, maxMicroseconds and buckets
+// (counts per power-of-two microsecond bucket)
+- (void)setLatencyTrackingEnabled:(BOOL)enable;
+- (void)resetLatency;
+- (NSDictionary<NSString*, NSDictionary<NSString*, id>*>*)latencyHistograms;
+
+// Boot cache (start restores the post-boot snapshot when configuration matches)
+- (void)setBootCachePath:(nullable NSString*)path;
+- (BOOL)restoredFromBootCache;
+
 // Boot string (auto-type at boot menu)
 - (void)setBootString:(NSString*)bootString;
 
@@ -7,6 +7,7 @@
 #import "RomWBWEmulator.h"
 #include "hbios_core.h"
 #include "emu_io.h"
+#include "emu_event.h"
 #include <memory>
 
 // Forward declare the delegate setter from emu_io_ios.mm
@@ -88,11 +89,14 @@ extern "C" void emu_io_set_delegate(id delegate);
 // RomWBWEmulator Implementation
 //=============================================================================
 
+static void wakeEmulator(void* context) {
+  static_cast<HBIOSEmulator*>(context)->wake();
+}
+
 @implementation RomWBWEmulator {
   std::unique_ptr<HBIOSEmulator> _emulator;
   dispatch_queue_t _emulatorQueue;
   RomWBWEmulatorInternal* _internal;
-  BOOL _shouldRun;
   BOOL _debug;
 }
 
@@ -103,17 +107,20 @@ extern "C" void emu_io_set_delegate(id delegate);
     _emulatorQueue = dispatch_queue_create("com.romwbw.emulator", DISPATCH_QUEUE_SERIAL);
     _internal = [[RomWBWEmulatorInternal alloc] init];
     _internal.owner = self;
-    _shouldRun = NO;
 
     // Initialize emu_io
     emu_io_init();
     emu_io_set_delegate(_internal);
+
+    // Host-file data and cancels resume a guest suspended on them
+    emu_event_set_handler(wakeEmulator, _emulator.get());
   }
   return self;
 }
 
 - (void)dealloc {
   [self stop];
+  emu_event_set_handler(nullptr, nullptr);
   emu_io_cleanup();
 }
 
@@ -217,6 +224,270 @@ static const size_t DISK_SIZE_8MB = 8 * 1024 * 1024;
   _emulator->setDiskSliceCount(unit, slices);
 }
 
+//=============================================================================
+// Save State
+//=============================================================================
+
+// Snapshots must not race the run loop: park it, work on the emulator
+// queue (which runs once the loop has returned), then resume.  The pause
+// ends the batch in progress within an instruction.
+- (BOOL)pauseRunLoop {
+  uint32_t state = _emulator->pause();
+  return (state & (HBIOSEmulator::RUN_RUNNING | HBIOSEmulator::RUN_PAUSED)) == HBIOSEmulator::RUN_RUNNING;
+}
+
+- (void)resumeRunLoop {
+  _emulator->resume();
+  dispatch_async(_emulatorQueue, ^{
+    [self runLoop];
+  });
+}
+
+- (nullable NSData*)saveState {
+  BOOL wasRunning = [self pauseRunLoop];
+  __block std::vector<uint8_t> buffer;
+  __block bool ok = false;
+  dispatch_sync(_emulatorQueue, ^{
+    ok = self->_emulator->saveState(buffer);
+  });
+  if (wasRunning) [self resumeRunLoop];
+  if (!ok) return nil;
+  return [NSData dataWithBytes:buffer.data() length:buffer.size()];
+}
+
+- (BOOL)loadState:(NSData*)data {
+  BOOL wasRunning = [self pauseRunLoop];
+  __block bool ok = false;
+  dispatch_sync(_emulatorQueue, ^{
+    ok = self->_emulator->loadState((const uint8_t*)data.bytes, data.length);
+  });
+  if (_debug) NSLog(@"[RomWBW] loadState returned: %@", ok ? @"YES" : @"NO");
+  if (ok || wasRunning) [self resumeRunLoop];
+  return ok;
+}
+
+- (BOOL)saveStateToPath:(NSString*)path {
+  NSData* data = [self saveState];
+  if (!data) return NO;
+  return [data writeToFile:path atomically:YES];
+}
+
+- (BOOL)loadStateFromPath:(NSString*)path {
+  NSData* data = [NSData dataWithContentsOfFile:path];
+  if (!data) {
+    NSLog(@"[RomWBW] Failed to read save state: %@", path);
+    return NO;
+  }
+  return [self loadState:data];
+}
+
+- (void)enableCheckpointsEvery:(long long)instructions keep:(NSInteger)count memoryCap:(NSUInteger)bytes {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->enableCheckpoints(instructions, (size_t)count, (size_t)bytes);
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (void)disableCheckpoints {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->disableCheckpoints();
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (NSInteger)checkpointCount {
+  __block size_t count = 0;
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    count = self->_emulator->getCheckpointCount();
+  });
+  if (wasRunning) [self resumeRunLoop];
+  return (NSInteger)count;
+}
+
+- (BOOL)rewindToCheckpoint:(NSInteger)index {
+  BOOL wasRunning = [self pauseRunLoop];
+  __block bool ok = false;
+  dispatch_sync(_emulatorQueue, ^{
+    ok = index >= 0 && self->_emulator->rewindToCheckpoint((size_t)index);
+  });
+  if (ok || wasRunning) [self resumeRunLoop];
+  return ok;
+}
+
+- (BOOL)startRecording {
+  BOOL wasRunning = [self pauseRunLoop];
+  __block bool ok = false;
+  dispatch_sync(_emulatorQueue, ^{
+    ok = self->_emulator->startRecording();
+  });
+  if (wasRunning) [self resumeRunLoop];
+  return ok;
+}
+
+- (nullable NSData*)stopRecording {
+  BOOL wasRunning = [self pauseRunLoop];
+  __block std::vector<uint8_t> log;
+  __block bool ok = false;
+  dispatch_sync(_emulatorQueue, ^{
+    ok = self->_emulator->stopRecording(log);
+  });
+  if (wasRunning) [self resumeRunLoop];
+  if (!ok) return nil;
+  return [NSData dataWithBytes:log.data() length:log.size()];
+}
+
+- (BOOL)startReplay:(NSData*)log {
+  BOOL wasRunning = [self pauseRunLoop];
+  __block bool ok = false;
+  dispatch_sync(_emulatorQueue, ^{
+    ok = self->_emulator->startReplay((const uint8_t*)log.bytes, log.length);
+  });
+  if (ok || wasRunning) [self resumeRunLoop];
+  return ok;
+}
+
+- (BOOL)isReplaying {
+  return _emulator->isReplaying();
+}
+
+- (long long)replayDivergedAt {
+  return _emulator->replayDivergedAt();
+}
+
+- (void)setHBIOSCallStatsEnabled:(BOOL)enable {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->setHBIOSCallStatsEnabled(enable);
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (void)resetHBIOSCallStats {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->resetHBIOSCallStats();
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (NSArray<NSDictionary<NSString*, id>*>*)hbiosCallStats {
+  __block std::vector<HBIOSCallStat> stats(256);
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    const HBIOSCallStats& calls = self->_emulator->getHBIOSCallStats();
+    for (int f = 0; f < 256; f++) stats[f] = calls.stat((uint8_t)f);
+  });
+  if (wasRunning) [self resumeRunLoop];
+
+  NSMutableArray* result = [NSMutableArray array];
+  for (int f = 0; f < 256; f++) {
+    const HBIOSCallStat& s = stats[f];
+    if (s.calls == 0) continue;
+    [result addObject:@{
+      @"name": [NSString stringWithUTF8String:HBIOSCallStats::functionName((uint8_t)f).c_str()],
+      @"function": @(f),
+      @"calls": @(s.calls),
+      @"hostNanoseconds": @(s.host_ns),
+      @"guestInstructions": @(s.guest_instructions),
+      @"intervalInstructions": @(s.interval_instructions)
+    }];
+  }
+  return result;
+}
+
+- (NSDictionary<NSString*, NSNumber*>*)metrics {
+  HBIOSMetricsSnapshot m = _emulator->getMetrics();
+  NSMutableDictionary* result = [NSMutableDictionary dictionary];
+#define HBIOS_METRIC_ENTRY(name, type, help) result[@#name] = @(m.name);
+  HBIOS_METRICS(HBIOS_METRIC_ENTRY)
+#undef HBIOS_METRIC_ENTRY
+  result[@"mips"] = @(m.mips());
+  return result;
+}
+
+- (void)setBatchTargetMicroseconds:(int)microseconds {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->setBatchTarget(microseconds);
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (void)setTimerInterruptHz:(int)hz im2Vector:(uint8_t)vector {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->setTimerInterrupt(hz, vector);
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (void)setTicksFollowGuest:(BOOL)guest instructionsPerSecond:(long long)ips {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->setTickSource(guest ? HBIOSEmulator::TICK_GUEST : HBIOSEmulator::TICK_HOST, ips);
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (void)setLatencyTrackingEnabled:(BOOL)enable {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->setLatencyTrackingEnabled(enable);
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+- (void)resetLatency {
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    self->_emulator->resetLatency();
+  });
+  if (wasRunning) [self resumeRunLoop];
+}
+
+static NSDictionary<NSString*, id>* latencyDictionary(const HBIOSLatencyHistogram& h) {
+  NSMutableArray* buckets = [NSMutableArray arrayWithCapacity:HBIOSLatencyHistogram::BUCKETS];
+  for (int b = 0; b < HBIOSLatencyHistogram::BUCKETS; b++) [buckets addObject:@(h.buckets[b])];
+  return @{
+    @"count": @(h.count),
+    @"meanMicroseconds": @(h.meanUs()),
+    @"p50": @(h.percentileUs(0.5)),
+    @"p90": @(h.percentileUs(0.9)),
+    @"p99": @(h.percentileUs(0.99)),
+    @"maxMicroseconds": @(h.max_ns / 1e3),
+    @"buckets": buckets
+  };
+}
+
+- (NSDictionary<NSString*, NSDictionary<NSString*, id>*>*)latencyHistograms {
+  __block HBIOSLatencyHistogram read, output, frontend;
+  BOOL wasRunning = [self pauseRunLoop];
+  dispatch_sync(_emulatorQueue, ^{
+    const HBIOSLatency& latency = self->_emulator->getLatency();
+    read = latency.toRead();
+    output = latency.toOutput();
+    frontend = latency.toFrontend();
+  });
+  if (wasRunning) [self resumeRunLoop];
+
+  return @{
+    @"read": latencyDictionary(read),
+    @"output": latencyDictionary(output),
+    @"frontend": latencyDictionary(frontend)
+  };
+}
+
+- (void)setBootCachePath:(nullable NSString*)path {
+  _emulator->setBootCachePath(path ? [path UTF8String] : "");
+}
+
+- (BOOL)restoredFromBootCache {
+  return _emulator->restoredFromBootCache();
+}
+
 //=============================================================================
 // Boot String
 //=============================================================================
@@ -239,7 +510,7 @@ static const size_t DISK_SIZE_8MB = 8 * 1024 * 1024;
 
 - (void)start {
   if (_debug) NSLog(@"[RomWBW] start called");
-  _shouldRun = YES;
+  _emulator->resume();
   _emulator->start();
   if (_debug) NSLog(@"[RomWBW] emulator started, isRunning=%d", _emulator->isRunning());
 
@@ -252,8 +523,10 @@ static const size_t DISK_SIZE_8MB = 8 * 1024 * 1024;
 }
 
 - (void)stop {
-  _shouldRun = NO;
   _emulator->stop();
+  // The batch in progress ends at its next instruction; wait for it so
+  // the caller can touch the emulator (reset) without racing the loop
+  _emulator->waitRunState(HBIOSEmulator::RUN_ACTIVE, 0, 100);
 }
 
 - (void)reset {
@@ -263,33 +536,41 @@ static const size_t DISK_SIZE_8MB = 8 * 1024 * 1024;
 
 - (void)runLoop {
   int loopCount = 0;
-  while (_shouldRun && _emulator->isRunning()) {
-    // Run a batch of instructions
-    _emulator->runBatch(10000);
+  HBIOSEmulator::WaitReason lastWait = HBIOSEmulator::WAIT_NONE;
+  const uint32_t live = HBIOSEmulator::RUN_RUNNING | HBIOSEmulator::RUN_PAUSED;
+  while ((_emulator->getRunState() & live) == HBIOSEmulator::RUN_RUNNING) {
+    // Run a display frame's worth; stop and pause end it within an
+    // instruction, and it returns early when the guest waits
+    HBIOSEmulator::WaitReason wait = _emulator->runFor(16000);
     loopCount++;
 
     // Log progress every 1000 batches (only in debug mode)
     if (_debug && (loopCount % 1000 == 0)) {
-      NSLog(@"[RomWBW] runLoop: %d batches, PC=0x%04X, instructions=%lld",
-            loopCount, _emulator->getPC(), _emulator->getInstructionCount());
+      NSLog(@"[RomWBW] runLoop: %d batches, PC=0x%04X, instructions=%lld, batch=%d",
+            loopCount, _emulator->getPC(), _emulator->getInstructionCount(),
+            _emulator->getAdaptiveBatchSize());
     }
 
-    // If waiting for input, notify delegate and wait a bit
-    if (_emulator->isWaitingForInput()) {
-      dispatch_async(dispatch_get_main_queue(), ^{
-        if (self.delegate && [self.delegate respondsToSelector:@selector(emulatorDidRequestInput)]) {
-          [self.delegate emulatorDidRequestInput];
-        }
-      });
-
-      // Small sleep to avoid spinning
-      [NSThread sleepForTimeInterval:0.001];
+    // Input wait: notify the delegate once, then sleep until resumed
+    if (wait == HBIOSEmulator::WAIT_INPUT) {
+      if (lastWait != HBIOSEmulator::WAIT_INPUT) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+          if (self.delegate && [self.delegate respondsToSelector:@selector(emulatorDidRequestInput)]) {
+            [self.delegate emulatorDidRequestInput];
+          }
+        });
+      }
+      _emulator->waitForEvent(50);
+    } else if (wait == HBIOSEmulator::WAIT_TICK) {
+      // HALT: sleep until the next timer tick
+      _emulator->waitForEvent(50);
     } else {
       // Very small yield to prevent CPU hogging
       [NSThread sleepForTimeInterval:0.0001];
     }
+    lastWait = wait;
   }
-  if (_debug) NSLog(@"[RomWBW] runLoop ended: shouldRun=%d, isRunning=%d", _shouldRun, _emulator->isRunning());
+  if (_debug) NSLog(@"[RomWBW] runLoop ended: paused=%d, isRunning=%d", _emulator->isPaused(), _emulator->isRunning());
 }
 
 //=============================================================================
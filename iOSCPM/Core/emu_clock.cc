@@ -0,0 +1,154 @@
+/*
+ * Emulator Clock - Cached Decomposition and Thread Binding
+ */
+
+#include "emu_clock.h"
+#include <chrono>
+#include <ctime>
+
+static void fromTm(const struct tm& tm, emu_time* t) {
+  t->year = tm.tm_year + 1900;
+  t->month = tm.tm_mon + 1;
+  t->day = tm.tm_mday;
+  t->hour = tm.tm_hour;
+  t->minute = tm.tm_min;
+  t->second = tm.tm_sec;
+  t->weekday = tm.tm_wday;  // 0=Sunday
+}
+
+void emu_clock_decompose(int64_t epoch, emu_time* t) {
+  time_t secs = (time_t)epoch;
+  struct tm tm;
+  gmtime_r(&secs, &tm);
+  fromTm(tm, t);
+}
+
+//=============================================================================
+// EmuClock
+//=============================================================================
+
+EmuClock::EmuClock()
+  : current_mode(HOST), start_epoch(0), instructions_per_second(1000000), cached_epoch(-1) {
+  cached = emu_time();
+}
+
+void EmuClock::setHost() {
+  current_mode = HOST;
+}
+
+void EmuClock::setFixed(int64_t epoch) {
+  current_mode = FIXED;
+  start_epoch = epoch;
+  cached_epoch = epoch;
+  emu_clock_decompose(epoch, &cached);
+}
+
+void EmuClock::setVirtual(int64_t epoch, long long ips) {
+  current_mode = VIRTUAL;
+  start_epoch = epoch;
+  instructions_per_second = ips > 0 ? ips : 1000000;
+  cached_epoch = epoch;
+  emu_clock_decompose(epoch, &cached);
+}
+
+void EmuClock::read(emu_time* t, long long instructions) {
+  if (current_mode == HOST) {
+    emu_clock_read(t);
+    return;
+  }
+  if (current_mode == VIRTUAL) {
+    int64_t epoch = start_epoch + instructions / instructions_per_second;
+    if (epoch != cached_epoch) {
+      // Within the cached minute only the seconds move
+      if (epoch > cached_epoch && epoch / 60 == cached_epoch / 60) {
+        cached.second += (int)(epoch - cached_epoch);
+      } else {
+        emu_clock_decompose(epoch, &cached);
+      }
+      cached_epoch = epoch;
+    }
+  }
+  *t = cached;
+}
+
+//=============================================================================
+// Host Time
+//=============================================================================
+
+namespace {
+
+struct HostClockCache {
+  bool valid = false;
+  std::chrono::steady_clock::time_point next_second;  // When the cached second ends
+  emu_time time = emu_time();
+};
+
+}  // namespace
+
+static thread_local HostClockCache t_host;
+
+static void readHost(emu_time* t) {
+  typedef std::chrono::steady_clock Steady;
+  typedef std::chrono::system_clock System;
+  Steady::time_point now = Steady::now();
+  HostClockCache& h = t_host;
+
+  if (h.valid && now < h.next_second) {
+    *t = h.time;
+    return;
+  }
+  if (h.valid) {
+    long long passed = 1 + (long long)((now - h.next_second) / std::chrono::seconds(1));
+    if (h.time.second + passed < 60) {
+      h.time.second += (int)passed;
+      h.next_second += std::chrono::seconds(passed);
+      *t = h.time;
+      return;
+    }
+  }
+
+  // New minute (or first read): full decomposition
+  System::time_point wall = System::now();
+  time_t secs = System::to_time_t(wall);
+  System::duration into = wall - System::from_time_t(secs);
+  if (into < System::duration::zero()) {  // to_time_t may round up
+    secs -= 1;
+    into += std::chrono::seconds(1);
+  }
+  struct tm tm;
+  localtime_r(&secs, &tm);
+  fromTm(tm, &h.time);
+  h.next_second = now + std::chrono::duration_cast<Steady::duration>(std::chrono::seconds(1) - into);
+  h.valid = true;
+  *t = h.time;
+}
+
+//=============================================================================
+// Thread Binding
+//=============================================================================
+
+static thread_local EmuClock* t_clock = nullptr;
+static thread_local const long long* t_instructions = nullptr;
+
+void emu_clock_bind(EmuClock* clock, const long long* instructions) {
+  t_clock = clock;
+  t_instructions = instructions;
+}
+
+EmuClockScope::EmuClockScope(EmuClock* clock, const long long* instructions)
+  : previous_clock(t_clock), previous_instructions(t_instructions) {
+  emu_clock_bind(clock, instructions);
+}
+
+EmuClockScope::~EmuClockScope() {
+  emu_clock_bind(previous_clock, previous_instructions);
+}
+
+void emu_clock_read(emu_time* t) {
+  EmuClock* clock = t_clock;
+  if (clock && clock->mode() != EmuClock::HOST) {
+    clock->read(t, t_instructions ? *t_instructions : 0);
+  } else {
+    readHost(t);
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ * Emulator Clock - Cached Real-Time Clock for emu_get_time()
+ *
+ * RTC reads are frequent (ZSDOS datestamping, clock utilities), but the
+ * time only changes once a second.  emu_clock_read() keeps the last
+ * decomposed time per thread and advances its seconds field on the
+ * monotonic clock; the calendar decomposition (localtime_r) runs again
+ * only when the minute rolls over, which also picks up DST and host
+ * clock changes.
+ *
+ * An HBIOSEmulator can replace host time with its own EmuClock, bound
+ * to the thread for the duration of runBatch() like the replay log:
+ *
+ *   FIXED    always the same instant
+ *   VIRTUAL  starts at a given instant and advances with the guest
+ *            instruction count, so runs are reproducible
+ *
+ * Fixed and virtual instants are seconds since 1970 and decompose as
+ * UTC, independent of the host time zone.  Weekday is 0 = Sunday.
+ */
+
+#ifndef EMU_CLOCK_H
+#define EMU_CLOCK_H
+
+#include "emu_io.h"
+#include <cstdint>
+
+class EmuClock {
+public:
+  enum Mode { HOST, FIXED, VIRTUAL };
+
+  EmuClock();
+
+  void setHost();
+  void setFixed(int64_t epoch);
+  void setVirtual(int64_t start_epoch, long long instructions_per_second = 1000000);
+  Mode mode() const { return current_mode; }
+
+  // Time at the given guest instruction count (ignored unless VIRTUAL)
+  void read(emu_time* t, long long instructions);
+
+private:
+  Mode current_mode;
+  int64_t start_epoch;
+  long long instructions_per_second;
+
+  // Last decomposition: the epoch second it describes
+  int64_t cached_epoch;
+  emu_time cached;
+};
+
+// Decompose epoch seconds as UTC
+void emu_clock_decompose(int64_t epoch, emu_time* t);
+
+//=============================================================================
+// Thread Binding and Backend Hook
+//=============================================================================
+
+void emu_clock_bind(EmuClock* clock, const long long* instructions);
+
+class EmuClockScope {
+public:
+  EmuClockScope(EmuClock* clock, const long long* instructions);
+  ~EmuClockScope();
+
+private:
+  EmuClock* previous_clock;
+  const long long* previous_instructions;
+};
+
+// Used by emu_get_time() backends for the live time: the bound clock if
+// any, otherwise cached host local time
+void emu_clock_read(emu_time* t);
+
+#endif // EMU_CLOCK_H
@@ -0,0 +1,21 @@
+/*
+ * Emulator Events - Handler Registration
+ */
+
+#include "emu_event.h"
+#include <mutex>
+
+static std::mutex g_event_lock;  // Held while signalling so a handler is never called after removal
+static emu_event_handler g_handler = nullptr;
+static void* g_context = nullptr;
+
+void emu_event_set_handler(emu_event_handler handler, void* context) {
+  std::lock_guard<std::mutex> guard(g_event_lock);
+  g_handler = handler;
+  g_context = context;
+}
+
+void emu_event_signal() {
+  std::lock_guard<std::mutex> guard(g_event_lock);
+  if (g_handler) g_handler(g_context);
+}
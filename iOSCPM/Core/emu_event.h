@@ -0,0 +1,26 @@
+/*
+ * Emulator Events - Wakeups from emu_io Backends
+ *
+ * A guest suspended on an HBIOS wait (see HBIOSEmulator::waitReason())
+ * is resumed by whatever it is waiting for.  Console input comes in
+ * through HBIOSEmulator::queueInput(), which resumes the emulator itself;
+ * other sources live in the backend, such as host-file data from the file
+ * picker or a cancelled transfer, and call emu_event_signal() instead.
+ *
+ * The frontend registers the emulator to resume.  There is one handler
+ * per process, like the backend's host-file state.  Handlers may be
+ * called from any thread.
+ */
+
+#ifndef EMU_EVENT_H
+#define EMU_EVENT_H
+
+typedef void (*emu_event_handler)(void* context);
+
+// nullptr removes the handler
+void emu_event_set_handler(emu_event_handler handler, void* context);
+
+// Called by emu_io backends when data a guest may be waiting for arrives
+void emu_event_signal();
+
+#endif // EMU_EVENT_H
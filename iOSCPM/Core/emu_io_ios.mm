@@ -7,6 +7,10 @@
 #import <Foundation/Foundation.h>
 #import <AVFoundation/AVFoundation.h>
 #include "emu_io.h"
+#include "emu_replay.h"
+#include "hbios_latency.h"
+#include "emu_clock.h"
+#include "emu_event.h"
 #include <cstdarg>
 #include <cstdio>
 #include <queue>
@@ -100,15 +104,31 @@ void emu_io_cleanup() {
 }
 
 bool emu_console_has_input() {
-  std::lock_guard<std::mutex> lock(g_input_mutex);
-  return !g_input_queue.empty();
+  int replayed;
+  if (emu_replay_fetch(REPLAY_CONSOLE_STATUS, &replayed)) return replayed != 0;
+  bool ready;
+  {
+    std::lock_guard<std::mutex> lock(g_input_mutex);
+    ready = !g_input_queue.empty();
+  }
+  emu_replay_note(REPLAY_CONSOLE_STATUS, ready ? 1 : 0);
+  return ready;
 }
 
 int emu_console_read_char() {
-  std::lock_guard<std::mutex> lock(g_input_mutex);
-  if (g_input_queue.empty()) return -1;
-  int ch = g_input_queue.front();
-  g_input_queue.pop();
+  int ch;
+  if (emu_replay_fetch(REPLAY_CONSOLE_CHAR, &ch)) return ch;
+  {
+    std::lock_guard<std::mutex> lock(g_input_mutex);
+    if (g_input_queue.empty()) {
+      ch = -1;
+    } else {
+      ch = g_input_queue.front();
+      g_input_queue.pop();
+    }
+  }
+  emu_replay_note(REPLAY_CONSOLE_CHAR, ch);
+  emu_latency_note_read(ch);
   return ch;
 }
 
@@ -370,22 +390,26 @@ size_t emu_disk_size(emu_disk_handle disk) {
 //=============================================================================
 
 void emu_get_time(emu_time* t) {
-  @autoreleasepool {
-    NSDate* now = [NSDate date];
-    NSCalendar* calendar = [NSCalendar currentCalendar];
-    NSDateComponents* components = [calendar components:(NSCalendarUnitYear | NSCalendarUnitMonth |
-                                                         NSCalendarUnitDay | NSCalendarUnitHour |
-                                                         NSCalendarUnitMinute | NSCalendarUnitSecond |
-                                                         NSCalendarUnitWeekday)
-                                               fromDate:now];
-    t->year = (int)components.year;
-    t->month = (int)components.month;
-    t->day = (int)components.day;
-    t->hour = (int)components.hour;
-    t->minute = (int)components.minute;
-    t->second = (int)components.second;
-    t->weekday = ((int)components.weekday + 6) % 7;  // Convert to 0=Sunday
+  int32_t fields[7];
+  if (emu_replay_fetch_values(REPLAY_TIME, fields, 7)) {
+    t->year = fields[0];
+    t->month = fields[1];
+    t->day = fields[2];
+    t->hour = fields[3];
+    t->minute = fields[4];
+    t->second = fields[5];
+    t->weekday = fields[6];
+    return;
   }
+  emu_clock_read(t);  // Cached local time, or the emulator's fixed/virtual clock
+  fields[0] = t->year;
+  fields[1] = t->month;
+  fields[2] = t->day;
+  fields[3] = t->hour;
+  fields[4] = t->minute;
+  fields[5] = t->second;
+  fields[6] = t->weekday;
+  emu_replay_note_values(REPLAY_TIME, fields, 7);
 }
 
 //=============================================================================
@@ -393,7 +417,11 @@ void emu_get_time(emu_time* t) {
 //=============================================================================
 
 unsigned int emu_random(unsigned int min, unsigned int max) {
-  return min + arc4random_uniform(max - min + 1);
+  int replayed;
+  if (emu_replay_fetch(REPLAY_RANDOM, &replayed)) return (unsigned int)replayed;
+  unsigned int value = min + arc4random_uniform(max - min + 1);
+  emu_replay_note(REPLAY_RANDOM, (int)value);
+  return value;
 }
 
 //=============================================================================
@@ -514,6 +542,9 @@ static std::vector<uint8_t> g_host_write_buffer;
 static std::string g_host_write_filename;
 
 emu_host_file_state emu_host_file_get_state() {
+  int replayed;
+  if (emu_replay_fetch(REPLAY_HOST_STATE, &replayed)) return (emu_host_file_state)replayed;
+  emu_replay_note(REPLAY_HOST_STATE, (int)g_host_file_state);
   return g_host_file_state;
 }
 
@@ -523,6 +554,11 @@ extern "C" int emu_host_file_get_state_c() {
 }
 
 bool emu_host_file_open_read(const char* filename) {
+  // A replayed transfer takes its data from the log, not the user
+  int replayed;
+  if (emu_replay_fetch(REPLAY_HOST_OPEN, &replayed)) return replayed != 0;
+  emu_replay_note(REPLAY_HOST_OPEN, 1);
+
   // Close any existing read operation
   g_host_read_buffer.clear();
   g_host_read_pos = 0;
@@ -542,6 +578,10 @@ bool emu_host_file_open_read(const char* filename) {
 }
 
 bool emu_host_file_open_write(const char* filename) {
+  // Always opens here; logged because the headless backend can refuse
+  int replayed;
+  if (!emu_replay_fetch(REPLAY_HOST_OPEN, &replayed)) emu_replay_note(REPLAY_HOST_OPEN, 1);
+
   // Close any existing write operation
   g_host_write_buffer.clear();
   g_host_write_filename = filename ? filename : "download.bin";
@@ -550,9 +590,15 @@ bool emu_host_file_open_write(const char* filename) {
 }
 
 int emu_host_file_read_byte() {
-  if (g_host_file_state != HOST_FILE_READING) return -1;
-  if (g_host_read_pos >= g_host_read_buffer.size()) return -1;
-  return g_host_read_buffer[g_host_read_pos++];
+  int value;
+  if (emu_replay_fetch(REPLAY_HOST_BYTE, &value)) return value;
+  if (g_host_file_state != HOST_FILE_READING || g_host_read_pos >= g_host_read_buffer.size()) {
+    value = -1;
+  } else {
+    value = g_host_read_buffer[g_host_read_pos++];
+  }
+  emu_replay_note(REPLAY_HOST_BYTE, value);
+  return value;
 }
 
 bool emu_host_file_write_byte(uint8_t byte) {
@@ -594,6 +640,7 @@ void emu_host_file_provide_data(const uint8_t* data, size_t size) {
   g_host_read_buffer.assign(data, data + size);
   g_host_read_pos = 0;
   g_host_file_state = HOST_FILE_READING;
+  emu_event_signal();  // Resume a guest waiting for the data
 }
 
 const uint8_t* emu_host_file_get_write_data() {
@@ -631,4 +678,5 @@ extern "C" void emu_host_file_cancel() {
   g_host_file_state = HOST_FILE_IDLE;
   g_host_read_buffer.clear();
   g_host_read_pos = 0;
+  emu_event_signal();  // The waiting guest sees the cancel
 }
@@ -0,0 +1,281 @@
+/*
+ * Emulator Record/Replay - Log Encoding and Playback
+ *
+ * Stream encoding, per event:
+ *   varint stamp delta   varint index delta   zigzag varint value...
+ */
+
+#include "emu_replay.h"
+#include "hbios_snapshot.h"
+#include "emu_io.h"
+
+static const uint32_t REPLAY_SECT_STATE = SNAP_TAG('S', 'T', 'A', 'T');
+static const uint32_t REPLAY_SECT_STREAM = SNAP_TAG('S', 'T', 'R', 'M');
+
+//=============================================================================
+// Varints
+//=============================================================================
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+static bool getVarint(const std::vector<uint8_t>& in, size_t& pos, uint64_t& v) {
+  v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos >= in.size()) return false;
+    uint8_t b = in[pos++];
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static uint64_t zigzag(int32_t v) {
+  return (uint64_t)(((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+static int32_t unzigzag(uint64_t v) {
+  return (int32_t)((uint32_t)(v >> 1) ^ (uint32_t)-(int32_t)(v & 1));
+}
+
+//=============================================================================
+// Log
+//=============================================================================
+
+EmuReplayLog::EmuReplayLog()
+  : current_mode(OFF), clock(nullptr), end_stamp(0), divergence(-1)
+{
+  resetStreams(false);
+}
+
+void EmuReplayLog::resetStreams(bool keep_data) {
+  for (Stream& s : streams) {
+    if (!keep_data) s.data.clear();
+    s.pos = 0;
+    s.calls = 0;
+    s.prev_stamp = 0;
+    s.prev_index = 0;
+    s.poll_value = 0;
+    s.has_next = false;
+    s.next_stamp = 0;
+    s.next_index = 0;
+  }
+}
+
+void EmuReplayLog::beginRecording(const long long* clk, const std::vector<uint8_t>& state) {
+  clock = clk;
+  start_state = state;
+  end_stamp = 0;
+  divergence = -1;
+  resetStreams(false);
+  // Stamps are stored relative to the start so they fit small varints
+  for (Stream& s : streams) s.prev_stamp = *clock;
+  current_mode = RECORDING;
+}
+
+void EmuReplayLog::stop() {
+  if (current_mode == RECORDING) end_stamp = *clock;
+  current_mode = OFF;
+}
+
+bool EmuReplayLog::beginPlayback(const long long* clk) {
+  if (start_state.empty()) return false;
+  clock = clk;
+  divergence = -1;
+  resetStreams(true);
+  for (int i = 0; i < REPLAY_SOURCE_COUNT; i++) {
+    streams[i].prev_stamp = *clock;
+    advance(streams[i], valueCount((EmuReplaySource)i));
+  }
+  current_mode = PLAYING;
+  return true;
+}
+
+void EmuReplayLog::append(Stream& s, uint64_t index, const int32_t* values, int count) {
+  long long stamp = *clock;
+  putVarint(s.data, (uint64_t)(stamp - s.prev_stamp));
+  putVarint(s.data, index - s.prev_index);
+  for (int i = 0; i < count; i++) putVarint(s.data, zigzag(values[i]));
+  s.prev_stamp = stamp;
+  s.prev_index = index;
+}
+
+// Decode the next event of a stream into its lookahead slot
+void EmuReplayLog::advance(Stream& s, int count) {
+  uint64_t stamp_delta, index_delta, v;
+  s.has_next = false;
+  if (!getVarint(s.data, s.pos, stamp_delta) || !getVarint(s.data, s.pos, index_delta)) return;
+  for (int i = 0; i < count; i++) {
+    if (!getVarint(s.data, s.pos, v)) return;
+    s.next_values[i] = unzigzag(v);
+  }
+  s.next_stamp = s.prev_stamp + (long long)stamp_delta;
+  s.next_index = s.prev_index + index_delta;
+  s.prev_stamp = s.next_stamp;
+  s.prev_index = s.next_index;
+  s.has_next = true;
+}
+
+void EmuReplayLog::checkStamp(EmuReplaySource source, long long stamp) {
+  if (stamp != *clock && divergence < 0) {
+    divergence = *clock;
+    emu_error("[REPLAY] Source %d diverged at instruction %lld (recorded at %lld)\n",
+              (int)source, *clock, stamp);
+  }
+}
+
+void EmuReplayLog::markDiverged(EmuReplaySource source) {
+  if (divergence < 0) {
+    divergence = *clock;
+    emu_error("[REPLAY] Source %d diverged at instruction %lld (no recorded event)\n",
+              (int)source, *clock);
+  }
+}
+
+void EmuReplayLog::note(EmuReplaySource source, const int32_t* values, int count) {
+  if (current_mode != RECORDING) return;
+  Stream& s = streams[source];
+  uint64_t index = s.calls++;
+  if (isPolled(source)) {
+    if (values[0] == s.poll_value) return;
+    s.poll_value = values[0];
+  }
+  append(s, index, values, count);
+}
+
+bool EmuReplayLog::fetch(EmuReplaySource source, int32_t* values, int count) {
+  if (current_mode != PLAYING) return false;
+  if (*clock >= end_stamp) {
+    // Past the end of the recording - hand over to live input
+    current_mode = OFF;
+    return false;
+  }
+
+  Stream& s = streams[source];
+  uint64_t index = s.calls++;
+
+  if (isPolled(source)) {
+    if (s.has_next && s.next_index == index) {
+      checkStamp(source, s.next_stamp);
+      s.poll_value = s.next_values[0];
+      advance(s, count);
+    }
+    values[0] = s.poll_value;
+    return true;
+  }
+
+  if (!s.has_next || s.next_index != index) {
+    markDiverged(source);
+    return false;
+  }
+  checkStamp(source, s.next_stamp);
+  for (int i = 0; i < count; i++) values[i] = s.next_values[i];
+  advance(s, count);
+  return true;
+}
+
+//=============================================================================
+// File Format
+//=============================================================================
+
+void EmuReplayLog::serialize(std::vector<uint8_t>& out) const {
+  out.clear();
+  SnapshotWriter w(out);
+  w.u32(REPLAY_MAGIC);
+  w.u16(REPLAY_VERSION);
+  w.u16(REPLAY_SOURCE_COUNT);
+  w.u64((uint64_t)end_stamp);
+
+  w.beginSection(REPLAY_SECT_STATE);
+  w.bytes(start_state.data(), start_state.size());
+  w.endSection();
+
+  for (int i = 0; i < REPLAY_SOURCE_COUNT; i++) {
+    w.beginSection(REPLAY_SECT_STREAM);
+    w.u8((uint8_t)i);
+    w.bytes(streams[i].data.data(), streams[i].data.size());
+    w.endSection();
+  }
+}
+
+bool EmuReplayLog::deserialize(const uint8_t* data, size_t size) {
+  SnapshotReader r(data, size);
+  if (r.u32() != REPLAY_MAGIC || r.u16() != REPLAY_VERSION) {
+    emu_error("[REPLAY] Not a replay log or unsupported version\n");
+    return false;
+  }
+  r.u16();  // Source count - unknown sources are skipped below
+  long long stamp = (long long)r.u64();
+  if (!r.ok()) return false;
+
+  std::vector<uint8_t> state;
+  std::vector<uint8_t> stream_data[REPLAY_SOURCE_COUNT];
+  uint32_t tag;
+  SnapshotReader body;
+  while (r.nextSection(tag, body)) {
+    if (tag == REPLAY_SECT_STATE) {
+      size_t n = body.remaining();
+      const uint8_t* p = body.skip(n);
+      if (p) state.assign(p, p + n);
+    } else if (tag == REPLAY_SECT_STREAM) {
+      uint8_t source = body.u8();
+      if (source >= REPLAY_SOURCE_COUNT) continue;  // Newer log
+      size_t n = body.remaining();
+      const uint8_t* p = body.skip(n);
+      if (p) stream_data[source].assign(p, p + n);
+    }
+  }
+  if (!r.ok() || state.empty()) {
+    emu_error("[REPLAY] Replay log is truncated\n");
+    return false;
+  }
+
+  current_mode = OFF;
+  start_state.swap(state);
+  end_stamp = stamp;
+  divergence = -1;
+  resetStreams(false);
+  for (int i = 0; i < REPLAY_SOURCE_COUNT; i++) streams[i].data.swap(stream_data[i]);
+  return true;
+}
+
+//=============================================================================
+// Thread Binding and Backend Hooks
+//=============================================================================
+
+static thread_local EmuReplayLog* t_replay = nullptr;
+
+void emu_replay_bind(EmuReplayLog* log) {
+  t_replay = log;
+}
+
+EmuReplayLog* emu_replay_bound() {
+  return t_replay;
+}
+
+bool emu_replay_fetch_values(EmuReplaySource source, int32_t* values, int count) {
+  EmuReplayLog* log = t_replay;
+  return log && log->fetch(source, values, count);
+}
+
+void emu_replay_note_values(EmuReplaySource source, const int32_t* values, int count) {
+  EmuReplayLog* log = t_replay;
+  if (log) log->note(source, values, count);
+}
+
+bool emu_replay_fetch(EmuReplaySource source, int* value) {
+  int32_t v;
+  if (!emu_replay_fetch_values(source, &v, 1)) return false;
+  *value = v;
+  return true;
+}
+
+void emu_replay_note(EmuReplaySource source, int value) {
+  int32_t v = value;
+  emu_replay_note_values(source, &v, 1);
+}
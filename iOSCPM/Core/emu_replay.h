@@ -0,0 +1,142 @@
+/*
+ * Emulator Record/Replay - Deterministic Input Log
+ *
+ * Everything the guest can observe that does not come from ROM, RAM or
+ * disk images passes through emu_io: console input, the RTC, emu_random
+ * and host-file transfers.  While a log is bound to the emulating thread
+ * (HBIOSEmulator binds its own log for each runBatch()), the emu_io
+ * backends note every such value when recording and take it from the
+ * log instead of the host when replaying.
+ *
+ * Each input source is a separate stream of events stamped with the
+ * guest instruction count and the call's position in that stream.
+ * Polled sources (console status, host-file state) only store changes,
+ * so a guest spinning on CIOIST costs nothing in the log.  A replay whose
+ * calls stop lining up with the recording is flagged as diverged at the
+ * first mismatching instruction count.
+ *
+ * A log starts with a full save state (disks included), so recording can
+ * begin in the middle of a session.
+ */
+
+#ifndef EMU_REPLAY_H
+#define EMU_REPLAY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+static const uint32_t REPLAY_MAGIC = 0x52425752;   // "RWBR"
+static const uint16_t REPLAY_VERSION = 2;   // 2: host file write opens logged
+
+// Input sources; each one is its own stream in the log
+enum EmuReplaySource {
+  REPLAY_CONSOLE_STATUS = 0,  // emu_console_has_input (polled)
+  REPLAY_CONSOLE_CHAR,        // emu_console_read_char
+  REPLAY_TIME,                // emu_get_time (7 fields)
+  REPLAY_RANDOM,              // emu_random
+  REPLAY_HOST_STATE,          // emu_host_file_get_state (polled)
+  REPLAY_HOST_OPEN,           // emu_host_file_open_read/open_write result
+  REPLAY_HOST_BYTE,           // emu_host_file_read_byte
+  REPLAY_SOURCE_COUNT
+};
+
+static const int REPLAY_MAX_VALUES = 7;
+
+class EmuReplayLog {
+public:
+  enum Mode { OFF, RECORDING, PLAYING };
+
+  EmuReplayLog();
+
+  // clock: the emulator's instruction counter, read on every event
+  void beginRecording(const long long* clock, const std::vector<uint8_t>& start_state);
+  bool beginPlayback(const long long* clock);
+  void stop();  // Ends a recording at the current instruction or abandons playback
+
+  Mode mode() const { return current_mode; }
+  bool diverged() const { return divergence >= 0; }
+  long long divergedAt() const { return divergence; }
+  long long endStamp() const { return end_stamp; }
+  const std::vector<uint8_t>& startState() const { return start_state; }
+
+  // Recording: log the live value(s) just returned to the guest
+  void note(EmuReplaySource source, const int32_t* values, int count);
+
+  // Playback: fill values from the log.  Returns false once the replay
+  // has reached the end of the recording (the caller then uses live
+  // input) or the stream has run dry.
+  bool fetch(EmuReplaySource source, int32_t* values, int count);
+
+  // File format: header, start state, one section per source stream
+  void serialize(std::vector<uint8_t>& out) const;
+  bool deserialize(const uint8_t* data, size_t size);
+
+private:
+  struct Stream {
+    std::vector<uint8_t> data;
+    size_t pos;
+    uint64_t calls;       // Calls seen in this session
+    long long prev_stamp; // Delta bases
+    uint64_t prev_index;
+    int32_t poll_value;   // Polled sources: value as of the last change
+
+    // Playback lookahead
+    bool has_next;
+    long long next_stamp;
+    uint64_t next_index;
+    int32_t next_values[REPLAY_MAX_VALUES];
+  };
+
+  static bool isPolled(EmuReplaySource source) {
+    return source == REPLAY_CONSOLE_STATUS || source == REPLAY_HOST_STATE;
+  }
+  static int valueCount(EmuReplaySource source) {
+    return source == REPLAY_TIME ? REPLAY_MAX_VALUES : 1;
+  }
+
+  void resetStreams(bool keep_data);
+  void append(Stream& s, uint64_t index, const int32_t* values, int count);
+  void advance(Stream& s, int count);
+  void checkStamp(EmuReplaySource source, long long stamp);
+  void markDiverged(EmuReplaySource source);
+
+  Mode current_mode;
+  const long long* clock;
+  long long end_stamp;
+  long long divergence;   // -1 = none
+  std::vector<uint8_t> start_state;
+  Stream streams[REPLAY_SOURCE_COUNT];
+};
+
+//=============================================================================
+// Thread Binding and Backend Hooks
+//=============================================================================
+
+void emu_replay_bind(EmuReplayLog* log);
+EmuReplayLog* emu_replay_bound();
+
+class EmuReplayScope {
+public:
+  explicit EmuReplayScope(EmuReplayLog* log) : previous(emu_replay_bound()) {
+    emu_replay_bind(log);
+  }
+  ~EmuReplayScope() { emu_replay_bind(previous); }
+
+private:
+  EmuReplayLog* previous;
+};
+
+// Used by emu_io backends around each nondeterministic call:
+//
+//   int v;
+//   if (emu_replay_fetch(REPLAY_RANDOM, &v)) return v;
+//   v = <live value>;
+//   emu_replay_note(REPLAY_RANDOM, v);
+//
+bool emu_replay_fetch(EmuReplaySource source, int* value);
+void emu_replay_note(EmuReplaySource source, int value);
+bool emu_replay_fetch_values(EmuReplaySource source, int32_t* values, int count);
+void emu_replay_note_values(EmuReplaySource source, const int32_t* values, int count);
+
+#endif // EMU_REPLAY_H
@@ -0,0 +1,349 @@
+/*
+ * HBIOS BDOS - Direct Console Output and hd1k File Reads
+ *
+ * The file functions follow the CP/M 2.2 BDOS routines they replace
+ * (search, open$copy, open$reel, rseek, diskread) so the FCB ends up
+ * byte-for-byte as the BDOS would leave it.
+ */
+
+#include "hbios_bdos.h"
+#include <cstring>
+
+static const uint16_t BDOS_ENTRY = 0x0005;
+static const uint16_t DEFAULT_DMA = 0x0080;
+
+// hd1k slice geometry (see tools/cpm_disk.h)
+static const size_t SLICE_SIZE = 8 * 1024 * 1024;
+static const size_t PREFIX_SIZE = 1024 * 1024;  // Combo images
+static const size_t DIR_OFFSET = 0x4000;
+static const size_t BLOCK_SIZE = 4096;
+static const int DIR_ENTRIES = 1024;
+static const int SLICE_BLOCKS = (int)((SLICE_SIZE - DIR_OFFSET) / BLOCK_SIZE);
+static const int BLKSHF = 5;   // 32 records per block
+static const int BLKMSK = 31;
+static const uint8_t EXM = 1;  // Two logical extents per entry
+
+// FCB layout
+static const int FCB_EX = 12;
+static const int FCB_S1 = 13;
+static const int FCB_S2 = 14;
+static const int FCB_RC = 15;
+static const int FCB_MAP = 16;
+static const int FCB_CR = 32;
+static const int FCB_R0 = 33;
+static const int FCB_SIZE = 36;
+static const int SEARCH_LENGTH = 15;  // Drive/user through S2
+static const uint8_t FWF = 0x80;      // S2: not written since open
+static const uint8_t MAXEXT = 0x1F;
+static const uint8_t EMPTY = 0xE5;
+
+static const int PASS = -1;  // call() result: run the real BDOS
+
+HBIOSBdos::HBIOSBdos() : trap_mode(0), handled(0), passed(0) {
+  clearDrives();
+  reset();
+}
+
+// While off, the trap sees no calls, so whatever it followed is stale
+void HBIOSBdos::setMode(unsigned mode) {
+  mode &= TRAP_CONSOLE | TRAP_FILES;
+  if (mode && !trap_mode) reset();
+  trap_mode = mode;
+}
+
+void HBIOSBdos::reset() {
+  seen = 0;
+  drive = 0;
+  user = 0;
+  dma = DEFAULT_DMA;
+  unflushed = false;
+  flushing = false;
+}
+
+void HBIOSBdos::writeState(SnapshotWriter& w) const {
+  w.u8(seen);
+  w.u8(drive);
+  w.u8(user);
+  w.u16(dma);
+  w.u8((uint8_t)((unflushed ? 1 : 0) | (flushing ? 2 : 0)));
+}
+
+void HBIOSBdos::readState(SnapshotReader& r) {
+  seen = r.u8() & SEEN_ALL;
+  drive = r.u8() & 0x0F;
+  user = r.u8() & 0x1F;
+  dma = r.u16();
+  uint8_t flags = r.u8();
+  unflushed = (flags & 1) != 0;
+  flushing = (flags & 2) != 0;
+  if (!r.ok()) reset();
+}
+
+bool HBIOSBdos::mapDrive(int d, int unit, int slice) {
+  if (d < 0 || d >= MAX_DRIVES || slice < 0) return false;
+  drives[d].unit = unit < 0 ? -1 : unit;
+  drives[d].slice = slice;
+  return true;
+}
+
+void HBIOSBdos::clearDrives() {
+  for (DriveMap& m : drives) {
+    m.unit = -1;
+    m.slice = 0;
+  }
+}
+
+//=============================================================================
+// Trap
+//=============================================================================
+
+// The TPA has JP WBOOT at 0000h and JP BDOS at 0005h, with the BDOS in
+// common memory; other banks never run code at these addresses with
+// that page zero
+static bool inTPA(qkz80_cpu_mem& mem) {
+  return mem.fetch_mem(0x0000) == 0xC3 && mem.fetch_mem(BDOS_ENTRY) == 0xC3 &&
+         mem.fetch_mem(BDOS_ENTRY + 2) >= 0x80;
+}
+
+bool HBIOSBdos::trap(uint16_t pc, qkz80_reg_set& regs, qkz80_cpu_mem& mem, HBIOSBdosHost& host) {
+  if (pc != BDOS_ENTRY || !inTPA(mem)) return false;
+
+  // The previous call has returned: a directory write it made has gone
+  // to disk, and the deblocking buffer with it
+  if (flushing) {
+    unflushed = false;
+    flushing = false;
+  }
+
+  uint8_t fn = (uint8_t)regs.BC.get_pair16();
+  int result = call(fn, regs.DE.get_pair16(), mem, host);
+  if (result == PASS) {
+    passed++;
+    return false;
+  }
+  handled++;
+
+  // Results come back in A = L with B = H = 0, then RET to the caller
+  regs.HL.set_pair16((uint16_t)result);
+  regs.AF.set_pair16((uint16_t)((result << 8) | (regs.AF.get_pair16() & 0xFF)));
+  regs.BC.set_pair16(regs.BC.get_pair16() & 0x00FF);
+  uint16_t sp = regs.SP.get_pair16();
+  regs.PC.set_pair16(mem.fetch_mem(sp) | (mem.fetch_mem((uint16_t)(sp + 1)) << 8));
+  regs.SP.set_pair16((uint16_t)(sp + 2));
+  return true;
+}
+
+int HBIOSBdos::call(uint8_t fn, uint16_t de, qkz80_cpu_mem& mem, HBIOSBdosHost& host) {
+  const bool console = (trap_mode & TRAP_CONSOLE) != 0;
+  const bool files = (trap_mode & TRAP_FILES) != 0 && seen == SEEN_ALL;
+  uint8_t e = (uint8_t)de;
+
+  switch (fn) {
+    case 6:  // Direct console I/O: FDh-FFh read or poll the console
+      if (!console || e >= 0xFD) return PASS;
+      host.bdosConsoleOut(e);
+      return 0;
+
+    // Calls that set state the file functions depend on run the real
+    // BDOS, but are followed here
+    case 13:  // Reset disk system: A:, DMA 0080h
+      drive = 0;
+      dma = DEFAULT_DMA;
+      seen |= SEEN_RESET;
+      return PASS;
+    case 14:  // Select disk
+      drive = e & 0x0F;
+      return PASS;
+    case 26:  // Set DMA address
+      dma = de;
+      return PASS;
+    case 32:  // Get/set user
+      if (e != 0xFF) {
+        user = e & 0x1F;
+        seen |= SEEN_USER;
+      }
+      return PASS;
+
+    // A data write can stay in the CBIOS deblocking buffer, where reads
+    // of the image do not see it, until the buffer is needed for another
+    // sector.  Directory writes go out at once, after the buffer is
+    // written back, so closing a written file flushes it.
+    case 21:  // Write sequential
+    case 34:  // Write random
+    case 40:  // Write random with zero fill
+      unflushed = true;
+      flushing = false;
+      return PASS;
+
+    case 15: return files && !unflushed ? openFile(de, mem, host) : PASS;
+    case 16: {
+      int result = files ? closeFile(de, mem, host) : PASS;
+      if (result == PASS && unflushed && !(mem.fetch_mem((uint16_t)(de + FCB_S2)) & FWF)) flushing = true;
+      return result;
+    }
+    case 20: return files && !unflushed ? readSequential(de, mem, host) : PASS;
+    case 33: return files && !unflushed ? readRandom(de, mem, host) : PASS;
+  }
+  return PASS;
+}
+
+//=============================================================================
+// Files
+//=============================================================================
+
+static void loadFCB(uint16_t addr, uint8_t* fcb, qkz80_cpu_mem& mem) {
+  for (int i = 0; i < FCB_SIZE; i++) fcb[i] = mem.fetch_mem((uint16_t)(addr + i));
+}
+
+static void storeFCB(uint16_t addr, const uint8_t* fcb, int length, qkz80_cpu_mem& mem) {
+  for (int i = 0; i < length; i++) mem.store_mem((uint16_t)(addr + i), fcb[i]);
+}
+
+// Slice for an FCB drive byte (0 = current drive)
+const uint8_t* HBIOSBdos::sliceFor(uint8_t drive_byte, HBIOSBdosHost& host) const {
+  int d = (drive_byte & 0x1F) ? (drive_byte & 0x1F) - 1 : drive;
+  if (d >= MAX_DRIVES || drives[d].unit < 0) return nullptr;
+  size_t size = 0;
+  const uint8_t* image = host.bdosDisk(drives[d].unit, &size);
+  if (!image) return nullptr;
+  size_t offset = (size % SLICE_SIZE == PREFIX_SIZE ? PREFIX_SIZE : 0) + (size_t)drives[d].slice * SLICE_SIZE;
+  if (offset + SLICE_SIZE > size) return nullptr;
+  return image + offset;
+}
+
+// BDOS search over FCB bytes 0-14 (byte 0 holding the user): '?'
+// matches anything, S1 is skipped, attribute bits and the file-write
+// flag are ignored and extents compare above EXM.  First match or -1.
+static int searchDir(const uint8_t* slice, const uint8_t* key) {
+  for (int i = 0; i < DIR_ENTRIES; i++) {
+    const uint8_t* e = slice + DIR_OFFSET + (size_t)i * 32;
+    if (e[0] == EMPTY) continue;
+    bool match = true;
+    for (int b = 0; b < SEARCH_LENGTH && match; b++) {
+      if (key[b] == '?' || b == FCB_S1) continue;
+      if (b == FCB_EX) {
+        match = (((key[b] & ~EXM) - (e[b] & ~EXM)) & MAXEXT) == 0;
+      } else {
+        match = ((key[b] - e[b]) & 0x7F) == 0;
+      }
+    }
+    if (match) return i;
+  }
+  return -1;
+}
+
+// open$copy: the directory entry replaces FCB bytes 1-31 (the drive
+// byte is restored on return), the file-write flag is set, and the
+// record count is fitted to the extent the FCB asked for
+static void openCopy(uint8_t* fcb, const uint8_t* e) {
+  uint8_t drive_byte = fcb[0];
+  uint8_t ex = fcb[FCB_EX];
+  memcpy(fcb, e, 32);
+  fcb[0] = drive_byte;
+  fcb[FCB_S2] |= FWF;
+  fcb[FCB_EX] = ex;
+  if (ex != e[FCB_EX]) fcb[FCB_RC] = ex > e[FCB_EX] ? 0 : 128;
+}
+
+static const uint8_t* dirEntry(const uint8_t* slice, int index) {
+  return slice + DIR_OFFSET + (size_t)index * 32;
+}
+
+// diskread: one record of the FCB's current extent to the DMA address;
+// false if the record is not allocated
+bool HBIOSBdos::readRecord(const uint8_t* slice, const uint8_t* fcb, uint8_t record, qkz80_cpu_mem& mem) {
+  int index = (record >> BLKSHF) + ((fcb[FCB_EX] & EXM) << (7 - BLKSHF));
+  int block = fcb[FCB_MAP + index * 2] | (fcb[FCB_MAP + index * 2 + 1] << 8);
+  if (block == 0 || block >= SLICE_BLOCKS) return false;
+  const uint8_t* src = slice + DIR_OFFSET + (size_t)block * BLOCK_SIZE + (size_t)(record & BLKMSK) * 128;
+  for (int i = 0; i < 128; i++) mem.store_mem((uint16_t)(dma + i), src[i]);
+  return true;
+}
+
+int HBIOSBdos::openFile(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host) {
+  uint8_t fcb[FCB_SIZE];
+  loadFCB(fcb_addr, fcb, mem);
+  const uint8_t* slice = sliceFor(fcb[0], host);
+  if (!slice) return PASS;
+
+  fcb[FCB_S2] = 0;  // Open always starts at module 0
+  uint8_t key[SEARCH_LENGTH];
+  memcpy(key, fcb, SEARCH_LENGTH);
+  key[0] = user;
+  int index = searchDir(slice, key);
+  if (index < 0) return PASS;  // Not here: the BDOS may still find it (ZSDOS public files)
+
+  openCopy(fcb, dirEntry(slice, index));
+  storeFCB(fcb_addr, fcb, 32, mem);
+  return index & 3;  // Directory code
+}
+
+int HBIOSBdos::closeFile(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host) {
+  // An unwritten file has nothing to put back in the directory
+  uint8_t fcb[FCB_SIZE];
+  loadFCB(fcb_addr, fcb, mem);
+  if (!(fcb[FCB_S2] & FWF) || !sliceFor(fcb[0], host)) return PASS;
+  return 0;
+}
+
+int HBIOSBdos::readSequential(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host) {
+  uint8_t fcb[FCB_SIZE];
+  loadFCB(fcb_addr, fcb, mem);
+  if (!(fcb[FCB_S2] & FWF)) return PASS;
+  const uint8_t* slice = sliceFor(fcb[0], host);
+  if (!slice) return PASS;
+
+  uint8_t record = fcb[FCB_CR];
+  if (record >= fcb[FCB_RC]) {
+    if (record != 128) return PASS;  // End of file
+
+    // open$reel: on to the next logical extent of the same module
+    uint8_t ex = (uint8_t)((fcb[FCB_EX] + 1) & MAXEXT);
+    if (ex == 0) return PASS;
+    uint8_t key[SEARCH_LENGTH];
+    memcpy(key, fcb, SEARCH_LENGTH);
+    key[0] = user;
+    key[FCB_EX] = ex;
+    int index = searchDir(slice, key);
+    if (index < 0) return PASS;
+    fcb[FCB_EX] = ex;
+    openCopy(fcb, dirEntry(slice, index));
+    record = 0;
+    if (record >= fcb[FCB_RC]) return PASS;
+  }
+
+  if (!readRecord(slice, fcb, record, mem)) return PASS;
+  fcb[FCB_CR] = (uint8_t)(record + 1);
+  storeFCB(fcb_addr, fcb, FCB_CR + 1, mem);
+  return 0;
+}
+
+int HBIOSBdos::readRandom(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host) {
+  uint8_t fcb[FCB_SIZE];
+  loadFCB(fcb_addr, fcb, mem);
+  if (!(fcb[FCB_S2] & FWF)) return PASS;
+  const uint8_t* slice = sliceFor(fcb[0], host);
+  if (!slice) return PASS;
+
+  // rseek: R0-R2 -> record, extent and module; R2 must be 0
+  uint8_t r0 = fcb[FCB_R0], r1 = fcb[FCB_R0 + 1];
+  if (fcb[FCB_R0 + 2] != 0) return PASS;
+  uint8_t record = r0 & 0x7F;
+  uint8_t ex = (uint8_t)(((r0 >> 7) | (r1 << 1)) & MAXEXT);
+  uint8_t module = (r1 >> 4) & 0x0F;
+  if (ex != fcb[FCB_EX] || ((module - fcb[FCB_S2]) & 0x7F) != 0) {
+    fcb[FCB_EX] = ex;
+    fcb[FCB_S2] = module;
+    uint8_t key[SEARCH_LENGTH];
+    memcpy(key, fcb, SEARCH_LENGTH);
+    key[0] = user;
+    int index = searchDir(slice, key);
+    if (index < 0) return PASS;
+    openCopy(fcb, dirEntry(slice, index));
+  }
+
+  if (record >= fcb[FCB_RC] || !readRecord(slice, fcb, record, mem)) return PASS;
+  fcb[FCB_CR] = record;  // Random reads leave the sequential position on the record
+  storeFCB(fcb_addr, fcb, FCB_CR + 1, mem);
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * HBIOS BDOS - Native CP/M 2.2 BDOS Calls
+ *
+ * Reading a file through the guest goes BDOS -> CBIOS -> HBIOS DIOREAD
+ * -> sector copy, and the BDOS alone runs thousands of instructions per
+ * 128-byte record.  With the trap on, a CALL 5 from the TPA is answered
+ * here when it can be, and falls through to the real BDOS otherwise:
+ *
+ *   console  6 (direct output only)
+ *   files    15 (open), 16 (close of an unmodified file),
+ *            20 (read sequential), 33 (read random)
+ *
+ * File calls work on hd1k slices mapped to drive letters by the host
+ * (the guest's drive table is not visible from here) and only on their
+ * success paths: open finds the entry, the record is allocated.
+ * Everything else - writes, make, delete, search, errors, end of file,
+ * unmapped drives - runs the real BDOS.  The FCB carries all file state
+ * in CP/M 2.2, and it is updated here exactly as the BDOS would, so a
+ * file opened natively can be written by the BDOS and the other way
+ * round.  Reads only answer FCBs whose file-write flag (S2 bit 7) is
+ * still set, and open and reads all run the real BDOS from a write call
+ * (21, 34, 40) until a written file has been closed: until then the
+ * data may still sit in the CBIOS deblocking buffer rather than the
+ * image.
+ *
+ * The current drive, user and DMA address are followed through the
+ * calls that set them (13, 14, 26, 32), which still run the real BDOS.
+ * They are only known once a set user and a disk reset have been seen
+ * since the last reset() - the CCP makes both on every warm boot - and
+ * file calls run the real BDOS until then.  The emulator resets this
+ * state when the guest starts and when the trap is turned on, and keeps
+ * it in save states.
+ *
+ * Functions 2 and 9 are left to the BDOS: it keeps the console column
+ * for tab expansion and line editing, and output that bypassed it would
+ * put that column out of step.  Function 6 output does not move it.
+ *
+ * Meant for CP/M 2.2 and compatible BDOSes (ZSDOS); CP/M 3 keeps file
+ * state of its own and must not use the file trap.
+ */
+
+#ifndef HBIOS_BDOS_H
+#define HBIOS_BDOS_H
+
+#include "qkz80.h"
+#include "hbios_snapshot.h"
+#include <cstddef>
+#include <cstdint>
+
+// What the trap needs from its emulator
+class HBIOSBdosHost {
+public:
+  virtual ~HBIOSBdosHost() {}
+  virtual const uint8_t* bdosDisk(int unit, size_t* size) = 0;  // nullptr if not in memory
+  virtual void bdosConsoleOut(uint8_t ch) = 0;
+};
+
+class HBIOSBdos {
+public:
+  enum Mode {
+    TRAP_CONSOLE = 1,
+    TRAP_FILES = 2,
+  };
+  static const int MAX_DRIVES = 16;
+
+  HBIOSBdos();
+
+  void setMode(unsigned mode);  // TRAP_* flags, 0 = off; turning it on resets
+  unsigned mode() const { return trap_mode; }
+
+  // Forget the followed BDOS state (a new guest boot)
+  void reset();
+
+  // Followed BDOS state, for the emulator's save states
+  void writeState(SnapshotWriter& w) const;
+  void readState(SnapshotReader& r);
+
+  // Map a drive (0 = A:) to an hd1k slice of a disk unit; unit -1 unmaps
+  bool mapDrive(int drive, int unit, int slice = 0);
+  void clearDrives();
+
+  // Called with PC at or below 0100h while the trap is on.  Returns true
+  // when a BDOS call was answered and returned to its caller.
+  bool trap(uint16_t pc, qkz80_reg_set& regs, qkz80_cpu_mem& mem, HBIOSBdosHost& host);
+
+  uint64_t handledCalls() const { return handled; }
+  uint64_t passedCalls() const { return passed; }
+  void resetCounts() { handled = passed = 0; }
+
+private:
+  struct DriveMap {
+    int unit;  // -1 = not mapped
+    int slice;
+  };
+
+  int call(uint8_t fn, uint16_t de, qkz80_cpu_mem& mem, HBIOSBdosHost& host);
+
+  const uint8_t* sliceFor(uint8_t drive_byte, HBIOSBdosHost& host) const;
+  int openFile(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host);
+  int closeFile(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host);
+  int readSequential(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host);
+  int readRandom(uint16_t fcb_addr, qkz80_cpu_mem& mem, HBIOSBdosHost& host);
+  bool readRecord(const uint8_t* slice, const uint8_t* fcb, uint8_t record, qkz80_cpu_mem& mem);
+
+  unsigned trap_mode;
+  DriveMap drives[MAX_DRIVES];
+
+  // BDOS state followed from the guest's calls
+  enum Seen {
+    SEEN_USER = 1,   // Set user (32)
+    SEEN_RESET = 2,  // Reset disk system (13)
+    SEEN_ALL = SEEN_USER | SEEN_RESET,
+  };
+  uint8_t seen;  // Seen flags since reset(); file calls need SEEN_ALL
+  uint8_t drive;
+  uint8_t user;
+  uint16_t dma;
+  bool unflushed;  // A write may still be in the CBIOS deblocking buffer
+  bool flushing;   // The last call passed closes a written file
+
+  uint64_t handled;
+  uint64_t passed;
+};
+
+#endif // HBIOS_BDOS_H
@@ -0,0 +1,130 @@
+/*
+ * HBIOS Call Statistics - Bookkeeping and Function Names
+ */
+
+#include "hbios_callstats.h"
+#include <algorithm>
+#include <cstdio>
+
+// Deeper nesting means the returns are not being seen (e.g. a service
+// that never returns to its caller); drop the oldest instead of growing
+static const size_t MAX_PENDING = 16;
+
+HBIOSCallStats::HBIOSCallStats() : enabled(false) {
+  reset();
+}
+
+void HBIOSCallStats::setEnabled(bool enable) {
+  enabled = enable;
+  pending.clear();
+}
+
+void HBIOSCallStats::reset() {
+  for (HBIOSCallStat& s : stats) {
+    s.calls = 0;
+    s.host_ns = 0;
+    s.guest_instructions = 0;
+    s.interval_instructions = 0;
+    s.last_call = -1;
+  }
+  pending.clear();
+}
+
+void HBIOSCallStats::enter(uint8_t function, uint16_t ret, uint16_t ret_sp, long long now) {
+  HBIOSCallStat& s = stats[function];
+  if (s.last_call >= 0) s.interval_instructions += (uint64_t)(now - s.last_call);
+  s.last_call = now;
+  s.calls++;
+
+  if (pending.size() == MAX_PENDING) pending.erase(pending.begin());
+  Pending p;
+  p.function = function;
+  p.ret = ret;
+  p.ret_sp = ret_sp;
+  p.entered = now;
+  p.since = Clock::now();
+  p.host_ns = 0;
+  pending.push_back(p);
+}
+
+void HBIOSCallStats::leave(long long now) {
+  const Pending& p = pending.back();
+  HBIOSCallStat& s = stats[p.function];
+  s.host_ns += p.host_ns + (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    Clock::now() - p.since).count();
+  s.guest_instructions += (uint64_t)(now - p.entered);
+  pending.pop_back();
+}
+
+void HBIOSCallStats::pause() {
+  if (pending.empty()) return;
+  Clock::time_point t = Clock::now();
+  for (Pending& p : pending) {
+    p.host_ns += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t - p.since).count();
+    p.since = t;
+  }
+}
+
+void HBIOSCallStats::resume() {
+  if (pending.empty()) return;
+  Clock::time_point t = Clock::now();
+  for (Pending& p : pending) p.since = t;
+}
+
+std::string HBIOSCallStats::functionName(uint8_t function) {
+  static const struct { uint8_t code; const char* name; } NAMES[] = {
+    { 0x00, "CIOIN" },     { 0x01, "CIOOUT" },    { 0x02, "CIOIST" },    { 0x03, "CIOOST" },
+    { 0x04, "CIOINIT" },   { 0x05, "CIOQUERY" },  { 0x06, "CIODEVICE" },
+    { 0x10, "DIOSTATUS" }, { 0x11, "DIORESET" },  { 0x12, "DIOSEEK" },   { 0x13, "DIOREAD" },
+    { 0x14, "DIOWRITE" },  { 0x15, "DIOVERIFY" }, { 0x16, "DIOFORMAT" }, { 0x17, "DIODEVICE" },
+    { 0x18, "DIOMEDIA" },  { 0x19, "DIODEFMED" }, { 0x1A, "DIOCAP" },    { 0x1B, "DIOGEOM" },
+    { 0x20, "RTCGETTIM" }, { 0x21, "RTCSETTIM" }, { 0x22, "RTCGETBYT" }, { 0x23, "RTCSETBYT" },
+    { 0x24, "RTCGETBLK" }, { 0x25, "RTCSETBLK" }, { 0x26, "RTCGETALM" }, { 0x27, "RTCSETALM" },
+    { 0x28, "RTCDEVICE" },
+    { 0x30, "DSKYRESET" }, { 0x31, "DSKYSTAT" },  { 0x32, "DSKYGETKEY" }, { 0x33, "DSKYSHOWLEDS" },
+    { 0x34, "DSKYSHOWSEG" }, { 0x35, "DSKYKEYLEDS" }, { 0x36, "DSKYSTATLED" }, { 0x37, "DSKYBEEP" },
+    { 0x38, "DSKYDEVICE" }, { 0x39, "DSKYMESSAGE" }, { 0x3A, "DSKYEVENT" },
+    { 0x40, "VDAINI" },    { 0x41, "VDAQRY" },    { 0x42, "VDARES" },    { 0x43, "VDADEV" },
+    { 0x44, "VDASCS" },    { 0x45, "VDASCP" },    { 0x46, "VDASAT" },    { 0x47, "VDASCO" },
+    { 0x48, "VDAWRC" },    { 0x49, "VDAFIL" },    { 0x4A, "VDACPY" },    { 0x4B, "VDASCR" },
+    { 0x4C, "VDAKST" },    { 0x4D, "VDAKFL" },    { 0x4E, "VDAKRD" },    { 0x4F, "VDARDC" },
+    { 0x50, "SNDRESET" },  { 0x51, "SNDVOL" },    { 0x52, "SNDPRD" },    { 0x53, "SNDNOTE" },
+    { 0x54, "SNDPLAY" },   { 0x55, "SNDQUERY" },  { 0x56, "SNDDURATION" }, { 0x57, "SNDDEVICE" },
+    { 0x58, "SNDBEEP" },
+    { 0xE0, "EXTSLICE" },
+    { 0xF0, "SYSRESET" },  { 0xF1, "SYSVER" },    { 0xF2, "SYSSETBNK" }, { 0xF3, "SYSGETBNK" },
+    { 0xF4, "SYSSETCPY" }, { 0xF5, "SYSBNKCPY" }, { 0xF6, "SYSALLOC" },  { 0xF7, "SYSFREE" },
+    { 0xF8, "SYSGET" },    { 0xF9, "SYSSET" },    { 0xFA, "SYSPEEK" },   { 0xFB, "SYSPOKE" },
+    { 0xFC, "SYSINT" },
+  };
+  for (const auto& n : NAMES) {
+    if (n.code == function) return n.name;
+  }
+  char buf[8];
+  snprintf(buf, sizeof(buf), "FN_%02X", function);
+  return buf;
+}
+
+std::string HBIOSCallStats::report() const {
+  std::vector<int> used;
+  for (int f = 0; f < 256; f++) {
+    if (stats[f].calls > 0) used.push_back(f);
+  }
+  std::sort(used.begin(), used.end(), [this](int a, int b) {
+    return stats[a].host_ns > stats[b].host_ns;
+  });
+
+  char line[128];
+  snprintf(line, sizeof(line), "%-12s %10s %10s %8s %12s %13s\n",
+           "function", "calls", "host_ms", "avg_us", "guest_instr", "avg_interval");
+  std::string out = line;
+  for (int f : used) {
+    const HBIOSCallStat& s = stats[f];
+    snprintf(line, sizeof(line), "%-12s %10llu %10.2f %8.2f %12llu %13.0f\n",
+             functionName((uint8_t)f).c_str(), (unsigned long long)s.calls, s.host_ns / 1e6,
+             s.host_ns / 1e3 / s.calls, (unsigned long long)s.guest_instructions,
+             s.calls > 1 ? (double)s.interval_instructions / (s.calls - 1) : 0.0);
+    out += line;
+  }
+  return out;
+}
@@ -0,0 +1,84 @@
+/*
+ * HBIOS Call Statistics - Per-Function Counts and Latency
+ *
+ * Every HBIOS service is entered through HB_INVOKE at FFF0h (directly or
+ * via RST 08) with the function code in B.  The emulator reports each
+ * entry here together with the return address on the stack; the call
+ * ends when execution comes back to that address with the stack popped.
+ * That works whether HBIOSDispatch services the call natively inside one
+ * instruction or runs Z80 code for it.
+ *
+ * Per function code this keeps the number of calls, host nanoseconds
+ * from entry to return (excluding time spent outside runBatch(), such as
+ * a CIOIN waiting for a key), guest instructions inside the call, and
+ * guest instructions between successive calls.  The core has no T-state
+ * counter, so guest time is measured in instructions.
+ */
+
+#ifndef HBIOS_CALLSTATS_H
+#define HBIOS_CALLSTATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+static const uint16_t HBIOS_INVOKE_ADDR = 0xFFF0;
+
+struct HBIOSCallStat {
+  uint64_t calls;
+  uint64_t host_ns;             // Entry to return, while emulating
+  uint64_t guest_instructions;  // Executed inside the call
+  uint64_t interval_instructions;  // Sum of gaps between successive calls
+  long long last_call;          // Instruction count at the last entry (-1 = none)
+};
+
+class HBIOSCallStats {
+public:
+  HBIOSCallStats();
+
+  void setEnabled(bool enable);
+  bool isEnabled() const { return enabled; }
+  void reset();
+
+  // Emulator hooks.  check() runs before every instruction while enabled
+  // and is cheap unless a call is returning.
+  void enter(uint8_t function, uint16_t ret, uint16_t ret_sp, long long now);
+  void check(uint16_t pc, uint16_t sp, long long now) {
+    if (!pending.empty() && pc == pending.back().ret && sp == pending.back().ret_sp) {
+      leave(now);
+    }
+  }
+  void pause();   // Leaving runBatch(): stop host clocks of open calls
+  void resume();  // Entering runBatch()
+
+  const HBIOSCallStat& stat(uint8_t function) const { return stats[function]; }
+
+  // RomWBW name of a function code ("CIOIN", "DIOREAD", ...) or "FN_xx"
+  static std::string functionName(uint8_t function);
+
+  // "name calls host_ms avg_us guest_instr avg_interval" table, busiest
+  // (by host time) first; codes never called are left out
+  std::string report() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Pending {
+    uint8_t function;
+    uint16_t ret;
+    uint16_t ret_sp;
+    long long entered;        // Instruction count
+    Clock::time_point since;  // Host clock start of the current stretch
+    uint64_t host_ns;         // Accumulated before the current stretch
+  };
+
+  void leave(long long now);
+
+  bool enabled;
+  HBIOSCallStat stats[256];
+  std::vector<Pending> pending;  // Nested calls, innermost last
+};
+
+#endif // HBIOS_CALLSTATS_H
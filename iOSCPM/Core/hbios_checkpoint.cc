@@ -0,0 +1,134 @@
+/*
+ * HBIOS Checkpoint Ring - Incremental Snapshots Implementation
+ */
+
+#include "hbios_checkpoint.h"
+#include "hbios_snapshot.h"
+#include <cstring>
+#include <algorithm>
+
+HBIOSCheckpointRing::HBIOSCheckpointRing()
+  : max_checkpoints(16), memory_cap(64 * 1024 * 1024), ref_bytes(0), delta_bytes(0)
+{
+}
+
+void HBIOSCheckpointRing::configure(size_t max_count, size_t cap) {
+  max_checkpoints = std::max<size_t>(max_count, 1);
+  memory_cap = cap;
+  trim();
+  if (ref_bytes > memory_cap) clear();
+}
+
+void HBIOSCheckpointRing::clear() {
+  refs.clear();
+  checkpoints.clear();
+  ref_bytes = 0;
+  delta_bytes = 0;
+}
+
+void HBIOSCheckpointRing::trim() {
+  while (checkpoints.size() > max_checkpoints) dropOldest();
+  while (memoryBytes() > memory_cap && checkpoints.size() > 1) dropOldest();
+}
+
+bool HBIOSCheckpointRing::layoutMatches(const std::vector<CheckpointRegion>& regions) const {
+  if (regions.size() != refs.size()) return false;
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (regions[i].id != refs[i].id || regions[i].size != refs[i].data.size()) return false;
+  }
+  return true;
+}
+
+void HBIOSCheckpointRing::dropOldest() {
+  if (checkpoints.empty()) return;
+  delta_bytes -= checkpoints.front().old_data.size();
+  checkpoints.pop_front();
+
+  // The new oldest checkpoint can never rewind past itself
+  if (!checkpoints.empty()) {
+    Checkpoint& oldest = checkpoints.front();
+    delta_bytes -= oldest.old_data.size();
+    oldest.pages.clear();
+    oldest.pages.shrink_to_fit();
+    oldest.old_data.clear();
+    oldest.old_data.shrink_to_fit();
+  }
+}
+
+bool HBIOSCheckpointRing::capture(const std::vector<CheckpointRegion>& regions, long long stamp,
+                                  const std::vector<uint8_t>& core_state) {
+  Checkpoint cp;
+  cp.stamp = stamp;
+  cp.core_state = core_state;
+
+  if (!layoutMatches(regions)) {
+    // First checkpoint (or new layout): seed the reference copies
+    clear();
+    size_t total = 0;
+    for (const CheckpointRegion& r : regions) total += r.size;
+    if (total > memory_cap) return false;
+    for (const CheckpointRegion& r : regions) {
+      RegionRef ref;
+      ref.id = r.id;
+      ref.generation = r.generation;
+      ref.data.assign(r.data, r.data + r.size);
+      refs.push_back(std::move(ref));
+    }
+    ref_bytes = total;
+  } else {
+    for (size_t ri = 0; ri < regions.size(); ri++) {
+      if (regions[ri].generation != CHECKPOINT_ALWAYS && regions[ri].generation == refs[ri].generation) {
+        continue;  // Unchanged since the previous checkpoint
+      }
+      refs[ri].generation = regions[ri].generation;
+      const uint8_t* live = regions[ri].data;
+      uint8_t* ref = refs[ri].data.data();
+      size_t size = regions[ri].size;
+      for (size_t off = 0; off < size; off += SNAPSHOT_PAGE_SIZE) {
+        size_t len = std::min(SNAPSHOT_PAGE_SIZE, size - off);
+        if (memcmp(live + off, ref + off, len) == 0) continue;
+        cp.pages.push_back({ (uint32_t)ri, (uint32_t)(off / SNAPSHOT_PAGE_SIZE) });
+        cp.old_data.insert(cp.old_data.end(), ref + off, ref + off + len);
+        memcpy(ref + off, live + off, len);
+      }
+    }
+  }
+
+  delta_bytes += cp.old_data.size();
+  checkpoints.push_back(std::move(cp));
+  trim();
+  return true;
+}
+
+bool HBIOSCheckpointRing::rewind(size_t index, std::vector<uint8_t>& core_state) {
+  if (index >= checkpoints.size()) return false;
+
+  // Undo newest-first until the reference holds checkpoint[index]
+  while (checkpoints.size() > index + 1) {
+    Checkpoint& cp = checkpoints.back();
+    size_t src = 0;
+    for (const DeltaPage& dp : cp.pages) {
+      std::vector<uint8_t>& ref = refs[dp.region].data;
+      size_t off = (size_t)dp.page * SNAPSHOT_PAGE_SIZE;
+      size_t len = std::min(SNAPSHOT_PAGE_SIZE, ref.size() - off);
+      memcpy(ref.data() + off, cp.old_data.data() + src, len);
+      src += len;
+    }
+    delta_bytes -= cp.old_data.size();
+    checkpoints.pop_back();
+  }
+
+  core_state = checkpoints.back().core_state;
+  return true;
+}
+
+const std::vector<uint8_t>* HBIOSCheckpointRing::reference(uint32_t id) const {
+  for (const RegionRef& r : refs) {
+    if (r.id == id) return &r.data;
+  }
+  return nullptr;
+}
+
+long long HBIOSCheckpointRing::stamp(size_t index) const {
+  return index < checkpoints.size() ? checkpoints[index].stamp : -1;
+}
@@ -0,0 +1,99 @@
+/*
+ * HBIOS Checkpoint Ring - Incremental Snapshots for Rewind
+ *
+ * Keeps a reference copy of each tracked region (ROM, RAM, disk images)
+ * as of the newest checkpoint.  Taking a checkpoint compares live memory
+ * against the reference page by page; each changed page's previous
+ * contents are stored as a reverse delta and the reference is updated.
+ * Rewinding applies reverse deltas newest-first into the reference copy,
+ * which then holds the target state for the caller to copy back.
+ *
+ * The cap bounds everything the ring holds: the reference copies (one
+ * image per region, disks included) plus the deltas.  Only the oldest
+ * checkpoints are ever dropped to stay under it; when the reference
+ * copies alone do not fit, no checkpoint is kept at all.  Regions carry
+ * the owner's change counter, so one that has not changed since the
+ * previous checkpoint is not compared.
+ */
+
+#ifndef HBIOS_CHECKPOINT_H
+#define HBIOS_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+// A tracked memory region (id is caller-defined and must be stable).
+// generation changes whenever the data may have; CHECKPOINT_ALWAYS for
+// regions that are compared at every checkpoint.
+struct CheckpointRegion {
+  uint32_t id;
+  const uint8_t* data;
+  size_t size;
+  uint64_t generation;
+};
+
+static const uint64_t CHECKPOINT_ALWAYS = ~0ULL;
+
+class HBIOSCheckpointRing {
+public:
+  HBIOSCheckpointRing();
+
+  // max_checkpoints: how many rewind points to keep (K)
+  // memory_cap: upper bound in bytes on reference copies plus deltas
+  void configure(size_t max_checkpoints, size_t memory_cap);
+  size_t maxCheckpoints() const { return max_checkpoints; }
+  size_t memoryCap() const { return memory_cap; }
+  void clear();
+
+  // Record a checkpoint.  stamp is the guest instruction count; core_state
+  // is an opaque blob (registers and wrapper state) returned on rewind.
+  // A change in region layout (disk swapped, resized) restarts the ring.
+  // False, with the ring empty, when the regions do not fit the cap.
+  bool capture(const std::vector<CheckpointRegion>& regions, long long stamp,
+               const std::vector<uint8_t>& core_state);
+
+  // Roll the reference copies back to checkpoint index (0 = oldest) and
+  // discard newer checkpoints.  The rewound checkpoint stays in the ring.
+  bool rewind(size_t index, std::vector<uint8_t>& core_state);
+
+  // Reference copy of a region - the state at the newest checkpoint
+  const std::vector<uint8_t>* reference(uint32_t id) const;
+
+  size_t count() const { return checkpoints.size(); }
+  long long stamp(size_t index) const;
+  size_t memoryBytes() const { return ref_bytes + delta_bytes; }
+
+private:
+  struct DeltaPage {
+    uint32_t region;   // Index into refs
+    uint32_t page;
+  };
+
+  struct Checkpoint {
+    long long stamp;
+    std::vector<uint8_t> core_state;
+    std::vector<DeltaPage> pages;    // Pages changed since the previous checkpoint
+    std::vector<uint8_t> old_data;   // Their previous contents, in page order
+  };
+
+  struct RegionRef {
+    uint32_t id;
+    uint64_t generation;  // The region's, as of the newest checkpoint
+    std::vector<uint8_t> data;
+  };
+
+  bool layoutMatches(const std::vector<CheckpointRegion>& regions) const;
+  void dropOldest();
+  void trim();
+
+  std::vector<RegionRef> refs;
+  std::deque<Checkpoint> checkpoints;
+  size_t max_checkpoints;
+  size_t memory_cap;
+  size_t ref_bytes;
+  size_t delta_bytes;
+};
+
+#endif // HBIOS_CHECKPOINT_H
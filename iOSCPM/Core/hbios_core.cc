@@ -5,22 +5,45 @@
  */
 
 #include "hbios_core.h"
+#include "hbios_opcodes.h"
 #include "emu_init.h"
 #include "emu_io.h"
+#include <algorithm>
 #include <cstring>
 #include <cstdarg>
+#include <type_traits>
+
+// Boot output kept for replay after a boot cache restore
+static const size_t BOOT_TRANSCRIPT_MAX = 16 * 1024;
+
+// Adaptive batch limits; while console I/O is active batches aim for a
+// quarter of the target so echo and output reach the screen sooner
+static const int BATCH_TARGET_DEFAULT_US = 2000;
+static const int BATCH_INITIAL = 10000;
+static const int BATCH_MIN = 1000;
+static const int BATCH_MAX = 2000000;
+static const int BATCH_IO_DIVISOR = 4;
 
 //=============================================================================
 // HBIOSCPUDelegate Implementation
 //=============================================================================
 
 void HBIOSEmulator::onHalt() {
-  running = false;
+  // Nothing can end a HALT without an interrupt source
+  if (timer_hz == 0 || !cpu.regs.IFF1) {
+    setRunFlag(RUN_RUNNING, false);
+    return;
+  }
+  // Park after the HALT, where the interrupt returns to, whether or not
+  // the CPU has stepped past it yet
+  uint16_t length = z80OpInfo(z80OpKeyAt(memory, exec_pc)).length;
+  cpu.regs.PC.set_pair16((uint16_t)(exec_pc + length));
+  setRunFlag(RUN_HALTED, true);
 }
 
 void HBIOSEmulator::onUnimplementedOpcode(uint8_t opcode, uint16_t pc) {
   emu_error("Unimplemented opcode 0x%02X at PC=0x%04X\n", opcode, pc);
-  running = false;
+  setRunFlag(RUN_RUNNING, false);
 }
 
 void HBIOSEmulator::logDebug(const char* fmt, ...) {
@@ -31,11 +54,22 @@ void HBIOSEmulator::logDebug(const char* fmt, ...) {
 // Constructor/Destructor
 //=============================================================================
 
-HBIOSEmulator::HBIOSEmulator()
-  : memory(), cpu(&memory, this), running(false), waiting_for_input(false),
+HBIOSEmulator::HBIOSEmulator() : HBIOSEmulator(true) {}
+
+HBIOSEmulator::HBIOSEmulator(bool clear_console)
+  : memory(), cpu(&memory, this), run_state(0), run_waiters(0),
     debug_enabled(false), instruction_count(0), boot_string_pos(0),
-    controlify_mode(CTRL_OFF), initialized_ram_banks(0)
+    controlify_mode(CTRL_OFF), initialized_ram_banks(0), rom_hash(0),
+    disk_generation(0), boot_cache_key(0), boot_cache_pending(false), boot_cache_restored(false),
+    checkpoint_interval(0), next_checkpoint(0), checkpoint_cap_warned(false), stop_patterns(0), stop_match(-1),
+    timer_hz(0), timer_im2_vector(0), tick_source(TICK_HOST),
+    tick_guest_ips(1000000), tick_instructions(0), next_tick_at(0), timer_ticks(0),
+    timer_secs(0), timer_sec_ticks(0), irq_pending(false), ei_shadow(false), exec_pc(0),
+    event_pending(false), wait_resumed(false), batch_target_us(BATCH_TARGET_DEFAULT_US), adaptive_batch(BATCH_INITIAL),
+    batch_ns_per_instruction(0), batch_input_seen(0), input_bytes(0), input_wait_open(false)
 {
+  for (int i = 0; i < HBIOS_MAX_DISK_UNITS; i++) disk_slices[i] = 0;
+
   // Initialize banked memory
   memory.enable_banking();
 
@@ -46,7 +80,8 @@ HBIOSEmulator::HBIOSEmulator()
   // iOS uses non-blocking I/O (UI must remain responsive)
   hbios.setBlockingAllowed(false);
 
-  reset();
+  if (clear_console) reset();
+  else resetState();
 }
 
 HBIOSEmulator::~HBIOSEmulator() {
@@ -58,15 +93,19 @@ HBIOSEmulator::~HBIOSEmulator() {
 //=============================================================================
 
 void HBIOSEmulator::reset() {
-  running = false;
-  waiting_for_input = false;
+  // Clear console input queue
+  emu_console_clear_queue();
+
+  resetState();
+}
+
+void HBIOSEmulator::resetState() {
+  setRunFlag(RUN_RUNNING | RUN_WAITING_INPUT | RUN_HALTED, false);
   instruction_count = 0;
   boot_string_pos = 0;
   controlify_mode = CTRL_OFF;
   initialized_ram_banks = 0;
-
-  // Clear console input queue
-  emu_console_clear_queue();
+  resetTimerCounters();
 
   // Reset HBIOS dispatcher (clears input/output buffers)
   hbios.reset();
@@ -102,12 +141,24 @@ bool HBIOSEmulator::loadROM(const uint8_t* data, size_t size) {
     return false;
   }
 
+  unpackFork();
+
   // Clear RAM for clean state when loading a new ROM
   // (ensures stop/start behaves identically to fresh app launch)
   memory.clear_ram();
 
   // Use shared ROM loading function
-  return emu_load_rom_from_buffer(&memory, data, size);
+  if (!emu_load_rom_from_buffer(&memory, data, size)) {
+    rom_image.clear();
+    rom_hash = 0;
+    return false;
+  }
+
+  // Keep the loaded image as the baseline for snapshot ROM pages
+  const uint8_t* rom = memory.get_rom();
+  rom_image.assign(rom, rom + HBIOS_ROM_SIZE);
+  rom_hash = snapshot_hash(rom_image.data(), rom_image.size());
+  return true;
 }
 
 bool HBIOSEmulator::loadROMFromFile(const std::string& path) {
@@ -123,35 +174,49 @@ bool HBIOSEmulator::loadROMFromFile(const std::string& path) {
 //=============================================================================
 
 bool HBIOSEmulator::loadDisk(int unit, const uint8_t* data, size_t size) {
+  unpackFork();
+  disk_generation++;
   bool result = hbios.loadDisk(unit, data, size);
   return result;
 }
 
 bool HBIOSEmulator::loadDiskFromFile(int unit, const std::string& path) {
+  unpackFork();
+  disk_generation++;
   return hbios.loadDiskFromFile(unit, path);
 }
 
 const uint8_t* HBIOSEmulator::getDiskData(int unit) const {
-  if (!hbios.isDiskLoaded(unit)) return nullptr;
+  if (fork_pending || !hbios.isDiskLoaded(unit)) return nullptr;
   const HBDisk& disk = hbios.getDisk(unit);
   return disk.data.empty() ? nullptr : disk.data.data();
 }
 
 size_t HBIOSEmulator::getDiskSize(int unit) const {
+  if (fork_pending) {
+    if (unit < 0 || unit >= HBIOS_MAX_DISK_UNITS || !fork_pending->disks[unit]) return 0;
+    return fork_pending->disks[unit]->size();
+  }
   if (!hbios.isDiskLoaded(unit)) return 0;
   return hbios.getDisk(unit).data.size();
 }
 
 bool HBIOSEmulator::isDiskLoaded(int unit) const {
+  if (fork_pending) return getDiskSize(unit) > 0;
   return hbios.isDiskLoaded(unit);
 }
 
 void HBIOSEmulator::closeAllDisks() {
+  unpackFork();
+  disk_generation++;
   hbios.closeAllDisks();
+  for (int i = 0; i < HBIOS_MAX_DISK_UNITS; i++) disk_slices[i] = 0;
 }
 
 void HBIOSEmulator::setDiskSliceCount(int unit, int slices) {
+  unpackFork();
   hbios.setDiskSliceCount(unit, slices);
+  if (unit >= 0 && unit < HBIOS_MAX_DISK_UNITS) disk_slices[unit] = slices;
 }
 
 //=============================================================================
@@ -180,11 +245,12 @@ void HBIOSEmulator::queueInput(int ch) {
 
   // Queue to emu_console - this is what CIOIN reads from
   emu_console_queue_char(ch);
+  latency.keyQueued();
+  input_bytes.fetch_add(1, std::memory_order_relaxed);
+  wake();
 
   // Clear waiting flag if we were blocked on input
-  if (waiting_for_input) {
-    waiting_for_input = false;
-  }
+  setRunFlag(RUN_WAITING_INPUT, false);
 }
 
 bool HBIOSEmulator::hasInput() const {
@@ -200,7 +266,7 @@ void HBIOSEmulator::setBootString(const std::string& str) {
 // Execution Control
 //=============================================================================
 
-void HBIOSEmulator::start() {
+void HBIOSEmulator::initSession() {
   // Set Z80 mode
   cpu.set_cpu_mode(qkz80::MODE_Z80);
 
@@ -224,6 +290,26 @@ void HBIOSEmulator::start() {
     // Set PC to 0 to restart from ROM
     cpu.regs.PC.set_pair16(0x0000);
   });
+}
+
+void HBIOSEmulator::start() {
+  unpackFork();
+  boot_cache_restored = false;
+  boot_cache_pending = false;
+  if (!boot_cache_path.empty() && !rom_image.empty()) {
+    boot_cache_key = computeBootCacheKey();
+    if (restoreBootCache()) {
+      boot_cache_restored = true;
+      metrics_counts.boot_cache_hits++;
+      publishMetrics();
+      return;
+    }
+    boot_cache_pending = true;
+    metrics_counts.boot_cache_misses++;
+    boot_transcript.clear();
+  }
+
+  initSession();
 
   // Reset all CPU registers (like web version does)
   cpu.regs.AF.set_pair16(0);
@@ -236,9 +322,11 @@ void HBIOSEmulator::start() {
   // Select ROM bank 0
   memory.select_bank(0);
 
-  running = true;
-  waiting_for_input = false;
+  setRunFlag(RUN_WAITING_INPUT | RUN_HALTED, false);
+  setRunFlag(RUN_RUNNING, true);
   instruction_count = 0;
+  resetTimerCounters();
+  bdos.reset();
 
   // Feed boot string to emu_console input buffer
   if (!boot_string.empty()) {
@@ -246,11 +334,128 @@ void HBIOSEmulator::start() {
       emu_console_queue_char(boot_string[i]);
     }
     emu_console_queue_char('\r');  // Submit with CR
+    latency.skipKeys(boot_string.size() + 1);
+    input_bytes.fetch_add(boot_string.size() + 1, std::memory_order_relaxed);
   }
+  publishMetrics();
 }
 
 void HBIOSEmulator::stop() {
-  running = false;
+  setRunFlag(RUN_RUNNING, false);
+  wake();
+}
+
+uint32_t HBIOSEmulator::pause() {
+  uint32_t state = getRunState();
+  setRunFlag(RUN_PAUSED, true);
+  wake();  // Cut short a waitForEvent()
+  return state;
+}
+
+void HBIOSEmulator::resume() {
+  setRunFlag(RUN_PAUSED, false);
+}
+
+void HBIOSEmulator::setRunFlag(uint32_t flag, bool on) {
+  // Sequentially consistent, like the waiter count in waitRunState():
+  // either this sees the waiter or the waiter sees the new state
+  uint32_t old = on ? run_state.fetch_or(flag) : run_state.fetch_and(~flag);
+  if ((on ? (old | flag) : (old & ~flag)) == old) return;  // No change
+  if (run_waiters.load() == 0) return;
+  { std::lock_guard<std::mutex> guard(run_state_lock); }  // Waiter is in wait() or has not checked yet
+  run_state_cv.notify_all();
+}
+
+bool HBIOSEmulator::waitRunState(uint32_t mask, uint32_t value, int max_ms) {
+  if ((getRunState() & mask) == value) return true;
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(max_ms);
+  std::unique_lock<std::mutex> lock(run_state_lock);
+  run_waiters.fetch_add(1);
+  bool reached = run_state_cv.wait_until(lock, deadline, [&]() { return (run_state.load() & mask) == value; });
+  run_waiters.fetch_sub(1);
+  return reached;
+}
+
+void HBIOSEmulator::setTimerInterrupt(int hz, uint8_t im2_vector) {
+  timer_hz = hz > 0 ? hz : 0;
+  timer_im2_vector = im2_vector;
+  irq_pending = false;
+  scheduleTicks();
+}
+
+void HBIOSEmulator::setTickSource(TickSource source, long long guest_ips) {
+  tick_source = source;
+  tick_guest_ips = guest_ips > 0 ? guest_ips : 1000000;
+  scheduleTicks();
+}
+
+// First tick one period from now, in the current tick source
+void HBIOSEmulator::scheduleTicks() {
+  if (timer_hz == 0) return;
+  tick_instructions = std::max<long long>(1, tick_guest_ips / timer_hz);
+  next_tick_at = instruction_count + tick_instructions;
+  next_tick = std::chrono::steady_clock::now() + std::chrono::microseconds(1000000 / timer_hz);
+}
+
+void HBIOSEmulator::resetTimerCounters() {
+  timer_ticks = 0;
+  timer_secs = 0;
+  timer_sec_ticks = 0;
+  irq_pending = false;
+  ei_shadow = false;
+  scheduleTicks();
+}
+
+void HBIOSEmulator::waitForEvent(int max_ms) {
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(max_ms);
+  uint32_t state = getRunState();
+  if ((state & (RUN_RUNNING | RUN_PAUSED)) != RUN_RUNNING) return;
+  if (state & RUN_HALTED) {
+    if (timer_hz && tick_source == TICK_GUEST) return;  // runBatch() skips to the tick
+    if (timer_hz && next_tick < deadline) deadline = next_tick;
+  } else if (!(state & RUN_WAITING_INPUT) || isReplaying() || hasInput()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(event_lock);
+  event_cv.wait_until(lock, deadline, [this]() { return event_pending; });
+  event_pending = false;
+}
+
+void HBIOSEmulator::wake() {
+  wait_resumed.store(true, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> guard(event_lock);
+    event_pending = true;
+  }
+  event_cv.notify_all();
+}
+
+HBIOSEmulator::WaitReason HBIOSEmulator::waitReason() const {
+  uint32_t state = getRunState();
+  if (!(state & RUN_RUNNING)) return WAIT_NONE;
+  if ((state & RUN_WAITING_INPUT) && !isReplaying()) return WAIT_INPUT;
+  if ((state & RUN_HALTED) && !irq_pending) return WAIT_TICK;
+  return WAIT_NONE;
+}
+
+HBIOSEmulator::WaitReason HBIOSEmulator::runFor(int budget_us, bool block, int batch) {
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::microseconds(budget_us);
+  for (;;) {
+    runBatch(batch);
+    if ((getRunState() & (RUN_RUNNING | RUN_PAUSED)) != RUN_RUNNING || stop_match >= 0) return WAIT_NONE;
+
+    WaitReason reason = waitReason();
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now >= deadline) return reason;
+    if (reason != WAIT_NONE) {
+      if (!block) return reason;
+      long long left_us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+      waitForEvent((int)((left_us + 999) / 1000));
+    }
+  }
 }
 
 void HBIOSEmulator::setDebug(bool enable) {
@@ -264,37 +469,1101 @@ void HBIOSEmulator::setDebug(bool enable) {
 // Main Execution Loop
 //=============================================================================
 
+// Any of these ends a batch at the next instruction
+static const uint32_t RUN_STOP_MASK =
+  HBIOSEmulator::RUN_RUNNING | HBIOSEmulator::RUN_HALTED | HBIOSEmulator::RUN_PAUSED |
+  HBIOSEmulator::RUN_DISPATCHED;
+
+// Fused sequences start above page zero (BDOS trap) and end below the
+// HBIOS entry (timer trap)
+static const uint16_t FUSION_TOP = HBIOS_INVOKE_ADDR - HBIOSFusion::MAX_BYTES;
+
 void HBIOSEmulator::runBatch(int count) {
-  if (!running) return;
+  if ((getRunState() & (RUN_RUNNING | RUN_PAUSED)) != RUN_RUNNING) return;
+  setRunFlag(RUN_ACTIVE, true);
+  unpackFork();
+  executeBatch(count);
+  setRunFlag(RUN_ACTIVE, false);
+}
+
+void HBIOSEmulator::executeBatch(int count) {
+  // Reports this batch only, even one that returns below without running:
+  // a match left over would end every runFor() at once
+  stop_match = -1;
 
-  // Check if we're blocked waiting for input
+  // A suspended input wait stays suspended until something resumes it;
+  // only then is HBIOSDispatch asked whether the read can complete.
+  // This look at the queue is the host's, not the guest's, so it comes
+  // before the replay log is bound: how often a frontend polls must not
+  // shift the guest's console calls in a recording.  A replay takes its
+  // input from the log and always asks.
+  if (isWaitingForInput() && !isReplaying() && !hasInput() &&
+      !wait_resumed.exchange(false, std::memory_order_acquire)) {
+    return;
+  }
   if (hbios.getState() == HBIOS_NEEDS_INPUT) {
-    waiting_for_input = true;
+    suspendForInput();
+    if (count == BATCH_ADAPTIVE) tuneBatch(0, 0, true);
+    if (!input_wait_open) {
+      noteInputWait();
+      publishMetrics();
+    }
     return;
   }
-  waiting_for_input = false;
 
-  for (int i = 0; i < count && running; i++) {
-    cpu.execute();
+  EmuReplayScope replay_scope(replay.mode() != EmuReplayLog::OFF ? &replay : nullptr);
+  const bool timing = latency.isEnabled();
+  EmuLatencyScope latency_scope(timing ? &latency : nullptr);
+  EmuClockScope clock_scope(clock.mode() != EmuClock::HOST ? &clock : nullptr, &instruction_count);
+
+  setRunFlag(RUN_WAITING_INPUT, false);
+
+  std::chrono::steady_clock::time_point batch_start = std::chrono::steady_clock::now();
+  if (input_wait_open) {
+    metrics_counts.input_wait_ns += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      batch_start - input_wait_since).count();
+    input_wait_open = false;
+  }
+  if (timer_hz) {
+    // A halted CPU executes NOPs until the interrupt
+    if (isHalted() && tick_source == TICK_GUEST) instruction_count = std::max(instruction_count, next_tick_at);
+    pollTimer();
+  }
+  if (isHalted()) {
+    if (!irq_pending) return;  // Nothing runs until the next tick
+    checkInterrupt();          // Ends the HALT
+  }
+
+  long long batch_first = instruction_count;
+  uint64_t output_before = metrics_counts.output_bytes;
+  const bool adaptive = count == BATCH_ADAPTIVE;
+  if (adaptive) count = adaptive_batch;
+  if (timer_hz && tick_source == TICK_GUEST && next_tick_at - instruction_count < count) {
+    count = (int)(next_tick_at - instruction_count);  // End the batch at the tick
+  }
+  const bool serving_timer = timer_hz != 0;
+  const bool bdos_trap = bdos.mode() != 0;
+  const bool native_routines = natives.mode() != HBIOSNative::OFF;
+
+  // Stop patterns need output scanned as each instruction produces it
+  // rather than once per batch
+  const bool watch_output = stop_patterns > 0;
+  const bool profiling = profiler.isActive();
+  const bool counting = hbios_calls.isEnabled();
+  if (counting) hbios_calls.resume();
+  const bool collecting_ops = opstats.isActive();
+  // Fusing skips instruction boundaries, so not while anything looks at
+  // every instruction
+  const bool fusing = fusion.isEnabled() && !profiling && !counting && !collecting_ops &&
+                      natives.mode() != HBIOSNative::VERIFY;
+
+  // One relaxed load per instruction, so stop() and pause() from another
+  // thread take effect within an instruction.  The same word carries
+  // RUN_DISPATCHED, so HBIOSDispatch's state is only looked at after an
+  // instruction that reached it.
+  for (int i = 0; i < count; i++) {
+    uint32_t state = run_state.load(std::memory_order_relaxed);
+    if ((state & RUN_STOP_MASK) != RUN_RUNNING && (!(state & RUN_DISPATCHED) || !dispatchContinues())) {
+      break;
+    }
+    if (irq_pending) checkInterrupt();
+    if (counting) countHBIOSCall();
+    if (cpu.regs.PC.get_pair16() == HBIOS_INVOKE_ADDR) {
+      countDiskCall();
+      if (serving_timer && serveTimerCall()) {
+        instruction_count++;
+        ei_shadow = false;
+        continue;
+      }
+    }
+    if (bdos_trap && cpu.regs.PC.get_pair16() <= 0x0100 &&
+        bdos.trap(cpu.regs.PC.get_pair16(), cpu.regs, memory, *this)) {
+      instruction_count++;
+      ei_shadow = false;
+      if (stop_match >= 0) break;
+      continue;
+    }
+    // Like fusion, a native call counts against the batch and never
+    // runs across a pending interrupt or the next guest tick
+    if (native_routines) {
+      long long replaced = natives.trap(cpu.regs, memory, irq_pending ? 0 : count - i);
+      if (replaced) {
+        instruction_count += replaced;
+        i += (int)replaced - 1;
+        ei_shadow = false;
+        continue;
+      }
+    }
+    // Only where no tick can land inside the sequence
+    if (fusing && !irq_pending && count - i >= HBIOSFusion::MAX_INSTRUCTIONS &&
+        cpu.regs.PC.get_pair16() > 0x0100 && cpu.regs.PC.get_pair16() <= FUSION_TOP) {
+      int fused = fusion.step(cpu.regs, memory);
+      if (fused) {
+        instruction_count += fused;
+        i += fused - 1;
+        ei_shadow = false;
+        continue;
+      }
+    }
+    exec_pc = cpu.regs.PC.get_pair16();
+    if (collecting_ops) opstats.step(memory, exec_pc);
+    // Read before it runs, and whether or not a tick is pending yet: the
+    // tick can land between this batch and the next.  The trapped, native
+    // and fused paths above never run an EI, so they clear it.
+    const bool ei = serving_timer && memory.fetch_mem(exec_pc) == 0xFB;
+    if (profiling) profileStep();
+    else cpu.execute();
     instruction_count++;
+    ei_shadow = ei;
 
-    // Check state after each instruction
-    HBIOSState state = hbios.getState();
-    if (state == HBIOS_NEEDS_INPUT) {
-      waiting_for_input = true;
-      break;  // Stop executing until input is provided
+    if (timing && latency.awaitingOutput() && hbios.hasOutputChars()) {
+      latency.outputProduced();
     }
-    if (state == HBIOS_HALTED) {
-      running = false;
-      break;
+    if (watch_output && hbios.hasOutputChars()) {
+      flushOutput();
+      if (stop_match >= 0) break;
     }
   }
+  // The batch's last instruction may have reached HBIOSDispatch
+  if (run_state.load(std::memory_order_relaxed) & RUN_DISPATCHED) dispatchContinues();
+
+  if (counting) hbios_calls.pause();
 
   // Poll output buffer and send chars to display
+  flushOutput();
+
+  if (checkpoint_interval > 0 && instruction_count >= next_checkpoint) {
+    takeCheckpoint();
+  }
+
+  uint64_t elapsed_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - batch_start).count();
+  if (adaptive) {
+    uint64_t queued = input_bytes.load(std::memory_order_relaxed);
+    bool io_active = metrics_counts.output_bytes != output_before ||
+                     queued != batch_input_seen || isWaitingForInput();
+    batch_input_seen = queued;
+    tuneBatch(instruction_count - batch_first, elapsed_ns, io_active);
+  }
+
+  metrics_counts.batches++;
+  metrics_counts.instructions += (uint64_t)(instruction_count - batch_first);
+  metrics_counts.run_ns += elapsed_ns;
+  publishMetrics();
+}
+
+// Enter a suspended input wait.  A wake() that raced ahead of it is kept:
+// at worst it costs one extra look at the dispatcher.
+void HBIOSEmulator::suspendForInput() {
+  setRunFlag(RUN_WAITING_INPUT, true);
+  if (boot_cache_pending) captureBootCache();
+}
+
+// Count the ticks that are due and raise one interrupt for them
+void HBIOSEmulator::pollTimer() {
+  uint64_t due;
+  if (tick_source == TICK_GUEST) {
+    if (instruction_count < next_tick_at) return;
+    due = (uint64_t)((instruction_count - next_tick_at) / tick_instructions) + 1;
+    next_tick_at += (long long)due * tick_instructions;
+  } else {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < next_tick) return;
+    std::chrono::microseconds period(1000000 / timer_hz);
+    due = (uint64_t)((now - next_tick) / period) + 1;
+    next_tick += period * (long long)due;
+  }
+  addTicks(due);
+  irq_pending = true;
+}
+
+void HBIOSEmulator::addTicks(uint64_t count) {
+  timer_ticks += (uint32_t)count;
+  uint64_t sec_ticks = timer_sec_ticks + count;
+  timer_secs += (uint32_t)(sec_ticks / (uint64_t)timer_hz);
+  timer_sec_ticks = (uint32_t)(sec_ticks % (uint64_t)timer_hz);
+}
+
+// After an instruction that reached HBIOSDispatch.  False when the call
+// ended the batch - an input wait or a final HALT - or stop() or pause()
+// came in meanwhile.
+bool HBIOSEmulator::dispatchContinues() {
+  run_state.fetch_and(~(uint32_t)RUN_DISPATCHED, std::memory_order_relaxed);
+  HBIOSState state = hbios.getState();
+  if (state == HBIOS_NEEDS_INPUT) {
+    suspendForInput();
+    noteInputWait();
+    return false;  // Stop executing until input is provided
+  }
+  if (state == HBIOS_HALTED) {
+    setRunFlag(RUN_RUNNING, false);
+    return false;
+  }
+  return (run_state.load(std::memory_order_relaxed) & RUN_STOP_MASK) == RUN_RUNNING;
+}
+
+// SYSGET/SYSSET TIMER (D0h) and SECS (D1h) with the 32-bit value in
+// DE:HL; SYSGET also returns the tick rate (TIMER) or ticks into the
+// second (SECS) in C.  Answered here and returned straight to the caller.
+bool HBIOSEmulator::serveTimerCall() {
+  uint8_t function = cpu.regs.BC.get_high();
+  uint8_t sub = (uint8_t)(cpu.regs.BC.get_pair16() & 0xFF);
+  if ((function != 0xF8 && function != 0xF9) || (sub != 0xD0 && sub != 0xD1)) return false;
+  bool secs = sub == 0xD1;
+
+  if (function == 0xF8) {
+    uint32_t value = secs ? timer_secs : timer_ticks;
+    cpu.regs.DE.set_pair16((uint16_t)(value >> 16));
+    cpu.regs.HL.set_pair16((uint16_t)value);
+    uint8_t c = (uint8_t)(secs ? timer_sec_ticks : (uint32_t)timer_hz);
+    cpu.regs.BC.set_pair16((uint16_t)((function << 8) | c));
+  } else {
+    uint32_t value = ((uint32_t)cpu.regs.DE.get_pair16() << 16) | cpu.regs.HL.get_pair16();
+    if (secs) {
+      timer_secs = value;
+      timer_sec_ticks = 0;
+    } else {
+      timer_ticks = value;
+    }
+  }
+
+  // A = 0 (success) with Z set and carry clear, then RET
+  uint8_t flags = (uint8_t)((cpu.regs.AF.get_pair16() & 0xFF) | 0x40) & (uint8_t)~0x01;
+  cpu.regs.AF.set_pair16(flags);
+  uint16_t sp = cpu.regs.SP.get_pair16();
+  cpu.regs.PC.set_pair16(memory.fetch_mem(sp) | (memory.fetch_mem((uint16_t)(sp + 1)) << 8));
+  cpu.regs.SP.set_pair16((uint16_t)(sp + 2));
+  return true;
+}
+
+// Runs before each instruction while a tick is pending
+void HBIOSEmulator::checkInterrupt() {
+  // EI enables interrupts only after the instruction that follows it
+  if (!cpu.regs.IFF1 || ei_shadow) return;
+
+  uint16_t pc = cpu.regs.PC.get_pair16();
+  uint16_t sp = (uint16_t)(cpu.regs.SP.get_pair16() - 2);
+  memory.store_mem(sp, pc & 0xFF);
+  memory.store_mem((uint16_t)(sp + 1), pc >> 8);
+  cpu.regs.SP.set_pair16(sp);
+  cpu.regs.IFF1 = 0;
+  cpu.regs.IFF2 = 0;
+
+  if (cpu.regs.IM == 2) {
+    uint16_t entry = (uint16_t)((cpu.regs.I << 8) | timer_im2_vector);
+    cpu.regs.PC.set_pair16(memory.fetch_mem(entry) |
+                           (memory.fetch_mem((uint16_t)(entry + 1)) << 8));
+  } else {
+    cpu.regs.PC.set_pair16(0x0038);  // IM 1, or IM 0 with FFh on the bus
+  }
+  irq_pending = false;
+  setRunFlag(RUN_HALTED, false);
+  natives.interrupted();
+  metrics_counts.interrupts++;
+}
+
+void HBIOSEmulator::setBatchTarget(int target_us) {
+  batch_target_us = target_us > 0 ? target_us : BATCH_TARGET_DEFAULT_US;
+}
+
+void HBIOSEmulator::tuneBatch(long long executed, uint64_t elapsed_ns, bool io_active) {
+  // Batches cut short (input wait, stop match) time mostly fixed overhead
+  if (executed >= BATCH_MIN && elapsed_ns > 0) {
+    double sample = (double)elapsed_ns / (double)executed;
+    batch_ns_per_instruction = batch_ns_per_instruction > 0
+      ? batch_ns_per_instruction * 0.875 + sample * 0.125 : sample;
+  }
+  long long fit = batch_ns_per_instruction > 0
+    ? (long long)(batch_target_us * 1000.0 / batch_ns_per_instruction) : BATCH_INITIAL;
+  long long next = io_active ? std::min<long long>(adaptive_batch / 2, fit / BATCH_IO_DIVISOR)
+                             : std::min<long long>((long long)adaptive_batch * 2, fit);
+  adaptive_batch = (int)std::max<long long>(BATCH_MIN, std::min<long long>(next, BATCH_MAX));
+}
+
+void HBIOSEmulator::profileStep() {
+  uint16_t pc = cpu.regs.PC.get_pair16();
+  uint16_t sp = cpu.regs.SP.get_pair16();
+  uint16_t op_key = z80OpKeyAt(memory, pc);
+  uint8_t bank = memory.get_current_bank();
+  cpu.execute();
+  profiler.step(bank, pc, sp, op_key, cpu.regs.PC.get_pair16(), cpu.regs.SP.get_pair16());
+}
+
+// DIOREAD (13h) and DIOWRITE (14h) as they enter HBIOS
+void HBIOSEmulator::countDiskCall() {
+  uint8_t function = cpu.regs.BC.get_high();
+  if (function == 0x13) metrics_counts.disk_reads++;
+  else if (function == 0x14) {
+    metrics_counts.disk_writes++;
+    disk_generation++;
+  }
+}
+
+void HBIOSEmulator::countHBIOSCall() {
+  uint16_t pc = cpu.regs.PC.get_pair16();
+  uint16_t sp = cpu.regs.SP.get_pair16();
+  if (pc == HBIOS_INVOKE_ADDR) {
+    uint16_t ret = memory.fetch_mem(sp) | (memory.fetch_mem((uint16_t)(sp + 1)) << 8);
+    hbios_calls.enter(cpu.regs.BC.get_high(), ret, (uint16_t)(sp + 2), instruction_count);
+  } else {
+    hbios_calls.check(pc, sp, instruction_count);
+  }
+}
+
+// stop() may come from another thread, so running is read live rather
+// than published
+HBIOSMetricsSnapshot HBIOSEmulator::getMetrics() const {
+  HBIOSMetricsSnapshot m = metrics.read();
+  m.running = isRunning() ? 1 : 0;
+  return m;
+}
+
+void HBIOSEmulator::noteInputWait() {
+  metrics_counts.input_waits++;
+  input_wait_open = true;
+  input_wait_since = std::chrono::steady_clock::now();
+}
+
+void HBIOSEmulator::publishMetrics() {
+  // Gauges and derived counts are read at publish time
+  uint16_t banks = initialized_ram_banks;
+  uint64_t used = 0;
+  for (; banks; banks &= (uint16_t)(banks - 1)) used++;
+  metrics_counts.ram_banks_used = used;
+  metrics_counts.checkpoints = checkpoints.count();
+  metrics_counts.checkpoint_bytes = checkpoints.memoryBytes();
+  metrics_counts.batch_size = (uint64_t)adaptive_batch;
+  metrics_counts.input_bytes = input_bytes.load(std::memory_order_relaxed);
+  metrics.publish(metrics_counts);
+}
+
+void HBIOSEmulator::flushOutput() {
   if (hbios.hasOutputChars()) {
     std::vector<uint8_t> chars = hbios.getOutputChars();
-    for (uint8_t ch : chars) {
-      emu_console_write_char(ch);
+    emitOutput(chars.data(), chars.size());
+  }
+}
+
+void HBIOSEmulator::emitOutput(const uint8_t* chars, size_t count) {
+  metrics_counts.output_bytes += count;
+  if (boot_cache_pending && boot_transcript.size() < BOOT_TRANSCRIPT_MAX) {
+    boot_transcript.append(chars, chars + count);
+  }
+  for (size_t i = 0; i < count; i++) {
+    emu_console_write_char(chars[i]);
+    if (output_matcher.feed(chars[i])) onOutputMatch();
+  }
+  if (latency.awaitingHandoff()) latency.outputHandedOff();
+}
+
+void HBIOSEmulator::onOutputMatch() {
+  // Copy: a callback may add or remove patterns, which rebuilds the matcher
+  std::vector<int> ids(output_matcher.matchBegin(), output_matcher.matchEnd());
+  for (int id : ids) {
+    if (id >= (int)output_matches.size()) continue;
+    OutputMatch match = output_matches[id];
+    if (match.stop && stop_match < 0) stop_match = id;
+    if (match.callback) match.callback(id);
+  }
+}
+
+//=============================================================================
+// Native BDOS
+//=============================================================================
+
+const uint8_t* HBIOSEmulator::bdosDisk(int unit, size_t* size) {
+  *size = getDiskSize(unit);
+  return getDiskData(unit);
+}
+
+// Straight to the frontend, behind anything HBIOS still holds
+void HBIOSEmulator::bdosConsoleOut(uint8_t ch) {
+  flushOutput();
+  if (latency.awaitingOutput()) latency.outputProduced();
+  emitOutput(&ch, 1);
+}
+
+//=============================================================================
+// Output Matching
+//=============================================================================
+
+int HBIOSEmulator::addOutputMatch(const std::string& pattern, bool stop,
+                                  OutputMatchCallback callback) {
+  if (pattern.empty()) return -1;
+  int id = output_matcher.add(pattern);
+  output_matches.resize(id + 1);
+  output_matches[id].stop = stop;
+  output_matches[id].callback = callback;
+  if (stop) stop_patterns++;
+  return id;
+}
+
+void HBIOSEmulator::setOutputMatchCallback(int id, OutputMatchCallback callback) {
+  if (id < 0 || id >= (int)output_matches.size()) return;
+  output_matches[id].callback = callback;
+}
+
+void HBIOSEmulator::removeOutputMatch(int id) {
+  if (id < 0 || id >= (int)output_matches.size()) return;
+  if (output_matches[id].stop) stop_patterns--;
+  output_matches[id].stop = false;
+  output_matches[id].callback = nullptr;
+  output_matcher.remove(id);
+}
+
+void HBIOSEmulator::clearOutputMatches() {
+  output_matcher.clear();
+  output_matches.clear();
+  stop_patterns = 0;
+  stop_match = -1;
+}
+
+int HBIOSEmulator::takeStopMatch() {
+  int id = stop_match;
+  stop_match = -1;
+  return id;
+}
+
+//=============================================================================
+// Profiling
+//=============================================================================
+
+void HBIOSEmulator::startProfiling(int interval, bool call_stacks) {
+  profiler.clear();
+  profiler.start(interval, call_stacks);
+}
+
+void HBIOSEmulator::stopProfiling() {
+  profiler.stop();
+}
+
+//=============================================================================
+// Save State
+//=============================================================================
+
+// Register set is captured as an opaque block; its size is recorded so a
+// snapshot from a different core build is rejected rather than misread.
+static_assert(std::is_trivially_copyable<qkz80_reg_set>::value,
+              "qkz80_reg_set must be trivially copyable for save states");
+
+bool HBIOSEmulator::atRestorePoint() const {
+  return instruction_count == 0 || isWaitingForInput() || isHalted();
+}
+
+bool HBIOSEmulator::saveState(std::vector<uint8_t>& out, bool include_disks) {
+  if (rom_image.empty()) {
+    emu_error("[SNAPSHOT] No ROM loaded\n");
+    return false;
+  }
+  if (!atRestorePoint()) {
+    emu_error("[SNAPSHOT] Save states are taken at an input wait or HALT\n");
+    return false;
+  }
+
+  unpackFork();
+
+  // Anything still buffered belongs to the host side, not the snapshot
+  flushOutput();
+
+  out.clear();
+  SnapshotWriter w(out);
+  w.u32(SNAPSHOT_MAGIC);
+  w.u16(SNAPSHOT_VERSION);
+  w.u16(include_disks ? SNAP_FLAG_DISKS : SNAP_FLAG_NONE);
+
+  writeCoreState(w);
+
+  w.beginSection(SNAP_SECT_ROM);
+  w.u64(rom_hash);
+  snapshot_write_pages(w, memory.get_rom(), HBIOS_ROM_SIZE, rom_image.data(), 0);
+  w.endSection();
+
+  w.beginSection(SNAP_SECT_RAM);
+  snapshot_write_pages(w, memory.get_ram(), HBIOS_RAM_SIZE, nullptr, 0x00);
+  w.endSection();
+
+  if (include_disks) {
+    for (int unit = 0; unit < HBIOS_MAX_DISK_UNITS; unit++) {
+      const uint8_t* data = getDiskData(unit);
+      size_t size = getDiskSize(unit);
+      if (!data || size == 0) continue;
+      w.beginSection(SNAP_SECT_DISK);
+      w.u8((uint8_t)unit);
+      w.u8((uint8_t)disk_slices[unit]);
+      w.u64(size);
+      snapshot_write_pages(w, data, size, nullptr, 0xE5);
+      w.endSection();
     }
   }
+
+  // Console input is consumed from emu_console; drain and re-queue it.
+  // These reads are the host's, even from a callback inside a batch, so
+  // they stay out of a recording and the key latencies.
+  EmuReplayScope replay_scope(nullptr);
+  EmuLatencyScope latency_scope(nullptr);
+  std::vector<int> pending;
+  for (int ch = emu_console_read_char(); ch >= 0; ch = emu_console_read_char()) {
+    pending.push_back(ch);
+  }
+  for (int ch : pending) emu_console_queue_char(ch);
+
+  w.beginSection(SNAP_SECT_CONI);
+  w.u32((uint32_t)pending.size());
+  for (int ch : pending) w.u16((uint16_t)ch);
+  w.endSection();
+
+  return true;
+}
+
+void HBIOSEmulator::writeCoreState(SnapshotWriter& w) {
+  w.beginSection(SNAP_SECT_EMU);
+  w.u64((uint64_t)instruction_count);
+  w.u16(initialized_ram_banks);
+  w.u8((uint8_t)controlify_mode);
+  w.u8(memory.get_current_bank());
+  w.u8(isWaitingForInput() ? 1 : 0);
+  w.u8(isHalted() ? 1 : 0);
+  w.u32(timer_ticks);
+  w.u32(timer_secs);
+  w.u32(timer_sec_ticks);
+  bdos.writeState(w);
+  w.u8(irq_pending ? 1 : 0);
+  w.u8(ei_shadow ? 1 : 0);
+  w.endSection();
+
+  w.beginSection(SNAP_SECT_CPU);
+  w.u32((uint32_t)sizeof(cpu.regs));
+  w.bytes(&cpu.regs, sizeof(cpu.regs));
+  w.endSection();
+}
+
+// EMU section bytes each snapshot version writes (see writeCoreState())
+static size_t emuSectionSize(uint16_t version) {
+  size_t size = 8 + 2 + 1 + 1 + 1;  // Count, RAM banks, controlify, bank, waiting
+  if (version >= 2) size += 1;      // HALT
+  if (version >= 3) size += 3 * 4;  // Timer counters
+  if (version >= 4) size += 6;      // BDOS state
+  if (version >= 5) size += 2;      // Pending interrupt, EI shadow
+  return size;
+}
+
+// Caller has validated the register block size and the EMU section length
+void HBIOSEmulator::readCoreState(SnapshotReader& emu, SnapshotReader& cpu_sect, uint16_t version) {
+  cpu_sect.u32();
+  cpu_sect.bytes(&cpu.regs, sizeof(cpu.regs));
+
+  instruction_count = (long long)emu.u64();
+  initialized_ram_banks = emu.u16();
+  controlify_mode = (ControlifyMode)emu.u8();
+  memory.select_bank(emu.u8());
+  setRunFlag(RUN_WAITING_INPUT, emu.u8() != 0);
+  setRunFlag(RUN_HALTED, version >= 2 && emu.u8() != 0);
+  resetTimerCounters();
+  if (version >= 3) {
+    timer_ticks = emu.u32();
+    timer_secs = emu.u32();
+    timer_sec_ticks = emu.u32();
+  }
+  if (version >= 4) bdos.readState(emu);
+  else bdos.reset();
+  if (version >= 5) {
+    irq_pending = emu.u8() != 0;
+    ei_shadow = emu.u8() != 0;
+  }
+}
+
+bool HBIOSEmulator::loadState(const uint8_t* data, size_t size) {
+  SnapshotReader r(data, size);
+  if (r.u32() != SNAPSHOT_MAGIC || !r.ok()) {
+    emu_error("[SNAPSHOT] Not a save state\n");
+    return false;
+  }
+  uint16_t version = r.u16();
+  r.u16();  // flags - sections are self-describing
+  if (version < SNAPSHOT_MIN_VERSION || version > SNAPSHOT_VERSION) {
+    emu_error("[SNAPSHOT] Unsupported version %u\n", version);
+    return false;
+  }
+  if (rom_image.empty()) {
+    emu_error("[SNAPSHOT] Load the ROM before restoring a state\n");
+    return false;
+  }
+
+  // Parse and validate everything before touching emulator state
+  SnapshotReader emu_sect, cpu_sect, rom_sect, ram_sect, coni_sect;
+  std::vector<SnapshotReader> disk_sects;
+  uint32_t tag;
+  SnapshotReader body;
+  while (r.nextSection(tag, body)) {
+    if (tag == SNAP_SECT_EMU) emu_sect = body;
+    else if (tag == SNAP_SECT_CPU) cpu_sect = body;
+    else if (tag == SNAP_SECT_ROM) rom_sect = body;
+    else if (tag == SNAP_SECT_RAM) ram_sect = body;
+    else if (tag == SNAP_SECT_DISK) disk_sects.push_back(body);
+    else if (tag == SNAP_SECT_CONI) coni_sect = body;
+    // Unknown sections are skipped
+  }
+  if (!r.ok() || !emu_sect.ok() || !cpu_sect.ok() || !rom_sect.ok() || !ram_sect.ok()) {
+    emu_error("[SNAPSHOT] Truncated or incomplete save state\n");
+    return false;
+  }
+
+  if (emu_sect.remaining() < emuSectionSize(version)) {
+    emu_error("[SNAPSHOT] Truncated or incomplete save state\n");
+    return false;
+  }
+  if (rom_sect.u64() != rom_hash) {
+    emu_error("[SNAPSHOT] Save state was taken with a different ROM\n");
+    return false;
+  }
+  SnapshotReader probe = cpu_sect;
+  if (probe.u32() != sizeof(cpu.regs) || !probe.skip(sizeof(cpu.regs))) {
+    emu_error("[SNAPSHOT] Register layout mismatch\n");
+    return false;
+  }
+
+  std::vector<uint8_t> rom(rom_image);
+  std::vector<uint8_t> ram(HBIOS_RAM_SIZE, 0x00);
+  if (!snapshot_read_pages(rom_sect, rom.data(), rom.size()) ||
+      !snapshot_read_pages(ram_sect, ram.data(), ram.size())) {
+    emu_error("[SNAPSHOT] Corrupt memory pages\n");
+    return false;
+  }
+
+  // Disk images are decoded into local buffers; the mounted disks are
+  // only replaced once every section has parsed
+  struct SnapshotDisk {
+    int unit;
+    int slices;
+    std::vector<uint8_t> image;
+  };
+  std::vector<SnapshotDisk> disks;
+  uint32_t units_seen = 0;
+  for (SnapshotReader& d : disk_sects) {
+    SnapshotDisk disk;
+    disk.unit = d.u8();
+    disk.slices = d.u8();
+    uint64_t disk_size = d.u64();
+    if (!d.ok() || disk.unit >= HBIOS_MAX_DISK_UNITS || (units_seen & (1u << disk.unit)) ||
+        disk_size == 0 || disk_size > HBIOS_MAX_DISK_SIZE) {
+      emu_error("[SNAPSHOT] Bad disk section\n");
+      return false;
+    }
+    units_seen |= 1u << disk.unit;
+    disk.image.assign((size_t)disk_size, 0xE5);
+    if (!snapshot_read_pages(d, disk.image.data(), disk.image.size())) {
+      emu_error("[SNAPSHOT] Corrupt disk %d\n", disk.unit);
+      return false;
+    }
+    disks.push_back(std::move(disk));
+  }
+
+  // Everything has parsed: a replay in progress ends here, not on a
+  // state that was refused
+  replay.stop();
+
+  // This is no longer a fresh boot, so not one for the boot cache
+  boot_cache_pending = false;
+  boot_transcript.clear();
+
+  // A clone keeps its own disks when the state has none
+  unpackFork();
+
+  // Disks must be in place before initSession() builds the unit table
+  if (!disks.empty()) {
+    closeAllDisks();
+    for (SnapshotDisk& disk : disks) {
+      if (!loadDisk(disk.unit, disk.image.data(), disk.image.size())) {
+        emu_error("[SNAPSHOT] Cannot mount disk %d\n", disk.unit);
+        return false;
+      }
+      if (disk.slices > 0) setDiskSliceCount(disk.unit, disk.slices);
+      std::vector<uint8_t>().swap(disk.image);
+    }
+  }
+
+  initSession();
+
+  memcpy(memory.get_rom(), rom.data(), rom.size());
+  memcpy(memory.get_ram(), ram.data(), ram.size());
+  readCoreState(emu_sect, cpu_sect, version);
+  boot_string_pos = boot_string.size();
+
+  emu_console_clear_queue();
+  latency.clearPending();
+  if (coni_sect.ok()) {
+    uint32_t count = coni_sect.u32();
+    for (uint32_t i = 0; i < count && coni_sect.ok(); i++) {
+      emu_console_queue_char(coni_sect.u16());
+    }
+    latency.skipKeys(count);
+  }
+
+  setRunFlag(RUN_RUNNING, true);
+  return true;
+}
+
+bool HBIOSEmulator::saveStateToFile(const std::string& path, bool include_disks) {
+  std::vector<uint8_t> data;
+  if (!saveState(data, include_disks)) return false;
+  return emu_file_save(path, data);
+}
+
+bool HBIOSEmulator::loadStateFromFile(const std::string& path) {
+  std::vector<uint8_t> data;
+  if (!emu_file_load(path, data)) return false;
+  return loadState(data.data(), data.size());
+}
+
+//=============================================================================
+// Record/Replay
+//=============================================================================
+
+bool HBIOSEmulator::startRecording() {
+  if (!isRunning()) {
+    emu_error("[REPLAY] Start the emulator before recording\n");
+    return false;
+  }
+  replay.stop();
+  std::vector<uint8_t> state;
+  if (!saveState(state, true)) return false;
+  replay.beginRecording(&instruction_count, state);
+  return true;
+}
+
+bool HBIOSEmulator::stopRecording(std::vector<uint8_t>& log) {
+  if (!isRecording()) return false;
+  replay.stop();
+  replay.serialize(log);
+  return true;
+}
+
+bool HBIOSEmulator::stopRecordingToFile(const std::string& path) {
+  std::vector<uint8_t> log;
+  if (!stopRecording(log)) return false;
+  return emu_file_save(path, log);
+}
+
+bool HBIOSEmulator::startReplay(const uint8_t* data, size_t size) {
+  replay.stop();
+  if (!replay.deserialize(data, size)) return false;
+  const std::vector<uint8_t>& state = replay.startState();
+  if (!loadState(state.data(), state.size())) return false;
+  return replay.beginPlayback(&instruction_count);
+}
+
+bool HBIOSEmulator::startReplayFromFile(const std::string& path) {
+  std::vector<uint8_t> data;
+  if (!emu_file_load(path, data)) return false;
+  return startReplay(data.data(), data.size());
+}
+
+//=============================================================================
+// Clone
+//=============================================================================
+
+// This session's pages, reusing the previous clone's where nothing changed
+std::shared_ptr<const HBIOSForkImage> HBIOSEmulator::forkImage() {
+  if (fork_pending) return fork_pending;  // Not run since it was cloned
+
+  std::shared_ptr<HBIOSForkImage> image =
+    fork_base ? std::make_shared<HBIOSForkImage>(*fork_base) : std::make_shared<HBIOSForkImage>();
+  bool changed = image->rom.update(memory.get_rom(), HBIOS_ROM_SIZE);
+  changed = image->ram.update(memory.get_ram(), HBIOS_RAM_SIZE) || changed;
+  if (!fork_base || fork_base->disk_generation != disk_generation) {
+    for (int unit = 0; unit < HBIOS_MAX_DISK_UNITS; unit++) {
+      const uint8_t* data = getDiskData(unit);
+      size_t size = getDiskSize(unit);
+      if (!data || size == 0) {
+        image->disks[unit].reset();
+        continue;
+      }
+      std::shared_ptr<HBIOSPageImage> disk = image->disks[unit]
+        ? std::make_shared<HBIOSPageImage>(*image->disks[unit]) : std::make_shared<HBIOSPageImage>();
+      if (disk->update(data, size)) image->disks[unit] = disk;
+    }
+    image->disk_generation = disk_generation;
+    changed = true;
+  }
+  if (!changed) return fork_base;
+  fork_base = image;
+  return fork_base;
+}
+
+// Copy all of a clone's pages into its memory and disks, the same setup
+// as loadState().  banked_mem and HBIOSDispatch keep flat arrays, so
+// from here on the clone holds a full copy.
+void HBIOSEmulator::unpackFork() {
+  if (!fork_pending) return;
+  std::shared_ptr<const HBIOSForkImage> image = fork_pending;
+  fork_pending.reset();
+
+  // Disks must be in place before initSession() builds the unit table
+  std::vector<uint8_t> data;
+  for (int unit = 0; unit < HBIOS_MAX_DISK_UNITS; unit++) {
+    if (!image->disks[unit]) continue;
+    data.resize(image->disks[unit]->size());
+    image->disks[unit]->copyTo(data.data());
+    hbios.loadDisk(unit, data.data(), data.size());
+    if (disk_slices[unit] > 0) hbios.setDiskSliceCount(unit, disk_slices[unit]);
+  }
+  std::vector<uint8_t>().swap(data);
+
+  qkz80_reg_set regs = cpu.regs;
+  uint8_t bank = memory.get_current_bank();
+  initSession();
+  image->rom.copyTo(memory.get_rom());
+  image->ram.copyTo(memory.get_ram());
+  cpu.regs = regs;
+  memory.select_bank(bank);
+
+  // Later clones of this session start from the same pages
+  fork_base = image;
+  disk_generation = image->disk_generation;
+}
+
+std::unique_ptr<HBIOSEmulator> HBIOSEmulator::clone() {
+  if (!atRestorePoint()) {
+    emu_error("[CLONE] Clones are taken at an input wait or HALT\n");
+    return nullptr;
+  }
+
+  // Output produced so far belongs to the parent's console
+  flushOutput();
+
+  std::unique_ptr<HBIOSEmulator> child(new HBIOSEmulator(false));
+  child->fork_pending = forkImage();
+  for (int unit = 0; unit < HBIOS_MAX_DISK_UNITS; unit++) child->disk_slices[unit] = disk_slices[unit];
+  child->cpu.regs = cpu.regs;
+  child->memory.select_bank(memory.get_current_bank());
+
+  // Guest state
+  child->rom_image = rom_image;
+  child->rom_hash = rom_hash;
+  child->boot_string = boot_string;
+  child->boot_string_pos = boot_string.size();
+  child->instruction_count = instruction_count;
+  child->initialized_ram_banks = initialized_ram_banks;
+  child->controlify_mode = controlify_mode;
+  child->clock = clock;
+  child->bdos = bdos;
+  child->timer_hz = timer_hz;
+  child->timer_im2_vector = timer_im2_vector;
+  child->tick_source = tick_source;
+  child->tick_guest_ips = tick_guest_ips;
+  child->tick_instructions = tick_instructions;
+  child->next_tick_at = next_tick_at;
+  child->next_tick = next_tick;
+  child->timer_ticks = timer_ticks;
+  child->timer_secs = timer_secs;
+  child->timer_sec_ticks = timer_sec_ticks;
+  child->irq_pending = irq_pending;
+  child->ei_shadow = ei_shadow;
+
+  // Settings
+  child->setDebug(debug_enabled);
+  child->profiler = profiler;
+  child->profiler.clear();  // Keeps symbols and the sampling setup
+  child->output_matcher = output_matcher;
+  child->output_matches = output_matches;
+  for (OutputMatch& match : child->output_matches) match.callback = nullptr;  // Parent's context
+  child->stop_patterns = stop_patterns;
+  if (checkpoint_interval > 0) {
+    child->enableCheckpoints(checkpoint_interval, checkpoints.maxCheckpoints(), checkpoints.memoryCap());
+  }
+  child->hbios_calls.setEnabled(hbios_calls.isEnabled());
+  if (opstats.isActive()) child->startOpcodeStats();
+  child->latency.setEnabled(latency.isEnabled());
+  child->natives.setMode(natives.mode());
+  child->fusion.setEnabled(fusion.isEnabled());
+  child->batch_target_us = batch_target_us;
+  child->adaptive_batch = adaptive_batch;
+  child->batch_ns_per_instruction = batch_ns_per_instruction;
+
+  // Left at their defaults: rewind points, recording or replay, the boot
+  // cache, metrics and the statistics gathered so far
+  child->setRunFlag(RUN_HALTED, isHalted());
+  child->setRunFlag(RUN_RUNNING, isRunning());
+  return child;
+}
+
+//=============================================================================
+// Checkpoints
+//=============================================================================
+
+// Region ids for the checkpoint ring
+static const uint32_t CKPT_REGION_ROM = 0;
+static const uint32_t CKPT_REGION_RAM = 1;
+static const uint32_t CKPT_REGION_DISK = 0x100;  // + unit
+
+void HBIOSEmulator::enableCheckpoints(long long interval, size_t max_checkpoints, size_t memory_cap) {
+  checkpoints.clear();
+  checkpoints.configure(max_checkpoints, memory_cap);
+  checkpoint_cap_warned = false;
+  checkpoint_interval = interval > 0 ? interval : 0;
+  next_checkpoint = instruction_count + checkpoint_interval;
+}
+
+void HBIOSEmulator::disableCheckpoints() {
+  checkpoint_interval = 0;
+  checkpoints.clear();
+}
+
+bool HBIOSEmulator::takeCheckpoint() {
+  if (!atRestorePoint()) return false;  // Still due; runBatch() tries again
+  unpackFork();
+
+  // Disks only change through DIOWRITE or a mount, both counted in
+  // disk_generation
+  std::vector<CheckpointRegion> regions;
+  regions.push_back({ CKPT_REGION_ROM, memory.get_rom(), HBIOS_ROM_SIZE, CHECKPOINT_ALWAYS });
+  regions.push_back({ CKPT_REGION_RAM, memory.get_ram(), HBIOS_RAM_SIZE, CHECKPOINT_ALWAYS });
+  for (int unit = 0; unit < HBIOS_MAX_DISK_UNITS; unit++) {
+    const uint8_t* data = getDiskData(unit);
+    size_t size = getDiskSize(unit);
+    if (data && size > 0) {
+      regions.push_back({ CKPT_REGION_DISK + (uint32_t)unit, data, size, disk_generation });
+    }
+  }
+
+  std::vector<uint8_t> core;
+  SnapshotWriter w(core);
+  writeCoreState(w);
+
+  if (!checkpoints.capture(regions, instruction_count, core) && !checkpoint_cap_warned) {
+    emu_error("[CHECKPOINT] Memory and disk images do not fit the %zu byte cap - no rewind points\n",
+              checkpoints.memoryCap());
+    checkpoint_cap_warned = true;
+  }
+  next_checkpoint = instruction_count + checkpoint_interval;
+  return true;
+}
+
+bool HBIOSEmulator::rewindToCheckpoint(size_t index) {
+  flushOutput();
+  replay.stop();
+
+  std::vector<uint8_t> core;
+  if (!checkpoints.rewind(index, core)) return false;
+  boot_cache_pending = false;
+  boot_transcript.clear();
+
+  const std::vector<uint8_t>* rom = checkpoints.reference(CKPT_REGION_ROM);
+  const std::vector<uint8_t>* ram = checkpoints.reference(CKPT_REGION_RAM);
+  if (!rom || !ram) return false;
+
+  // Only reload disk images the guest actually changed
+  for (int unit = 0; unit < HBIOS_MAX_DISK_UNITS; unit++) {
+    const std::vector<uint8_t>* ref = checkpoints.reference(CKPT_REGION_DISK + unit);
+    const uint8_t* live = getDiskData(unit);
+    if (!ref || !live || getDiskSize(unit) != ref->size()) continue;
+    if (memcmp(live, ref->data(), ref->size()) == 0) continue;
+    loadDisk(unit, ref->data(), ref->size());
+    if (disk_slices[unit] > 0) hbios.setDiskSliceCount(unit, disk_slices[unit]);
+  }
+
+  // The checkpoint was taken with no HBIOS call under way, so the live
+  // dispatcher's seek positions and buffers do not belong to it
+  initSession();
+  memcpy(memory.get_rom(), rom->data(), rom->size());
+  memcpy(memory.get_ram(), ram->data(), ram->size());
+
+  SnapshotReader r(core.data(), core.size());
+  SnapshotReader emu_sect, cpu_sect, body;
+  uint32_t tag;
+  while (r.nextSection(tag, body)) {
+    if (tag == SNAP_SECT_EMU) emu_sect = body;
+    else if (tag == SNAP_SECT_CPU) cpu_sect = body;
+  }
+  readCoreState(emu_sect, cpu_sect, SNAPSHOT_VERSION);
+
+  setRunFlag(RUN_WAITING_INPUT, false);
+  next_checkpoint = instruction_count + checkpoint_interval;
+  setRunFlag(RUN_RUNNING, true);
+  return true;
+}
+
+//=============================================================================
+// Boot Cache
+//=============================================================================
+
+void HBIOSEmulator::setBootCachePath(const std::string& path) {
+  boot_cache_path = path;
+}
+
+// Key covers everything that shapes the boot: snapshot format, ROM,
+// each disk unit's size, content and slice count, and the boot string.
+uint64_t HBIOSEmulator::computeBootCacheKey() const {
+  std::vector<uint8_t> id;
+  SnapshotWriter w(id);
+  w.u16(SNAPSHOT_VERSION);
+  w.u64(rom_hash);
+  for (int unit = 0; unit < HBIOS_MAX_DISK_UNITS; unit++) {
+    const uint8_t* data = getDiskData(unit);
+    size_t size = getDiskSize(unit);
+    if (!data || size == 0) continue;
+    w.u8((uint8_t)unit);
+    w.u8((uint8_t)disk_slices[unit]);
+    w.u64(size);
+    w.u64(snapshot_fingerprint(data, size));
+  }
+  w.u32((uint32_t)boot_string.size());
+  w.bytes(boot_string.data(), boot_string.size());
+  return snapshot_hash(id.data(), id.size());
+}
+
+bool HBIOSEmulator::restoreBootCache() {
+  std::vector<uint8_t> data;
+  if (!emu_file_exists(boot_cache_path) || !emu_file_load(boot_cache_path, data)) {
+    return false;
+  }
+
+  SnapshotReader boot;
+  if (!snapshot_find_section(data.data(), data.size(), SNAP_SECT_BOOT, boot) ||
+      boot.u64() != boot_cache_key) {
+    emu_log("[BOOTCACHE] Stale or missing key - full boot\n");
+    return false;
+  }
+  uint32_t transcript_len = boot.u32();
+  const uint8_t* transcript = boot.skip(transcript_len);
+  if (!transcript || !loadState(data.data(), data.size())) {
+    return false;
+  }
+
+  // Show the boot banner and prompt as if the boot had just run
+  for (uint32_t i = 0; i < transcript_len; i++) {
+    emu_console_write_char(transcript[i]);
+  }
+  emu_log("[BOOTCACHE] Restored boot snapshot (%zu bytes)\n", data.size());
+  return true;
+}
+
+void HBIOSEmulator::captureBootCache() {
+  // Wait until auto-typed input has been consumed.  Runs inside a batch;
+  // the host's look at the queue is not a guest console call.
+  EmuReplayScope replay_scope(nullptr);
+  if (emu_console_has_input()) return;
+
+  std::vector<uint8_t> data;
+  bool ok = saveState(data, false);  // Flushes the rest of the banner first
+  boot_cache_pending = false;
+  if (!ok) return;
+
+  // A boot that wrote to disk cannot be replayed against the original images
+  if (computeBootCacheKey() != boot_cache_key) {
+    emu_log("[BOOTCACHE] Disks changed during boot - not cached\n");
+    return;
+  }
+
+  SnapshotWriter w(data);
+  w.beginSection(SNAP_SECT_BOOT);
+  w.u64(boot_cache_key);
+  w.u32((uint32_t)boot_transcript.size());
+  w.bytes(boot_transcript.data(), boot_transcript.size());
+  w.endSection();
+  boot_transcript.clear();
+
+  if (!emu_file_save(boot_cache_path, data)) {
+    emu_error("[BOOTCACHE] Failed to write %s\n", boot_cache_path.c_str());
+  }
 }
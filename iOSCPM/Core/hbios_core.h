@@ -12,10 +12,30 @@
 #include "qkz80.h"
 #include "romwbw_mem.h"
 #include "hbios_dispatch.h"
+#include "hbios_snapshot.h"
+#include "hbios_checkpoint.h"
+#include "hbios_pages.h"
+#include "hbios_matcher.h"
+#include "hbios_profiler.h"
+#include "hbios_callstats.h"
+#include "hbios_metrics.h"
+#include "hbios_latency.h"
+#include "hbios_bdos.h"
+#include "hbios_native.h"
+#include "hbios_opstats.h"
+#include "hbios_fusion.h"
+#include "emu_clock.h"
+#include "emu_replay.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <queue>
+#include <memory>
+#include <mutex>
 
 //=============================================================================
 // Controlify Mode - convert next input char(s) to control codes
@@ -31,7 +51,7 @@ enum ControlifyMode {
 // HBIOS Emulator Class - implements HBIOSCPUDelegate for the shared CPU
 //=============================================================================
 
-class HBIOSEmulator : public HBIOSCPUDelegate {
+class HBIOSEmulator : public HBIOSCPUDelegate, public HBIOSBdosHost {
 public:
   HBIOSEmulator();
   ~HBIOSEmulator();
@@ -45,7 +65,7 @@ public:
   bool loadDisk(int unit, const uint8_t* data, size_t size);
   bool loadDiskFromFile(int unit, const std::string& path);
   void closeAllDisks();  // Close all disks before reconfiguring
-  const uint8_t* getDiskData(int unit) const;
+  const uint8_t* getDiskData(int unit) const;  // Null for a clone that has not run yet
   size_t getDiskSize(int unit) const;
   bool isDiskLoaded(int unit) const;
   void setDiskSliceCount(int unit, int slices);  // Set max slices (1-8)
@@ -64,13 +84,241 @@ public:
   // Execution control
   void start();
   void stop();
-  bool isRunning() const { return running; }
-  bool isWaitingForInput() const { return waiting_for_input; }
-  void clearWaitingForInput() { waiting_for_input = false; }
+  bool isRunning() const { return runFlag(RUN_RUNNING); }
+  bool isWaitingForInput() const { return runFlag(RUN_WAITING_INPUT); }
+  void clearWaitingForInput() { setRunFlag(RUN_WAITING_INPUT, false); }
+  bool isHalted() const { return runFlag(RUN_HALTED); }  // In HALT, waiting for an interrupt
+
+  // Pause - the batch in progress ends after its current instruction and
+  // runBatch() runs nothing until resume().  Any thread; pause() returns
+  // the run state from before the call.
+  uint32_t pause();
+  void resume();
+  bool isPaused() const { return runFlag(RUN_PAUSED); }
+
+  // Run state - the flags above in one atomic word.  Control calls may
+  // come from any thread and readers (a UI polling isRunning()) load it
+  // without locking; changes are published with release ordering, so a
+  // reader that sees a flag also sees the work done before it was set.
+  // waitRunState() sleeps until (state & mask) == value, futex-style:
+  // writers only take its lock while someone is waiting.  For example,
+  // after pause() or stop(), waitRunState(RUN_ACTIVE, 0, ms) returns once
+  // the emulator thread is out of runBatch().
+  enum RunFlags : uint32_t {
+    RUN_RUNNING = 1u << 0,        // Started; cleared by stop() or a final HALT
+    RUN_WAITING_INPUT = 1u << 1,  // Suspended input wait
+    RUN_HALTED = 1u << 2,         // In HALT, waiting for an interrupt
+    RUN_PAUSED = 1u << 3,
+    RUN_ACTIVE = 1u << 4,         // A thread is inside runBatch()
+    RUN_DISPATCHED = 1u << 5,     // The current instruction reached HBIOSDispatch (run loop only)
+  };
+  uint32_t getRunState() const { return run_state.load(std::memory_order_acquire); }
+  bool waitRunState(uint32_t mask, uint32_t value, int max_ms);  // false on timeout
+
+  // Timer tick - a periodic tick that advances the HBIOS timer counters
+  // (SYSGET/SYSSET TIMER and SECS are answered from them) and raises an
+  // interrupt, delivered when the guest has interrupts enabled: RST 38h
+  // in IM 0/1, or through the table at I*256 + im2_vector in IM 2, as the
+  // guest set them up.  With the timer on, HALT waits for the next tick
+  // instead of stopping the emulator; HALT with interrupts disabled still
+  // stops it.  Interrupts the guest cannot take in time are coalesced;
+  // the counters still count every tick.  hz 0 (the default) turns the
+  // timer off and leaves SYSGET TIMER to HBIOSDispatch.
+  //
+  // TICK_HOST paces ticks on the host monotonic clock, checked at batch
+  // boundaries.  TICK_GUEST paces them every guest_ips / hz instructions
+  // (there is no T-state count) and cuts batches at tick boundaries, so
+  // tick timing is deterministic and a HALT skips straight to the tick.
+  enum TickSource { TICK_HOST, TICK_GUEST };
+  void setTimerInterrupt(int hz, uint8_t im2_vector = 0);
+  void setTickSource(TickSource source, long long guest_ips = 1000000);
+  int getTimerHz() const { return timer_hz; }
+  TickSource getTickSource() const { return tick_source; }
+  uint32_t getTimerTicks() const { return timer_ticks; }
+  uint32_t getTimerSeconds() const { return timer_secs; }
+
+  // Sleep the calling thread until the guest can make progress: input
+  // queued while it waits for input, or the next tick while halted.
+  // Returns at once when the guest is runnable, and after max_ms at most.
+  // wake() ends a wait early from any thread.
+  void waitForEvent(int max_ms);
+  void wake();
+
+  // Why the guest cannot make progress after the last runBatch():
+  //   WAIT_INPUT  a console read is suspended until input arrives
+  //   WAIT_TICK   halted until the next timer tick
+  // A suspended read costs nothing: runBatch() returns at once without
+  // asking HBIOSDispatch again until it is resumed, by queueInput(),
+  // input appearing on the console, or wake() (emu_event_signal() for
+  // backend events such as host-file data).  A replay takes console
+  // input from its log, so it never reports WAIT_INPUT.
+  enum WaitReason { WAIT_NONE, WAIT_INPUT, WAIT_TICK };
+  WaitReason waitReason() const;
+
+  // Run batches for up to budget_us of host time - the loop shared by
+  // frontends.  Without block it returns as soon as the guest waits, so
+  // the caller decides how to wait; with block it sleeps in waitForEvent()
+  // and carries on when resumed.  Returns the wait the guest is in, or
+  // WAIT_NONE when the budget ran out, the emulator stopped or paused, or
+  // a stop pattern matched.
+  WaitReason runFor(int budget_us, bool block = false, int batch = BATCH_ADAPTIVE);
 
   // Run a batch of instructions (call from main loop)
   void runBatch(int count = 50000);
 
+  // Adaptive batch sizing - runBatch(BATCH_ADAPTIVE) runs as many
+  // instructions as fit the target host time, using the speed measured
+  // over previous batches.  The size drops while console I/O is active
+  // (output produced, keys queued or the guest waiting for input) and
+  // doubles back toward the target during pure compute.
+  static const int BATCH_ADAPTIVE = 0;
+  void setBatchTarget(int target_us);  // Default 2000
+  int getBatchTarget() const { return batch_target_us; }
+  int getAdaptiveBatchSize() const { return adaptive_batch; }
+
+  // Save state - versioned binary snapshot (see hbios_snapshot.h).
+  // Take between runBatch() calls at a restore point; the same ROM must
+  // be loaded to restore.
+  bool saveState(std::vector<uint8_t>& out, bool include_disks = true);
+  bool loadState(const uint8_t* data, size_t size);
+  bool saveStateToFile(const std::string& path, bool include_disks = true);
+  bool loadStateFromFile(const std::string& path);
+
+  // Save states, checkpoints and clones are only taken where no HBIOS
+  // call is half done (a DIOSEEK whose DIOREAD has not run yet): while
+  // the guest waits for console input, in HALT, or before it has run.
+  // HBIOSDispatch keeps its seek positions and buffers to itself, so a
+  // restore starts it afresh (see KNOWN_PROBLEMS.md).
+  bool atRestorePoint() const;
+
+  // Boot cache - start() restores a snapshot taken at the first console
+  // input wait of a previous boot when ROM, disks, slice counts and boot
+  // string all match; otherwise it boots normally and refreshes the cache.
+  void setBootCachePath(const std::string& path);  // Empty disables
+  bool restoredFromBootCache() const { return boot_cache_restored; }
+
+  // Fork this session into an independent emulator at the current
+  // instruction boundary.  This is a lazy full copy, not a copy-on-write
+  // fork, and costs O(image size) in time and memory: clone() compares
+  // all of RAM and ROM against the previous clone, plus every mounted
+  // disk when the guest wrote to any since (hundreds of MB for the hd1k
+  // combo images), and the clone copies all of it into its own memory
+  // and disk images on first use - running, saving, checkpointing or
+  // changing disks.  Until then it shares the refcounted pages (see
+  // hbios_pages.h) with every clone taken from the same state.  Real
+  // page sharing needs hooks in the external banked_mem and HBDisk
+  // (see KNOWN_PROBLEMS.md).  The clone gets the guest state
+  // (registers, timer, clock, BDOS trap, boot string) and the settings
+  // (profiler with its symbols, output match patterns, checkpoint
+  // interval, statistics and latency switches, native routines, fusion,
+  // batch tuning); it starts without the parent's rewind points,
+  // recording or replay, boot cache, metrics and counts.  Output match
+  // callbacks are not copied, since they capture the parent's context;
+  // attach the clone's own with setOutputMatchCallback().  The console
+  // queue is left alone: console I/O goes through the process-wide
+  // emu_io backend, so concurrent clones need per-session console
+  // routing from the host.  Null when not at a restore point.
+  std::unique_ptr<HBIOSEmulator> clone();
+
+  // Checkpoints - incremental rewind points (see hbios_checkpoint.h).
+  // interval is in guest instructions; checked at batch granularity.
+  // memory_cap bounds all checkpoint memory, the reference copies of RAM,
+  // ROM and every mounted disk included.
+  void enableCheckpoints(long long interval, size_t max_checkpoints, size_t memory_cap);
+  void disableCheckpoints();
+  // A due checkpoint waits for the next restore point; takeCheckpoint()
+  // returns false without taking one anywhere else.
+  bool takeCheckpoint();
+  size_t getCheckpointCount() const { return checkpoints.count(); }
+  long long getCheckpointInstructionCount(size_t index) const { return checkpoints.stamp(index); }
+  bool rewindToCheckpoint(size_t index);  // 0 = oldest
+
+  // Record/replay - log every nondeterministic input the guest consumes
+  // (console, RTC, random, host-file data) stamped with the instruction
+  // count (see emu_replay.h).  A recording starts with a save state taken
+  // at startRecording(); startReplay() restores it and feeds the logged
+  // inputs back, then hands over to live input at the recording's end.
+  // Loading a state or rewinding ends a recording or replay.
+  bool startRecording();
+  bool stopRecording(std::vector<uint8_t>& log);
+  bool stopRecordingToFile(const std::string& path);
+  bool startReplay(const uint8_t* data, size_t size);
+  bool startReplayFromFile(const std::string& path);
+  bool isRecording() const { return replay.mode() == EmuReplayLog::RECORDING; }
+  bool isReplaying() const { return replay.mode() == EmuReplayLog::PLAYING; }
+  bool replayDiverged() const { return replay.diverged(); }
+  long long replayDivergedAt() const { return replay.divergedAt(); }
+
+  // Output matching - patterns are searched in console output as it is
+  // produced (see hbios_matcher.h).  The callback runs on the emulator
+  // thread.  With stop set, runBatch() returns right after the
+  // instruction that completed the match and takeStopMatch() reports it.
+  typedef std::function<void(int id)> OutputMatchCallback;
+  int addOutputMatch(const std::string& pattern, bool stop,
+                     OutputMatchCallback callback = nullptr);
+  void setOutputMatchCallback(int id, OutputMatchCallback callback);
+  void removeOutputMatch(int id);
+  void clearOutputMatches();
+  int takeStopMatch();  // Pattern id, or -1 if the last batch did not stop on a match
+
+  // Profiling - sample the guest PC every interval instructions, with
+  // CALL/RET tracking for call stacks (see hbios_profiler.h).  Load
+  // symbols and read reports through getProfiler().
+  void startProfiling(int interval, bool call_stacks = true);
+  void stopProfiling();
+  bool isProfiling() const { return profiler.isActive(); }
+  HBIOSProfiler& getProfiler() { return profiler; }
+
+  // HBIOS call statistics - calls, host time and guest instructions per
+  // function code (see hbios_callstats.h).  Off by default.
+  void setHBIOSCallStatsEnabled(bool enable) { hbios_calls.setEnabled(enable); }
+  bool isHBIOSCallStatsEnabled() const { return hbios_calls.isEnabled(); }
+  void resetHBIOSCallStats() { hbios_calls.reset(); }
+  const HBIOSCallStats& getHBIOSCallStats() const { return hbios_calls; }
+
+  // Real-time clock seen by the guest (see emu_clock.h): host local time
+  // by default, or a fixed or instruction-driven virtual clock for
+  // reproducible runs
+  EmuClock& getClock() { return clock; }
+
+  // Native BDOS - answer CP/M 2.2 direct console output and file reads
+  // from the TPA without running the guest BDOS (see hbios_bdos.h).
+  // File calls need their drive mapped to an hd1k slice of a loaded disk;
+  // anything the trap does not cover runs the real BDOS.  Off by default.
+  void setBDOSTrap(unsigned mode) { bdos.setMode(mode); }  // HBIOSBdos::TRAP_* flags
+  bool mapBDOSDrive(int drive, int unit, int slice = 0) { return bdos.mapDrive(drive, unit, slice); }
+  const HBIOSBdos& getBDOS() const { return bdos; }
+
+  // Native routines - run recognized runtime library routines (HI-TECH
+  // C, Turbo Pascal 3) as host code, or run both and compare under
+  // VERIFY (see hbios_native.h).  Off by default.
+  void setNativeRoutines(HBIOSNative::Mode mode) { natives.setMode(mode); }
+  HBIOSNative& getNativeRoutines() { return natives; }
+
+  // Opcode statistics - count the instructions, pairs and triples the
+  // interpreter executes (see hbios_opstats.h).  Off by default.
+  void startOpcodeStats() { opstats.clear(); opstats.start(); }
+  void stopOpcodeStats() { opstats.stop(); }
+  HBIOSOpStats& getOpcodeStats() { return opstats; }
+
+  // Fused handlers - run hot instruction sequences as one step (see
+  // hbios_fusion.h).  Off by default.
+  void setFusion(bool enable) { fusion.setEnabled(enable); }
+  HBIOSFusion& getFusion() { return fusion; }
+
+  // Metrics - running totals published at the end of each runBatch()
+  // (see hbios_metrics.h).  Unlike everything else here, safe to call
+  // from any thread while the emulator runs.
+  HBIOSMetricsSnapshot getMetrics() const;
+
+  // Input latency - histograms of key queued (queueInput) to read by the
+  // guest, to first output, and to handoff to the frontend (see
+  // hbios_latency.h).  Off by default.
+  void setLatencyTrackingEnabled(bool enable) { latency.setEnabled(enable); }
+  bool isLatencyTrackingEnabled() const { return latency.isEnabled(); }
+  void resetLatency() { latency.reset(); }
+  const HBIOSLatency& getLatency() const { return latency; }
+
   // Debug
   void setDebug(bool enable);
   uint16_t getPC() const { return cpu.regs.PC.get_pair16(); }
@@ -78,13 +326,78 @@ public:
 
   // HBIOSCPUDelegate interface - called by shared hbios_cpu
   banked_mem* getMemory() override { return &memory; }
-  HBIOSDispatch* getHBIOS() override { return &hbios; }
+  // hbios_cpu asks for the dispatcher when the guest enters it; the run
+  // loop sees the flag in its next run-state load
+  HBIOSDispatch* getHBIOS() override {
+    run_state.fetch_or(RUN_DISPATCHED, std::memory_order_relaxed);
+    return &hbios;
+  }
   void initializeRamBankIfNeeded(uint8_t bank) override;
   void onHalt() override;
   void onUnimplementedOpcode(uint8_t opcode, uint16_t pc) override;
   void logDebug(const char* fmt, ...) override;
 
+  // HBIOSBdosHost interface - called by the BDOS trap
+  const uint8_t* bdosDisk(int unit, size_t* size) override;
+  void bdosConsoleOut(uint8_t ch) override;
+
 private:
+  // clone() constructs without clearing the parent's console queue
+  explicit HBIOSEmulator(bool clear_console);
+  void resetState();  // reset() without the console queue
+
+  // Session setup shared by start() and loadState()
+  void initSession();
+
+  // Clone pages: this session as of the last clone(), and the pages a
+  // clone copies into its memory and disks before first use
+  std::shared_ptr<const HBIOSForkImage> forkImage();
+  void unpackFork();
+
+  // Execute one instruction under the profiler
+  void profileStep();
+
+  // Note HBIOS entries and returns before the next instruction
+  void countHBIOSCall();
+  void countDiskCall();  // At HB_INVOKE, whatever else is enabled
+
+  // Timer tick helpers
+  void pollTimer();
+  void addTicks(uint64_t count);
+  void checkInterrupt();
+  bool serveTimerCall();  // At HB_INVOKE: SYSGET/SYSSET TIMER or SECS
+  void scheduleTicks();
+  void resetTimerCounters();
+
+  // Pick the next adaptive batch size after a batch
+  void tuneBatch(long long executed, uint64_t elapsed_ns, bool io_active);
+
+  // Body of runBatch(), with RUN_ACTIVE set
+  void executeBatch(int count);
+  bool dispatchContinues();  // After an instruction that reached HBIOSDispatch
+
+  // HBIOSDispatch reported HBIOS_NEEDS_INPUT
+  void suspendForInput();
+
+  // Metrics bookkeeping on the emulator thread
+  void noteInputWait();
+  void publishMetrics();
+
+  // Drain the HBIOS output buffer to the console and the matcher
+  void flushOutput();
+  void emitOutput(const uint8_t* chars, size_t count);
+  void onOutputMatch();
+
+  // EMU + CPU snapshot sections, shared by save states and checkpoints.
+  // version is the snapshot's, SNAPSHOT_VERSION for checkpoints.
+  void writeCoreState(SnapshotWriter& w);
+  void readCoreState(SnapshotReader& emu, SnapshotReader& cpu, uint16_t version);
+
+  // Boot cache helpers
+  uint64_t computeBootCacheKey() const;
+  bool restoreBootCache();
+  void captureBootCache();
+
   // CPU and memory
   banked_mem memory;
   hbios_cpu cpu;
@@ -93,8 +406,13 @@ private:
   HBIOSDispatch hbios;
 
   // State
-  bool running;
-  bool waiting_for_input;
+  // Run state (RunFlags)
+  std::atomic<uint32_t> run_state;
+  std::atomic<int> run_waiters;  // Threads in waitRunState()
+  std::mutex run_state_lock;
+  std::condition_variable run_state_cv;
+  bool runFlag(uint32_t flag) const { return (getRunState() & flag) != 0; }
+  void setRunFlag(uint32_t flag, bool on);
   bool debug_enabled;
   long long instruction_count;
 
@@ -108,6 +426,101 @@ private:
 
   // RAM bank initialization tracking (bitmask for banks 0x80-0x8F)
   uint16_t initialized_ram_banks;
+
+  // ROM as loaded (before init patches) - baseline for snapshot ROM pages
+  std::vector<uint8_t> rom_image;
+  uint64_t rom_hash;
+
+  // Slice counts passed to setDiskSliceCount (0 = HBIOS default)
+  int disk_slices[HBIOS_MAX_DISK_UNITS];
+
+  // Clone pages.  disk_generation counts mounts and DIOWRITE calls, so
+  // forkImage() only compares disks that may have changed.
+  std::shared_ptr<const HBIOSForkImage> fork_base;     // Shared with past clones
+  std::shared_ptr<const HBIOSForkImage> fork_pending;  // Not copied in yet
+  uint64_t disk_generation;
+
+  // Boot cache
+  std::string boot_cache_path;
+  uint64_t boot_cache_key;
+  bool boot_cache_pending;      // Capture at the next idle input wait
+  bool boot_cache_restored;
+  std::string boot_transcript;  // Console output replayed after a restore
+
+  // Checkpoint ring
+  HBIOSCheckpointRing checkpoints;
+  long long checkpoint_interval;  // 0 = disabled
+  long long next_checkpoint;
+  bool checkpoint_cap_warned;     // Reported that the images do not fit
+
+  // Record/replay log, bound to the thread during runBatch()
+  EmuReplayLog replay;
+
+  // Output matching
+  struct OutputMatch {
+    bool stop;
+    OutputMatchCallback callback;
+  };
+  HBIOSOutputMatcher output_matcher;
+  std::vector<OutputMatch> output_matches;  // Indexed by pattern id
+  int stop_patterns;                        // Armed patterns with stop set
+  int stop_match;
+
+  // Sampling profiler
+  HBIOSProfiler profiler;
+
+  // Per-function HBIOS call statistics
+  HBIOSCallStats hbios_calls;
+
+  // Native BDOS calls
+  HBIOSBdos bdos;
+
+  // Native runtime library routines
+  HBIOSNative natives;
+
+  // Opcode sequence statistics and fused handlers
+  HBIOSOpStats opstats;
+  HBIOSFusion fusion;
+
+  // HALT and timer tick
+  int timer_hz;
+  uint8_t timer_im2_vector;
+  TickSource tick_source;
+  long long tick_guest_ips;     // TICK_GUEST: nominal guest instructions per second
+  long long tick_instructions;  // TICK_GUEST: instructions per tick
+  long long next_tick_at;       // TICK_GUEST: instruction count of the next tick
+  std::chrono::steady_clock::time_point next_tick;  // TICK_HOST
+  uint32_t timer_ticks;         // HBIOS TIMER
+  uint32_t timer_secs;          // HBIOS SECS
+  uint32_t timer_sec_ticks;     // Ticks into the current second
+  bool irq_pending;
+  bool ei_shadow;  // EI just executed: hold interrupts for one instruction
+  uint16_t exec_pc;  // Address of the instruction the CPU is executing
+
+  // waitForEvent() wakeup
+  std::mutex event_lock;
+  std::condition_variable event_cv;
+  bool event_pending;
+  std::atomic<bool> wait_resumed;  // wake() since the input wait began
+
+  // Adaptive batch sizing
+  int batch_target_us;
+  int adaptive_batch;
+  double batch_ns_per_instruction;  // Smoothed host cost, 0 = not measured yet
+  uint64_t batch_input_seen;        // input_bytes at the previous batch
+
+  // Guest RTC, bound to the thread during runBatch()
+  EmuClock clock;
+
+  // Keystroke latency, bound to the thread during runBatch()
+  HBIOSLatency latency;
+
+  // Metrics: counted here, published to readers at batch boundaries
+  HBIOSMetricsSnapshot metrics_counts;
+  HBIOSMetrics metrics;
+  std::atomic<uint64_t> input_bytes;  // queueInput() may run on a UI thread
+  bool input_wait_open;
+  std::chrono::steady_clock::time_point input_wait_since;
 };
 
 #endif // HBIOS_CORE_H
@@ -0,0 +1,382 @@
+/*
+ * HBIOS Fusion - Handler Table, Selection and the Handlers
+ */
+
+#include "hbios_fusion.h"
+#include "hbios_opcodes.h"
+#include <cstdio>
+
+// Flag bits
+static const uint8_t FLAG_C = 0x01;
+static const uint8_t FLAG_N = 0x02;
+static const uint8_t FLAG_PV = 0x04;
+static const uint8_t FLAG_X = 0x08;  // Undocumented bit 3
+static const uint8_t FLAG_H = 0x10;
+static const uint8_t FLAG_Y = 0x20;  // Undocumented bit 5
+static const uint8_t FLAG_Z = 0x40;
+static const uint8_t FLAG_S = 0x80;
+
+//=============================================================================
+// Instruction Semantics
+//=============================================================================
+
+static uint8_t szp(uint8_t v) {
+  uint8_t p = v;
+  p ^= p >> 4;
+  p ^= p >> 2;
+  p ^= p >> 1;
+  return (uint8_t)((v & (FLAG_S | FLAG_Y | FLAG_X)) | (v ? 0 : FLAG_Z) | ((p & 1) ? 0 : FLAG_PV));
+}
+
+static void setAF(qkz80_reg_set& r, uint8_t a, uint8_t f) {
+  r.AF.set_pair16((uint16_t)(a << 8 | f));
+}
+
+static void setA(qkz80_reg_set& r, uint8_t a) {
+  r.AF.set_pair16((uint16_t)(a << 8 | (r.AF.get_pair16() & 0xFF)));
+}
+
+// DEC r, carry kept
+static uint8_t dec8(uint8_t& f, uint8_t v) {
+  uint8_t r = (uint8_t)(v - 1);
+  f = (uint8_t)((f & FLAG_C) | (r & (FLAG_S | FLAG_Y | FLAG_X)) | (r ? 0 : FLAG_Z) |
+                ((r & 0x0F) == 0x0F ? FLAG_H : 0) | (r == 0x7F ? FLAG_PV : 0) | FLAG_N);
+  return r;
+}
+
+// ADD HL,rr
+static uint16_t add16(uint8_t& f, uint16_t x, uint16_t y) {
+  uint32_t r = (uint32_t)x + y;
+  f = (uint8_t)((f & (FLAG_S | FLAG_Z | FLAG_PV)) | ((r >> 8) & (FLAG_Y | FLAG_X)) |
+                (((x ^ y ^ r) >> 8) & FLAG_H) | (r >> 16));
+  return (uint16_t)r;
+}
+
+// SBC HL,rr with carry clear
+static uint16_t sub16(uint8_t& f, uint16_t x, uint16_t y) {
+  uint32_t r = (uint32_t)x - y;
+  uint16_t v = (uint16_t)r;
+  f = (uint8_t)(((v >> 8) & (FLAG_S | FLAG_Y | FLAG_X)) | (v ? 0 : FLAG_Z) |
+                (((x ^ y ^ r) >> 8) & FLAG_H) | (((x ^ y) & (x ^ r) & 0x8000) ? FLAG_PV : 0) |
+                ((r >> 16) & FLAG_C) | FLAG_N);
+  return v;
+}
+
+// CP n: bits 3 and 5 come from the operand
+static uint8_t cp8(uint8_t a, uint8_t v) {
+  unsigned r = (unsigned)a - v;
+  return (uint8_t)((r & FLAG_S) | ((r & 0xFF) ? 0 : FLAG_Z) | ((a ^ v ^ r) & FLAG_H) |
+                   (((a ^ v) & (a ^ r) & 0x80) ? FLAG_PV : 0) | ((r >> 8) & FLAG_C) | FLAG_N |
+                   (v & (FLAG_Y | FLAG_X)));
+}
+
+// PC after the JR e at addr
+static uint16_t jr(qkz80_cpu_mem& m, uint16_t addr, bool taken) {
+  uint16_t next = (uint16_t)(addr + 2);
+  return taken ? (uint16_t)(next + (int8_t)m.fetch_mem((uint16_t)(addr + 1))) : next;
+}
+
+// PC after the JP nn at addr
+static uint16_t jp(qkz80_cpu_mem& m, uint16_t addr, bool taken) {
+  if (!taken) return (uint16_t)(addr + 3);
+  return (uint16_t)(m.fetch_mem((uint16_t)(addr + 1)) | m.fetch_mem((uint16_t)(addr + 2)) << 8);
+}
+
+//=============================================================================
+// Handlers
+//=============================================================================
+
+// Each runs the sequence at pc, PC included, or returns false before
+// changing anything to leave it to the interpreter
+
+// LD A,(HL) / INC HL
+static bool fuseLdAHLInc(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t hl = r.HL.get_pair16();
+  setA(r, m.fetch_mem(hl));
+  r.HL.set_pair16((uint16_t)(hl + 1));
+  r.PC.set_pair16((uint16_t)(pc + 2));
+  return true;
+}
+
+// LD (HL),A / INC HL
+static bool fuseLdHLAInc(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t hl = r.HL.get_pair16();
+  if (hl == (uint16_t)(pc + 1)) return false;  // Stores over the INC
+  m.store_mem(hl, r.AF.get_high());
+  r.HL.set_pair16((uint16_t)(hl + 1));
+  r.PC.set_pair16((uint16_t)(pc + 2));
+  return true;
+}
+
+// LD A,(DE) / INC DE
+static bool fuseLdADEInc(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t de = r.DE.get_pair16();
+  setA(r, m.fetch_mem(de));
+  r.DE.set_pair16((uint16_t)(de + 1));
+  r.PC.set_pair16((uint16_t)(pc + 2));
+  return true;
+}
+
+// LD (DE),A / INC DE
+static bool fuseLdDEAInc(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t de = r.DE.get_pair16();
+  if (de == (uint16_t)(pc + 1)) return false;
+  m.store_mem(de, r.AF.get_high());
+  r.DE.set_pair16((uint16_t)(de + 1));
+  r.PC.set_pair16((uint16_t)(pc + 2));
+  return true;
+}
+
+// LD E,(HL) / INC HL / LD D,(HL)
+static bool fuseLdDEInd(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t hl = r.HL.get_pair16();
+  uint8_t lo = m.fetch_mem(hl);
+  hl = (uint16_t)(hl + 1);
+  r.DE.set_pair16((uint16_t)(m.fetch_mem(hl) << 8 | lo));
+  r.HL.set_pair16(hl);
+  r.PC.set_pair16((uint16_t)(pc + 3));
+  return true;
+}
+
+// LD C,(HL) / INC HL / LD B,(HL)
+static bool fuseLdBCInd(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t hl = r.HL.get_pair16();
+  uint8_t lo = m.fetch_mem(hl);
+  hl = (uint16_t)(hl + 1);
+  r.BC.set_pair16((uint16_t)(m.fetch_mem(hl) << 8 | lo));
+  r.HL.set_pair16(hl);
+  r.PC.set_pair16((uint16_t)(pc + 3));
+  return true;
+}
+
+// DEC B / JR NZ,e
+static bool fuseDecBJrNz(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t af = r.AF.get_pair16();
+  uint16_t bc = r.BC.get_pair16();
+  uint8_t f = (uint8_t)af;
+  uint8_t b = dec8(f, (uint8_t)(bc >> 8));
+  r.BC.set_pair16((uint16_t)(b << 8 | (bc & 0xFF)));
+  setAF(r, (uint8_t)(af >> 8), f);
+  r.PC.set_pair16(jr(m, (uint16_t)(pc + 1), b != 0));
+  return true;
+}
+
+// DEC B / JP NZ,nn: the same loop in 8080 code
+static bool fuseDecBJpNz(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t af = r.AF.get_pair16();
+  uint16_t bc = r.BC.get_pair16();
+  uint8_t f = (uint8_t)af;
+  uint8_t b = dec8(f, (uint8_t)(bc >> 8));
+  r.BC.set_pair16((uint16_t)(b << 8 | (bc & 0xFF)));
+  setAF(r, (uint8_t)(af >> 8), f);
+  r.PC.set_pair16(jp(m, (uint16_t)(pc + 1), b != 0));
+  return true;
+}
+
+// DEC C / JR NZ,e
+static bool fuseDecCJrNz(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t af = r.AF.get_pair16();
+  uint16_t bc = r.BC.get_pair16();
+  uint8_t f = (uint8_t)af;
+  uint8_t c = dec8(f, (uint8_t)bc);
+  r.BC.set_pair16((uint16_t)((bc & 0xFF00) | c));
+  setAF(r, (uint8_t)(af >> 8), f);
+  r.PC.set_pair16(jr(m, (uint16_t)(pc + 1), c != 0));
+  return true;
+}
+
+// DEC BC / LD A,B / OR C: the loop test of every BC-counted loop
+static bool fuseDecBCTest(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t bc = (uint16_t)(r.BC.get_pair16() - 1);
+  uint8_t a = (uint8_t)((bc >> 8) | bc);
+  r.BC.set_pair16(bc);
+  setAF(r, a, szp(a));
+  r.PC.set_pair16((uint16_t)(pc + 3));
+  return true;
+}
+
+// LD A,B / OR C
+static bool fuseTestBC(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t bc = r.BC.get_pair16();
+  uint8_t a = (uint8_t)((bc >> 8) | bc);
+  setAF(r, a, szp(a));
+  r.PC.set_pair16((uint16_t)(pc + 2));
+  return true;
+}
+
+// EX DE,HL / ADD HL,DE
+static bool fuseExAddHLDE(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint16_t af = r.AF.get_pair16();
+  uint16_t de = r.HL.get_pair16();
+  uint16_t hl = r.DE.get_pair16();
+  uint8_t f = (uint8_t)af;
+  r.HL.set_pair16(add16(f, hl, de));
+  r.DE.set_pair16(de);
+  setAF(r, (uint8_t)(af >> 8), f);
+  r.PC.set_pair16((uint16_t)(pc + 2));
+  return true;
+}
+
+// OR A / SBC HL,DE: 16-bit compare and subtract
+static bool fuseSubHLDE(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint8_t f = 0;
+  r.HL.set_pair16(sub16(f, r.HL.get_pair16(), r.DE.get_pair16()));
+  setAF(r, r.AF.get_high(), f);
+  r.PC.set_pair16((uint16_t)(pc + 3));
+  return true;
+}
+
+// CP n / JR Z,e
+static bool fuseCpJrZ(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint8_t a = r.AF.get_high();
+  uint8_t f = cp8(a, m.fetch_mem((uint16_t)(pc + 1)));
+  setAF(r, a, f);
+  r.PC.set_pair16(jr(m, (uint16_t)(pc + 2), (f & FLAG_Z) != 0));
+  return true;
+}
+
+// CP n / JR NZ,e
+static bool fuseCpJrNz(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint8_t a = r.AF.get_high();
+  uint8_t f = cp8(a, m.fetch_mem((uint16_t)(pc + 1)));
+  setAF(r, a, f);
+  r.PC.set_pair16(jr(m, (uint16_t)(pc + 2), (f & FLAG_Z) == 0));
+  return true;
+}
+
+// CP n / JP Z,nn
+static bool fuseCpJpZ(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint8_t a = r.AF.get_high();
+  uint8_t f = cp8(a, m.fetch_mem((uint16_t)(pc + 1)));
+  setAF(r, a, f);
+  r.PC.set_pair16(jp(m, (uint16_t)(pc + 2), (f & FLAG_Z) != 0));
+  return true;
+}
+
+// CP n / JP NZ,nn
+static bool fuseCpJpNz(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc) {
+  uint8_t a = r.AF.get_high();
+  uint8_t f = cp8(a, m.fetch_mem((uint16_t)(pc + 1)));
+  setAF(r, a, f);
+  r.PC.set_pair16(jp(m, (uint16_t)(pc + 2), (f & FLAG_Z) == 0));
+  return true;
+}
+
+//=============================================================================
+// Table
+//=============================================================================
+
+typedef bool (*FusedFn)(qkz80_reg_set& r, qkz80_cpu_mem& m, uint16_t pc);
+
+static constexpr int16_t ANY = -1;  // Operand byte
+
+// Patterns start with the opcode that selects them; handlers sharing a
+// first opcode are tried in table order.  Their lengths come from the
+// opcode table (hbios_opcodes.h).
+static constexpr struct {
+  const char* name;
+  int16_t bytes[HBIOSFusion::MAX_BYTES];
+  int instructions;
+  FusedFn run;
+} HANDLERS[] = {
+  { "LD A,(HL); INC HL",            { 0x7E, 0x23 },                2, fuseLdAHLInc },
+  { "LD (HL),A; INC HL",            { 0x77, 0x23 },                2, fuseLdHLAInc },
+  { "LD A,(DE); INC DE",            { 0x1A, 0x13 },                2, fuseLdADEInc },
+  { "LD (DE),A; INC DE",            { 0x12, 0x13 },                2, fuseLdDEAInc },
+  { "LD E,(HL); INC HL; LD D,(HL)", { 0x5E, 0x23, 0x56 },          3, fuseLdDEInd },
+  { "LD C,(HL); INC HL; LD B,(HL)", { 0x4E, 0x23, 0x46 },          3, fuseLdBCInd },
+  { "DEC B; JR NZ",                 { 0x05, 0x20, ANY },           2, fuseDecBJrNz },
+  { "DEC B; JP NZ",                 { 0x05, 0xC2, ANY, ANY },      2, fuseDecBJpNz },
+  { "DEC C; JR NZ",                 { 0x0D, 0x20, ANY },           2, fuseDecCJrNz },
+  { "DEC BC; LD A,B; OR C",         { 0x0B, 0x78, 0xB1 },          3, fuseDecBCTest },
+  { "LD A,B; OR C",                 { 0x78, 0xB1 },                2, fuseTestBC },
+  { "EX DE,HL; ADD HL,DE",          { 0xEB, 0x19 },                2, fuseExAddHLDE },
+  { "OR A; SBC HL,DE",              { 0xB7, 0xED, 0x52 },          2, fuseSubHLDE },
+  { "CP n; JR Z",                   { 0xFE, ANY, 0x28, ANY },      2, fuseCpJrZ },
+  { "CP n; JR NZ",                  { 0xFE, ANY, 0x20, ANY },      2, fuseCpJrNz },
+  { "CP n; JP Z",                   { 0xFE, ANY, 0xCA, ANY, ANY }, 2, fuseCpJpZ },
+  { "CP n; JP NZ",                  { 0xFE, ANY, 0xC2, ANY, ANY }, 2, fuseCpJpNz },
+};
+static constexpr int HANDLER_COUNT = (int)(sizeof(HANDLERS) / sizeof(HANDLERS[0]));
+
+// First handler for each opcode and the next one with the same opcode
+// (-1 = none), and the bytes each pattern covers
+struct Selector {
+  int8_t first[256];
+  int8_t next[HANDLER_COUNT];
+  uint8_t length[HANDLER_COUNT];
+  uint8_t longest;
+
+  constexpr Selector() : first(), next(), length(), longest(0) {
+    for (int op = 0; op < 256; op++) first[op] = -1;
+    for (int h = HANDLER_COUNT - 1; h >= 0; h--) {
+      next[h] = first[HANDLERS[h].bytes[0]];
+      first[HANDLERS[h].bytes[0]] = (int8_t)h;
+      int n = 0;
+      for (int i = 0; i < HANDLERS[h].instructions; i++) {
+        const int16_t* op = HANDLERS[h].bytes + n;
+        n += z80OpInfo(z80OpKey((uint8_t)op[0], n + 1 < HBIOSFusion::MAX_BYTES ? (uint8_t)op[1] : 0, 0)).length;
+      }
+      length[h] = (uint8_t)n;
+      if (n > longest) longest = (uint8_t)n;
+    }
+  }
+};
+static constexpr Selector SELECTOR;
+static_assert(SELECTOR.longest <= HBIOSFusion::MAX_BYTES, "pattern longer than MAX_BYTES");
+
+static bool matches(int h, uint16_t pc, qkz80_cpu_mem& mem) {
+  for (int i = 1; i < SELECTOR.length[h]; i++) {
+    int16_t b = HANDLERS[h].bytes[i];
+    if (b != ANY && mem.fetch_mem((uint16_t)(pc + i)) != b) return false;
+  }
+  return true;
+}
+
+int HBIOSFusion::handlerCount() {
+  return HANDLER_COUNT;
+}
+
+const char* HBIOSFusion::handlerName(int index) {
+  return HANDLERS[index].name;
+}
+
+int HBIOSFusion::handlerPattern(int index, int16_t bytes[MAX_BYTES]) {
+  for (int i = 0; i < MAX_BYTES; i++) bytes[i] = HANDLERS[index].bytes[i];
+  return SELECTOR.length[index];
+}
+
+//=============================================================================
+// HBIOSFusion
+//=============================================================================
+
+HBIOSFusion::HBIOSFusion() : enabled(false) {
+  resetStats();
+}
+
+void HBIOSFusion::resetStats() {
+  counts.assign(HANDLER_COUNT, 0);
+}
+
+int HBIOSFusion::step(qkz80_reg_set& regs, qkz80_cpu_mem& mem) {
+  uint16_t pc = regs.PC.get_pair16();
+  for (int h = SELECTOR.first[mem.fetch_mem(pc)]; h >= 0; h = SELECTOR.next[h]) {
+    if (!matches(h, pc, mem) || !HANDLERS[h].run(regs, mem, pc)) continue;
+    counts[h]++;
+    return HANDLERS[h].instructions;
+  }
+  return 0;
+}
+
+std::string HBIOSFusion::report() const {
+  char line[128];
+  snprintf(line, sizeof(line), "%-30s %12s %14s\n", "sequence", "hits", "instructions");
+  std::string out = line;
+  for (int h = 0; h < HANDLER_COUNT; h++) {
+    if (counts[h] == 0) continue;
+    snprintf(line, sizeof(line), "%-30s %12llu %14llu\n", HANDLERS[h].name, (unsigned long long)counts[h],
+             (unsigned long long)(counts[h] * HANDLERS[h].instructions));
+    out += line;
+  }
+  return out;
+}
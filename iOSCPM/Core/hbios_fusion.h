@@ -0,0 +1,67 @@
+/*
+ * HBIOS Fusion - Fused Handlers for Hot Instruction Sequences
+ *
+ * A few short sequences make up a large share of what CP/M programs
+ * execute: copy loops (LD A,(HL) / INC HL), counted loops (DEC B /
+ * JR NZ), 16-bit pointer arithmetic (EX DE,HL / ADD HL,DE).  While
+ * enabled, the bytes at PC are looked up before each instruction and a
+ * sequence with a fused handler runs as one step instead of two or three
+ * trips through the interpreter.  8080-style code gets the JP forms of
+ * the same loops.  The first opcode selects the candidate
+ * handlers through a 256-entry table, so an instruction that starts no
+ * fused sequence costs one memory read and one table load.
+ *
+ * A fused handler leaves exactly what the interpreter would: registers,
+ * flags (bits 3 and 5 included), memory and PC, and reports how many
+ * instructions it stood for.  None of them performs I/O, changes SP or
+ * the interrupt state, so only the instruction boundaries inside a
+ * sequence are skipped; the emulator does not fuse while an interrupt is
+ * pending or while anything that looks at every instruction (profiler,
+ * opcode statistics, HBIOS call counts, native routine verification) is
+ * active.  The refresh register is not advanced for the skipped
+ * instructions.
+ *
+ * Candidates for the set are the hottest pairs and triples in the
+ * benchmark workloads; romwbw_bench --opcode-stats lists them (see
+ * hbios_opstats.h).
+ */
+
+#ifndef HBIOS_FUSION_H
+#define HBIOS_FUSION_H
+
+#include "qkz80.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class HBIOSFusion {
+public:
+  static const int MAX_BYTES = 5;         // Longest fused sequence
+  static const int MAX_INSTRUCTIONS = 3;  // Most instructions in one
+
+  HBIOSFusion();
+
+  void setEnabled(bool on) { enabled = on; }
+  bool isEnabled() const { return enabled; }
+
+  // Runs the fused sequence starting at PC, if there is one.  Returns the
+  // number of instructions it stood for, 0 to execute PC as usual.
+  int step(qkz80_reg_set& regs, qkz80_cpu_mem& mem);
+
+  // Handlers, in the order of hits()
+  static int handlerCount();
+  static const char* handlerName(int index);
+  // The bytes a handler matches at PC (-1 for an operand); returns how many
+  static int handlerPattern(int index, int16_t bytes[MAX_BYTES]);
+  uint64_t hits(int index) const { return counts[index]; }
+  void resetStats();
+
+  // "sequence hits instructions" table of the handlers used so far
+  std::string report() const;
+
+private:
+  bool enabled;
+  std::vector<uint64_t> counts;
+};
+
+#endif // HBIOS_FUSION_H
@@ -0,0 +1,158 @@
+/*
+ * HBIOS Latency - Histograms and Key Tracking
+ */
+
+#include "hbios_latency.h"
+#include <algorithm>
+#include <cstdio>
+
+// A program that never reads the console must not grow the stamp queue
+// without bound; older stamps are dropped and counted as skipped keys
+static const size_t MAX_QUEUED = 4096;
+
+void HBIOSLatencyHistogram::clear() {
+  for (uint64_t& b : buckets) b = 0;
+  count = 0;
+  total_ns = 0;
+  max_ns = 0;
+}
+
+void HBIOSLatencyHistogram::add(uint64_t ns) {
+  uint64_t us = ns / 1000;
+  int bucket = 0;
+  while (us && bucket < BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  buckets[bucket]++;
+  count++;
+  total_ns += ns;
+  if (ns > max_ns) max_ns = ns;
+}
+
+double HBIOSLatencyHistogram::percentileUs(double fraction) const {
+  if (count == 0) return 0.0;
+  uint64_t target = (uint64_t)(fraction * count + 0.5);
+  if (target < 1) target = 1;
+  uint64_t seen = 0;
+  for (int b = 0; b < BUCKETS - 1; b++) {
+    seen += buckets[b];
+    if (seen >= target) return std::min(bucketLimitUs(b), max_ns / 1e3);
+  }
+  return max_ns / 1e3;
+}
+
+HBIOSLatency::HBIOSLatency()
+  : enabled(false), skip(0), awaiting_output(false), awaiting_handoff(false) {
+}
+
+void HBIOSLatency::setEnabled(bool enable) {
+  enabled = enable;
+  clearPending();
+}
+
+void HBIOSLatency::reset() {
+  read_hist.clear();
+  output_hist.clear();
+  frontend_hist.clear();
+  clearPending();
+}
+
+void HBIOSLatency::clearPending() {
+  {
+    std::lock_guard<std::mutex> guard(queue_lock);
+    queued.clear();
+    skip = 0;
+  }
+  awaiting_output = false;
+  awaiting_handoff = false;
+}
+
+uint64_t HBIOSLatency::elapsedNs(Clock::time_point since, Clock::time_point now) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count();
+}
+
+void HBIOSLatency::keyQueued() {
+  if (!enabled) return;
+  Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> guard(queue_lock);
+  if (queued.size() == MAX_QUEUED) {
+    queued.pop_front();
+    skip++;
+  }
+  queued.push_back(now);
+}
+
+void HBIOSLatency::skipKeys(size_t count) {
+  std::lock_guard<std::mutex> guard(queue_lock);
+  skip += count;
+}
+
+void HBIOSLatency::keyRead(int ch) {
+  if (ch < 0) return;
+  Clock::time_point now = Clock::now();
+  {
+    std::lock_guard<std::mutex> guard(queue_lock);
+    if (skip > 0) {
+      skip--;
+      return;
+    }
+    if (queued.empty()) return;
+    key_time = queued.front();
+    queued.pop_front();
+  }
+  read_hist.add(elapsedNs(key_time, now));
+  // A newer key restarts the wait for output
+  awaiting_output = true;
+  awaiting_handoff = false;
+}
+
+void HBIOSLatency::outputProduced() {
+  output_hist.add(elapsedNs(key_time, Clock::now()));
+  awaiting_output = false;
+  awaiting_handoff = true;
+}
+
+void HBIOSLatency::outputHandedOff() {
+  frontend_hist.add(elapsedNs(key_time, Clock::now()));
+  awaiting_handoff = false;
+}
+
+std::string HBIOSLatency::report() const {
+  static const struct { const char* name; const HBIOSLatencyHistogram HBIOSLatency::* hist; } STAGES[] = {
+    { "read", &HBIOSLatency::read_hist },
+    { "output", &HBIOSLatency::output_hist },
+    { "frontend", &HBIOSLatency::frontend_hist },
+  };
+  char line[128];
+  snprintf(line, sizeof(line), "%-9s %8s %10s %10s %10s %10s %10s\n",
+           "stage", "count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+  std::string out = line;
+  for (const auto& stage : STAGES) {
+    const HBIOSLatencyHistogram& h = this->*stage.hist;
+    snprintf(line, sizeof(line), "%-9s %8llu %10.1f %10.0f %10.0f %10.0f %10.1f\n",
+             stage.name, (unsigned long long)h.count, h.meanUs(), h.percentileUs(0.5),
+             h.percentileUs(0.9), h.percentileUs(0.99), h.max_ns / 1e3);
+    out += line;
+  }
+  return out;
+}
+
+//=============================================================================
+// Thread Binding
+//=============================================================================
+
+static thread_local HBIOSLatency* t_latency = nullptr;
+
+void emu_latency_bind(HBIOSLatency* latency) {
+  t_latency = latency;
+}
+
+HBIOSLatency* emu_latency_bound() {
+  return t_latency;
+}
+
+void emu_latency_note_read(int ch) {
+  HBIOSLatency* latency = t_latency;
+  if (latency) latency->keyRead(ch);
+}
@@ -0,0 +1,124 @@
+/*
+ * HBIOS Latency - Keystroke to Screen Timing
+ *
+ * Each key passed to HBIOSEmulator::queueInput() is stamped with the
+ * host clock.  Three intervals are measured from that stamp:
+ *
+ *   read      the guest takes the key from the console queue (CIOIN)
+ *   output    the guest produces its first console byte after the read
+ *             (normally the echo)
+ *   frontend  that byte is handed to the frontend by flushOutput()
+ *
+ * read shows how long keys sit in the queue (batch size, sleeping while
+ * parked), output adds the guest's own handling, and frontend adds output
+ * batching.  Display itself is asynchronous on iOS (main queue) and is
+ * not included.
+ *
+ * Reads are seen through emu_latency_note_read(), which emu_io backends
+ * call after every live console read; the emulator binds its tracker to
+ * the thread for the duration of runBatch(), like the replay log.  Input
+ * queued behind the emulator's back (boot string, restored type-ahead)
+ * is skipped with skipKeys() so stamps stay lined up with their keys.
+ *
+ * keyQueued() may run on a UI thread while the emulator thread reads
+ * keys, so the stamp queue has its own lock; everything else belongs to
+ * the emulator thread.
+ */
+
+#ifndef HBIOS_LATENCY_H
+#define HBIOS_LATENCY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Power-of-two microsecond buckets: bucket 0 is under 1us, bucket b
+// holds [2^(b-1), 2^b) us, and the last bucket everything above
+struct HBIOSLatencyHistogram {
+  static const int BUCKETS = 24;  // Last bucket starts at ~4.2 s
+
+  uint64_t buckets[BUCKETS];
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+
+  HBIOSLatencyHistogram() { clear(); }
+  void clear();
+  void add(uint64_t ns);
+
+  double meanUs() const { return count ? total_ns / 1e3 / count : 0.0; }
+  // Upper bound of the bucket holding the given fraction (0-1) of
+  // samples, capped at the largest sample
+  double percentileUs(double fraction) const;
+  static double bucketLimitUs(int bucket) { return (double)(1ull << bucket); }
+};
+
+class HBIOSLatency {
+public:
+  HBIOSLatency();
+
+  void setEnabled(bool enable);
+  bool isEnabled() const { return enabled; }
+  void reset();         // Clear histograms and keys in flight
+  void clearPending();  // Forget keys in flight (queue was replaced)
+
+  // Emulator hooks
+  void keyQueued();
+  void skipKeys(size_t count);
+  void keyRead(int ch);
+  bool awaitingOutput() const { return awaiting_output; }
+  void outputProduced();
+  bool awaitingHandoff() const { return awaiting_handoff; }
+  void outputHandedOff();
+
+  const HBIOSLatencyHistogram& toRead() const { return read_hist; }
+  const HBIOSLatencyHistogram& toOutput() const { return output_hist; }
+  const HBIOSLatencyHistogram& toFrontend() const { return frontend_hist; }
+
+  // "stage count mean_us p50_us p90_us p99_us max_us" table
+  std::string report() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  static uint64_t elapsedNs(Clock::time_point since, Clock::time_point now);
+
+  std::atomic<bool> enabled;
+  std::mutex queue_lock;                 // Guards queued and skip
+  std::deque<Clock::time_point> queued;  // One stamp per key not yet read
+  size_t skip;                           // Unstamped keys ahead of the stamped ones
+  Clock::time_point key_time;            // Stamp of the last key read
+  bool awaiting_output;
+  bool awaiting_handoff;
+
+  HBIOSLatencyHistogram read_hist;
+  HBIOSLatencyHistogram output_hist;
+  HBIOSLatencyHistogram frontend_hist;
+};
+
+//=============================================================================
+// Thread Binding and Backend Hook
+//=============================================================================
+
+void emu_latency_bind(HBIOSLatency* latency);
+HBIOSLatency* emu_latency_bound();
+
+class EmuLatencyScope {
+public:
+  explicit EmuLatencyScope(HBIOSLatency* latency) : previous(emu_latency_bound()) {
+    emu_latency_bind(latency);
+  }
+  ~EmuLatencyScope() { emu_latency_bind(previous); }
+
+private:
+  HBIOSLatency* previous;
+};
+
+// Called by emu_io backends with each live emu_console_read_char() result
+void emu_latency_note_read(int ch);
+
+#endif // HBIOS_LATENCY_H
@@ -0,0 +1,99 @@
+/*
+ * HBIOS Output Matcher - Aho-Corasick Automaton Construction
+ */
+
+#include "hbios_matcher.h"
+#include <queue>
+
+HBIOSOutputMatcher::HBIOSOutputMatcher() : state(0) {
+  build();
+}
+
+int HBIOSOutputMatcher::add(const std::string& pattern) {
+  patterns.push_back(pattern);
+  build();
+  return (int)patterns.size() - 1;
+}
+
+void HBIOSOutputMatcher::remove(int id) {
+  if (id < 0 || id >= (int)patterns.size()) return;
+  patterns[id].clear();
+  build();
+}
+
+void HBIOSOutputMatcher::clear() {
+  patterns.clear();
+  build();
+}
+
+size_t HBIOSOutputMatcher::patternCount() const {
+  size_t n = 0;
+  for (const std::string& p : patterns) {
+    if (!p.empty()) n++;
+  }
+  return n;
+}
+
+// Build the trie, then fill in missing transitions breadth-first from
+// each state's failure link so the result is a complete DFA.  Output
+// sets are merged along failure links so a state reports every pattern
+// that is a suffix of the text read so far.
+void HBIOSOutputMatcher::build() {
+  std::vector<int32_t> trie(256, -1);
+  std::vector<std::vector<int>> outputs(1);
+
+  for (size_t id = 0; id < patterns.size(); id++) {
+    const std::string& p = patterns[id];
+    if (p.empty()) continue;
+    int32_t s = 0;
+    for (unsigned char c : p) {
+      int32_t& next = trie[s * 256 + c];
+      if (next < 0) {
+        next = (int32_t)outputs.size();
+        outputs.emplace_back();
+        trie.resize(trie.size() + 256, -1);
+      }
+      s = trie[s * 256 + c];
+    }
+    outputs[s].push_back((int)id);
+  }
+
+  size_t states = outputs.size();
+  std::vector<int32_t> fail(states, 0);
+  std::queue<int32_t> pending;
+
+  for (int c = 0; c < 256; c++) {
+    int32_t& next = trie[c];
+    if (next < 0) {
+      next = 0;
+    } else {
+      fail[next] = 0;
+      pending.push(next);
+    }
+  }
+  while (!pending.empty()) {
+    int32_t s = pending.front();
+    pending.pop();
+    const std::vector<int>& inherited = outputs[fail[s]];
+    outputs[s].insert(outputs[s].end(), inherited.begin(), inherited.end());
+    for (int c = 0; c < 256; c++) {
+      int32_t& next = trie[s * 256 + c];
+      if (next < 0) {
+        next = trie[fail[s] * 256 + c];
+      } else {
+        fail[next] = trie[fail[s] * 256 + c];
+        pending.push(next);
+      }
+    }
+  }
+
+  delta.swap(trie);
+  out_offset.assign(states + 1, 0);
+  out_ids.clear();
+  for (size_t s = 0; s < states; s++) {
+    out_offset[s] = (uint32_t)out_ids.size();
+    out_ids.insert(out_ids.end(), outputs[s].begin(), outputs[s].end());
+  }
+  out_offset[states] = (uint32_t)out_ids.size();
+  state = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * HBIOS Output Matcher - Multi-Pattern Search over Console Output
+ *
+ * Aho-Corasick automaton compiled to a full DFA: every state has a
+ * transition for all 256 byte values, so feeding a byte is one table
+ * lookup and the scanner never backtracks or re-reads output.  Patterns
+ * are matched across runBatch() boundaries because the current state is
+ * kept between calls.
+ *
+ * Adding or removing a pattern rebuilds the table (states x 256 ints);
+ * that is meant for a handful of prompts and error strings, not for
+ * thousands of patterns.
+ */
+
+#ifndef HBIOS_MATCHER_H
+#define HBIOS_MATCHER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class HBIOSOutputMatcher {
+public:
+  HBIOSOutputMatcher();
+
+  // Add a pattern and return its id (ids are never reused until clear())
+  int add(const std::string& pattern);
+  void remove(int id);
+  void clear();
+
+  // Forget partially matched input (patterns are kept)
+  void reset() { state = 0; }
+
+  // Advance by one output byte.  Returns true if at least one pattern
+  // ends at this byte; the ids are then in [matchBegin(), matchEnd()).
+  bool feed(uint8_t ch) {
+    state = delta[state * 256 + ch];
+    return out_offset[state] != out_offset[state + 1];
+  }
+  const int* matchBegin() const { return out_ids.data() + out_offset[state]; }
+  const int* matchEnd() const { return out_ids.data() + out_offset[state + 1]; }
+
+  size_t patternCount() const;
+
+private:
+  void build();
+
+  std::vector<std::string> patterns;  // Indexed by id; empty = removed
+
+  // Compiled DFA
+  std::vector<int32_t> delta;       // state * 256 + byte -> next state
+  std::vector<uint32_t> out_offset; // state -> range in out_ids (states + 1 entries)
+  std::vector<int> out_ids;         // Pattern ids ending at each state
+  int32_t state;
+};
+
+#endif // HBIOS_MATCHER_H
@@ -0,0 +1,91 @@
+/*
+ * HBIOS Metrics - Sequence Lock and Prometheus Output
+ */
+
+#include "hbios_metrics.h"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+HBIOSMetrics::HBIOSMetrics() : sequence(0) {
+  for (std::atomic<uint64_t>& f : fields) f.store(0, std::memory_order_relaxed);
+}
+
+void HBIOSMetrics::publish(const HBIOSMetricsSnapshot& s) {
+  uint32_t seq = sequence.load(std::memory_order_relaxed);
+  sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+#define HBIOS_METRIC_STORE(name, type, help) \
+  fields[INDEX_##name].store(s.name, std::memory_order_relaxed);
+  HBIOS_METRICS(HBIOS_METRIC_STORE)
+#undef HBIOS_METRIC_STORE
+  sequence.store(seq + 2, std::memory_order_release);
+}
+
+HBIOSMetricsSnapshot HBIOSMetrics::read() const {
+  HBIOSMetricsSnapshot s;
+  for (;;) {
+    uint32_t before = sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+#define HBIOS_METRIC_LOAD(name, type, help) \
+    s.name = fields[INDEX_##name].load(std::memory_order_relaxed);
+    HBIOS_METRICS(HBIOS_METRIC_LOAD)
+#undef HBIOS_METRIC_LOAD
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) == before) return s;
+  }
+}
+
+// Counters are exposed with the _total suffix, on the TYPE line as well
+static std::string familyName(const char* name, const char* type) {
+  std::string family = name;
+  if (!strcmp(type, "counter")) family += "_total";
+  return family;
+}
+
+static void appendFamily(std::string& out, const std::string& name, const char* type, const char* help) {
+  out += "# HELP romwbw_"; out += name; out += " "; out += help; out += "\n";
+  out += "# TYPE romwbw_"; out += name; out += " "; out += type; out += "\n";
+}
+
+static void appendSample(std::string& out, const std::string& name, const std::string& labels,
+                         const char* value) {
+  out += "romwbw_";
+  out += name;
+  if (!labels.empty()) out += "{" + labels + "}";
+  out += " ";
+  out += value;
+  out += "\n";
+}
+
+std::string hbios_metrics_prometheus(const std::vector<HBIOSMetricsSample>& samples) {
+  std::string out;
+  std::string family;
+  char value[32];
+#define HBIOS_METRIC_TEXT(name, type, help) \
+  family = familyName(#name, type); \
+  appendFamily(out, family, type, help); \
+  for (const HBIOSMetricsSample& s : samples) { \
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)s.metrics.name); \
+    appendSample(out, family, s.labels, value); \
+  }
+  HBIOS_METRICS(HBIOS_METRIC_TEXT)
+#undef HBIOS_METRIC_TEXT
+
+  appendFamily(out, "mips", "gauge", "Million guest instructions per second of execution time");
+  for (const HBIOSMetricsSample& s : samples) {
+    snprintf(value, sizeof(value), "%.3f", s.metrics.mips());
+    appendSample(out, "mips", s.labels, value);
+  }
+  return out;
+}
+
+std::string hbios_metrics_prometheus(const HBIOSMetricsSnapshot& s, const std::string& labels) {
+  HBIOSMetricsSample sample;
+  sample.labels = labels;
+  sample.metrics = s;
+  return hbios_metrics_prometheus(std::vector<HBIOSMetricsSample>(1, sample));
+}
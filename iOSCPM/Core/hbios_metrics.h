@@ -0,0 +1,88 @@
+/*
+ * HBIOS Metrics - Lock-Free Runtime Counters
+ *
+ * The emulator thread keeps plain counters and publishes them at the
+ * end of every runBatch() under a sequence lock: the sequence number is
+ * odd while a publish is in progress, and a reader retries until it sees
+ * the same even number before and after copying.  Readers on any thread
+ * therefore get a consistent snapshot without ever blocking the CPU, and
+ * the writer never waits for readers.
+ *
+ * The field list is defined once (HBIOS_METRICS) and drives the snapshot
+ * struct, the publish/read loops and the Prometheus text output.
+ *
+ * Guest time is counted in instructions; the core keeps no T-state
+ * count, so speed is reported in MIPS rather than MHz.
+ * Disk counters count DIOREAD/DIOWRITE calls as they enter HBIOS.
+ */
+
+#ifndef HBIOS_METRICS_H
+#define HBIOS_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//    field                 Prometheus type   help
+#define HBIOS_METRICS(X) \
+  X(instructions,         "counter", "Guest instructions executed") \
+  X(batches,              "counter", "runBatch() calls that executed instructions") \
+  X(batch_size,           "gauge",   "Instructions per adaptive batch") \
+  X(run_ns,               "counter", "Host nanoseconds spent executing batches") \
+  X(input_wait_ns,        "counter", "Host nanoseconds parked waiting for console input") \
+  X(input_waits,          "counter", "Times the guest blocked on console input") \
+  X(interrupts,           "counter", "Timer interrupts delivered to the guest") \
+  X(output_bytes,         "counter", "Console bytes written by the guest") \
+  X(input_bytes,          "counter", "Console bytes queued for the guest") \
+  X(disk_reads,           "counter", "HBIOS DIOREAD calls") \
+  X(disk_writes,          "counter", "HBIOS DIOWRITE calls") \
+  X(ram_banks_used,       "gauge",   "32KB RAM banks initialized by the guest") \
+  X(boot_cache_hits,      "counter", "Boots restored from the boot cache") \
+  X(boot_cache_misses,    "counter", "Boots run in full with the boot cache enabled") \
+  X(checkpoints,          "gauge",   "Rewind checkpoints held") \
+  X(checkpoint_bytes,     "gauge",   "Bytes held for checkpoints: reference copies and reverse deltas") \
+  X(running,              "gauge",   "1 while the guest is running")
+
+struct HBIOSMetricsSnapshot {
+#define HBIOS_METRIC_FIELD(name, type, help) uint64_t name = 0;
+  HBIOS_METRICS(HBIOS_METRIC_FIELD)
+#undef HBIOS_METRIC_FIELD
+
+  // Million instructions per second of host time spent executing
+  double mips() const { return run_ns ? instructions * 1000.0 / run_ns : 0.0; }
+};
+
+class HBIOSMetrics {
+public:
+  HBIOSMetrics();
+
+  // Emulator thread only
+  void publish(const HBIOSMetricsSnapshot& s);
+
+  // Any thread
+  HBIOSMetricsSnapshot read() const;
+
+private:
+#define HBIOS_METRIC_INDEX(name, type, help) INDEX_##name,
+  enum { HBIOS_METRICS(HBIOS_METRIC_INDEX) FIELD_COUNT };
+#undef HBIOS_METRIC_INDEX
+
+  std::atomic<uint32_t> sequence;
+  std::atomic<uint64_t> fields[FIELD_COUNT];
+};
+
+// One labelled snapshot in a Prometheus scrape.  labels is the inside
+// of the braces (e.g. "session=\"3\""), or empty for none.
+struct HBIOSMetricsSample {
+  std::string labels;
+  HBIOSMetricsSnapshot metrics;
+};
+
+// Prometheus text exposition: each metric's HELP and TYPE lines followed
+// by one line per sample, so several sessions form a valid scrape.
+// Counters are named romwbw_<field>_total, gauges romwbw_<field>.
+std::string hbios_metrics_prometheus(const std::vector<HBIOSMetricsSample>& samples);
+std::string hbios_metrics_prometheus(const HBIOSMetricsSnapshot& s, const std::string& labels = "");
+
+#endif // HBIOS_METRICS_H
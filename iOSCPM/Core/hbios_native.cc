@@ -0,0 +1,852 @@
+/*
+ * HBIOS Native Routines - Registry, Lookup and the Routines
+ *
+ * Each native routine follows its guest code instruction by instruction,
+ * flags included, so the registers, memory and instruction count it
+ * leaves are exactly those of the guest; it only skips decoding.
+ */
+
+#include "hbios_native.h"
+#include "emu_io.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+static const uint16_t PROGRAM_START = 0x0100;
+static const uint8_t OP_CALL = 0xCD;
+static const int FINGERPRINT_LEN = 6;  // Literal bytes hashed per signature
+static const uint32_t ADDRESS_SPACE = 0x10000;
+
+// Flag bits
+static const uint8_t FLAG_C = 0x01;
+static const uint8_t FLAG_N = 0x02;
+static const uint8_t FLAG_PV = 0x04;
+static const uint8_t FLAG_X = 0x08;  // Undocumented bit 3
+static const uint8_t FLAG_H = 0x10;
+static const uint8_t FLAG_Y = 0x20;  // Undocumented bit 5
+static const uint8_t FLAG_Z = 0x40;
+static const uint8_t FLAG_S = 0x80;
+
+//=============================================================================
+// Frame
+//=============================================================================
+
+HBIOSNativeFrame::HBIOSNativeFrame(const qkz80_reg_set& regs, qkz80_cpu_mem* mem_, uint8_t* copy_,
+                                   std::vector<uint32_t>* undo_)
+  : instructions(0), mem(mem_), copy(copy_), undo(undo_) {
+  uint16_t af = regs.AF.get_pair16();
+  a = (uint8_t)(af >> 8);
+  f = (uint8_t)af;
+  setBC(regs.BC.get_pair16());
+  setDE(regs.DE.get_pair16());
+  setHL(regs.HL.get_pair16());
+  sp = regs.SP.get_pair16();
+  pc = regs.PC.get_pair16();
+}
+
+void HBIOSNativeFrame::store(qkz80_reg_set& regs) const {
+  regs.AF.set_pair16((uint16_t)(a << 8 | f));
+  regs.BC.set_pair16(bc());
+  regs.DE.set_pair16(de());
+  regs.HL.set_pair16(hl());
+  regs.SP.set_pair16(sp);
+  regs.PC.set_pair16(pc);
+}
+
+void HBIOSNativeFrame::push(uint16_t v) {
+  sp = (uint16_t)(sp - 2);
+  write(sp, (uint8_t)v);
+  write((uint16_t)(sp + 1), (uint8_t)(v >> 8));
+}
+
+uint16_t HBIOSNativeFrame::pop() {
+  uint16_t v = (uint16_t)(read(sp) | read((uint16_t)(sp + 1)) << 8);
+  sp = (uint16_t)(sp + 2);
+  return v;
+}
+
+//=============================================================================
+// Instruction Semantics
+//=============================================================================
+
+static uint8_t szp(uint8_t v) {
+  uint8_t p = v;
+  p ^= p >> 4;
+  p ^= p >> 2;
+  p ^= p >> 1;
+  return (uint8_t)((v & (FLAG_S | FLAG_Y | FLAG_X)) | (v ? 0 : FLAG_Z) | ((p & 1) ? 0 : FLAG_PV));
+}
+
+// ADD HL,rr
+static uint16_t add16(HBIOSNativeFrame& fr, uint16_t x, uint16_t y) {
+  uint32_t r = (uint32_t)x + y;
+  fr.f = (uint8_t)((fr.f & (FLAG_S | FLAG_Z | FLAG_PV)) | ((r >> 8) & (FLAG_Y | FLAG_X)) |
+                   (((x ^ y ^ r) >> 8) & FLAG_H) | (r >> 16));
+  return (uint16_t)r;
+}
+
+// ADC HL,rr
+static uint16_t adc16(HBIOSNativeFrame& fr, uint16_t x, uint16_t y) {
+  uint32_t r = (uint32_t)x + y + (fr.f & FLAG_C);
+  uint16_t v = (uint16_t)r;
+  fr.f = (uint8_t)(((v >> 8) & (FLAG_S | FLAG_Y | FLAG_X)) | (v ? 0 : FLAG_Z) |
+                   (((x ^ y ^ r) >> 8) & FLAG_H) | ((~(x ^ y) & (x ^ r) & 0x8000) ? FLAG_PV : 0) |
+                   (r >> 16));
+  return v;
+}
+
+// SBC HL,rr
+static uint16_t sbc16(HBIOSNativeFrame& fr, uint16_t x, uint16_t y) {
+  uint32_t r = (uint32_t)x - y - (fr.f & FLAG_C);
+  uint16_t v = (uint16_t)r;
+  fr.f = (uint8_t)(((v >> 8) & (FLAG_S | FLAG_Y | FLAG_X)) | (v ? 0 : FLAG_Z) |
+                   (((x ^ y ^ r) >> 8) & FLAG_H) | (((x ^ y) & (x ^ r) & 0x8000) ? FLAG_PV : 0) |
+                   ((r >> 16) & FLAG_C) | FLAG_N);
+  return v;
+}
+
+// OR r / XOR r
+static void orA(HBIOSNativeFrame& fr, uint8_t v) {
+  fr.a |= v;
+  fr.f = szp(fr.a);
+}
+
+static void xorA(HBIOSNativeFrame& fr, uint8_t v) {
+  fr.a ^= v;
+  fr.f = szp(fr.a);
+}
+
+// CP r: bits 3 and 5 come from the operand
+static void cpA(HBIOSNativeFrame& fr, uint8_t v) {
+  unsigned r = (unsigned)fr.a - v;
+  fr.f = (uint8_t)((r & FLAG_S) | ((r & 0xFF) ? 0 : FLAG_Z) | ((fr.a ^ v ^ r) & FLAG_H) |
+                   (((fr.a ^ v) & (fr.a ^ r) & 0x80) ? FLAG_PV : 0) | ((r >> 8) & FLAG_C) | FLAG_N |
+                   (v & (FLAG_Y | FLAG_X)));
+}
+
+// DEC r
+static uint8_t dec8(HBIOSNativeFrame& fr, uint8_t v) {
+  uint8_t r = (uint8_t)(v - 1);
+  fr.f = (uint8_t)((fr.f & FLAG_C) | (r & (FLAG_S | FLAG_Y | FLAG_X)) | (r ? 0 : FLAG_Z) |
+                   ((r & 0x0F) == 0x0F ? FLAG_H : 0) | (r == 0x7F ? FLAG_PV : 0) | FLAG_N);
+  return r;
+}
+
+// SRL r / RL r
+static uint8_t srl(HBIOSNativeFrame& fr, uint8_t v) {
+  uint8_t r = (uint8_t)(v >> 1);
+  fr.f = (uint8_t)(szp(r) | (v & FLAG_C));
+  return r;
+}
+
+static uint8_t rl(HBIOSNativeFrame& fr, uint8_t v) {
+  uint8_t r = (uint8_t)(v << 1 | (fr.f & FLAG_C));
+  fr.f = (uint8_t)(szp(r) | (v >> 7));
+  return r;
+}
+
+// BIT 7,r
+static void bit7(HBIOSNativeFrame& fr, uint8_t v) {
+  fr.f = (uint8_t)((fr.f & FLAG_C) | FLAG_H | ((v & 0x80) ? FLAG_S : (FLAG_Z | FLAG_PV)) |
+                   (v & (FLAG_Y | FLAG_X)));
+}
+
+// CPL / SCF / CCF: bits 3 and 5 come from A
+static void cpl(HBIOSNativeFrame& fr) {
+  fr.a = (uint8_t)~fr.a;
+  fr.f = (uint8_t)((fr.f & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | FLAG_H | FLAG_N |
+                   (fr.a & (FLAG_Y | FLAG_X)));
+}
+
+static void scf(HBIOSNativeFrame& fr) {
+  fr.f = (uint8_t)((fr.f & (FLAG_S | FLAG_Z | FLAG_PV)) | (fr.a & (FLAG_Y | FLAG_X)) | FLAG_C);
+}
+
+static void ccf(HBIOSNativeFrame& fr) {
+  fr.f = (uint8_t)(((fr.f & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | ((fr.f & FLAG_C) ? FLAG_H : 0) |
+                    (fr.a & (FLAG_Y | FLAG_X))) ^ FLAG_C);
+}
+
+static void exDEHL(HBIOSNativeFrame& fr) {
+  std::swap(fr.d, fr.h);
+  std::swap(fr.e, fr.l);
+}
+
+// Do [a, a+alen) and [b, b+blen) share a byte of the 64KB address space?
+static bool overlaps(uint16_t a, uint32_t alen, uint16_t b, uint32_t blen) {
+  uint32_t from_a = (uint16_t)(b - a);  // Offset of b from a
+  uint32_t from_b = (uint16_t)(a - b);
+  return from_a < alen || from_b < blen;
+}
+
+// Length of the zero-terminated string at addr, or -1 if none in 64KB
+static long stringLength(const HBIOSNativeFrame& fr, uint16_t addr) {
+  for (uint32_t n = 0; n < ADDRESS_SPACE; n++) {
+    if (fr.read((uint16_t)(addr + n)) == 0) return (long)n;
+  }
+  return -1;
+}
+
+//=============================================================================
+// HI-TECH C Runtime
+//=============================================================================
+
+// amul: HL = HL * DE.  The low byte of the multiplier is done by the
+// shift-and-add loop at mult8b (entry+13h), the multiplicand is shifted
+// into place, and mult8b runs again for the high byte.
+static const uint16_t AMUL_MULT8B_RET = 0x0B;
+
+static void amulMult8b(HBIOSNativeFrame& fr) {
+  long long& n = fr.instructions;
+  for (;;) {
+    fr.a = srl(fr, fr.a);                               // SRL A
+    n += 2;                                             // JR NC
+    if (fr.f & FLAG_C) {
+      fr.setHL(add16(fr, fr.hl(), fr.de()));            // ADD HL,DE
+      n++;
+    }
+    fr.setDE(add16(fr, fr.de(), fr.de()));              // EX DE,HL / ADD HL,HL / EX DE,HL
+    n += 4;                                             // RET Z
+    if (fr.f & FLAG_Z) break;
+    n++;                                                // DJNZ
+    if (--fr.b == 0) {
+      n++;                                              // RET
+      break;
+    }
+  }
+  fr.pc = fr.pop();
+}
+
+static bool nativeAmul(HBIOSNativeFrame& fr, uint16_t entry) {
+  long long& n = fr.instructions;
+  fr.a = fr.e;                                          // LD A,E
+  fr.c = fr.d;                                          // LD C,D
+  exDEHL(fr);                                           // EX DE,HL
+  fr.setHL(0);                                          // LD HL,0
+  fr.b = 8;                                             // LD B,8
+  fr.push((uint16_t)(entry + AMUL_MULT8B_RET));         // CALL mult8b
+  n += 6;
+  amulMult8b(fr);
+  exDEHL(fr);                                           // EX DE,HL
+  n += 2;                                               // JR
+  for (;;) {
+    n++;                                                // DJNZ
+    if (--fr.b == 0) break;
+    fr.setHL(add16(fr, fr.hl(), fr.hl()));              // ADD HL,HL
+    n++;
+  }
+  exDEHL(fr);                                           // EX DE,HL
+  fr.a = fr.c;                                          // LD A,C
+  n += 2;
+  amulMult8b(fr);                                       // Falls into mult8b
+  return true;
+}
+
+// The string routines take their arguments on the stack above the return
+// address (pop bc / pop de / pop hl, pushed back unchanged)
+static void popStringArgs(HBIOSNativeFrame& fr, uint16_t* ret, uint16_t* first, uint16_t* second) {
+  *ret = fr.pop();
+  *first = fr.pop();
+  if (second) *second = fr.pop();
+}
+
+// strlen: HL = length of the string at the argument
+static bool nativeStrlen(HBIOSNativeFrame& fr, uint16_t entry) {
+  long long& n = fr.instructions;
+  uint16_t ret, s;
+  popStringArgs(fr, &ret, &s, nullptr);                 // POP HL / POP DE
+  long len = stringLength(fr, s);
+  if (len < 0) return false;
+  fr.push(s);                                           // PUSH DE
+  fr.push(ret);                                         // PUSH HL
+  n += 5;                                               // LD HL,0
+  fr.setHL((uint16_t)len);
+  fr.setDE((uint16_t)(s + len));
+  n += len * 6 + 3;                                     // LD A,(DE) / OR A / RET Z / INC HL / INC DE / JR
+  fr.a = 0;
+  fr.f = szp(0);
+  fr.pc = fr.pop();
+  return true;
+}
+
+// strcpy(dst, src): copies through the terminator, HL = dst
+static const uint16_t STRCPY_LENGTH = 0x12;
+
+static bool nativeStrcpy(HBIOSNativeFrame& fr, uint16_t entry) {
+  long long& n = fr.instructions;
+  uint16_t ret, dst, src;
+  popStringArgs(fr, &ret, &dst, &src);
+  long len = stringLength(fr, src);
+  if (len < 0) return false;
+  uint32_t bytes = (uint32_t)len + 1;
+  if (overlaps(dst, bytes, src, bytes) || overlaps(dst, bytes, entry, STRCPY_LENGTH)) return false;
+  fr.push(src);
+  fr.push(dst);
+  fr.push(ret);
+  fr.setBC(dst);                                        // LD C,E / LD B,D
+  n += 8;
+  for (uint32_t i = 0; i < bytes; i++) {
+    fr.write((uint16_t)(dst + i), fr.read((uint16_t)(src + i)));
+  }
+  n += (long long)bytes * 6;                            // LD A,(HL) / LD (DE),A / INC DE / INC HL / OR A / JR NZ
+  fr.setDE((uint16_t)(dst + bytes));
+  fr.setHL(dst);                                        // LD L,C / LD H,B
+  fr.a = 0;
+  fr.f = szp(0);
+  n += 3;                                               // RET
+  fr.pc = fr.pop();
+  return true;
+}
+
+// strcat(dst, src): appends src at the end of dst, HL = dst
+static const uint16_t STRCAT_LENGTH = 0x1B;
+
+static bool nativeStrcat(HBIOSNativeFrame& fr, uint16_t entry) {
+  long long& n = fr.instructions;
+  uint16_t ret, dst, src;
+  popStringArgs(fr, &ret, &dst, &src);
+  long dst_len = stringLength(fr, dst);
+  long src_len = stringLength(fr, src);
+  if (dst_len < 0 || src_len < 0) return false;
+  uint16_t end = (uint16_t)(dst + dst_len);
+  uint32_t bytes = (uint32_t)src_len + 1;
+  if (overlaps(end, bytes, src, bytes) || overlaps(end, bytes, entry, STRCAT_LENGTH)) return false;
+  fr.push(src);
+  fr.push(dst);
+  fr.push(ret);
+  fr.setBC(dst);                                        // LD C,E / LD B,D
+  n += 8;
+  n += dst_len * 5 + 3;                                 // LD A,(DE) / OR A / JR Z / INC DE / JR
+  for (uint32_t i = 0; i < bytes; i++) {
+    fr.write((uint16_t)(end + i), fr.read((uint16_t)(src + i)));
+  }
+  n += src_len * 7 + 4;                                 // LD A,(HL) / LD (DE),A / OR A / JR Z / INC DE / INC HL / JR
+  fr.setDE((uint16_t)(end + src_len));
+  fr.setHL(dst);                                        // LD L,C / LD H,B
+  fr.a = 0;
+  fr.f = szp(0);
+  n += 3;                                               // RET
+  fr.pc = fr.pop();
+  return true;
+}
+
+// strcmp(s1, s2): HL = 0 if equal, 1 if s1 > s2, -1 if s1 < s2
+static bool nativeStrcmp(HBIOSNativeFrame& fr, uint16_t entry) {
+  long long& n = fr.instructions;
+  uint16_t ret, s1, s2;
+  popStringArgs(fr, &ret, &s1, &s2);
+  uint32_t i = 0;
+  while (fr.read((uint16_t)(s1 + i)) == fr.read((uint16_t)(s2 + i)) && fr.read((uint16_t)(s1 + i)) != 0) {
+    if (++i == ADDRESS_SPACE) return false;
+  }
+  fr.push(s2);
+  fr.push(s1);
+  fr.push(ret);
+  fr.setBC(ret);
+  n += 6;
+  n += (long long)i * 7;                                // LD A,(DE) / CP (HL) / JR NZ / INC DE / INC HL / OR A / JR NZ
+  fr.a = fr.read((uint16_t)(s1 + i));
+  uint8_t other = fr.read((uint16_t)(s2 + i));
+  cpA(fr, other);                                       // CP (HL)
+  n += 3;
+  if (fr.a == other) {                                  // Both at the terminator
+    fr.setDE((uint16_t)(s1 + i + 1));
+    fr.f = szp(0);                                      // OR A
+    fr.setHL(0);                                        // LD HL,0
+    n += 6;                                             // INC DE / INC HL / OR A / JR NZ / LD HL,0 / RET
+  } else {
+    fr.setDE((uint16_t)(s1 + i));
+    fr.setHL(1);                                        // LD HL,1
+    n += 2;                                             // RET NC
+    if (fr.f & FLAG_C) {
+      fr.setHL(0xFFFF);                                 // DEC HL / DEC HL
+      n += 3;                                           // RET
+    }
+  }
+  fr.pc = fr.pop();
+  return true;
+}
+
+//=============================================================================
+// Turbo Pascal 3 Runtime
+//=============================================================================
+
+// Integer *, DIV and MOD.  DIV and MOD call the runtime's ABS helper
+// (bit 7,h / ret z, falling into NEG) and end in NEG for negative results.
+static const uint16_t TPDIV_ABS1_RET = 0x0B;
+static const uint16_t TPDIV_ABS2_RET = 0x0F;
+static const uint16_t TPMOD_DIV_RET = 0x03;
+static const int16_t TPMOD_DIV = -0x36;
+
+// NEG: HL = -HL, then RET
+static void tpNeg(HBIOSNativeFrame& fr) {
+  fr.a = fr.h;                                          // LD A,H
+  cpl(fr);                                              // CPL
+  fr.h = fr.a;                                          // LD H,A
+  fr.a = fr.l;                                          // LD A,L
+  cpl(fr);                                              // CPL
+  fr.l = fr.a;                                          // LD L,A
+  fr.setHL((uint16_t)(fr.hl() + 1));                    // INC HL
+  fr.instructions += 8;                                 // RET
+  fr.pc = fr.pop();
+}
+
+// ABS: HL = |HL|, then RET
+static void tpAbs(HBIOSNativeFrame& fr) {
+  bit7(fr, fr.h);                                       // BIT 7,H
+  fr.instructions += 2;                                 // RET Z
+  if (fr.f & FLAG_Z) fr.pc = fr.pop();
+  else tpNeg(fr);
+}
+
+// HL * DE
+static void tpMulBody(HBIOSNativeFrame& fr) {
+  long long& n = fr.instructions;
+  fr.setBC(fr.de());                                    // LD C,E / LD B,D
+  exDEHL(fr);                                           // EX DE,HL
+  fr.setHL(0);                                          // LD HL,0
+  fr.a = fr.d;                                          // LD A,D
+  orA(fr, fr.a);                                        // OR A
+  fr.a = 0x10;                                          // LD A,10H
+  n += 8;                                               // JR NZ
+  if (fr.f & FLAG_Z) {
+    fr.d = fr.e;                                        // LD D,E
+    fr.a = 8;                                           // LD A,8
+    n += 2;
+  }
+  do {
+    fr.setHL(add16(fr, fr.hl(), fr.hl()));              // ADD HL,HL
+    fr.setDE(add16(fr, fr.de(), fr.de()));              // EX DE,HL / ADD HL,HL / EX DE,HL
+    n += 5;                                             // JR NC
+    if (fr.f & FLAG_C) {
+      fr.setHL(add16(fr, fr.hl(), fr.bc()));            // ADD HL,BC
+      n++;
+    }
+    fr.a = dec8(fr, fr.a);                              // DEC A
+    n += 2;                                             // JR NZ
+  } while (fr.a != 0);
+  n++;                                                  // RET
+  fr.pc = fr.pop();
+}
+
+static bool nativeTpMul(HBIOSNativeFrame& fr, uint16_t entry) {
+  tpMulBody(fr);
+  return true;
+}
+
+// SQR: LD D,H / LD E,L in front of *
+static bool nativeTpSqr(HBIOSNativeFrame& fr, uint16_t entry) {
+  fr.setDE(fr.hl());
+  fr.instructions += 2;
+  tpMulBody(fr);
+  return true;
+}
+
+// DE DIV HL: HL = quotient, DE = |remainder|.  Zero divisors go to the
+// runtime error handler, which is left to the guest.
+static void tpDivBody(HBIOSNativeFrame& fr, uint16_t entry) {
+  long long& n = fr.instructions;
+  fr.a = fr.h;                                          // LD A,H
+  xorA(fr, fr.d);                                       // XOR D
+  fr.push((uint16_t)(fr.a << 8 | fr.f));                // PUSH AF
+  fr.push((uint16_t)(entry + TPDIV_ABS1_RET));          // CALL ABS
+  n += 7;                                               // And LD A,H / OR L / JP Z
+  tpAbs(fr);
+  exDEHL(fr);                                           // EX DE,HL
+  fr.push((uint16_t)(entry + TPDIV_ABS2_RET));          // CALL ABS
+  n += 2;
+  tpAbs(fr);
+  exDEHL(fr);                                           // EX DE,HL
+  fr.setBC(fr.hl());                                    // LD B,H / LD C,L
+  fr.a = 0;                                             // XOR A
+  fr.f = szp(0);
+  fr.setHL(0);                                          // LD H,A / LD L,A
+  fr.a = 0x11;                                          // LD A,11H
+  n += 7;
+  do {
+    fr.setHL(adc16(fr, fr.hl(), fr.hl()));              // ADC HL,HL
+    fr.setHL(sbc16(fr, fr.hl(), fr.bc()));              // SBC HL,BC
+    n += 3;                                             // JR NC
+    if (fr.f & FLAG_C) {
+      fr.setHL(add16(fr, fr.hl(), fr.bc()));            // ADD HL,BC
+      scf(fr);                                          // SCF
+      n += 2;
+    }
+    ccf(fr);                                            // CCF
+    fr.e = rl(fr, fr.e);                                // RL E
+    fr.d = rl(fr, fr.d);                                // RL D
+    fr.a = dec8(fr, fr.a);                              // DEC A
+    n += 5;                                             // JR NZ
+  } while (fr.a != 0);
+  exDEHL(fr);                                           // EX DE,HL
+  uint16_t af = fr.pop();                               // POP AF
+  fr.a = (uint8_t)(af >> 8);
+  fr.f = (uint8_t)af;
+  n += 3;                                               // RET P
+  if (fr.f & FLAG_S) {
+    n++;                                                // JR NEG
+    tpNeg(fr);
+  } else {
+    fr.pc = fr.pop();
+  }
+}
+
+static bool nativeTpDiv(HBIOSNativeFrame& fr, uint16_t entry) {
+  if (fr.hl() == 0) return false;
+  tpDivBody(fr, entry);
+  return true;
+}
+
+// MOD: CALL DIV / EX DE,HL, negated when the quotient is negative
+static bool nativeTpMod(HBIOSNativeFrame& fr, uint16_t entry) {
+  if (fr.hl() == 0) return false;
+  fr.push((uint16_t)(entry + TPMOD_DIV_RET));           // CALL DIV
+  fr.instructions++;
+  tpDivBody(fr, (uint16_t)(entry + TPMOD_DIV));
+  exDEHL(fr);                                           // EX DE,HL
+  bit7(fr, fr.d);                                       // BIT 7,D
+  fr.instructions += 3;                                 // RET Z
+  if (fr.f & FLAG_Z) {
+    fr.pc = fr.pop();
+  } else {
+    fr.instructions++;                                  // JR NEG
+    tpNeg(fr);
+  }
+  return true;
+}
+
+//=============================================================================
+// Registry
+//=============================================================================
+
+// Signatures are hex bytes from the entry point on, plus:
+//   ??      any byte
+//   @n      16-bit address entry+n (relocated calls and jumps)
+//   n:      continue matching at entry+n
+// n is signed hex.  Every signature needs FINGERPRINT_LEN consecutive
+// literal bytes somewhere; the first such run is its fingerprint.
+static const struct {
+  const char* name;
+  const char* signature;
+  HBIOSNativeFn fn;
+} ROUTINES[] = {
+  { "hitech.amul",
+    "7B 4A EB 21 00 00 06 08 CD @13 EB 18 01 29 10 FD EB 79 CB 3F 30 01 19 EB 29 EB C8 10 F5 C9",
+    nativeAmul },
+  { "hitech.strlen",
+    "E1 D1 D5 E5 21 00 00 1A B7 C8 23 13 18 F9",
+    nativeStrlen },
+  { "hitech.strcpy",
+    "C1 D1 E1 E5 D5 C5 4B 42 7E 12 13 23 B7 20 F9 69 60 C9",
+    nativeStrcpy },
+  { "hitech.strcat",
+    "C1 D1 E1 E5 D5 C5 4B 42 1A B7 28 03 13 18 F9 7E 12 B7 28 04 13 23 18 F7 69 60 C9",
+    nativeStrcat },
+  { "hitech.strcmp",
+    "C1 D1 E1 E5 D5 C5 1A BE 20 09 13 23 B7 20 F7 21 00 00 C9 21 01 00 D0 2B 2B C9",
+    nativeStrcmp },
+  { "tp3.mul",
+    "4B 42 EB 21 00 00 7A B7 3E 10 20 03 53 3E 08 29 EB 29 EB 30 01 09 3D 20 F6 C9",
+    nativeTpMul },
+  { "tp3.sqr",
+    "54 5D 4B 42 EB 21 00 00 7A B7 3E 10 20 03 53 3E 08 29 EB 29 EB 30 01 09 3D 20 F6 C9",
+    nativeTpSqr },
+  { "tp3.div",
+    "7C B5 CA @2F4 7C AA F5 CD @71 EB CD @71 EB 44 4D AF 67 6F 3E 11 ED 6A ED 42 30 02 09 37 3F "
+    "CB 13 CB 12 3D 20 F0 EB F1 F0 18 48 "
+    "71: CB 7C C8 7C 2F 67 7D 2F 6F 23 C9",
+    nativeTpDiv },
+  { "tp3.mod",
+    "CD @-36 EB CB 7A C8 18 35 "
+    "-36: 7C B5 CA @2BE 7C AA F5 CD @3B EB CD @3B EB 44 4D AF 67 6F 3E 11 ED 6A ED 42 30 02 09 37 3F "
+    "CB 13 CB 12 3D 20 F0 EB F1 F0 18 48 "
+    "3B: CB 7C C8 7C 2F 67 7D 2F 6F 23 C9",
+    nativeTpMod },
+};
+static const int ROUTINE_COUNT = (int)(sizeof(ROUTINES) / sizeof(ROUTINES[0]));
+
+namespace {
+
+struct SignatureByte {
+  int16_t offset;  // From the entry point
+  enum Kind : uint8_t { LITERAL, ANY, ADDRESS_LOW, ADDRESS_HIGH } kind;
+  uint8_t value;
+  int16_t delta;   // ADDRESS_*: expected address is entry+delta
+};
+
+struct Signature {
+  std::vector<SignatureByte> bytes;
+  int16_t fingerprint_offset;
+  uint32_t fingerprint;
+};
+
+}  // namespace
+
+static uint32_t fingerprintHash(const uint8_t* bytes) {
+  uint32_t h = 0x811C9DC5;  // FNV-1a
+  for (int i = 0; i < FINGERPRINT_LEN; i++) {
+    h = (h ^ bytes[i]) * 0x01000193;
+  }
+  return h;
+}
+
+static Signature parseSignature(const char* text) {
+  Signature sig;
+  int offset = 0;
+  const char* p = text;
+  while (*p) {
+    while (*p == ' ') p++;
+    if (!*p) break;
+    const char* start = p;
+    while (*p && *p != ' ') p++;
+    std::string token(start, p);
+    if (token == "??") {
+      sig.bytes.push_back({ (int16_t)offset++, SignatureByte::ANY, 0, 0 });
+    } else if (token[0] == '@') {
+      int16_t delta = (int16_t)strtol(token.c_str() + 1, nullptr, 16);
+      sig.bytes.push_back({ (int16_t)offset++, SignatureByte::ADDRESS_LOW, 0, delta });
+      sig.bytes.push_back({ (int16_t)offset++, SignatureByte::ADDRESS_HIGH, 0, delta });
+    } else if (token.back() == ':') {
+      offset = (int)strtol(token.c_str(), nullptr, 16);
+    } else {
+      sig.bytes.push_back({ (int16_t)offset++, SignatureByte::LITERAL, (uint8_t)strtol(token.c_str(), nullptr, 16), 0 });
+    }
+  }
+
+  sig.fingerprint_offset = 0;
+  sig.fingerprint = 0;
+  for (size_t i = 0; i + FINGERPRINT_LEN <= sig.bytes.size(); i++) {
+    uint8_t run[FINGERPRINT_LEN];
+    int k = 0;
+    for (; k < FINGERPRINT_LEN; k++) {
+      const SignatureByte& b = sig.bytes[i + k];
+      if (b.kind != SignatureByte::LITERAL || b.offset != sig.bytes[i].offset + k) break;
+      run[k] = b.value;
+    }
+    if (k == FINGERPRINT_LEN) {
+      sig.fingerprint_offset = sig.bytes[i].offset;
+      sig.fingerprint = fingerprintHash(run);
+      break;
+    }
+  }
+  return sig;
+}
+
+static const std::vector<Signature>& signatures() {
+  static const std::vector<Signature> parsed = [] {
+    std::vector<Signature> v;
+    for (int i = 0; i < ROUTINE_COUNT; i++) v.push_back(parseSignature(ROUTINES[i].signature));
+    return v;
+  }();
+  return parsed;
+}
+
+// Fingerprint offsets in use, so a target is hashed once per offset
+static const std::vector<int16_t>& fingerprintOffsets() {
+  static const std::vector<int16_t> offsets = [] {
+    std::vector<int16_t> v;
+    for (const Signature& s : signatures()) {
+      if (std::find(v.begin(), v.end(), s.fingerprint_offset) == v.end()) v.push_back(s.fingerprint_offset);
+    }
+    return v;
+  }();
+  return offsets;
+}
+
+static bool matches(const Signature& sig, uint16_t entry, qkz80_cpu_mem& mem) {
+  for (const SignatureByte& b : sig.bytes) {
+    uint8_t v = mem.fetch_mem((uint16_t)(entry + b.offset));
+    uint16_t address = (uint16_t)(entry + b.delta);
+    switch (b.kind) {
+    case SignatureByte::LITERAL:
+      if (v != b.value) return false;
+      break;
+    case SignatureByte::ADDRESS_LOW:
+      if (v != (uint8_t)address) return false;
+      break;
+    case SignatureByte::ADDRESS_HIGH:
+      if (v != (uint8_t)(address >> 8)) return false;
+      break;
+    case SignatureByte::ANY:
+      break;
+    }
+  }
+  return true;
+}
+
+int HBIOSNative::routineCount() {
+  return ROUTINE_COUNT;
+}
+
+const char* HBIOSNative::routineName(int index) {
+  return index >= 0 && index < ROUTINE_COUNT ? ROUTINES[index].name : "";
+}
+
+//=============================================================================
+// HBIOSNative
+//=============================================================================
+
+HBIOSNative::HBIOSNative()
+  : current_mode(OFF), stats(ROUTINE_COUNT), pending_active(false), pending_routine(-1),
+    pending_ret(0), pending_sp(0), pending_instructions(0), guest_instructions(0) {
+  clearCache();
+  resetStats();
+}
+
+void HBIOSNative::setMode(Mode mode) {
+  current_mode = mode;
+  pending_active = false;
+  if (mode == VERIFY) pending_mem.resize(ADDRESS_SPACE);
+  else pending_mem.clear();
+  clearCache();
+}
+
+void HBIOSNative::resetStats() {
+  for (HBIOSNativeStat& s : stats) s = HBIOSNativeStat();
+}
+
+void HBIOSNative::clearCache() {
+  for (CacheEntry& c : cache) c = { 0, -2, 0 };
+}
+
+long long HBIOSNative::trap(qkz80_reg_set& regs, qkz80_cpu_mem& mem, long long budget) {
+  uint16_t pc = regs.PC.get_pair16();
+  if (pending_active) {
+    guest_instructions++;
+    if (pc == pending_ret && regs.SP.get_pair16() == pending_sp) endVerify(regs, mem);
+    return 0;
+  }
+  if (pc == PROGRAM_START) clearCache();
+  if (mem.fetch_mem(pc) != OP_CALL) return 0;
+  if (current_mode == ON && budget < 2) return 0;  // Not even CALL and RET fit
+
+  uint16_t target = (uint16_t)(mem.fetch_mem((uint16_t)(pc + 1)) | mem.fetch_mem((uint16_t)(pc + 2)) << 8);
+  int routine = lookup(target, mem);
+  if (routine < 0) return 0;
+  stats[routine].calls++;
+  if (current_mode == VERIFY) {
+    beginVerify(routine, pc, target, regs, mem);
+    return 0;
+  }
+  return run(routine, pc, target, budget, regs, mem);
+}
+
+int HBIOSNative::lookup(uint16_t target, qkz80_cpu_mem& mem) {
+  CacheEntry& c = cache[target % CACHE_SIZE];
+  uint8_t first = mem.fetch_mem(target);
+  if (c.routine == -2 || c.target != target || c.first != first) {
+    c.target = target;
+    c.first = first;
+    c.routine = -1;
+    const std::vector<Signature>& sigs = signatures();
+    for (int16_t offset : fingerprintOffsets()) {
+      uint8_t head[FINGERPRINT_LEN];
+      for (int i = 0; i < FINGERPRINT_LEN; i++) head[i] = mem.fetch_mem((uint16_t)(target + offset + i));
+      uint32_t hash = fingerprintHash(head);
+      for (int r = 0; r < ROUTINE_COUNT && c.routine < 0; r++) {
+        if (sigs[r].fingerprint_offset == offset && sigs[r].fingerprint == hash && matches(sigs[r], target, mem)) {
+          c.routine = (int16_t)r;
+        }
+      }
+      if (c.routine >= 0) break;
+    }
+    return c.routine;
+  }
+  // Code may have been loaded over a known routine since
+  if (c.routine >= 0 && !matches(signatures()[c.routine], target, mem)) c.routine = -1;
+  return c.routine;
+}
+
+long long HBIOSNative::run(int routine, uint16_t site, uint16_t target, long long budget, qkz80_reg_set& regs,
+                           qkz80_cpu_mem& mem) {
+  undo.clear();
+  HBIOSNativeFrame fr(regs, &mem, nullptr, &undo);
+  fr.push((uint16_t)(site + 3));
+  fr.pc = target;
+  fr.instructions = 1;
+  // Declined, or longer than the batch allows: every write, the CALL's
+  // own push included, is put back in reverse order
+  if (!ROUTINES[routine].fn(fr, target) || fr.instructions > budget) {
+    for (size_t n = undo.size(); n-- > 0;) mem.store_mem((uint16_t)(undo[n] >> 8), (uint8_t)undo[n]);
+    stats[routine].declined++;
+    return 0;
+  }
+  fr.store(regs);
+  stats[routine].native++;
+  stats[routine].instructions += (uint64_t)fr.instructions;
+  return fr.instructions;
+}
+
+void HBIOSNative::beginVerify(int routine, uint16_t site, uint16_t target, const qkz80_reg_set& regs,
+                              qkz80_cpu_mem& mem) {
+  for (uint32_t a = 0; a < ADDRESS_SPACE; a++) pending_mem[a] = mem.fetch_mem((uint16_t)a);
+  HBIOSNativeFrame fr(regs, nullptr, pending_mem.data());
+  fr.push((uint16_t)(site + 3));
+  fr.pc = target;
+  fr.instructions = 1;
+  if (!ROUTINES[routine].fn(fr, target)) {
+    stats[routine].declined++;
+    return;
+  }
+  pending_regs = regs;
+  fr.store(pending_regs);
+  pending_active = true;
+  pending_routine = routine;
+  pending_ret = (uint16_t)(site + 3);
+  pending_sp = regs.SP.get_pair16();
+  pending_instructions = fr.instructions;
+  guest_instructions = 0;
+}
+
+void HBIOSNative::endVerify(const qkz80_reg_set& regs, qkz80_cpu_mem& mem) {
+  pending_active = false;
+  const char* name = ROUTINES[pending_routine].name;
+  char what[64] = "";
+  static const struct {
+    const char* name;
+    qkz80_reg_pair qkz80_reg_set::*pair;
+  } PAIRS[] = {
+    { "AF", &qkz80_reg_set::AF }, { "BC", &qkz80_reg_set::BC }, { "DE", &qkz80_reg_set::DE },
+    { "HL", &qkz80_reg_set::HL }, { "SP", &qkz80_reg_set::SP },
+  };
+  for (const auto& p : PAIRS) {
+    uint16_t guest = (regs.*p.pair).get_pair16();
+    uint16_t native = (pending_regs.*p.pair).get_pair16();
+    if (guest != native) {
+      snprintf(what, sizeof(what), "%s=%04X, native %04X", p.name, guest, native);
+      break;
+    }
+  }
+  if (!what[0] && guest_instructions != pending_instructions) {
+    snprintf(what, sizeof(what), "%lld instructions, native %lld", guest_instructions, pending_instructions);
+  }
+  for (uint32_t a = 0; !what[0] && a < ADDRESS_SPACE; a++) {
+    uint8_t guest = mem.fetch_mem((uint16_t)a);
+    if (guest != pending_mem[a]) {
+      snprintf(what, sizeof(what), "(%04X)=%02X, native %02X", a, guest, pending_mem[a]);
+    }
+  }
+  if (what[0]) {
+    stats[pending_routine].mismatches++;
+    emu_error("[NATIVE] %s returning to %04X: %s\n", name, pending_ret, what);
+  } else {
+    stats[pending_routine].verified++;
+  }
+}
+
+std::string HBIOSNative::report() const {
+  char line[128];
+  snprintf(line, sizeof(line), "%-14s %10s %10s %8s %10s %10s %14s\n",
+           "routine", "calls", "native", "declined", "verified", "mismatches", "instructions");
+  std::string out = line;
+  for (int r = 0; r < ROUTINE_COUNT; r++) {
+    const HBIOSNativeStat& s = stats[r];
+    if (s.calls == 0) continue;
+    snprintf(line, sizeof(line), "%-14s %10llu %10llu %8llu %10llu %10llu %14llu\n", ROUTINES[r].name,
+             (unsigned long long)s.calls, (unsigned long long)s.native, (unsigned long long)s.declined,
+             (unsigned long long)s.verified, (unsigned long long)s.mismatches,
+             (unsigned long long)s.instructions);
+    out += line;
+  }
+  return out;
+}
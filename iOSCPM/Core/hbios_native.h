@@ -0,0 +1,154 @@
+/*
+ * HBIOS Native Routines - Recognized Guest Library Code Run on the Host
+ *
+ * Compiled CP/M programs spend much of their time in a handful of runtime
+ * library routines (integer multiply and divide, string copies).  Each of
+ * those routines is the same sequence of bytes in every program built
+ * with the same compiler, so it can be recognized where it is called and
+ * run as C++ instead of being interpreted.
+ *
+ * While enabled, every CALL nnnn is looked at before it executes.  The
+ * first bytes at the target are hashed and compared with the registry's
+ * fingerprints; a hit is confirmed against the routine's full signature
+ * (relocated addresses included) and the routine then runs natively,
+ * CALL to RET.  A native routine reproduces the guest's results exactly:
+ * AF, BC, DE, HL and SP, every byte of memory it writes (stack residue
+ * included), and the number of instructions the guest would have
+ * executed, so instruction-driven timers and clocks do not drift.
+ * Routines that touch any other register are not in the registry.  An
+ * input the native code does not handle (divide by zero, overlapping
+ * copies, a string with no terminator) runs the guest routine instead.
+ *
+ * VERIFY runs both: the native result is computed on a copy of memory,
+ * the guest routine then runs for real, and when it returns the two are
+ * compared.  A mismatch is logged and counted; the guest's result is the
+ * one kept, so verification never changes what the program sees.  A
+ * verification interrupted by a timer tick is dropped.
+ *
+ * Targets are cached per address and the cache is cleared whenever a
+ * program starts at 0100h.
+ */
+
+#ifndef HBIOS_NATIVE_H
+#define HBIOS_NATIVE_H
+
+#include "qkz80.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Guest state a native routine works on.  Memory goes to the emulator in
+// ON mode and to a private copy of the 64KB address space in VERIFY mode.
+// In ON mode each write first records (address << 8 | old byte) in undo,
+// so a call can be taken back.
+class HBIOSNativeFrame {
+public:
+  uint8_t a, f, b, c, d, e, h, l;
+  uint16_t sp, pc;
+  long long instructions;  // Guest instructions replaced so far
+
+  HBIOSNativeFrame(const qkz80_reg_set& regs, qkz80_cpu_mem* mem, uint8_t* copy,
+                   std::vector<uint32_t>* undo = nullptr);
+  void store(qkz80_reg_set& regs) const;
+
+  uint8_t read(uint16_t addr) const { return copy ? copy[addr] : mem->fetch_mem(addr); }
+  void write(uint16_t addr, uint8_t value) {
+    if (copy) {
+      copy[addr] = value;
+      return;
+    }
+    if (undo) undo->push_back((uint32_t)addr << 8 | mem->fetch_mem(addr));
+    mem->store_mem(addr, value);
+  }
+
+  uint16_t bc() const { return (uint16_t)(b << 8 | c); }
+  uint16_t de() const { return (uint16_t)(d << 8 | e); }
+  uint16_t hl() const { return (uint16_t)(h << 8 | l); }
+  void setBC(uint16_t v) { b = (uint8_t)(v >> 8); c = (uint8_t)v; }
+  void setDE(uint16_t v) { d = (uint8_t)(v >> 8); e = (uint8_t)v; }
+  void setHL(uint16_t v) { h = (uint8_t)(v >> 8); l = (uint8_t)v; }
+
+  void push(uint16_t v);
+  uint16_t pop();
+
+private:
+  qkz80_cpu_mem* mem;
+  uint8_t* copy;
+  std::vector<uint32_t>* undo;
+};
+
+// Runs one recognized routine from its entry (return address already
+// pushed) through its final RET.  Returns false, before writing any
+// memory, to leave the call to the guest.
+typedef bool (*HBIOSNativeFn)(HBIOSNativeFrame& fr, uint16_t entry);
+
+struct HBIOSNativeStat {
+  uint64_t calls;       // Recognized calls
+  uint64_t native;      // Run natively (ON)
+  uint64_t declined;    // Left to the guest by the routine, or over the budget
+  uint64_t verified;    // VERIFY: native and guest agreed
+  uint64_t mismatches;  // VERIFY: they did not
+  uint64_t instructions;  // Guest instructions replaced (ON)
+};
+
+class HBIOSNative {
+public:
+  enum Mode { OFF, ON, VERIFY };
+
+  HBIOSNative();
+
+  void setMode(Mode mode);
+  Mode mode() const { return current_mode; }
+
+  // Called before every instruction while the mode is not OFF.  Returns
+  // the number of guest instructions run natively, at most budget, or 0
+  // to execute the instruction at PC as usual.  A routine that would
+  // stand for more than budget instructions is undone and left to the
+  // guest, so a batch (and a timer tick at its end) is never overrun.
+  long long trap(qkz80_reg_set& regs, qkz80_cpu_mem& mem, long long budget);
+
+  // An interrupt was accepted; a verification in progress is dropped
+  void interrupted() { pending_active = false; }
+
+  // Registry, in the order of stat()
+  static int routineCount();
+  static const char* routineName(int index);
+  const HBIOSNativeStat& stat(int index) const { return stats[index]; }
+  void resetStats();
+
+  // "name calls native declined verified mismatches" table of the
+  // routines seen so far
+  std::string report() const;
+
+private:
+  struct CacheEntry {
+    uint16_t target;
+    int16_t routine;  // Registry index, -1 = none, -2 = empty slot
+    uint8_t first;    // Byte at target when the entry was made
+  };
+  static const int CACHE_SIZE = 256;
+
+  int lookup(uint16_t target, qkz80_cpu_mem& mem);
+  long long run(int routine, uint16_t site, uint16_t target, long long budget, qkz80_reg_set& regs,
+                qkz80_cpu_mem& mem);
+  void beginVerify(int routine, uint16_t site, uint16_t target, const qkz80_reg_set& regs, qkz80_cpu_mem& mem);
+  void endVerify(const qkz80_reg_set& regs, qkz80_cpu_mem& mem);
+  void clearCache();
+
+  Mode current_mode;
+  CacheEntry cache[CACHE_SIZE];
+  std::vector<HBIOSNativeStat> stats;
+
+  // VERIFY: native result waiting for the guest routine to return
+  bool pending_active;
+  int pending_routine;
+  uint16_t pending_ret;     // Return address and stack pointer after RET
+  uint16_t pending_sp;
+  long long pending_instructions;
+  qkz80_reg_set pending_regs;
+  std::vector<uint32_t> undo;        // ON: writes of the call being run
+  std::vector<uint8_t> pending_mem;  // 64KB, native result
+  long long guest_instructions;      // Counted while the guest runs it
+};
+
+#endif // HBIOS_NATIVE_H
@@ -0,0 +1,349 @@
+/*
+ * HBIOS Opcodes - Z80 Instruction Metadata
+ *
+ * One entry per opcode under every prefix (none, CB, ED, DD, FD, DD CB,
+ * FD CB): mnemonic, length, T-states, operand kinds and what the
+ * instruction does to the flow of control.  The tables are generated at
+ * compile time from the structure of the opcode map (x/y/z/p/q fields of
+ * the opcode byte), so lengths and timings are written down once, here,
+ * for every decoder in the core.
+ *
+ * Mnemonics use placeholders for operands: n (byte), nn (word), e
+ * (relative jump target) and d (index displacement).  Undocumented
+ * instructions are included: IXH/IXL/IYH/IYL forms, SLL, the register
+ * copies of DD CB rotates and bit changes, IN (C) and OUT (C),0.  Invalid
+ * ED opcodes are the 8 T-state NOP the CPU runs, and a DD or FD followed
+ * by another prefix is a 4 T-state NOP of one byte.
+ *
+ * T-states are for the Z80 itself, without wait states.  Conditional
+ * jumps, calls and returns have a second timing for the taken case;
+ * repeating block instructions (LDIR, CPIR, ...) have it for every pass
+ * that repeats.
+ */
+
+#ifndef HBIOS_OPCODES_H
+#define HBIOS_OPCODES_H
+
+#include <cstdint>
+#include <initializer_list>
+
+enum Z80Prefix {
+  Z80_BASE, Z80_CB, Z80_ED, Z80_DD, Z80_FD, Z80_DDCB, Z80_FDCB,
+  Z80_PREFIX_COUNT
+};
+
+// Operand kinds, in the order their bytes follow the opcode
+enum : uint8_t {
+  Z80_OPD_DISP = 0x01,   // d, index displacement (DD CB: before the opcode)
+  Z80_OPD_IMM8 = 0x02,   // n, also the port of IN A,(n) / OUT (n),A
+  Z80_OPD_IMM16 = 0x04,  // nn, value or address
+  Z80_OPD_REL8 = 0x08,   // e, relative jump
+};
+
+enum Z80Flow : uint8_t {
+  Z80_FLOW_NONE,
+  Z80_FLOW_JUMP,    // JP, JR, DJNZ, JP (HL)
+  Z80_FLOW_CALL,    // CALL
+  Z80_FLOW_RST,     // RST
+  Z80_FLOW_RET,     // RET, RETI, RETN
+  Z80_FLOW_REPEAT,  // LDIR and the other repeating block instructions
+  Z80_FLOW_HALT,
+};
+
+struct Z80OpInfo {
+  char mnemonic[16];
+  uint8_t length;         // Bytes, prefixes and operands included
+  uint8_t tstates;        // Not taken, or the only timing
+  uint8_t tstates_taken;  // Condition met or block instruction repeating
+  uint8_t operands;       // Z80_OPD_* flags
+  uint8_t flow;           // Z80Flow
+  bool conditional;       // Flow depends on a condition (or BC/B for DJNZ and repeats)
+};
+
+struct Z80OpTable {
+  Z80OpInfo op[256];
+};
+
+namespace z80_opcodes_detail {
+
+constexpr const char* REGS[] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+constexpr const char* PAIRS[] = { "BC", "DE", "HL", "SP" };
+constexpr const char* PAIRS_AF[] = { "BC", "DE", "HL", "AF" };
+constexpr const char* CONDITIONS[] = { "NZ", "Z", "NC", "C", "PO", "PE", "P", "M" };
+constexpr const char* ALU[] = { "ADD A,", "ADC A,", "SUB ", "SBC A,", "AND ", "XOR ", "OR ", "CP " };
+constexpr const char* ROTATES[] = { "RLC", "RRC", "RL", "RR", "SLA", "SRA", "SLL", "SRL" };
+constexpr const char* DIGITS[] = { "0", "1", "2", "3", "4", "5", "6", "7" };
+constexpr const char* IM_MODES[] = { "0", "0", "1", "2", "0", "0", "1", "2" };
+constexpr const char* BLOCK[4][4] = {
+  { "LDI", "CPI", "INI", "OUTI" },
+  { "LDD", "CPD", "IND", "OUTD" },
+  { "LDIR", "CPIR", "INIR", "OTIR" },
+  { "LDDR", "CPDR", "INDR", "OTDR" },
+};
+
+// Index register names; 0 = HL (no prefix), 1 = IX, 2 = IY
+constexpr const char* INDEX_PAIR[] = { "HL", "IX", "IY" };
+constexpr const char* INDEX_HIGH[] = { "H", "IXH", "IYH" };
+constexpr const char* INDEX_LOW[] = { "L", "IXL", "IYL" };
+constexpr const char* INDEX_MEM[] = { "(HL)", "(IX+d)", "(IY+d)" };
+
+constexpr Z80OpInfo make(uint8_t tstates, uint8_t operands, const char* a, const char* b = "",
+                         const char* c = "", const char* d = "", const char* e = "", const char* f = "") {
+  Z80OpInfo info{};
+  int n = 0;
+  for (const char* part : { a, b, c, d, e, f }) {
+    for (; *part && n < (int)sizeof(info.mnemonic) - 1; part++) info.mnemonic[n++] = *part;
+  }
+  info.mnemonic[n] = 0;
+  info.length = (uint8_t)(1 + ((operands & Z80_OPD_DISP) ? 1 : 0) + ((operands & Z80_OPD_IMM8) ? 1 : 0) +
+                          ((operands & Z80_OPD_IMM16) ? 2 : 0) + ((operands & Z80_OPD_REL8) ? 1 : 0));
+  info.tstates = info.tstates_taken = tstates;
+  info.operands = operands;
+  info.flow = Z80_FLOW_NONE;
+  info.conditional = false;
+  return info;
+}
+
+constexpr Z80OpInfo flow(Z80OpInfo info, Z80Flow kind) {
+  info.flow = kind;
+  return info;
+}
+
+constexpr Z80OpInfo conditional(Z80OpInfo info, Z80Flow kind, uint8_t tstates_taken) {
+  info.flow = kind;
+  info.conditional = true;
+  info.tstates_taken = tstates_taken;
+  return info;
+}
+
+// Instructions whose (HL) operand becomes (IX+d) under a DD/FD prefix
+constexpr bool usesIndirectHL(int op) {
+  if (op == 0x34 || op == 0x35 || op == 0x36) return true;
+  if (op == 0x76) return false;  // HALT
+  if ((op & 0xC0) == 0x40) return (op & 0x07) == 6 || (op & 0x38) == 0x30;
+  return (op & 0xC0) == 0x80 && (op & 0x07) == 6;
+}
+
+// Register r of an instruction; H and L only become IXH/IXL when the
+// instruction has no (IX+d) operand
+constexpr const char* reg(int r, int index, bool indirect) {
+  if (r == 4) return indirect ? "H" : INDEX_HIGH[index];
+  if (r == 5) return indirect ? "L" : INDEX_LOW[index];
+  if (r == 6) return INDEX_MEM[index];
+  return REGS[r];
+}
+
+constexpr const char* pair(int p, int index) {
+  return p == 2 ? INDEX_PAIR[index] : PAIRS[p];
+}
+
+constexpr const char* pairAF(int p, int index) {
+  return p == 2 ? INDEX_PAIR[index] : PAIRS_AF[p];
+}
+
+// Unprefixed opcode, or the instruction a DD/FD prefix (index 1/2)
+// applies to.  Timings are for the unprefixed form.
+constexpr Z80OpInfo baseOp(int op, int index) {
+  int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+  bool ind = index != 0 && usesIndirectHL(op);
+  uint8_t disp = ind ? Z80_OPD_DISP : 0;
+  const char* hl = INDEX_PAIR[index];
+
+  if (x == 0) {
+    switch (z) {
+      case 0:
+        if (y == 0) return make(4, 0, "NOP");
+        if (y == 1) return make(4, 0, "EX AF,AF'");
+        if (y == 2) return conditional(make(8, Z80_OPD_REL8, "DJNZ e"), Z80_FLOW_JUMP, 13);
+        if (y == 3) return flow(make(12, Z80_OPD_REL8, "JR e"), Z80_FLOW_JUMP);
+        return conditional(make(7, Z80_OPD_REL8, "JR ", CONDITIONS[y - 4], ",e"), Z80_FLOW_JUMP, 12);
+      case 1:
+        if (q == 0) return make(10, Z80_OPD_IMM16, "LD ", pair(p, index), ",nn");
+        return make(11, 0, "ADD ", hl, ",", pair(p, index));
+      case 2:
+        switch (y) {
+          case 0: return make(7, 0, "LD (BC),A");
+          case 1: return make(7, 0, "LD A,(BC)");
+          case 2: return make(7, 0, "LD (DE),A");
+          case 3: return make(7, 0, "LD A,(DE)");
+          case 4: return make(16, Z80_OPD_IMM16, "LD (nn),", hl);
+          case 5: return make(16, Z80_OPD_IMM16, "LD ", hl, ",(nn)");
+          case 6: return make(13, Z80_OPD_IMM16, "LD (nn),A");
+          default: return make(13, Z80_OPD_IMM16, "LD A,(nn)");
+        }
+      case 3:
+        return make(6, 0, q ? "DEC " : "INC ", pair(p, index));
+      case 4:
+      case 5:
+        return make(y == 6 ? 11 : 4, disp, z == 4 ? "INC " : "DEC ", reg(y, index, ind));
+      case 6:
+        return make(y == 6 ? 10 : 7, (uint8_t)(disp | Z80_OPD_IMM8), "LD ", reg(y, index, ind), ",n");
+      default: {
+        constexpr const char* names[] = { "RLCA", "RRCA", "RLA", "RRA", "DAA", "CPL", "SCF", "CCF" };
+        return make(4, 0, names[y]);
+      }
+    }
+  }
+  if (x == 1) {
+    if (op == 0x76) return flow(make(4, 0, "HALT"), Z80_FLOW_HALT);
+    return make(y == 6 || z == 6 ? 7 : 4, disp, "LD ", reg(y, index, ind), ",", reg(z, index, ind));
+  }
+  if (x == 2) return make(z == 6 ? 7 : 4, disp, ALU[y], reg(z, index, ind));
+
+  switch (z) {
+    case 0:
+      return conditional(make(5, 0, "RET ", CONDITIONS[y]), Z80_FLOW_RET, 11);
+    case 1:
+      if (q == 0) return make(10, 0, "POP ", pairAF(p, index));
+      if (p == 0) return flow(make(10, 0, "RET"), Z80_FLOW_RET);
+      if (p == 1) return make(4, 0, "EXX");
+      if (p == 2) return flow(make(4, 0, "JP (", hl, ")"), Z80_FLOW_JUMP);
+      return make(6, 0, "LD SP,", hl);
+    case 2:
+      return conditional(make(10, Z80_OPD_IMM16, "JP ", CONDITIONS[y], ",nn"), Z80_FLOW_JUMP, 10);
+    case 3:
+      switch (y) {
+        case 0: return flow(make(10, Z80_OPD_IMM16, "JP nn"), Z80_FLOW_JUMP);
+        case 1: return make(4, 0, "");  // CB prefix
+        case 2: return make(11, Z80_OPD_IMM8, "OUT (n),A");
+        case 3: return make(11, Z80_OPD_IMM8, "IN A,(n)");
+        case 4: return make(19, 0, "EX (SP),", hl);
+        case 5: return make(4, 0, "EX DE,HL");
+        case 6: return make(4, 0, "DI");
+        default: return make(4, 0, "EI");
+      }
+    case 4:
+      return conditional(make(10, Z80_OPD_IMM16, "CALL ", CONDITIONS[y], ",nn"), Z80_FLOW_CALL, 17);
+    case 5:
+      if (q == 0) return make(11, 0, "PUSH ", pairAF(p, index));
+      if (p == 0) return flow(make(17, Z80_OPD_IMM16, "CALL nn"), Z80_FLOW_CALL);
+      return make(4, 0, "");  // DD, ED, FD prefixes
+    case 6:
+      return make(7, Z80_OPD_IMM8, ALU[y], "n");
+    default:
+      return flow(make(11, 0, "RST ", y < 2 ? "0" : y < 4 ? "1" : y < 6 ? "2" : "3",
+                       (y & 1) ? "8H" : "0H"), Z80_FLOW_RST);
+  }
+}
+
+constexpr Z80OpInfo cbOp(int op) {
+  int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+  if (x == 0) return make(z == 6 ? 15 : 8, 0, ROTATES[y], " ", REGS[z]);
+  if (x == 1) return make(z == 6 ? 12 : 8, 0, "BIT ", DIGITS[y], ",", REGS[z]);
+  return make(z == 6 ? 15 : 8, 0, x == 2 ? "RES " : "SET ", DIGITS[y], ",", REGS[z]);
+}
+
+constexpr Z80OpInfo edOp(int op) {
+  int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+  if (x == 2 && y >= 4 && z <= 3) {
+    Z80OpInfo info = make(16, 0, BLOCK[y - 4][z]);
+    return y >= 6 ? conditional(info, Z80_FLOW_REPEAT, 21) : info;
+  }
+  if (x != 1) return make(8, 0, "NOP");
+  switch (z) {
+    case 0: return y == 6 ? make(12, 0, "IN (C)") : make(12, 0, "IN ", REGS[y], ",(C)");
+    case 1: return y == 6 ? make(12, 0, "OUT (C),0") : make(12, 0, "OUT (C),", REGS[y]);
+    case 2: return make(15, 0, q ? "ADC HL," : "SBC HL,", PAIRS[p]);
+    case 3:
+      if (q == 0) return make(20, Z80_OPD_IMM16, "LD (nn),", PAIRS[p]);
+      return make(20, Z80_OPD_IMM16, "LD ", PAIRS[p], ",(nn)");
+    case 4: return make(8, 0, "NEG");
+    case 5: return flow(make(14, 0, y == 1 ? "RETI" : "RETN"), Z80_FLOW_RET);
+    case 6: return make(8, 0, "IM ", IM_MODES[y]);
+    default: {
+      constexpr const char* names[] = { "LD I,A", "LD R,A", "LD A,I", "LD A,R", "RRD", "RLD", "NOP", "NOP" };
+      constexpr uint8_t tstates[] = { 9, 9, 9, 9, 18, 18, 8, 8 };
+      return make(tstates[y], 0, names[y]);
+    }
+  }
+}
+
+// DD/FD + op: 4 T-states for the prefix, more for (IX+d) operands
+constexpr Z80OpInfo indexOp(int op, int index) {
+  if (op == 0xDD || op == 0xED || op == 0xFD) return make(4, 0, "NOP");  // Prefix without effect
+  Z80OpInfo info = baseOp(op, index);
+  info.length++;
+  if (!usesIndirectHL(op)) {
+    info.tstates += 4;
+    info.tstates_taken += 4;
+  } else {
+    info.tstates = info.tstates_taken = (op == 0x34 || op == 0x35) ? 23 : 19;
+  }
+  return info;
+}
+
+// DD CB d op / FD CB d op
+constexpr Z80OpInfo indexCbOp(int op, int index) {
+  int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+  const char* mem = INDEX_MEM[index];
+  // Undocumented: with z != 6 the result is also copied to a register
+  const char* comma = z == 6 ? "" : ",";
+  const char* copy = z == 6 ? "" : REGS[z];
+  Z80OpInfo info{};
+  if (x == 0) info = make(23, Z80_OPD_DISP, ROTATES[y], " ", mem, comma, copy);
+  else if (x == 1) info = make(20, Z80_OPD_DISP, "BIT ", DIGITS[y], ",", mem);
+  else info = make(23, Z80_OPD_DISP, x == 2 ? "RES " : "SET ", DIGITS[y], ",", mem, comma, copy);
+  info.length = 4;
+  return info;
+}
+
+constexpr Z80OpTable build(Z80Prefix prefix) {
+  Z80OpTable table{};
+  for (int op = 0; op < 256; op++) {
+    switch (prefix) {
+      case Z80_BASE: table.op[op] = baseOp(op, 0); break;
+      case Z80_CB: table.op[op] = cbOp(op); table.op[op].length = 2; break;
+      case Z80_ED: table.op[op] = edOp(op); table.op[op].length++; break;
+      case Z80_DD: table.op[op] = indexOp(op, 1); break;  // [CB] is unused: DD CB has its own table
+      case Z80_FD: table.op[op] = indexOp(op, 2); break;
+      case Z80_DDCB: table.op[op] = indexCbOp(op, 1); break;
+      default: table.op[op] = indexCbOp(op, 2); break;
+    }
+  }
+  return table;
+}
+
+}  // namespace z80_opcodes_detail
+
+// One table per prefix, each built in its own constant evaluation
+inline constexpr Z80OpTable Z80_OPS_BASE = z80_opcodes_detail::build(Z80_BASE);
+inline constexpr Z80OpTable Z80_OPS_CB = z80_opcodes_detail::build(Z80_CB);
+inline constexpr Z80OpTable Z80_OPS_ED = z80_opcodes_detail::build(Z80_ED);
+inline constexpr Z80OpTable Z80_OPS_DD = z80_opcodes_detail::build(Z80_DD);
+inline constexpr Z80OpTable Z80_OPS_FD = z80_opcodes_detail::build(Z80_FD);
+inline constexpr Z80OpTable Z80_OPS_DDCB = z80_opcodes_detail::build(Z80_DDCB);
+inline constexpr Z80OpTable Z80_OPS_FDCB = z80_opcodes_detail::build(Z80_FDCB);
+
+inline constexpr const Z80OpTable* Z80_OPS[Z80_PREFIX_COUNT] = {
+  &Z80_OPS_BASE, &Z80_OPS_CB, &Z80_OPS_ED, &Z80_OPS_DD, &Z80_OPS_FD, &Z80_OPS_DDCB, &Z80_OPS_FDCB,
+};
+
+// Instruction key: prefix in bits 8-10, opcode in bits 0-7.  b3 (the
+// fourth byte) is only read for DD CB / FD CB.
+constexpr uint16_t z80OpKey(uint8_t b0, uint8_t b1, uint8_t b3) {
+  if (b0 == 0xCB) return (uint16_t)(Z80_CB << 8 | b1);
+  if (b0 == 0xED) return (uint16_t)(Z80_ED << 8 | b1);
+  if (b0 != 0xDD && b0 != 0xFD) return b0;
+  if (b1 == 0xCB) return (uint16_t)((b0 == 0xDD ? Z80_DDCB : Z80_FDCB) << 8 | b3);
+  return (uint16_t)((b0 == 0xDD ? Z80_DD : Z80_FD) << 8 | b1);
+}
+
+constexpr const Z80OpInfo& z80OpInfo(uint16_t key) {
+  return Z80_OPS[key >> 8]->op[key & 0xFF];
+}
+
+// Decode the instruction at pc from anything with fetch_mem()
+template <typename Mem>
+inline uint16_t z80OpKeyAt(Mem& mem, uint16_t pc) {
+  uint8_t b0 = mem.fetch_mem(pc);
+  if (b0 != 0xCB && b0 != 0xED && b0 != 0xDD && b0 != 0xFD) return b0;
+  uint8_t b1 = mem.fetch_mem((uint16_t)(pc + 1));
+  uint8_t b3 = (b1 == 0xCB && b0 != 0xCB && b0 != 0xED) ? mem.fetch_mem((uint16_t)(pc + 3)) : 0;
+  return z80OpKey(b0, b1, b3);
+}
+
+static_assert(z80OpInfo(z80OpKey(0xDD, 0x36, 0)).length == 4, "LD (IX+d),n");
+static_assert(z80OpInfo(z80OpKey(0xFD, 0xCB, 0x46)).tstates == 20, "BIT 0,(IY+d)");
+static_assert(z80OpInfo(z80OpKey(0xED, 0xB0, 0)).tstates_taken == 21, "LDIR");
+
+#endif // HBIOS_OPCODES_H
@@ -0,0 +1,139 @@
+/*
+ * HBIOS Opcode Statistics - Counting and Reports
+ */
+
+#include "hbios_opstats.h"
+#include "hbios_opcodes.h"
+#include "emu_io.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+HBIOSOpStats::HBIOSOpStats()
+  : active(false), instructions(0), tstates(0), prev_end(-1), run(0)
+{
+  clear();
+}
+
+void HBIOSOpStats::clear() {
+  instructions = 0;
+  tstates = 0;
+  memset(singles, 0, sizeof(singles));
+  pairs.clear();
+  triples.clear();
+  prev_end = -1;
+  run = 0;
+  prev_keys[0] = prev_keys[1] = 0;
+}
+
+std::string HBIOSOpStats::keyBytes(uint16_t key) {
+  static const char* const PREFIXES[] = { "", "CB ", "ED ", "DD ", "FD ", "DD CB .. ", "FD CB .. " };
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%s%02X", PREFIXES[key >> 8], key & 0xFF);
+  return buf;
+}
+
+//=============================================================================
+// Counting
+//=============================================================================
+
+void HBIOSOpStats::step(qkz80_cpu_mem& mem, uint16_t pc) {
+  uint16_t k = z80OpKeyAt(mem, pc);
+  instructions++;
+  singles[k]++;
+
+  // The previous instruction's timing: conditional ones were taken when
+  // they did not fall through
+  if (prev_end >= 0) {
+    const Z80OpInfo& last = z80OpInfo((uint16_t)prev_keys[0]);
+    tstates += prev_end != pc ? last.tstates_taken : last.tstates;
+  }
+
+  if (prev_end == pc) {
+    pairs[prev_keys[0] << KEY_BITS | k]++;
+    if (run == 2) {
+      triples[(uint64_t)prev_keys[1] << (2 * KEY_BITS) | (uint64_t)prev_keys[0] << KEY_BITS | k]++;
+    }
+    if (run < 2) run++;
+  } else {
+    run = 1;
+  }
+  prev_keys[1] = prev_keys[0];
+  prev_keys[0] = k;
+  prev_end = (uint16_t)(pc + z80OpInfo(k).length);
+}
+
+void HBIOSOpStats::merge(const HBIOSOpStats& other) {
+  instructions += other.instructions;
+  tstates += other.tstates;
+  for (int k = 0; k < KEY_COUNT; k++) singles[k] += other.singles[k];
+  for (const auto& p : other.pairs) pairs[p.first] += p.second;
+  for (const auto& t : other.triples) triples[t.first] += t.second;
+}
+
+//=============================================================================
+// Reports
+//=============================================================================
+
+template <typename Map>
+static std::vector<std::pair<uint64_t, uint64_t>> hottest(const Map& counts, size_t max_lines) {
+  std::vector<std::pair<uint64_t, uint64_t>> rows;  // (count, sequence)
+  for (const auto& c : counts) rows.push_back(std::make_pair((uint64_t)c.second, (uint64_t)c.first));
+  std::sort(rows.begin(), rows.end(), [](const std::pair<uint64_t, uint64_t>& a,
+                                         const std::pair<uint64_t, uint64_t>& b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+  if (rows.size() > max_lines) rows.resize(max_lines);
+  return rows;
+}
+
+std::string HBIOSOpStats::report(size_t max_lines) const {
+  std::string out;
+  char buf[96];
+  snprintf(buf, sizeof(buf), "# %llu instructions, %llu T-states\n", (unsigned long long)instructions,
+           (unsigned long long)tstates);
+  out += buf;
+
+  // Each section lists sequences of n keys
+  std::unordered_map<uint64_t, uint64_t> single_map;
+  for (int k = 0; k < KEY_COUNT; k++) {
+    if (singles[k]) single_map[(uint64_t)k] = singles[k];
+  }
+  const struct {
+    const char* title;
+    int length;
+    std::vector<std::pair<uint64_t, uint64_t>> rows;
+  } sections[] = {
+    { "instructions", 1, hottest(single_map, max_lines) },
+    { "pairs", 2, hottest(pairs, max_lines) },
+    { "triples", 3, hottest(triples, max_lines) },
+  };
+
+  for (const auto& s : sections) {
+    out += std::string("\n# ") + s.title + "\n";
+    for (const auto& row : s.rows) {
+      snprintf(buf, sizeof(buf), "%14llu %6.2f%%  ", (unsigned long long)row.first,
+               instructions ? 100.0 * row.first / instructions : 0.0);
+      out += buf;
+      std::string bytes, text;
+      for (int i = s.length - 1; i >= 0; i--) {
+        uint16_t key = (uint16_t)((row.second >> (i * KEY_BITS)) & KEY_MASK);
+        bytes += keyBytes(key);
+        text += z80OpInfo(key).mnemonic;
+        if (i > 0) {
+          bytes += " ; ";
+          text += " ; ";
+        }
+      }
+      snprintf(buf, sizeof(buf), "%-24s ", bytes.c_str());
+      out += buf + text + "\n";
+    }
+  }
+  return out;
+}
+
+bool HBIOSOpStats::saveReport(const std::string& path, size_t max_lines) const {
+  std::string text = report(max_lines);
+  return emu_file_save(path, std::vector<uint8_t>(text.begin(), text.end()));
+}
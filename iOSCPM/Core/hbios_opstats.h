@@ -0,0 +1,69 @@
+/*
+ * HBIOS Opcode Statistics - Instruction, Pair and Triple Frequencies
+ *
+ * While active, every instruction the interpreter executes is counted by
+ * opcode, and so are the sequences of two and three instructions that
+ * follow each other in memory.  Those sequences are the candidates for
+ * fused handlers (see hbios_fusion.h): an instruction reached by a taken
+ * jump, an interrupt or a trap starts a new sequence.  Instructions run
+ * by the BDOS trap or a native routine are not seen at all, so the
+ * counts describe what is still left to the interpreter.
+ *
+ * Opcodes are keyed with their prefix (CB, ED, DD, FD, DD CB, FD CB) and
+ * without operands or displacements: "DD 7E" is every LD A,(IX+d).
+ * Lengths, mnemonics and T-states come from hbios_opcodes.h; the T-state
+ * total takes a conditional instruction as taken when the next one
+ * counted does not follow it in memory.
+ */
+
+#ifndef HBIOS_OPSTATS_H
+#define HBIOS_OPSTATS_H
+
+#include "qkz80.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class HBIOSOpStats {
+public:
+  HBIOSOpStats();
+
+  void start() { active = true; prev_end = -1; }
+  void stop() { active = false; }
+  bool isActive() const { return active; }
+  void clear();
+
+  // Called before every instruction while active
+  void step(qkz80_cpu_mem& mem, uint16_t pc);
+
+  // Adds another collector's counts, e.g. to total several runs
+  void merge(const HBIOSOpStats& other);
+
+  uint64_t instructionCount() const { return instructions; }
+  uint64_t tstateCount() const { return tstates; }  // Up to the last instruction
+
+  // "count percent opcodes mnemonics" tables of the hottest instructions,
+  // pairs and triples, max_lines each
+  std::string report(size_t max_lines = 40) const;
+  bool saveReport(const std::string& path, size_t max_lines = 40) const;
+
+private:
+  // Keys are z80OpKey(): prefix in bits 8-10, opcode in bits 0-7
+  enum { KEY_BITS = 11, KEY_MASK = (1 << KEY_BITS) - 1, KEY_COUNT = 7 << 8 };
+
+  static std::string keyBytes(uint16_t key);
+
+  bool active;
+  uint64_t instructions;
+  uint64_t tstates;
+  uint64_t singles[KEY_COUNT];
+  std::unordered_map<uint32_t, uint64_t> pairs;    // key1 << KEY_BITS | key2
+  std::unordered_map<uint64_t, uint64_t> triples;  // key1 << 2*KEY_BITS | ...
+
+  // The sequence leading up to the next instruction
+  int32_t prev_end;  // Address following the last instruction, -1 = none
+  int run;           // Sequential instructions in prev_keys, up to 2
+  uint32_t prev_keys[2];  // [0] = most recent
+};
+
+#endif // HBIOS_OPSTATS_H
@@ -0,0 +1,30 @@
+/*
+ * HBIOS Page Image - Shared Pages Implementation
+ */
+
+#include "hbios_pages.h"
+#include <algorithm>
+#include <cstring>
+
+bool HBIOSPageImage::update(const uint8_t* data, size_t size) {
+  size_t page_count = (size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+  bool changed = size != bytes;
+  pages.resize(page_count);
+  bytes = size;
+
+  for (size_t i = 0; i < page_count; i++) {
+    size_t off = i * SNAPSHOT_PAGE_SIZE;
+    size_t len = std::min(SNAPSHOT_PAGE_SIZE, size - off);
+    const Page& page = pages[i];
+    if (page && page->size() == len && memcmp(page->data(), data + off, len) == 0) continue;
+    pages[i] = std::make_shared<const std::vector<uint8_t>>(data + off, data + off + len);
+    changed = true;
+  }
+  return changed;
+}
+
+void HBIOSPageImage::copyTo(uint8_t* out) const {
+  for (size_t i = 0; i < pages.size(); i++) {
+    memcpy(out + i * SNAPSHOT_PAGE_SIZE, pages[i]->data(), pages[i]->size());
+  }
+}
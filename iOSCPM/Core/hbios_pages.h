@@ -0,0 +1,55 @@
+/*
+ * HBIOS Page Image - Shared Pages for clone()
+ *
+ * A region (ROM, RAM, a disk image) held as refcounted pages of
+ * SNAPSHOT_PAGE_SIZE bytes.  Copying an image shares all of its pages;
+ * update() compares live data against the image and replaces only the
+ * pages that differ, so a page nobody wrote stays shared by every copy.
+ *
+ * HBIOSEmulator keeps an HBIOSForkImage of itself as of its last
+ * clone().  The next clone() compares all of RAM and ROM against it
+ * (and disk images when a DIOWRITE or a mount happened since), and
+ * every clone taken from the same state shares the same pages.  The
+ * sharing ends when a clone runs: banked_mem and HBIOSDispatch keep
+ * flat arrays, so the clone copies every page into its own memory and
+ * disks on first use, on whatever thread runs it.  Writes are not
+ * tracked page by page.
+ */
+
+#ifndef HBIOS_PAGES_H
+#define HBIOS_PAGES_H
+
+#include "hbios_snapshot.h"
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class HBIOSPageImage {
+public:
+  HBIOSPageImage() : bytes(0) {}
+
+  // Bring the image in line with data[0..size).  Returns true if any
+  // page (or the size) changed.
+  bool update(const uint8_t* data, size_t size);
+
+  // Write the image to out[0..size())
+  void copyTo(uint8_t* out) const;
+
+  size_t size() const { return bytes; }
+
+private:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Page;
+  std::vector<Page> pages;
+  size_t bytes;
+};
+
+// A session's memory and disks at one instruction boundary
+struct HBIOSForkImage {
+  HBIOSPageImage rom;
+  HBIOSPageImage ram;
+  std::shared_ptr<const HBIOSPageImage> disks[HBIOS_MAX_DISK_UNITS];  // Null: no disk
+  uint64_t disk_generation = 0;  // Owner's count of disk changes when taken
+};
+
+#endif // HBIOS_PAGES_H
@@ -0,0 +1,254 @@
+/*
+ * HBIOS Profiler - Sampling, Shadow Call Stack and Symbol Tables
+ */
+
+#include "hbios_profiler.h"
+#include "hbios_opcodes.h"
+#include "emu_io.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+HBIOSProfiler::HBIOSProfiler()
+  : active(false), track_calls(false), interval(1000), countdown(1000), total_samples(0)
+{
+}
+
+void HBIOSProfiler::start(int sample_interval, bool call_stacks) {
+  interval = sample_interval > 0 ? sample_interval : 1;
+  countdown = interval;
+  track_calls = call_stacks;
+  frames.clear();
+  active = true;
+}
+
+void HBIOSProfiler::clear() {
+  frames.clear();
+  flat.clear();
+  stacks.clear();
+  total_samples = 0;
+}
+
+//=============================================================================
+// Sampling
+//=============================================================================
+
+void HBIOSProfiler::trackCall(uint8_t bank, uint16_t pc, uint16_t sp, uint16_t op_key,
+                              uint16_t new_pc, uint16_t new_sp) {
+  const Z80OpInfo& op = z80OpInfo(op_key);
+
+  // CALL nn, CALL cc,nn, RST n - taken when the return address was pushed
+  if (op.flow == Z80_FLOW_CALL || op.flow == Z80_FLOW_RST) {
+    if (new_sp != (uint16_t)(sp - 2)) return;
+    if (frames.size() == PROFILE_MAX_DEPTH) frames.erase(frames.begin());
+    Frame f;
+    f.site = key(bank, pc);
+    f.ret = (uint16_t)(pc + op.length);
+    f.sp = new_sp;
+    frames.push_back(f);
+    return;
+  }
+
+  // RET, RET cc, RETI/RETN - taken when the return address was popped
+  if (op.flow != Z80_FLOW_RET || new_sp != (uint16_t)(sp + 2) || frames.empty()) return;
+
+  // Normally the top frame; look a little deeper for routines that
+  // discarded their caller's frame (POP HL / JP (HL) style returns)
+  size_t depth = std::min(frames.size(), (size_t)8);
+  for (size_t i = 0; i < depth; i++) {
+    size_t index = frames.size() - 1 - i;
+    if (frames[index].ret == new_pc) {
+      frames.resize(index);
+      return;
+    }
+  }
+  while (!frames.empty() && frames.back().sp < new_sp) frames.pop_back();
+}
+
+void HBIOSProfiler::sample(uint8_t bank, uint16_t pc) {
+  uint32_t leaf = key(bank, pc);
+  total_samples++;
+  flat[leaf]++;
+  if (track_calls) {
+    std::vector<uint32_t> stack;
+    stack.reserve(frames.size() + 1);
+    for (const Frame& f : frames) stack.push_back(f.site);
+    stack.push_back(leaf);
+    stacks[stack]++;
+  }
+}
+
+//=============================================================================
+// Symbols
+//=============================================================================
+
+// "0100", "0100H", "0100'" (M80 relocatable), "0100\"" (COMMON), "0100*" (external)
+static bool parseAddress(const std::string& tok, uint16_t& addr) {
+  if (tok.size() < 4) return false;
+  for (size_t i = 0; i < 4; i++) {
+    if (!isxdigit((unsigned char)tok[i])) return false;
+  }
+  if (tok.size() > 5) return false;
+  if (tok.size() == 5 && !strchr("Hh'\"*", tok[4])) return false;
+  addr = (uint16_t)strtoul(tok.substr(0, 4).c_str(), nullptr, 16);
+  return true;
+}
+
+static bool isIdentifier(const std::string& tok) {
+  if (tok.empty()) return false;
+  unsigned char c = (unsigned char)tok[0];
+  if (!isalpha(c) && !strchr("._?$@", c)) return false;
+  for (unsigned char ch : tok) {
+    if (!isalnum(ch) && !strchr("._?$@", ch)) return false;
+  }
+  return true;
+}
+
+size_t HBIOSProfiler::loadSymbols(const std::string& text, int bank) {
+  // A .PRN listing carries its symbols after a table header; skip the
+  // listing itself, whose address/opcode columns would parse as pairs
+  size_t begin = 0;
+  for (const char* header : { "Symbols:", "SYMBOL TABLE", "Symbol Table" }) {
+    size_t at = text.find(header);
+    if (at != std::string::npos) {
+      begin = text.find('\n', at);
+      if (begin == std::string::npos) return 0;
+      break;
+    }
+  }
+
+  size_t count = 0;
+  size_t pos = begin;
+  while (pos < text.size()) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(pos, end - pos);
+    pos = end + 1;
+
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while (i < line.size()) {
+      while (i < line.size() && isspace((unsigned char)line[i])) i++;
+      if (i < line.size() && line[i] == ';') break;
+      size_t start = i;
+      while (i < line.size() && !isspace((unsigned char)line[i])) i++;
+      if (i > start) {
+        std::string tok = line.substr(start, i - start);
+        if (tok.back() == ':') tok.pop_back();
+        tokens.push_back(tok);
+      }
+    }
+
+    // Pairs in either order: "0100 START" (L80) or "START 0100" (M80, SLR)
+    for (size_t t = 0; t + 1 < tokens.size();) {
+      uint16_t addr;
+      std::string name;
+      if (parseAddress(tokens[t], addr) && isIdentifier(tokens[t + 1])) {
+        name = tokens[t + 1];
+      } else if (isIdentifier(tokens[t]) && parseAddress(tokens[t + 1], addr)) {
+        name = tokens[t];
+      } else {
+        t++;
+        continue;
+      }
+      if (bank < 0) global_symbols[addr] = name;
+      else bank_symbols[key((uint8_t)bank, addr)] = name;
+      count++;
+      t += 2;
+    }
+  }
+  return count;
+}
+
+size_t HBIOSProfiler::loadSymbolsFromFile(const std::string& path, int bank) {
+  std::vector<uint8_t> data;
+  if (!emu_file_load(path, data)) return 0;
+  return loadSymbols(std::string(data.begin(), data.end()), bank);
+}
+
+void HBIOSProfiler::clearSymbols() {
+  global_symbols.clear();
+  bank_symbols.clear();
+}
+
+std::string HBIOSProfiler::symbolize(uint8_t bank, uint16_t addr) const {
+  return symbolizeKey(key(bank, addr));
+}
+
+// Nearest preceding symbol, bank-specific ones first; raw BANK:ADDR if none
+std::string HBIOSProfiler::symbolizeKey(uint32_t k) const {
+  uint16_t addr = (uint16_t)(k & 0xFFFF);
+  uint8_t bank = (uint8_t)(k >> 16);
+
+  const std::string* best = nullptr;
+  uint16_t best_addr = 0;
+  auto b = bank_symbols.upper_bound(k);
+  if (b != bank_symbols.begin() && ((--b)->first >> 16) == bank) {
+    best = &b->second;
+    best_addr = (uint16_t)(b->first & 0xFFFF);
+  }
+  auto g = global_symbols.upper_bound(addr);
+  if (g != global_symbols.begin()) {
+    --g;
+    if (!best || g->first > best_addr) best = &g->second;
+  }
+  if (best) return *best;
+
+  char buf[16];
+  if (bank == PROFILE_COMMON_BANK) snprintf(buf, sizeof(buf), "C:%04X", addr);
+  else snprintf(buf, sizeof(buf), "%02X:%04X", bank, addr);
+  return buf;
+}
+
+//=============================================================================
+// Reports
+//=============================================================================
+
+std::string HBIOSProfiler::folded() const {
+  // Stacks that symbolize identically are merged
+  std::map<std::string, uint64_t> merged;
+  if (track_calls) {
+    for (const auto& s : stacks) {
+      std::string line;
+      for (uint32_t k : s.first) {
+        if (!line.empty()) line += ';';
+        line += symbolizeKey(k);
+      }
+      merged[line] += s.second;
+    }
+  } else {
+    for (const auto& f : flat) merged[symbolizeKey(f.first)] += f.second;
+  }
+
+  std::string out;
+  for (const auto& m : merged) out += m.first + " " + std::to_string(m.second) + "\n";
+  return out;
+}
+
+std::string HBIOSProfiler::histogram(size_t max_lines) const {
+  std::map<std::string, uint64_t> by_symbol;
+  for (const auto& f : flat) by_symbol[symbolizeKey(f.first)] += f.second;
+
+  std::vector<std::pair<uint64_t, std::string>> rows;
+  for (const auto& s : by_symbol) rows.push_back(std::make_pair(s.second, s.first));
+  std::sort(rows.begin(), rows.end(), [](const std::pair<uint64_t, std::string>& a,
+                                         const std::pair<uint64_t, std::string>& b) {
+    return a.first > b.first;
+  });
+
+  std::string out;
+  char buf[64];
+  for (size_t i = 0; i < rows.size() && i < max_lines; i++) {
+    snprintf(buf, sizeof(buf), "%10llu %6.2f%%  ", (unsigned long long)rows[i].first,
+             total_samples ? 100.0 * rows[i].first / total_samples : 0.0);
+    out += buf + rows[i].second + "\n";
+  }
+  return out;
+}
+
+bool HBIOSProfiler::saveFolded(const std::string& path) const {
+  std::string text = folded();
+  return emu_file_save(path, std::vector<uint8_t>(text.begin(), text.end()));
+}
@@ -0,0 +1,103 @@
+/*
+ * HBIOS Profiler - Sampling Guest Profiler with Symbols and Call Stacks
+ *
+ * Every interval instructions the (bank, PC) about to execute is counted
+ * in a flat histogram.  With call tracking on, CALL/RST/RET are followed
+ * on a shadow stack so each sample also carries the chain of routines
+ * that led to it; samples are then written as folded stacks
+ * ("outer;inner;leaf count" lines) for flamegraph.pl and compatible
+ * viewers.
+ *
+ * The shadow stack is approximate: a RET pops back to the frame whose
+ * return address it lands on, or failing that drops frames whose stack
+ * slot is now above SP.  Code that returns by JP (HL) or resets SP
+ * leaves stale frames until the next RET past them.
+ *
+ * Addresses below 8000h are banked and keyed by the bank selected at the
+ * sample; 8000h-FFFFh is the common bank and is reported as bank "C".
+ * Symbols come from .SYM files (L80/LINK-80, Z80ASM, SLR) or the symbol
+ * table at the end of a .PRN listing (M80); each symbol is the nearest
+ * preceding label for addresses up to the next symbol.
+ */
+
+#ifndef HBIOS_PROFILER_H
+#define HBIOS_PROFILER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static const uint8_t PROFILE_COMMON_BANK = 0xFF;  // Sample key bank for 8000h-FFFFh
+static const size_t PROFILE_MAX_DEPTH = 64;
+
+class HBIOSProfiler {
+public:
+  HBIOSProfiler();
+
+  // interval: instructions between samples
+  void start(int interval, bool call_stacks);
+  void stop() { active = false; }
+  bool isActive() const { return active; }
+  void clear();  // Drop samples (symbols are kept)
+
+  // Called by the emulator around every instruction while active.  pc/sp
+  // and the instruction's z80OpKey() (hbios_opcodes.h) are from before
+  // execution, new_pc/new_sp after.
+  void step(uint8_t bank, uint16_t pc, uint16_t sp, uint16_t op_key,
+            uint16_t new_pc, uint16_t new_sp) {
+    if (--countdown == 0) {
+      countdown = interval;
+      sample(bank, pc);
+    }
+    if (track_calls) trackCall(bank, pc, sp, op_key, new_pc, new_sp);
+  }
+
+  // Symbols.  bank < 0 applies them to every bank; returns the number read
+  size_t loadSymbols(const std::string& text, int bank = -1);
+  size_t loadSymbolsFromFile(const std::string& path, int bank = -1);
+  void clearSymbols();
+  std::string symbolize(uint8_t bank, uint16_t addr) const;
+
+  uint64_t sampleCount() const { return total_samples; }
+
+  // Reports: folded stacks, and a flat "count percent symbol" table
+  // sorted by count
+  std::string folded() const;
+  std::string histogram(size_t max_lines = 50) const;
+  bool saveFolded(const std::string& path) const;
+
+private:
+  struct Frame {
+    uint32_t site;       // Bank-keyed address of the CALL/RST, in the caller
+    uint16_t ret;        // Return address pushed by the call
+    uint16_t sp;         // SP after the push
+  };
+
+  static uint32_t key(uint8_t bank, uint16_t addr) {
+    return ((uint32_t)(addr >= 0x8000 ? PROFILE_COMMON_BANK : bank) << 16) | addr;
+  }
+
+  void trackCall(uint8_t bank, uint16_t pc, uint16_t sp, uint16_t op_key,
+                 uint16_t new_pc, uint16_t new_sp);
+  void sample(uint8_t bank, uint16_t pc);
+  std::string symbolizeKey(uint32_t k) const;
+
+  bool active;
+  bool track_calls;
+  int interval;
+  int countdown;
+
+  std::vector<Frame> frames;  // Shadow call stack, outermost first
+
+  uint64_t total_samples;
+  std::unordered_map<uint32_t, uint64_t> flat;         // Key -> samples
+  std::map<std::vector<uint32_t>, uint64_t> stacks;    // Outer..leaf keys -> samples
+
+  std::map<uint16_t, std::string> global_symbols;
+  std::map<uint32_t, std::string> bank_symbols;        // Bank-keyed
+};
+
+#endif // HBIOS_PROFILER_H
@@ -0,0 +1,176 @@
+/*
+ * HBIOS Snapshot - Save-State Serialization Implementation
+ */
+
+#include "hbios_snapshot.h"
+#include <cstring>
+#include <algorithm>
+
+//=============================================================================
+// SnapshotWriter
+//=============================================================================
+
+void SnapshotWriter::u16(uint16_t v) {
+  buf.push_back((uint8_t)(v & 0xFF));
+  buf.push_back((uint8_t)(v >> 8));
+}
+
+void SnapshotWriter::u32(uint32_t v) {
+  for (int i = 0; i < 4; i++) buf.push_back((uint8_t)(v >> (i * 8)));
+}
+
+void SnapshotWriter::u64(uint64_t v) {
+  for (int i = 0; i < 8; i++) buf.push_back((uint8_t)(v >> (i * 8)));
+}
+
+void SnapshotWriter::bytes(const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  buf.insert(buf.end(), p, p + size);
+}
+
+void SnapshotWriter::beginSection(uint32_t tag) {
+  u32(tag);
+  section_start = buf.size();
+  u32(0);  // Length placeholder, patched by endSection()
+}
+
+void SnapshotWriter::endSection() {
+  uint32_t len = (uint32_t)(buf.size() - section_start - 4);
+  for (int i = 0; i < 4; i++) buf[section_start + i] = (uint8_t)(len >> (i * 8));
+}
+
+//=============================================================================
+// SnapshotReader
+//=============================================================================
+
+const uint8_t* SnapshotReader::skip(size_t count) {
+  if (!valid || count > size - pos) {
+    valid = false;
+    return nullptr;
+  }
+  const uint8_t* p = data + pos;
+  pos += count;
+  return p;
+}
+
+uint8_t SnapshotReader::u8() {
+  const uint8_t* p = skip(1);
+  return p ? p[0] : 0;
+}
+
+uint16_t SnapshotReader::u16() {
+  const uint8_t* p = skip(2);
+  return p ? (uint16_t)(p[0] | (p[1] << 8)) : 0;
+}
+
+uint32_t SnapshotReader::u32() {
+  const uint8_t* p = skip(4);
+  if (!p) return 0;
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (i * 8);
+  return v;
+}
+
+uint64_t SnapshotReader::u64() {
+  const uint8_t* p = skip(8);
+  if (!p) return 0;
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (i * 8);
+  return v;
+}
+
+bool SnapshotReader::bytes(void* out, size_t count) {
+  const uint8_t* p = skip(count);
+  if (!p) return false;
+  memcpy(out, p, count);
+  return true;
+}
+
+bool SnapshotReader::nextSection(uint32_t& tag, SnapshotReader& body) {
+  if (!valid || atEnd()) return false;
+  tag = u32();
+  uint32_t len = u32();
+  const uint8_t* p = skip(len);
+  if (!p) return false;
+  body = SnapshotReader(p, len);
+  return true;
+}
+
+//=============================================================================
+// Page Helpers
+//=============================================================================
+
+uint64_t snapshot_hash(const uint8_t* data, size_t size, uint64_t seed) {
+  uint64_t h = seed;
+  for (size_t i = 0; i < size; i++) {
+    h ^= data[i];
+    h *= 0x100000001B3ULL;
+  }
+  return h;
+}
+
+uint64_t snapshot_fingerprint(const uint8_t* data, size_t size) {
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t v;
+    memcpy(&v, data + i, 8);
+    h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+  }
+  for (; i < size; i++) {
+    h = (h ^ data[i]) * 0x100000001B3ULL;
+  }
+  return h;
+}
+
+bool snapshot_find_section(const uint8_t* data, size_t size, uint32_t tag, SnapshotReader& body) {
+  SnapshotReader r(data, size);
+  if (r.u32() != SNAPSHOT_MAGIC) return false;
+  uint16_t version = r.u16();
+  if (version < SNAPSHOT_MIN_VERSION || version > SNAPSHOT_VERSION) return false;
+  r.u16();  // flags
+  uint32_t t;
+  while (r.nextSection(t, body)) {
+    if (t == tag) return true;
+  }
+  return false;
+}
+
+bool snapshot_page_is_fill(const uint8_t* page, size_t size, uint8_t fill) {
+  for (size_t i = 0; i < size; i++) {
+    if (page[i] != fill) return false;
+  }
+  return true;
+}
+
+void snapshot_write_pages(SnapshotWriter& w, const uint8_t* data, size_t size,
+                          const uint8_t* base, uint8_t fill) {
+  size_t page_count = (size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+
+  std::vector<uint32_t> pages;
+  for (size_t i = 0; i < page_count; i++) {
+    size_t off = i * SNAPSHOT_PAGE_SIZE;
+    size_t len = std::min(SNAPSHOT_PAGE_SIZE, size - off);
+    bool skip = base ? memcmp(data + off, base + off, len) == 0
+                     : snapshot_page_is_fill(data + off, len, fill);
+    if (!skip) pages.push_back((uint32_t)i);
+  }
+
+  w.u32((uint32_t)pages.size());
+  for (uint32_t index : pages) {
+    size_t off = (size_t)index * SNAPSHOT_PAGE_SIZE;
+    w.u32(index);
+    w.bytes(data + off, std::min(SNAPSHOT_PAGE_SIZE, size - off));
+  }
+}
+
+bool snapshot_read_pages(SnapshotReader& r, uint8_t* data, size_t size) {
+  uint32_t count = r.u32();
+  for (uint32_t i = 0; i < count && r.ok(); i++) {
+    size_t off = (size_t)r.u32() * SNAPSHOT_PAGE_SIZE;
+    if (off >= size) return false;
+    if (!r.bytes(data + off, std::min(SNAPSHOT_PAGE_SIZE, size - off))) return false;
+  }
+  return r.ok();
+}
@@ -0,0 +1,149 @@
+/*
+ * HBIOS Snapshot - Save-State Serialization
+ *
+ * Versioned binary format used by HBIOSEmulator::saveState() and
+ * loadState().  A snapshot is a fixed header followed by tagged
+ * sections; memory and disk regions are stored as sparse 4KB pages so
+ * that all-zero RAM, unchanged ROM and unused (0xE5) disk space cost
+ * nothing.  Header, section framing and integer fields are
+ * little-endian, but the CPU section is a raw host dump of
+ * qkz80_reg_set, so a state only loads on a build with the same
+ * register layout and byte order.
+ *
+ * Layout:
+ *   u32 magic ("RWBS")  u16 version  u16 flags
+ *   repeat { u32 tag  u32 length  u8 body[length] }
+ */
+
+#ifndef HBIOS_SNAPSHOT_H
+#define HBIOS_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//=============================================================================
+// Format Constants
+//=============================================================================
+
+static const uint32_t SNAPSHOT_MAGIC = 0x53425752;   // "RWBS"
+// Each layout change bumps the version; loadState() keeps a read path
+// for every version from SNAPSHOT_MIN_VERSION up.
+//   1  First format
+//   2  EMU: HALT flag
+//   3  EMU: timer tick and seconds counters
+//   4  EMU: native BDOS drive, user, DMA and write state
+//   5  EMU: pending interrupt and EI shadow
+static const uint16_t SNAPSHOT_VERSION = 5;
+static const uint16_t SNAPSHOT_MIN_VERSION = 1;
+static const size_t SNAPSHOT_PAGE_SIZE = 4096;
+
+// RomWBW memory layout: 16 x 32KB ROM banks + 16 x 32KB RAM banks
+static const size_t HBIOS_ROM_SIZE = 512 * 1024;
+static const size_t HBIOS_RAM_SIZE = 512 * 1024;
+
+// HBIOS disk units tracked by the emulator
+static const int HBIOS_MAX_DISK_UNITS = 16;
+
+// Largest disk image a snapshot may carry: an hd1k combo image (1MB
+// prefix) with 64 slices of 8MB
+static const uint64_t HBIOS_MAX_DISK_SIZE = (1ULL << 20) + 64ULL * (8ULL << 20);
+
+// Header flags
+enum SnapshotFlags {
+  SNAP_FLAG_NONE = 0x0000,
+  SNAP_FLAG_DISKS = 0x0001     // Snapshot carries DISK sections
+};
+
+// Section tags (four-character codes, stored little-endian)
+#define SNAP_TAG(a, b, c, d) \
+  ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+static const uint32_t SNAP_SECT_EMU  = SNAP_TAG('E', 'M', 'U', ' ');  // Wrapper state
+static const uint32_t SNAP_SECT_CPU  = SNAP_TAG('C', 'P', 'U', ' ');  // Register set
+static const uint32_t SNAP_SECT_ROM  = SNAP_TAG('R', 'O', 'M', ' ');  // ROM pages changed since load
+static const uint32_t SNAP_SECT_RAM  = SNAP_TAG('R', 'A', 'M', ' ');  // Non-zero RAM pages
+static const uint32_t SNAP_SECT_DISK = SNAP_TAG('D', 'I', 'S', 'K');  // One per loaded disk unit
+static const uint32_t SNAP_SECT_CONI = SNAP_TAG('C', 'O', 'N', 'I');  // Pending console input
+static const uint32_t SNAP_SECT_BOOT = SNAP_TAG('B', 'O', 'O', 'T');  // Boot cache key + transcript
+
+//=============================================================================
+// Writer - appends little-endian values to a byte vector
+//=============================================================================
+
+class SnapshotWriter {
+public:
+  explicit SnapshotWriter(std::vector<uint8_t>& out) : buf(out), section_start(0) {}
+
+  void u8(uint8_t v) { buf.push_back(v); }
+  void u16(uint16_t v);
+  void u32(uint32_t v);
+  void u64(uint64_t v);
+  void bytes(const void* data, size_t size);
+
+  // Sections cannot nest; endSection() back-patches the length field
+  void beginSection(uint32_t tag);
+  void endSection();
+
+private:
+  std::vector<uint8_t>& buf;
+  size_t section_start;
+};
+
+//=============================================================================
+// Reader - bounds-checked; any overrun latches ok() to false
+//=============================================================================
+
+class SnapshotReader {
+public:
+  SnapshotReader() : data(nullptr), size(0), pos(0), valid(false) {}
+  SnapshotReader(const uint8_t* d, size_t n) : data(d), size(n), pos(0), valid(d != nullptr) {}
+
+  uint8_t u8();
+  uint16_t u16();
+  uint32_t u32();
+  uint64_t u64();
+  bool bytes(void* out, size_t count);
+  const uint8_t* skip(size_t count);   // Returns pointer to skipped bytes, or null
+
+  // Read the next tagged section into a sub-reader.  Returns false at end.
+  bool nextSection(uint32_t& tag, SnapshotReader& body);
+
+  bool ok() const { return valid; }
+  bool atEnd() const { return pos >= size; }
+  size_t remaining() const { return pos < size ? size - pos : 0; }
+
+private:
+  const uint8_t* data;
+  size_t size;
+  size_t pos;
+  bool valid;
+};
+
+//=============================================================================
+// Page Helpers
+//=============================================================================
+
+// 64-bit FNV-1a, used for ROM identity checks
+uint64_t snapshot_hash(const uint8_t* data, size_t size, uint64_t seed = 0xCBF29CE484222325ULL);
+
+// Fast 64-bit content fingerprint (word at a time, host byte order).
+// Used for disk identities in boot cache keys; not stable across hosts.
+uint64_t snapshot_fingerprint(const uint8_t* data, size_t size);
+
+// Locate a section in a complete snapshot without restoring it
+bool snapshot_find_section(const uint8_t* data, size_t size, uint32_t tag, SnapshotReader& body);
+
+// True if every byte of the page equals fill
+bool snapshot_page_is_fill(const uint8_t* page, size_t size, uint8_t fill);
+
+// Write the pages of data[0..size) that differ from base (or, when base is
+// null, are not entirely fill).  Format: u32 count, then {u32 index, page}.
+void snapshot_write_pages(SnapshotWriter& w, const uint8_t* data, size_t size,
+                          const uint8_t* base, uint8_t fill);
+
+// Apply pages written by snapshot_write_pages() onto data[0..size).
+// The caller pre-fills data with the base image or fill byte.
+bool snapshot_read_pages(SnapshotReader& r, uint8_t* data, size_t size);
+
+#endif // HBIOS_SNAPSHOT_H
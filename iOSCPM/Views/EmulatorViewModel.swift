@@ -242,6 +242,7 @@ class EmulatorViewModel: NSObject, ObservableObject {
 
         emulator = RomWBWEmulator()
         emulator?.delegate = self
+        emulator?.setBootCachePath(bootCacheURL.path)
 
         setupAudio()
     }
@@ -947,7 +948,7 @@ class EmulatorViewModel: NSObject, ObservableObject {
         debugPrint("🟢 [START] calling emulator.start()")
         emulator?.start()
         isRunning = emulator?.isRunning ?? false
-        statusText = "Running"
+        statusText = emulator?.restoredFromBootCache() == true ? "Running (instant boot)" : "Running"
         terminalShouldFocus = true  // Auto-focus terminal
         debugPrint("🟢 [START] emulator started, isRunning=\(isRunning)")
     }
@@ -1247,6 +1248,12 @@ class EmulatorViewModel: NSObject, ObservableObject {
         return disks
     }
 
+    /// Post-boot snapshot used for instant boot (rebuilt automatically on config change)
+    var bootCacheURL: URL {
+        let caches = FileManager.default.urls(for: .cachesDirectory, in: .userDomainMask).first!
+        return caches.appendingPathComponent("boot_snapshot.rwbs")
+    }
+
     /// Check if a disk image is already downloaded
     func isDiskDownloaded(_ filename: String) -> Bool {
         let path = downloadsDirectory.appendingPathComponent(filename)
@@ -0,0 +1,313 @@
+/*
+ * Batch Scripts - Parser and Runner
+ */
+
+#include "batch_script.h"
+#include "emu_io.h"
+#include "emu_session.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+//=============================================================================
+// Parser
+//=============================================================================
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Expand \r \n \t \e \\ \xHH and ^X; returns false on a malformed escape
+static bool unescape(const std::string& in, std::string& out) {
+  out.clear();
+  for (size_t i = 0; i < in.size(); i++) {
+    char c = in[i];
+    if (c == '^' && i + 1 < in.size()) {
+      char n = in[++i];
+      if (n == '^') {
+        out += '^';
+      } else {
+        int upper = (n >= 'a' && n <= 'z') ? n - 32 : n;
+        if (upper < '@' || upper > '_') return false;
+        out += (char)(upper - '@');
+      }
+      continue;
+    }
+    if (c != '\\') {
+      out += c;
+      continue;
+    }
+    if (++i >= in.size()) return false;
+    switch (in[i]) {
+      case 'r': out += '\r'; break;
+      case 'n': out += '\n'; break;
+      case 't': out += '\t'; break;
+      case 'e': out += '\x1b'; break;
+      case '\\': out += '\\'; break;
+      case 'x': {
+        int hi = (i + 1 < in.size()) ? hexDigit(in[i + 1]) : -1;
+        int lo = (i + 2 < in.size()) ? hexDigit(in[i + 2]) : -1;
+        if (hi < 0 || lo < 0) return false;
+        out += (char)(hi * 16 + lo);
+        i += 2;
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+bool batch_script_parse(const std::string& text, BatchScript& script, std::string& error) {
+  script.steps.clear();
+  int line_no = 0;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(pos, end - pos);
+    pos = end + 1;
+    line_no++;
+
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line[start] == '#') continue;
+
+    size_t sp = line.find_first_of(" \t", start);
+    std::string keyword = line.substr(start, sp == std::string::npos ? std::string::npos : sp - start);
+    // Argument is everything after a single separator, so prompts and
+    // commands may keep leading/trailing spaces
+    std::string arg = (sp == std::string::npos) ? std::string() : line.substr(sp + 1);
+
+    BatchStep step;
+    step.value = 0;
+    step.line = line_no;
+    if (keyword == "send") {
+      step.type = BATCH_SEND;
+    } else if (keyword == "type") {
+      step.type = BATCH_TYPE;
+    } else if (keyword == "expect") {
+      step.type = BATCH_EXPECT;
+    } else if (keyword == "timeout" || keyword == "run") {
+      step.type = (keyword == "run") ? BATCH_RUN : BATCH_SET_TIMEOUT;
+      char* num_end = nullptr;
+      step.value = strtoll(arg.c_str(), &num_end, 10);
+      if (num_end == arg.c_str() || step.value <= 0) {
+        error = "line " + std::to_string(line_no) + ": " + keyword + " needs a positive instruction count";
+        return false;
+      }
+      script.steps.push_back(step);
+      continue;
+    } else if (keyword == "idle") {
+      step.type = BATCH_IDLE;
+      if (!arg.empty() && arg.find_first_not_of(" \t") != std::string::npos) {
+        error = "line " + std::to_string(line_no) + ": idle takes no argument";
+        return false;
+      }
+      script.steps.push_back(step);
+      continue;
+    } else if (keyword == "mark") {
+      step.type = BATCH_MARK;
+      step.text = arg;
+      if (step.text.empty()) {
+        error = "line " + std::to_string(line_no) + ": mark needs a name";
+        return false;
+      }
+      script.steps.push_back(step);
+      continue;
+    } else {
+      error = "line " + std::to_string(line_no) + ": unknown command '" + keyword + "'";
+      return false;
+    }
+
+    if (!unescape(arg, step.text)) {
+      error = "line " + std::to_string(line_no) + ": bad escape sequence";
+      return false;
+    }
+    if (step.type == BATCH_EXPECT && step.text.empty()) {
+      error = "line " + std::to_string(line_no) + ": expect needs a pattern";
+      return false;
+    }
+    script.steps.push_back(step);
+  }
+  return true;
+}
+
+bool batch_script_load(const std::string& path, BatchScript& script, std::string& error) {
+  std::vector<uint8_t> data;
+  if (!emu_file_load(path, data)) {
+    error = "cannot read " + path;
+    return false;
+  }
+  script.name = path;
+  std::string text(data.begin(), data.end());
+  if (!batch_script_parse(text, script, error)) {
+    error = path + ": " + error;
+    return false;
+  }
+  return true;
+}
+
+const char* batch_status_name(BatchStatus status) {
+  switch (status) {
+    case BATCH_PASS: return "PASS";
+    case BATCH_FAIL_TIMEOUT: return "TIMEOUT";
+    case BATCH_FAIL_STALLED: return "STALLED";
+    case BATCH_FAIL_HALTED: return "HALTED";
+    case BATCH_FAIL_SETUP: return "SETUP";
+  }
+  return "?";
+}
+
+//=============================================================================
+// Runner
+//=============================================================================
+
+static std::string printable(const std::string& s) {
+  std::string out;
+  for (unsigned char c : s) {
+    if (c >= 0x20 && c < 0x7F) {
+      out += (char)c;
+    } else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\x%02X", c);
+      out += buf;
+    }
+  }
+  return out;
+}
+
+BatchResult batch_script_run(const BatchScript& script,
+                             const std::function<bool(HBIOSEmulator&)>& setup,
+                             int batch_size, std::vector<uint8_t>* replay_log,
+                             const std::function<void(HBIOSEmulator&)>& finish)
+{
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point started = Clock::now();
+
+  BatchResult result;
+  result.status = BATCH_PASS;
+  result.failed_line = 0;
+  result.instructions = 0;
+
+  EmuConsoleChannel channel;
+  channel.output = [&result](uint8_t ch) { result.transcript += (char)ch; };
+  EmuConsoleScope scope(&channel);
+
+  std::unique_ptr<HBIOSEmulator> emu(new HBIOSEmulator());
+  if (!setup(*emu) || !emu->isRunning()) {
+    result.status = BATCH_FAIL_SETUP;
+    result.message = "emulator setup failed";
+  } else if (replay_log && !emu->startRecording()) {
+    result.status = BATCH_FAIL_SETUP;
+    result.message = "cannot start recording";
+  }
+
+  long long budget = BATCH_DEFAULT_TIMEOUT;
+
+  for (size_t i = 0; i < script.steps.size() && result.status == BATCH_PASS; i++) {
+    const BatchStep& step = script.steps[i];
+    switch (step.type) {
+      case BATCH_SET_TIMEOUT:
+        budget = step.value;
+        break;
+
+      case BATCH_SEND:
+      case BATCH_TYPE:
+        for (char c : step.text) emu->queueInput((uint8_t)c);
+        if (step.type == BATCH_SEND) emu->queueInput('\r');
+        break;
+
+      case BATCH_EXPECT: {
+        // Stop pattern: runBatch() returns at the instruction that
+        // completes the text, so the next step reacts immediately
+        int id = emu->addOutputMatch(step.text, true);
+        long long limit = emu->getInstructionCount() + budget;
+        for (;;) {
+          if (!emu->isRunning()) {
+            result.status = BATCH_FAIL_HALTED;
+          } else if (emu->isWaitingForInput() && !emu->hasInput()) {
+            result.status = BATCH_FAIL_STALLED;
+          } else if (emu->getInstructionCount() >= limit) {
+            result.status = BATCH_FAIL_TIMEOUT;
+          }
+          if (result.status != BATCH_PASS) {
+            result.failed_line = step.line;
+            result.message = "waiting for \"" + printable(step.text) + "\"";
+            break;
+          }
+
+          emu->clearWaitingForInput();
+          emu->runBatch(batch_size);
+          if (emu->takeStopMatch() == id) break;
+        }
+        emu->removeOutputMatch(id);
+        break;
+      }
+
+      case BATCH_IDLE: {
+        // The first batch clears the wait left over from the previous step
+        long long limit = emu->getInstructionCount() + budget;
+        bool first = true;
+        for (;;) {
+          if (!first && emu->isWaitingForInput() && !emu->hasInput()) break;
+          if (!emu->isRunning()) {
+            result.status = BATCH_FAIL_HALTED;
+          } else if (emu->getInstructionCount() >= limit) {
+            result.status = BATCH_FAIL_TIMEOUT;
+          }
+          if (result.status != BATCH_PASS) {
+            result.failed_line = step.line;
+            result.message = "waiting for the guest to go idle";
+            break;
+          }
+          first = false;
+          emu->clearWaitingForInput();
+          emu->runBatch(batch_size);
+        }
+        break;
+      }
+
+      case BATCH_RUN: {
+        long long limit = emu->getInstructionCount() + step.value;
+        while (emu->getInstructionCount() < limit) {
+          if (!emu->isRunning()) {
+            result.status = BATCH_FAIL_HALTED;
+          } else if (emu->isWaitingForInput() && !emu->hasInput()) {
+            result.status = BATCH_FAIL_STALLED;
+          }
+          if (result.status != BATCH_PASS) {
+            result.failed_line = step.line;
+            result.message = "running " + std::to_string(step.value) + " instructions";
+            break;
+          }
+          long long left = limit - emu->getInstructionCount();
+          emu->clearWaitingForInput();
+          emu->runBatch(left < batch_size ? (int)left : batch_size);
+        }
+        break;
+      }
+
+      case BATCH_MARK: {
+        BatchMark mark;
+        mark.name = step.text;
+        mark.instructions = emu->getInstructionCount();
+        mark.host_ms = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+        result.marks.push_back(mark);
+        break;
+      }
+    }
+  }
+
+  if (replay_log) emu->stopRecording(*replay_log);
+  if (finish && result.status != BATCH_FAIL_SETUP) finish(*emu);
+  result.instructions = emu->getInstructionCount();
+  result.host_ms = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+  return result;
+}
@@ -0,0 +1,106 @@
+/*
+ * Batch Scripts - Unattended CP/M Command Runs
+ *
+ * A batch script generalizes setBootString(): instead of one line typed
+ * at boot it is a sequence of steps that type input and wait for output.
+ *
+ *   # comment
+ *   expect A>            Run until "A>" appears in new console output
+ *   send TPC HELLO       Type "TPC HELLO" followed by CR
+ *   type ^C              Type without a trailing CR
+ *   timeout 500000000    Instruction budget for each following expect
+ *   idle                 Run until the guest waits for input with none queued
+ *   run 100000000        Execute this many instructions, whatever the output
+ *   mark compiled        Record instruction count and host time (benchmarks)
+ *
+ * send/type/expect text accepts the escapes \r \n \t \e \\ \xHH and ^X
+ * for control characters ("^^" is a literal caret).  expect matches
+ * text produced after it is armed (HBIOSEmulator::addOutputMatch), so
+ * repeated prompts are seen one at a time.
+ *
+ * idle is the prompt-agnostic form of expect: it succeeds once
+ * everything typed so far has been consumed and the guest is blocked
+ * reading the console again, whatever it printed.
+ *
+ * Timeouts count guest instructions, not host time, so a script that
+ * passes on a fast machine passes on a loaded CI runner too.
+ */
+
+#ifndef BATCH_SCRIPT_H
+#define BATCH_SCRIPT_H
+
+#include "hbios_core.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+enum BatchStepType {
+  BATCH_SEND,        // Type text + CR
+  BATCH_TYPE,        // Type text as-is
+  BATCH_EXPECT,      // Wait for text in console output
+  BATCH_SET_TIMEOUT, // Set the expect instruction budget
+  BATCH_IDLE,        // Wait for the guest to block on console input
+  BATCH_RUN,         // Execute a fixed number of instructions
+  BATCH_MARK         // Record a named timing point
+};
+
+struct BatchStep {
+  BatchStepType type;
+  std::string text;
+  long long value;  // BATCH_SET_TIMEOUT budget, BATCH_RUN count
+  int line;         // Source line for diagnostics
+};
+
+struct BatchScript {
+  std::string name;
+  std::vector<BatchStep> steps;
+};
+
+enum BatchStatus {
+  BATCH_PASS = 0,
+  BATCH_FAIL_TIMEOUT,   // Expect budget ran out
+  BATCH_FAIL_STALLED,   // Guest is waiting for input that will never match
+  BATCH_FAIL_HALTED,    // Guest stopped before the script finished
+  BATCH_FAIL_SETUP      // ROM/disk load or start() failed
+};
+
+struct BatchMark {
+  std::string name;
+  long long instructions;
+  double host_ms;
+};
+
+struct BatchResult {
+  BatchStatus status;
+  int failed_line;         // Script line of the failing step (0 = none)
+  std::string message;
+  std::string transcript;  // All console output
+  long long instructions;
+  double host_ms;
+  std::vector<BatchMark> marks;  // In script order
+};
+
+// Default per-expect budget - roughly a minute of a 4MHz Z80
+static const long long BATCH_DEFAULT_TIMEOUT = 2000000000LL;
+
+// Parse a script; on failure returns false with a "line N: ..." error
+bool batch_script_parse(const std::string& text, BatchScript& script, std::string& error);
+bool batch_script_load(const std::string& path, BatchScript& script, std::string& error);
+
+const char* batch_status_name(BatchStatus status);
+
+// Create an emulator on the calling thread with a private console
+// channel, run setup (load ROM/disks, start()), then execute the script
+// flat out - no pacing, no video.  Safe to call from many threads at once.
+// With replay_log set, the run is recorded from just after setup (see
+// HBIOSEmulator::startRecording) and the log is stored there.  finish,
+// if set, sees the emulator after the last step (e.g. to collect a
+// profile), whether or not the script passed.
+BatchResult batch_script_run(const BatchScript& script,
+                             const std::function<bool(HBIOSEmulator&)>& setup,
+                             int batch_size = 100000,
+                             std::vector<uint8_t>* replay_log = nullptr,
+                             const std::function<void(HBIOSEmulator&)>& finish = nullptr);
+
+#endif // BATCH_SCRIPT_H
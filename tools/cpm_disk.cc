@@ -0,0 +1,216 @@
+/*
+ * CP/M Disk Access - hd1k Directory and Allocation
+ */
+
+#include "cpm_disk.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+static const size_t HD1K_DIR_OFFSET = 0x4000;   // 2 tracks x 16 sectors x 512
+static const size_t HD1K_BLOCK_SIZE = 4096;
+static const int HD1K_DIR_ENTRIES = 1024;
+static const int HD1K_DIR_BLOCKS = 8;           // 1024 x 32 bytes
+static const int HD1K_MAX_BLOCKS = 2040;        // Stay below DSM on every hd1k DPB
+static const int HD1K_SLICE_BLOCKS = (int)((CPM_HD1K_SLICE_SIZE - HD1K_DIR_OFFSET) / HD1K_BLOCK_SIZE);
+static const int HD1K_BLOCKS_PER_ENTRY = 8;     // 16-bit pointers
+static const int RECORDS_PER_EXTENT = 128;      // 16KB logical extent
+static const int RECORDS_PER_ENTRY = 256;       // EXM=1: two logical extents
+static const uint8_t CPM_EMPTY = 0xE5;
+
+bool cpm_hd1k_slice_offset(size_t image_size, int slice, size_t& offset) {
+  size_t prefix = (image_size % CPM_HD1K_SLICE_SIZE == CPM_HD1K_PREFIX_SIZE) ? CPM_HD1K_PREFIX_SIZE : 0;
+  if (slice < 0) return false;
+  offset = prefix + (size_t)slice * CPM_HD1K_SLICE_SIZE;
+  return offset + CPM_HD1K_SLICE_SIZE <= image_size;
+}
+
+bool cpm_fcb_name(const std::string& name, uint8_t fcb[11]) {
+  memset(fcb, ' ', 11);
+  size_t dot = name.find('.');
+  std::string base = name.substr(0, dot);
+  std::string ext = (dot == std::string::npos) ? std::string() : name.substr(dot + 1);
+  if (base.empty() || base.size() > 8 || ext.size() > 3) return false;
+  for (size_t i = 0; i < base.size(); i++) fcb[i] = (uint8_t)toupper((unsigned char)base[i]);
+  for (size_t i = 0; i < ext.size(); i++) fcb[8 + i] = (uint8_t)toupper((unsigned char)ext[i]);
+  return true;
+}
+
+static std::string displayName(const uint8_t* e) {
+  std::string name, ext;
+  for (int i = 0; i < 8; i++) {
+    char c = (char)(e[1 + i] & 0x7F);
+    if (c != ' ') name += c;
+  }
+  for (int i = 0; i < 3; i++) {
+    char c = (char)(e[9 + i] & 0x7F);
+    if (c != ' ') ext += c;
+  }
+  return ext.empty() ? name : name + "." + ext;
+}
+
+// Logical extent number of a directory entry (S2:EX)
+static int logicalExtent(const uint8_t* e) {
+  return ((e[14] & 0x3F) << 5) | (e[12] & 0x1F);
+}
+
+//=============================================================================
+// Slice
+//=============================================================================
+
+CpmSlice::CpmSlice(uint8_t* image, size_t size, int slice) : base(nullptr) {
+  size_t offset;
+  if (image && cpm_hd1k_slice_offset(size, slice, offset)) base = image + offset;
+}
+
+uint8_t* CpmSlice::entry(int index) const {
+  return base + HD1K_DIR_OFFSET + (size_t)index * 32;
+}
+
+uint8_t* CpmSlice::block(int index) const {
+  return base + HD1K_DIR_OFFSET + (size_t)index * HD1K_BLOCK_SIZE;
+}
+
+bool CpmSlice::matches(const uint8_t* e, int user, const uint8_t* fcb_name) const {
+  if (e[0] != user) return false;
+  for (int i = 0; i < 11; i++) {
+    if ((e[1 + i] & 0x7F) != fcb_name[i]) return false;
+  }
+  return true;
+}
+
+// Directory entries of a file, ordered by logical extent
+std::vector<int> CpmSlice::entriesFor(int user, const uint8_t* fcb_name) const {
+  std::vector<int> found;
+  for (int i = 0; i < HD1K_DIR_ENTRIES; i++) {
+    if (matches(entry(i), user, fcb_name)) found.push_back(i);
+  }
+  std::sort(found.begin(), found.end(), [this](int a, int b) {
+    return logicalExtent(entry(a)) < logicalExtent(entry(b));
+  });
+  return found;
+}
+
+std::vector<CpmFileInfo> CpmSlice::list() const {
+  std::map<std::pair<int, std::string>, size_t> files;
+  if (!base) return std::vector<CpmFileInfo>();
+  for (int i = 0; i < HD1K_DIR_ENTRIES; i++) {
+    const uint8_t* e = entry(i);
+    if (e[0] > 15) continue;  // Empty (0xE5), label or timestamps
+    size_t records = (size_t)logicalExtent(e) * RECORDS_PER_EXTENT + e[15];
+    size_t& size = files[std::make_pair((int)e[0], displayName(e))];
+    size = std::max(size, records * 128);
+  }
+  std::vector<CpmFileInfo> result;
+  for (const auto& f : files) {
+    CpmFileInfo info;
+    info.user = f.first.first;
+    info.name = f.first.second;
+    info.size = f.second;
+    result.push_back(info);
+  }
+  return result;
+}
+
+bool CpmSlice::exists(int user, const std::string& name) const {
+  uint8_t fcb[11];
+  if (!base || !cpm_fcb_name(name, fcb)) return false;
+  return !entriesFor(user, fcb).empty();
+}
+
+bool CpmSlice::readFile(int user, const std::string& name, std::vector<uint8_t>& data) const {
+  uint8_t fcb[11];
+  data.clear();
+  if (!base || !cpm_fcb_name(name, fcb)) return false;
+  std::vector<int> entries = entriesFor(user, fcb);
+  if (entries.empty()) return false;
+
+  size_t records = 0;
+  for (int index : entries) {
+    const uint8_t* e = entry(index);
+    for (int k = 0; k < HD1K_BLOCKS_PER_ENTRY; k++) {
+      int b = e[16 + 2 * k] | (e[17 + 2 * k] << 8);
+      if (b == 0) continue;
+      if (b >= HD1K_SLICE_BLOCKS) return false;
+      const uint8_t* p = block(b);
+      data.insert(data.end(), p, p + HD1K_BLOCK_SIZE);
+    }
+    records = (size_t)logicalExtent(e) * RECORDS_PER_EXTENT + e[15];
+  }
+  if (data.size() > records * 128) data.resize(records * 128);
+  return true;
+}
+
+bool CpmSlice::removeFile(int user, const std::string& name) {
+  uint8_t fcb[11];
+  if (!base || !cpm_fcb_name(name, fcb)) return false;
+  std::vector<int> entries = entriesFor(user, fcb);
+  for (int index : entries) entry(index)[0] = CPM_EMPTY;
+  return !entries.empty();
+}
+
+bool CpmSlice::writeFile(int user, const std::string& name, const std::vector<uint8_t>& data) {
+  uint8_t fcb[11];
+  if (!base || user < 0 || user > 15 || !cpm_fcb_name(name, fcb)) return false;
+  removeFile(user, name);
+
+  // Allocation map from the remaining directory
+  std::vector<bool> used(HD1K_MAX_BLOCKS, false);
+  for (int b = 0; b < HD1K_DIR_BLOCKS; b++) used[b] = true;
+  std::vector<int> free_entries;
+  for (int i = 0; i < HD1K_DIR_ENTRIES; i++) {
+    const uint8_t* e = entry(i);
+    if (e[0] == CPM_EMPTY) {
+      free_entries.push_back(i);
+      continue;
+    }
+    if (e[0] > 15) continue;
+    for (int k = 0; k < HD1K_BLOCKS_PER_ENTRY; k++) {
+      int b = e[16 + 2 * k] | (e[17 + 2 * k] << 8);
+      if (b > 0 && b < HD1K_MAX_BLOCKS) used[b] = true;
+    }
+  }
+
+  size_t records = (data.size() + 127) / 128;
+  size_t blocks_needed = (data.size() + HD1K_BLOCK_SIZE - 1) / HD1K_BLOCK_SIZE;
+  size_t entries_needed = records == 0 ? 1 : (records + RECORDS_PER_ENTRY - 1) / RECORDS_PER_ENTRY;
+  if (entries_needed > free_entries.size()) return false;
+
+  std::vector<int> blocks;
+  for (int b = 0; b < HD1K_MAX_BLOCKS && blocks.size() < blocks_needed; b++) {
+    if (!used[b]) blocks.push_back(b);
+  }
+  if (blocks.size() < blocks_needed) return false;
+
+  for (size_t i = 0; i < blocks.size(); i++) {
+    uint8_t* p = block(blocks[i]);
+    size_t offset = i * HD1K_BLOCK_SIZE;
+    size_t n = std::min(HD1K_BLOCK_SIZE, data.size() - offset);
+    memcpy(p, data.data() + offset, n);
+    memset(p + n, 0, HD1K_BLOCK_SIZE - n);
+  }
+
+  for (size_t n = 0; n < entries_needed; n++) {
+    uint8_t* e = entry(free_entries[n]);
+    memset(e, 0, 32);
+    e[0] = (uint8_t)user;
+    memcpy(e + 1, fcb, 11);
+
+    size_t first = n * RECORDS_PER_ENTRY;
+    size_t in_entry = std::min((size_t)RECORDS_PER_ENTRY, records - std::min(records, first));
+    // EX/S2 name the last logical extent this entry reaches; RC counts
+    // the records in that extent
+    int lext = (int)(n * 2) + (in_entry > RECORDS_PER_EXTENT ? 1 : 0);
+    size_t rc = in_entry > RECORDS_PER_EXTENT ? in_entry - RECORDS_PER_EXTENT : in_entry;
+    e[12] = (uint8_t)(lext & 0x1F);
+    e[14] = (uint8_t)(lext >> 5);
+    e[15] = (uint8_t)rc;
+    for (int k = 0; k < HD1K_BLOCKS_PER_ENTRY; k++) {
+      size_t bi = n * HD1K_BLOCKS_PER_ENTRY + k;
+      int b = bi < blocks.size() ? blocks[bi] : 0;
+      e[16 + 2 * k] = (uint8_t)(b & 0xFF);
+      e[17 + 2 * k] = (uint8_t)(b >> 8);
+    }
+  }
+  return true;
+}
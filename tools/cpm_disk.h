@@ -0,0 +1,63 @@
+/*
+ * CP/M Disk Access - Files in RomWBW hd1k Slices from the Host
+ *
+ * Reads and writes CP/M 2.2 files directly in a disk image so host tools
+ * can stage inputs (sources to compile, test programs) and collect
+ * results without typing them through the console.
+ *
+ * hd1k slice geometry: 8MB, 512-byte sectors, 16 sectors per track,
+ * 2 reserved tracks (directory at +0x4000), 4KB blocks with 16-bit block
+ * pointers, 1024 directory entries (blocks 0-7), EXM=1 so each entry
+ * maps 32KB.  Combo images carry a 1MB prefix before slice 0.
+ */
+
+#ifndef CPM_DISK_H
+#define CPM_DISK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+static const size_t CPM_HD1K_SLICE_SIZE = 8 * 1024 * 1024;
+static const size_t CPM_HD1K_PREFIX_SIZE = 1024 * 1024;
+
+struct CpmFileInfo {
+  int user;
+  std::string name;   // "NAME.EXT"
+  size_t size;        // Bytes, rounded up to 128-byte records
+};
+
+class CpmSlice {
+public:
+  // image/size: the whole disk image; slice: 0-based slice index
+  CpmSlice(uint8_t* image, size_t size, int slice = 0);
+
+  bool valid() const { return base != nullptr; }
+
+  std::vector<CpmFileInfo> list() const;
+  bool exists(int user, const std::string& name) const;
+  bool readFile(int user, const std::string& name, std::vector<uint8_t>& data) const;
+
+  // Create or replace a file.  Text should already be padded with ^Z if
+  // the reader expects it; the tail of the last record is zero-filled.
+  bool writeFile(int user, const std::string& name, const std::vector<uint8_t>& data);
+  bool removeFile(int user, const std::string& name);
+
+private:
+  uint8_t* entry(int index) const;
+  uint8_t* block(int index) const;
+  bool matches(const uint8_t* e, int user, const uint8_t* fcb_name) const;
+  std::vector<int> entriesFor(int user, const uint8_t* fcb_name) const;
+
+  uint8_t* base;  // Start of the slice
+};
+
+// Byte offset of a slice in an hd1k image (handles the combo prefix);
+// returns false if the slice lies outside the image
+bool cpm_hd1k_slice_offset(size_t image_size, int slice, size_t& offset);
+
+// "name.ext" -> 11 space-padded upper-case FCB bytes; false if invalid
+bool cpm_fcb_name(const std::string& name, uint8_t fcb[11]);
+
+#endif // CPM_DISK_H
@@ -0,0 +1,569 @@
+/*
+ * Headless Implementation of emu_io.h
+ *
+ * Portable POSIX backend for running the emulator core without the iOS
+ * frontend (servers, batch runners, benchmarks).  Console I/O goes through
+ * per-thread channels (see emu_session.h); video, DSKY and sound are
+ * no-ops.  Host file transfer (R8/W8) reads and writes files in the
+ * directory given to emu_host_files_set_dir(), and is off without one.
+ */
+
+#include "emu_io.h"
+#include "emu_session.h"
+#include "emu_replay.h"
+#include "hbios_latency.h"
+#include "emu_clock.h"
+#include "emu_event.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <strings.h>
+
+//=============================================================================
+// Console Channels
+//=============================================================================
+
+void EmuConsoleChannel::push(int ch) {
+  if (ch == '\n') ch = '\r';  // LF -> CR for CP/M
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    input.push_back(ch);
+  }
+  if (on_input) on_input();
+}
+
+void EmuConsoleChannel::pushString(const char* s) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (; *s; s++) input.push_back(*s == '\n' ? '\r' : (uint8_t)*s);
+  }
+  if (on_input) on_input();
+}
+
+static EmuConsoleChannel g_default_channel;
+static thread_local EmuConsoleChannel* t_channel = nullptr;
+static bool g_debug_enabled = false;
+
+void emu_console_bind(EmuConsoleChannel* channel) {
+  t_channel = channel;
+}
+
+EmuConsoleChannel* emu_console_bound() {
+  return t_channel;
+}
+
+static EmuConsoleChannel& channel() {
+  return t_channel ? *t_channel : g_default_channel;
+}
+
+//=============================================================================
+// Utility Functions
+//=============================================================================
+
+void emu_sleep_ms(int ms) {
+  usleep(ms * 1000);
+}
+
+int emu_strcasecmp(const char* s1, const char* s2) {
+  return strcasecmp(s1, s2);
+}
+
+int emu_strncasecmp(const char* s1, const char* s2, size_t n) {
+  return strncasecmp(s1, s2, n);
+}
+
+//=============================================================================
+// Console I/O
+//=============================================================================
+
+void emu_io_init() {
+  emu_console_clear_queue();
+}
+
+void emu_io_cleanup() {
+}
+
+bool emu_console_has_input() {
+  int replayed;
+  if (emu_replay_fetch(REPLAY_CONSOLE_STATUS, &replayed)) return replayed != 0;
+  EmuConsoleChannel& ch = channel();
+  bool ready;
+  {
+    std::lock_guard<std::mutex> guard(ch.lock);
+    ready = !ch.input.empty();
+  }
+  emu_replay_note(REPLAY_CONSOLE_STATUS, ready ? 1 : 0);
+  return ready;
+}
+
+int emu_console_read_char() {
+  int c;
+  if (emu_replay_fetch(REPLAY_CONSOLE_CHAR, &c)) return c;
+  EmuConsoleChannel& ch = channel();
+  {
+    std::lock_guard<std::mutex> guard(ch.lock);
+    if (ch.input.empty()) {
+      c = -1;
+    } else {
+      c = ch.input.front();
+      ch.input.pop_front();
+    }
+  }
+  emu_replay_note(REPLAY_CONSOLE_CHAR, c);
+  emu_latency_note_read(c);
+  return c;
+}
+
+void emu_console_queue_char(int ch) {
+  channel().push(ch);
+}
+
+void emu_console_clear_queue() {
+  EmuConsoleChannel& ch = channel();
+  std::lock_guard<std::mutex> guard(ch.lock);
+  ch.input.clear();
+}
+
+void emu_console_write_char(uint8_t ch) {
+  EmuConsoleChannel& c = channel();
+  if (c.output) {
+    c.output(ch);
+  } else if (&c == &g_default_channel) {
+    fputc(ch, stdout);
+  }
+}
+
+bool emu_console_check_escape(char escape_char) {
+  return false;
+}
+
+bool emu_console_check_ctrl_c_exit(int ch, int count) {
+  return false;
+}
+
+//=============================================================================
+// Auxiliary Device I/O (stubs)
+//=============================================================================
+
+void emu_printer_set_file(const char* path) {}
+void emu_printer_out(uint8_t ch) {}
+bool emu_printer_ready() { return false; }
+void emu_aux_set_input_file(const char* path) {}
+void emu_aux_set_output_file(const char* path) {}
+int emu_aux_in() { return 0x1A; }  // EOF
+void emu_aux_out(uint8_t ch) {}
+
+//=============================================================================
+// Debug/Log Output
+//=============================================================================
+
+void emu_log(const char* fmt, ...) {
+  if (!g_debug_enabled) return;
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[EMU] ");
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+}
+
+void emu_set_debug(bool enable) {
+  g_debug_enabled = enable;
+}
+
+void emu_error(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[EMU ERROR] ");
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+}
+
+void emu_fatal(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[EMU FATAL] ");
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  abort();
+}
+
+void emu_status(const char* fmt, ...) {
+  if (!g_debug_enabled) return;
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[STATUS] ");
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+//=============================================================================
+// File I/O
+//=============================================================================
+
+bool emu_file_load(const std::string& path, std::vector<uint8_t>& data) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return false;
+  in.seekg(0, std::ios::end);
+  std::streamoff size = in.tellg();
+  if (size < 0) return false;
+  in.seekg(0, std::ios::beg);
+  data.resize((size_t)size);
+  return size == 0 || (bool)in.read((char*)data.data(), size);
+}
+
+size_t emu_file_load_to_mem(const std::string& path, uint8_t* mem, size_t mem_size, size_t offset) {
+  std::vector<uint8_t> data;
+  if (!emu_file_load(path, data) || offset >= mem_size) return 0;
+  size_t copy_size = std::min(data.size(), mem_size - offset);
+  memcpy(mem + offset, data.data(), copy_size);
+  return copy_size;
+}
+
+bool emu_file_save(const std::string& path, const std::vector<uint8_t>& data) {
+  // Write to a temporary file then rename, like the iOS atomic write
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    if (!out.write((const char*)data.data(), data.size())) return false;
+  }
+  return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool emu_file_exists(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+size_t emu_file_size(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+//=============================================================================
+// Disk Image I/O
+//=============================================================================
+
+struct DiskHandle {
+  FILE* fp;
+  size_t size;
+  bool readonly;
+};
+
+emu_disk_handle emu_disk_open(const std::string& path, const char* mode) {
+  bool readonly = (strcmp(mode, "r") == 0);
+  FILE* fp = fopen(path.c_str(), readonly ? "rb" : "r+b");
+  if (!fp && strchr(mode, '+')) fp = fopen(path.c_str(), "w+b");
+  if (!fp) return nullptr;
+
+  DiskHandle* dh = new DiskHandle();
+  dh->fp = fp;
+  dh->readonly = readonly;
+  fseek(fp, 0, SEEK_END);
+  dh->size = (size_t)ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  return (emu_disk_handle)dh;
+}
+
+void emu_disk_close(emu_disk_handle disk) {
+  if (!disk) return;
+  DiskHandle* dh = (DiskHandle*)disk;
+  fclose(dh->fp);
+  delete dh;
+}
+
+size_t emu_disk_read(emu_disk_handle disk, size_t offset, uint8_t* buffer, size_t count) {
+  if (!disk) return 0;
+  DiskHandle* dh = (DiskHandle*)disk;
+  if (fseek(dh->fp, (long)offset, SEEK_SET) != 0) return 0;
+  return fread(buffer, 1, count, dh->fp);
+}
+
+size_t emu_disk_write(emu_disk_handle disk, size_t offset, const uint8_t* buffer, size_t count) {
+  if (!disk) return 0;
+  DiskHandle* dh = (DiskHandle*)disk;
+  if (dh->readonly) return 0;
+  if (fseek(dh->fp, (long)offset, SEEK_SET) != 0) return 0;
+  size_t written = fwrite(buffer, 1, count, dh->fp);
+  if (offset + written > dh->size) dh->size = offset + written;
+  return written;
+}
+
+void emu_disk_flush(emu_disk_handle disk) {
+  if (!disk) return;
+  fflush(((DiskHandle*)disk)->fp);
+}
+
+size_t emu_disk_size(emu_disk_handle disk) {
+  if (!disk) return 0;
+  return ((DiskHandle*)disk)->size;
+}
+
+//=============================================================================
+// Time
+//=============================================================================
+
+void emu_get_time(emu_time* t) {
+  int32_t fields[7];
+  if (emu_replay_fetch_values(REPLAY_TIME, fields, 7)) {
+    t->year = fields[0];
+    t->month = fields[1];
+    t->day = fields[2];
+    t->hour = fields[3];
+    t->minute = fields[4];
+    t->second = fields[5];
+    t->weekday = fields[6];
+    return;
+  }
+  emu_clock_read(t);  // Cached local time, or the emulator's fixed/virtual clock
+  fields[0] = t->year;
+  fields[1] = t->month;
+  fields[2] = t->day;
+  fields[3] = t->hour;
+  fields[4] = t->minute;
+  fields[5] = t->second;
+  fields[6] = t->weekday;
+  emu_replay_note_values(REPLAY_TIME, fields, 7);
+}
+
+//=============================================================================
+// Random Numbers
+//=============================================================================
+
+unsigned int emu_random(unsigned int min, unsigned int max) {
+  int replayed;
+  if (emu_replay_fetch(REPLAY_RANDOM, &replayed)) return (unsigned int)replayed;
+  static thread_local std::mt19937 rng(std::random_device{}());
+  std::uniform_int_distribution<unsigned int> dist(min, max);
+  unsigned int value = dist(rng);
+  emu_replay_note(REPLAY_RANDOM, (int)value);
+  return value;
+}
+
+//=============================================================================
+// Video/Display (no display attached)
+//=============================================================================
+
+static thread_local int t_cursor_row = 0;
+static thread_local int t_cursor_col = 0;
+static thread_local uint8_t t_attr = 0x07;
+
+void emu_video_get_caps(emu_video_caps* caps) {
+  caps->has_text_display = false;
+  caps->has_pixel_display = false;
+  caps->has_dsky = false;
+  caps->text_rows = 25;
+  caps->text_cols = 80;
+  caps->pixel_width = 0;
+  caps->pixel_height = 0;
+}
+
+void emu_video_clear() {
+  t_cursor_row = 0;
+  t_cursor_col = 0;
+}
+
+void emu_video_set_cursor(int row, int col) {
+  t_cursor_row = row;
+  t_cursor_col = col;
+}
+
+void emu_video_get_cursor(int* row, int* col) {
+  *row = t_cursor_row;
+  *col = t_cursor_col;
+}
+
+void emu_video_write_char(uint8_t ch) {}
+void emu_video_write_char_at(int row, int col, uint8_t ch) {}
+void emu_video_scroll_up(int lines) {}
+
+void emu_video_set_attr(uint8_t attr) {
+  t_attr = attr;
+}
+
+uint8_t emu_video_get_attr() {
+  return t_attr;
+}
+
+//=============================================================================
+// DSKY (stubs)
+//=============================================================================
+
+void emu_dsky_show_hex(uint8_t position, uint8_t value) {}
+void emu_dsky_show_segments(uint8_t position, uint8_t segments) {}
+void emu_dsky_set_leds(uint8_t leds) {}
+void emu_dsky_beep(int duration_ms) {}
+int emu_dsky_get_key() { return -1; }
+
+//=============================================================================
+// Host File Transfer (R8/W8 utilities)
+//=============================================================================
+
+static std::string g_host_file_dir;
+
+void emu_host_files_set_dir(const std::string& dir) {
+  g_host_file_dir = dir;
+}
+
+// A guest file name reduced to its last component; empty when nothing
+// usable is left
+static std::string hostFileName(const char* filename) {
+  std::string name = filename ? filename : "";
+  size_t slash = name.find_last_of("/\\");
+  if (slash != std::string::npos) name.erase(0, slash + 1);
+  if (name == "." || name == "..") name.clear();
+  return name;
+}
+
+emu_host_file_state emu_host_file_get_state() {
+  int replayed;
+  if (emu_replay_fetch(REPLAY_HOST_STATE, &replayed)) return (emu_host_file_state)replayed;
+  EmuConsoleChannel& ch = channel();
+  emu_host_file_state state;
+  {
+    std::lock_guard<std::mutex> guard(ch.lock);
+    state = ch.host_state;
+  }
+  emu_replay_note(REPLAY_HOST_STATE, (int)state);
+  return state;
+}
+
+static bool hostFileOpenRead(const char* filename) {
+  EmuConsoleChannel& ch = channel();
+  std::string name = hostFileName(filename);
+  std::vector<uint8_t> data;
+  bool loaded = !g_host_file_dir.empty() && !name.empty() &&
+                emu_file_load(g_host_file_dir + "/" + name, data);
+  std::lock_guard<std::mutex> guard(ch.lock);
+  ch.host_read.swap(data);
+  ch.host_read_pos = 0;
+  if (!loaded) {
+    ch.host_read.clear();
+    ch.host_state = HOST_FILE_IDLE;
+    return false;
+  }
+  ch.host_state = HOST_FILE_READING;
+  return true;
+}
+
+bool emu_host_file_open_read(const char* filename) {
+  // A replayed transfer takes its data from the log, not the filesystem
+  int replayed;
+  if (emu_replay_fetch(REPLAY_HOST_OPEN, &replayed)) return replayed != 0;
+  bool opened = hostFileOpenRead(filename);
+  emu_replay_note(REPLAY_HOST_OPEN, opened ? 1 : 0);
+  return opened;
+}
+
+static void hostFileBeginWrite(const std::string& name) {
+  EmuConsoleChannel& ch = channel();
+  std::lock_guard<std::mutex> guard(ch.lock);
+  ch.host_write.clear();
+  ch.host_write_name = name;
+  ch.host_state = HOST_FILE_WRITING;
+}
+
+bool emu_host_file_open_write(const char* filename) {
+  std::string name = hostFileName(filename ? filename : "download.bin");
+  // Whether transfers are on is host configuration, so it is logged too
+  int replayed;
+  if (emu_replay_fetch(REPLAY_HOST_OPEN, &replayed)) {
+    if (replayed) hostFileBeginWrite(name);
+    return replayed != 0;
+  }
+  bool opened = !g_host_file_dir.empty() && !name.empty();
+  if (opened) hostFileBeginWrite(name);
+  emu_replay_note(REPLAY_HOST_OPEN, opened ? 1 : 0);
+  return opened;
+}
+
+int emu_host_file_read_byte() {
+  int value;
+  if (emu_replay_fetch(REPLAY_HOST_BYTE, &value)) return value;
+  EmuConsoleChannel& ch = channel();
+  {
+    std::lock_guard<std::mutex> guard(ch.lock);
+    if (ch.host_state != HOST_FILE_READING || ch.host_read_pos >= ch.host_read.size()) {
+      value = -1;
+    } else {
+      value = ch.host_read[ch.host_read_pos++];
+    }
+  }
+  emu_replay_note(REPLAY_HOST_BYTE, value);
+  return value;
+}
+
+bool emu_host_file_write_byte(uint8_t byte) {
+  EmuConsoleChannel& ch = channel();
+  std::lock_guard<std::mutex> guard(ch.lock);
+  if (ch.host_state != HOST_FILE_WRITING) return false;
+  ch.host_write.push_back(byte);
+  return true;
+}
+
+void emu_host_file_close_read() {
+  EmuConsoleChannel& ch = channel();
+  std::lock_guard<std::mutex> guard(ch.lock);
+  ch.host_read.clear();
+  ch.host_read_pos = 0;
+  ch.host_state = HOST_FILE_IDLE;
+}
+
+void emu_host_file_close_write() {
+  EmuConsoleChannel& ch = channel();
+  std::vector<uint8_t> data;
+  std::string name;
+  {
+    std::lock_guard<std::mutex> guard(ch.lock);
+    if (ch.host_state == HOST_FILE_WRITING) {
+      data.swap(ch.host_write);
+      name.swap(ch.host_write_name);
+    }
+    ch.host_write.clear();
+    ch.host_write_name.clear();
+    ch.host_state = HOST_FILE_IDLE;
+  }
+  // No UI to confirm - write straight to the host file directory
+  if (!data.empty() && !g_host_file_dir.empty() && !name.empty()) emu_file_save(g_host_file_dir + "/" + name, data);
+}
+
+void emu_host_file_write_done() {
+  EmuConsoleChannel& ch = channel();
+  std::lock_guard<std::mutex> guard(ch.lock);
+  ch.host_write.clear();
+  ch.host_write_name.clear();
+  ch.host_state = HOST_FILE_IDLE;
+}
+
+void emu_host_file_provide_data(const uint8_t* data, size_t size) {
+  EmuConsoleChannel& ch = channel();
+  {
+    std::lock_guard<std::mutex> guard(ch.lock);
+    ch.host_read.assign(data, data + size);
+    ch.host_read_pos = 0;
+    ch.host_state = HOST_FILE_READING;
+  }
+  emu_event_signal();  // Resume a guest waiting for the data
+}
+
+// The pointers stay valid until the bound session's next transfer
+const uint8_t* emu_host_file_get_write_data() {
+  EmuConsoleChannel& ch = channel();
+  return ch.host_write.empty() ? nullptr : ch.host_write.data();
+}
+
+size_t emu_host_file_get_write_size() {
+  return channel().host_write.size();
+}
+
+const char* emu_host_file_get_write_name() {
+  return channel().host_write_name.c_str();
+}
@@ -0,0 +1,67 @@
+/*
+ * Headless Console Channels
+ *
+ * The emu_io console functions are process-wide, but a headless host runs
+ * many HBIOSEmulator sessions at once.  emu_io_headless.cc routes console
+ * input/output through the channel bound to the calling thread, so a
+ * worker binds a session's channel for the duration of its time slice.
+ * With no binding, the process default channel (stdin/stdout) is used.
+ * A channel also carries its session's host file transfer (R8/W8), so
+ * concurrent sessions never see each other's files.
+ */
+
+#ifndef EMU_SESSION_H
+#define EMU_SESSION_H
+
+#include "emu_io.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct EmuConsoleChannel {
+  std::mutex lock;
+  std::deque<int> input;
+
+  // Called on the emulating thread for every console output byte
+  std::function<void(uint8_t)> output;
+
+  // Called (without the lock held) after input is queued, so a scheduler
+  // can wake a session parked on console input
+  std::function<void()> on_input;
+
+  // Host file transfer, also under lock
+  emu_host_file_state host_state = HOST_FILE_IDLE;
+  std::vector<uint8_t> host_read;
+  size_t host_read_pos = 0;
+  std::vector<uint8_t> host_write;
+  std::string host_write_name;  // Basename, resolved under the host file directory
+
+  void push(int ch);
+  void pushString(const char* s);
+};
+
+// Bind a channel to the current thread (nullptr restores the default)
+void emu_console_bind(EmuConsoleChannel* channel);
+EmuConsoleChannel* emu_console_bound();
+
+// Directory that R8/W8 read from and write to, for every session.  Guest
+// file names are reduced to their last path component.  Empty (the
+// default) turns host file transfer off.
+void emu_host_files_set_dir(const std::string& dir);
+
+// RAII binding for a time slice or a setup call
+class EmuConsoleScope {
+public:
+  explicit EmuConsoleScope(EmuConsoleChannel* channel) : previous(emu_console_bound()) {
+    emu_console_bind(channel);
+  }
+  ~EmuConsoleScope() { emu_console_bind(previous); }
+
+private:
+  EmuConsoleChannel* previous;
+};
+
+#endif // EMU_SESSION_H
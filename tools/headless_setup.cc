@@ -0,0 +1,49 @@
+/*
+ * Headless Setup - ROM/Disk Options Shared by the Headless Tools
+ */
+
+#include "headless_setup.h"
+#include "emu_io.h"
+#include <cstdio>
+#include <cstdlib>
+
+bool headless_parse_disk(const char* arg, DiskSpec& spec) {
+  std::string s(arg);
+  size_t c1 = s.find(':');
+  if (c1 == std::string::npos) {
+    fprintf(stderr, "Bad disk spec %s (want UNIT:FILE[:SLICES])\n", arg);
+    return false;
+  }
+  spec.unit = atoi(s.substr(0, c1).c_str());
+  std::string path = s.substr(c1 + 1);
+  spec.slices = 0;
+  size_t c2 = path.rfind(':');
+  if (c2 != std::string::npos) {
+    spec.slices = atoi(path.substr(c2 + 1).c_str());
+    path = path.substr(0, c2);
+  }
+  if (!emu_file_load(path, spec.data)) {
+    fprintf(stderr, "Cannot read disk image %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool headless_load_rom(const std::string& path, HeadlessImages& images) {
+  if (!emu_file_load(path, images.rom)) {
+    fprintf(stderr, "Cannot read ROM %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool headless_start(HBIOSEmulator& emu, const HeadlessImages& images) {
+  if (!emu.loadROM(images.rom.data(), images.rom.size())) return false;
+  for (const DiskSpec& d : images.disks) {
+    if (!emu.loadDisk(d.unit, d.data.data(), d.data.size())) return false;
+    if (d.slices > 0) emu.setDiskSliceCount(d.unit, d.slices);
+  }
+  emu.setBootString(images.boot);
+  emu.start();
+  return emu.isRunning();
+}
@@ -0,0 +1,33 @@
+/*
+ * Headless Setup - ROM/Disk Options Shared by the Headless Tools
+ */
+
+#ifndef HEADLESS_SETUP_H
+#define HEADLESS_SETUP_H
+
+#include "hbios_core.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct DiskSpec {
+  int unit;
+  int slices;  // 0 = HBIOS default
+  std::vector<uint8_t> data;
+};
+
+struct HeadlessImages {
+  std::vector<uint8_t> rom;
+  std::vector<DiskSpec> disks;
+  std::string boot;
+};
+
+// Parse and load "UNIT:FILE[:SLICES]"; prints an error on failure
+bool headless_parse_disk(const char* arg, DiskSpec& spec);
+
+bool headless_load_rom(const std::string& path, HeadlessImages& images);
+
+// Load ROM and disks into emu, set the boot string and start it
+bool headless_start(HBIOSEmulator& emu, const HeadlessImages& images);
+
+#endif // HEADLESS_SETUP_H
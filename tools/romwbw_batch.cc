@@ -0,0 +1,202 @@
+/*
+ * RomWBW Batch Runner
+ *
+ * Runs batch scripts (see batch_script.h) against freshly booted
+ * headless emulators, one per script, in parallel across cores.  Meant
+ * for CI: build and test CP/M software without a terminal attached.
+ *
+ * Usage:
+ *   romwbw_batch --rom FILE [--disk UNIT:FILE[:SLICES]]... [--boot STR]
+ *                [--jobs N] [--log-dir DIR] [--record] [--quiet]
+ *                [--profile N [--sym FILE[@BANK]]...] [--latency]
+ *                [--clock EPOCH] [--host-dir DIR] SCRIPT...
+ *
+ * Console output of each script goes to DIR/<script name>.log (default
+ * DIR is the current directory).  --record also writes a replay log of
+ * each run to DIR/<script name>.rwbr (see emu_replay.h).  --profile samples
+ * the guest every N instructions and writes DIR/<script name>.folded for
+ * flamegraph.pl, symbolized with any --sym files (.SYM or .PRN; @BANK
+ * limits a file to one hex bank, see hbios_profiler.h).  --latency prints
+ * key-to-read, key-to-output and key-to-frontend latency percentiles for
+ * each script's typed input (see hbios_latency.h).  --clock starts the
+ * guest RTC at EPOCH (seconds since 1970, UTC) and advances it with guest
+ * instructions, so datestamps are the same on every run.  --host-dir
+ * turns on R8/W8 host file transfer, confined to DIR, with a separate
+ * transfer per script (it is off by default).  Exit status is 0 when
+ * every script passes, 1 when any fails, 2 for usage or script syntax
+ * errors.
+ */
+
+#include "batch_script.h"
+#include "headless_setup.h"
+#include "emu_io.h"
+#include "emu_session.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void usage() {
+  fprintf(stderr,
+          "usage: romwbw_batch --rom FILE [--disk UNIT:FILE[:SLICES]]... [--boot STR]\n"
+          "                    [--jobs N] [--log-dir DIR] [--record] [--quiet]\n"
+          "                    [--profile N [--sym FILE[@BANK]]...] [--latency]\n"
+          "                    [--clock EPOCH] [--host-dir DIR] SCRIPT...\n");
+  exit(2);
+}
+
+static std::string outputPath(const std::string& dir, const std::string& script,
+                              const char* ext) {
+  size_t slash = script.find_last_of('/');
+  std::string base = (slash == std::string::npos) ? script : script.substr(slash + 1);
+  size_t dot = base.find_last_of('.');
+  if (dot != std::string::npos && dot > 0) base = base.substr(0, dot);
+  return dir + "/" + base + ext;
+}
+
+// Last few lines of a transcript, for failure reports
+static std::string tail(const std::string& text, int lines) {
+  size_t pos = text.size();
+  while (lines-- > 0 && pos > 0) {
+    size_t nl = text.rfind('\n', pos - 1);
+    if (nl == std::string::npos) return text;
+    pos = nl;
+  }
+  return text.substr(pos);
+}
+
+// "FILE" or "FILE@BANK" (hex bank number)
+static void loadSymbols(HBIOSProfiler& profiler, const std::string& spec) {
+  size_t at = spec.rfind('@');
+  std::string path = spec;
+  int bank = -1;
+  if (at != std::string::npos) {
+    path = spec.substr(0, at);
+    bank = (int)strtol(spec.c_str() + at + 1, nullptr, 16);
+  }
+  if (profiler.loadSymbolsFromFile(path, bank) == 0) {
+    fprintf(stderr, "No symbols read from %s\n", path.c_str());
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string rom_path;
+  std::string log_dir = ".";
+  HeadlessImages images;
+  std::vector<std::string> script_paths;
+  int jobs = (int)std::thread::hardware_concurrency();
+  bool quiet = false;
+  bool record = false;
+  int profile_interval = 0;
+  std::vector<std::string> sym_files;
+  bool latency = false;
+  long long clock_epoch = -1;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--rom") && i + 1 < argc) rom_path = argv[++i];
+    else if (!strcmp(argv[i], "--boot") && i + 1 < argc) images.boot = argv[++i];
+    else if (!strcmp(argv[i], "--jobs") && i + 1 < argc) jobs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--log-dir") && i + 1 < argc) log_dir = argv[++i];
+    else if (!strcmp(argv[i], "--quiet")) quiet = true;
+    else if (!strcmp(argv[i], "--record")) record = true;
+    else if (!strcmp(argv[i], "--profile") && i + 1 < argc) profile_interval = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--sym") && i + 1 < argc) sym_files.push_back(argv[++i]);
+    else if (!strcmp(argv[i], "--latency")) latency = true;
+    else if (!strcmp(argv[i], "--clock") && i + 1 < argc) clock_epoch = atoll(argv[++i]);
+    else if (!strcmp(argv[i], "--host-dir") && i + 1 < argc) emu_host_files_set_dir(argv[++i]);
+    else if (!strcmp(argv[i], "--disk") && i + 1 < argc) {
+      DiskSpec spec;
+      if (!headless_parse_disk(argv[++i], spec)) return 2;
+      images.disks.push_back(std::move(spec));
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      script_paths.push_back(argv[i]);
+    }
+  }
+  if (rom_path.empty() || script_paths.empty()) usage();
+  if (!headless_load_rom(rom_path, images)) return 2;
+
+  // Parse everything up front so a typo fails before any emulation
+  std::vector<BatchScript> scripts(script_paths.size());
+  for (size_t i = 0; i < script_paths.size(); i++) {
+    std::string error;
+    if (!batch_script_load(script_paths[i], scripts[i], error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 2;
+    }
+  }
+
+  // Symbol tables are parsed once and copied into each run's profiler
+  HBIOSProfiler symbols;
+  for (const std::string& sym : sym_files) loadSymbols(symbols, sym);
+
+  emu_io_init();
+
+  if (jobs < 1) jobs = 1;
+  if (jobs > (int)scripts.size()) jobs = (int)scripts.size();
+
+  std::atomic<size_t> next(0);
+  std::atomic<int> failures(0);
+  std::mutex report_lock;
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < scripts.size(); i = next++) {
+      const BatchScript& script = scripts[i];
+      std::vector<uint8_t> replay_log;
+      std::string folded_path = outputPath(log_dir, script.name, ".folded");
+      bool folded_saved = true;
+      std::string latency_report;
+      BatchResult r = batch_script_run(script, [&](HBIOSEmulator& emu) {
+        if (profile_interval > 0) {
+          emu.getProfiler() = symbols;
+          emu.startProfiling(profile_interval);
+        }
+        emu.setLatencyTrackingEnabled(latency);
+        if (clock_epoch >= 0) emu.getClock().setVirtual(clock_epoch);
+        return headless_start(emu, images);
+      }, 100000, record ? &replay_log : nullptr, [&](HBIOSEmulator& emu) {
+        if (profile_interval > 0) folded_saved = emu.getProfiler().saveFolded(folded_path);
+        if (latency) latency_report = emu.getLatency().report();
+      });
+
+      std::string log = outputPath(log_dir, script.name, ".log");
+      std::vector<uint8_t> bytes(r.transcript.begin(), r.transcript.end());
+      bool saved = emu_file_save(log, bytes);
+      if (record && !replay_log.empty()) {
+        std::string path = outputPath(log_dir, script.name, ".rwbr");
+        if (!emu_file_save(path, replay_log)) fprintf(stderr, "Cannot write %s\n", path.c_str());
+      }
+
+      std::lock_guard<std::mutex> guard(report_lock);
+      if (r.status == BATCH_PASS) {
+        if (!quiet) {
+          printf("PASS     %s  (%lld instructions, %.0f ms)\n", script.name.c_str(),
+                 r.instructions, r.host_ms);
+          if (!latency_report.empty()) printf("%s", latency_report.c_str());
+        }
+      } else {
+        failures++;
+        printf("%-8s %s:%d: %s\n", batch_status_name(r.status), script.name.c_str(),
+               r.failed_line, r.message.c_str());
+        printf("---- last output ----%s\n---------------------\n", tail(r.transcript, 8).c_str());
+      }
+      if (!saved) fprintf(stderr, "Cannot write %s\n", log.c_str());
+      if (!folded_saved) fprintf(stderr, "Cannot write %s\n", folded_path.c_str());
+      fflush(stdout);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < jobs; t++) threads.emplace_back(worker);
+  for (std::thread& t : threads) t.join();
+
+  if (!quiet || failures > 0) {
+    printf("%zu scripts, %d failed\n", scripts.size(), failures.load());
+  }
+  return failures > 0 ? 1 : 0;
+}
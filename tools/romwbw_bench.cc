@@ -0,0 +1,587 @@
+/*
+ * RomWBW Benchmark Suite
+ *
+ * Times a fixed set of workloads on the headless core and writes the
+ * results as JSON, so runs can be compared across commits and hosts.
+ *
+ * Usage:
+ *   romwbw_bench [--rom FILE] [--assets DIR] [--only TEXT] [--repeat N]
+ *                [--label TEXT] [--hbios-stats] [--bdos]
+ *                [--native | --native-verify] [--fusion]
+ *                [--opcode-stats FILE] [--out FILE]
+ *
+ * Workloads (each boots RomWBW from scratch with "2" at the boot menu):
+ *   boot/<image>   Power-on to the first idle prompt, for every bootable
+ *                  hd1k image in the assets directory
+ *   zexdoc         MIPS over a fixed slice of the instruction exerciser
+ *   type           Console throughput typing a generated text file
+ *   pip            Disk throughput copying the same file with PIP
+ *   tpascal        Turbo Pascal 3 compiling a generated program in memory
+ *   hitechc        HI-TECH C compiling and linking a generated program
+ *
+ * Inputs are staged straight into a copy of hd1k_cpm22.img (cpm_disk.h);
+ * compilers are copied from their own images so every workload runs on
+ * the boot drive.  Each workload is a batch script (batch_script.h) and
+ * is timed between its "start" and "end" marks.  MIPS are guest
+ * instructions per host microsecond, not emulated clock speed.
+ *
+ * With --repeat N every workload runs N times and the median is reported.
+ * --hbios-stats adds per-function HBIOS call counts and host time for the
+ * whole run (boot included) to each workload; it slows emulation, so
+ * compare MIPS only between runs made with the same setting.
+ * --bdos answers CP/M direct console output and file reads on the boot
+ * drive (A:) natively (hbios_bdos.h) and reports how many calls were
+ * answered; it cuts guest instructions, so compare host time rather
+ * than MIPS.
+ * --native runs recognized runtime library routines as host code
+ * (hbios_native.h) and reports per-routine call counts; the instruction
+ * count is unchanged, so MIPS compare directly.  --native-verify runs
+ * both the native and the guest routine on every call and compares
+ * them; any mismatch makes the exit status 1.
+ * --fusion runs hot instruction sequences through fused handlers
+ * (hbios_fusion.h) and reports per-sequence hits; the instruction count
+ * is unchanged.  --opcode-stats counts the instructions, pairs and
+ * triples the interpreter executes over every selected run (boot
+ * included) and writes the hottest to FILE (hbios_opstats.h); that table
+ * is what the fused set is chosen from.  It slows emulation and turns
+ * fusion off while it runs.
+ * A workload whose script fails is reported with its status and message
+ * and makes the exit status 1.
+ */
+
+#include "batch_script.h"
+#include "cpm_disk.h"
+#include "emu_io.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void usage() {
+  fprintf(stderr,
+          "usage: romwbw_bench [--rom FILE] [--assets DIR] [--only TEXT] [--repeat N]\n"
+          "                    [--label TEXT] [--hbios-stats] [--bdos]\n"
+          "                    [--native | --native-verify] [--fusion]\n"
+          "                    [--opcode-stats FILE] [--out FILE]\n");
+  exit(2);
+}
+
+//=============================================================================
+// Workloads
+//=============================================================================
+
+struct Workload {
+  std::string name;
+  std::vector<uint8_t> disk;   // Unit 0, fully staged
+  std::string script;
+  size_t bytes;                // Payload for throughput workloads (0 = none)
+};
+
+// Common prefix: pick the first hard disk at the boot menu and wait for
+// the CCP prompt
+static const char* BOOT_SCRIPT =
+  "expect Boot [H=Help]:\n"
+  "send 2\n"
+  "idle\n";
+
+// ~200KB of CR/LF text ending in ^Z
+static std::vector<uint8_t> makeText() {
+  std::string text;
+  char line[96];
+  for (int i = 0; text.size() < 200000; i++) {
+    snprintf(line, sizeof(line), "%05d The quick brown fox jumps over the lazy dog %08X\r\n",
+             i, (unsigned)(i * 2654435761u));
+    text += line;
+  }
+  text += '\x1a';
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+// Many small procedures so the compiler's symbol table and code
+// generator both get exercised
+static std::vector<uint8_t> makePascal() {
+  std::string src = "program Bench;\r\nvar Total: Integer;\r\n";
+  char buf[256];
+  for (int i = 0; i < 150; i++) {
+    snprintf(buf, sizeof(buf),
+             "function F%d(A, B: Integer): Integer;\r\n"
+             "var I, S: Integer;\r\n"
+             "begin\r\n"
+             "  S := 0;\r\n"
+             "  for I := A to B do\r\n"
+             "    if (I mod %d) = 0 then S := S + I * 2 else S := S - 1;\r\n"
+             "  F%d := S\r\n"
+             "end;\r\n\r\n", i, (i % 7) + 2, i);
+    src += buf;
+  }
+  src += "begin\r\n  Total := 0;\r\n";
+  for (int i = 0; i < 150; i++) {
+    snprintf(buf, sizeof(buf), "  Total := Total + F%d(%d, %d);\r\n", i, i, i + 10);
+    src += buf;
+  }
+  src += "  WriteLn(Total)\r\nend.\r\n\x1a";
+  return std::vector<uint8_t>(src.begin(), src.end());
+}
+
+static std::vector<uint8_t> makeC() {
+  std::string src = "#include <stdio.h>\r\n\r\n";
+  char buf[320];
+  for (int i = 0; i < 120; i++) {
+    snprintf(buf, sizeof(buf),
+             "int f%d(int a, int b)\r\n"
+             "{\r\n"
+             "\tint i, s = 0;\r\n"
+             "\tfor (i = a; i <= b; i++)\r\n"
+             "\t\ts += (i %% %d) ? -1 : i * 2;\r\n"
+             "\treturn s;\r\n"
+             "}\r\n\r\n", i, (i % 7) + 2);
+    src += buf;
+  }
+  src += "int main()\r\n{\r\n\tint total = 0;\r\n";
+  for (int i = 0; i < 120; i++) {
+    snprintf(buf, sizeof(buf), "\ttotal += f%d(%d, %d);\r\n", i, i, i + 10);
+    src += buf;
+  }
+  src += "\tprintf(\"%d\\n\", total);\r\n\treturn 0;\r\n}\r\n\x1a";
+  return std::vector<uint8_t>(src.begin(), src.end());
+}
+
+static bool isBootable(const std::vector<uint8_t>& image) {
+  size_t offset;
+  if (!cpm_hd1k_slice_offset(image.size(), 0, offset)) return false;
+  // System tracks sit before the directory; data disks leave them blank
+  for (size_t i = offset; i < offset + 0x4000; i++) {
+    if (image[i] != 0x00 && image[i] != 0xE5) return true;
+  }
+  return false;
+}
+
+// Copy the user 0 files of another image onto slice 0 of disk, keeping
+// any file disk already has
+static bool stageFrom(std::vector<uint8_t>& disk, const std::string& path,
+                      const std::vector<std::string>& names) {
+  std::vector<uint8_t> image;
+  if (!emu_file_load(path, image)) {
+    fprintf(stderr, "Cannot read %s\n", path.c_str());
+    return false;
+  }
+  CpmSlice from(image.data(), image.size());
+  CpmSlice to(disk.data(), disk.size());
+  for (const CpmFileInfo& f : from.list()) {
+    if (f.user != 0 || to.exists(0, f.name)) continue;
+    if (!names.empty() && std::find(names.begin(), names.end(), f.name) == names.end()) continue;
+    std::vector<uint8_t> data;
+    if (!from.readFile(0, f.name, data) || !to.writeFile(0, f.name, data)) {
+      fprintf(stderr, "Cannot copy %s from %s\n", f.name.c_str(), path.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool buildWorkloads(const std::string& assets, std::vector<Workload>& out) {
+  // Boot time for every bootable image
+  std::vector<std::string> images;
+  if (DIR* dir = opendir(assets.c_str())) {
+    while (struct dirent* e = readdir(dir)) {
+      std::string n = e->d_name;
+      if (n.compare(0, 5, "hd1k_") == 0 && n.size() > 4 && n.compare(n.size() - 4, 4, ".img") == 0) {
+        images.push_back(n);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(images.begin(), images.end());
+  for (const std::string& n : images) {
+    Workload w;
+    if (!emu_file_load(assets + "/" + n, w.disk) || !isBootable(w.disk)) continue;
+    w.name = "boot/" + n.substr(5, n.size() - 9);
+    w.script = std::string(BOOT_SCRIPT) + "mark end\n";
+    w.bytes = 0;
+    out.push_back(std::move(w));
+  }
+
+  std::vector<uint8_t> cpm22;
+  if (!emu_file_load(assets + "/hd1k_cpm22.img", cpm22)) {
+    fprintf(stderr, "Cannot read %s/hd1k_cpm22.img\n", assets.c_str());
+    return false;
+  }
+
+  // ZEXDOC lives in user 2; a fixed slice of it is plenty for a rate,
+  // the whole exerciser runs for billions of instructions
+  {
+    Workload w;
+    w.name = "zexdoc";
+    w.disk = cpm22;
+    w.script = std::string(BOOT_SCRIPT) +
+      "send USER 2\n"
+      "idle\n"
+      "send ZEXDOC\n"
+      "expect Z80doc instruction exerciser\n"
+      "mark start\n"
+      "run 200000000\n"
+      "mark end\n";
+    w.bytes = 0;
+    out.push_back(std::move(w));
+  }
+
+  std::vector<uint8_t> text = makeText();
+  {
+    Workload w;
+    w.name = "type";
+    w.disk = cpm22;
+    CpmSlice(w.disk.data(), w.disk.size()).writeFile(0, "BENCH.TXT", text);
+    w.script = std::string(BOOT_SCRIPT) +
+      "mark start\n"
+      "send TYPE BENCH.TXT\n"
+      "idle\n"
+      "mark end\n";
+    w.bytes = text.size();
+    out.push_back(std::move(w));
+  }
+  {
+    Workload w;
+    w.name = "pip";
+    w.disk = cpm22;
+    CpmSlice(w.disk.data(), w.disk.size()).writeFile(0, "BENCH.TXT", text);
+    w.script = std::string(BOOT_SCRIPT) +
+      "mark start\n"
+      "send PIP COPY.TXT=BENCH.TXT\n"
+      "idle\n"
+      "mark end\n";
+    w.bytes = text.size();
+    out.push_back(std::move(w));
+  }
+  {
+    Workload w;
+    w.name = "tpascal";
+    w.disk = cpm22;
+    if (!stageFrom(w.disk, assets + "/hd1k_tpascal.img",
+                   {"TURBO.COM", "TURBO.MSG", "TURBO.OVR", "TURBOMSG.OVR"})) {
+      return false;
+    }
+    CpmSlice(w.disk.data(), w.disk.size()).writeFile(0, "BENCH.PAS", makePascal());
+    // Turbo reads single keys at its menu; C compiles the work file to memory
+    w.script = std::string(BOOT_SCRIPT) +
+      "send TURBO\n"
+      "expect (Y/N)?\n"
+      "type Y\n"
+      "idle\n"
+      "type W\n"
+      "expect name:\n"
+      "send BENCH\n"
+      "idle\n"
+      "mark start\n"
+      "type C\n"
+      "expect lines\n"
+      "idle\n"
+      "mark end\n";
+    w.bytes = 0;
+    out.push_back(std::move(w));
+  }
+  {
+    Workload w;
+    w.name = "hitechc";
+    w.disk = cpm22;
+    if (!stageFrom(w.disk, assets + "/hd1k_hitechc.img", {})) return false;
+    CpmSlice(w.disk.data(), w.disk.size()).writeFile(0, "BENCH.C", makeC());
+    w.script = std::string(BOOT_SCRIPT) +
+      "mark start\n"
+      "send C BENCH.C\n"
+      "idle\n"
+      "mark end\n";
+    w.bytes = 0;
+    out.push_back(std::move(w));
+  }
+  return true;
+}
+
+//=============================================================================
+// Runs
+//=============================================================================
+
+struct RunResult {
+  BatchResult batch;
+  long long instructions;  // Between the marks
+  double host_ms;
+  std::vector<HBIOSCallStat> hbios_calls;  // Indexed by function (--hbios-stats)
+  uint64_t bdos_native;                    // --bdos: calls answered natively
+  uint64_t bdos_passed;                    // and run by the guest BDOS
+  std::vector<HBIOSNativeStat> natives;    // Indexed by routine (--native)
+  std::vector<uint64_t> fused;             // Hits by handler (--fusion)
+};
+
+static const BatchMark* findMark(const BatchResult& r, const char* name) {
+  for (const BatchMark& m : r.marks) {
+    if (m.name == name) return &m;
+  }
+  return nullptr;
+}
+
+static RunResult runWorkload(const Workload& w, const std::vector<uint8_t>& rom, bool hbios_stats,
+                             bool bdos, HBIOSNative::Mode natives, bool fusion, HBIOSOpStats* opstats) {
+  RunResult run;
+  run.bdos_native = run.bdos_passed = 0;
+  BatchScript script;
+  std::string error;
+  script.name = w.name;
+  if (!batch_script_parse(w.script, script, error)) {
+    // Built-in scripts; a parse error is a bug here
+    fprintf(stderr, "%s: %s\n", w.name.c_str(), error.c_str());
+    abort();
+  }
+
+  run.batch = batch_script_run(script, [&](HBIOSEmulator& emu) {
+    if (!emu.loadROM(rom.data(), rom.size())) return false;
+    if (!emu.loadDisk(0, w.disk.data(), w.disk.size())) return false;
+    emu.setHBIOSCallStatsEnabled(hbios_stats);
+    if (bdos) {
+      emu.setBDOSTrap(HBIOSBdos::TRAP_CONSOLE | HBIOSBdos::TRAP_FILES);
+      emu.mapBDOSDrive(0, 0);  // The boot slice is A:
+    }
+    emu.setNativeRoutines(natives);
+    emu.setFusion(fusion);
+    if (opstats) emu.startOpcodeStats();
+    emu.start();
+    return emu.isRunning();
+  }, 100000, nullptr, [&](HBIOSEmulator& emu) {
+    run.bdos_native = emu.getBDOS().handledCalls();
+    run.bdos_passed = emu.getBDOS().passedCalls();
+    if (natives != HBIOSNative::OFF) {
+      for (int r = 0; r < HBIOSNative::routineCount(); r++) run.natives.push_back(emu.getNativeRoutines().stat(r));
+    }
+    if (fusion) {
+      for (int h = 0; h < HBIOSFusion::handlerCount(); h++) run.fused.push_back(emu.getFusion().hits(h));
+    }
+    if (opstats) opstats->merge(emu.getOpcodeStats());
+    if (!hbios_stats) return;
+    for (int fn = 0; fn < 256; fn++) run.hbios_calls.push_back(emu.getHBIOSCallStats().stat((uint8_t)fn));
+  });
+
+  // Without a start mark the span begins at power-on
+  const BatchMark* start = findMark(run.batch, "start");
+  const BatchMark* end = findMark(run.batch, "end");
+  run.instructions = 0;
+  run.host_ms = 0;
+  if (end) {
+    run.instructions = end->instructions - (start ? start->instructions : 0);
+    run.host_ms = end->host_ms - (start ? start->host_ms : 0);
+  }
+  return run;
+}
+
+// Last non-empty line of console output, e.g. the prompt after boot
+static std::string lastLine(const std::string& text) {
+  size_t end = text.find_last_not_of("\r\n ");
+  if (end == std::string::npos) return std::string();
+  size_t start = text.find_last_of("\r\n", end);
+  start = (start == std::string::npos) ? 0 : start + 1;
+  return text.substr(start, end + 1 - start);
+}
+
+//=============================================================================
+// JSON
+//=============================================================================
+
+static std::string jsonString(const std::string& s) {
+  std::string out = "\"";
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += (char)c;
+    } else if (c < 0x20 || c >= 0x7F) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += (char)c;
+    }
+  }
+  return out + "\"";
+}
+
+static void writeResult(FILE* f, const Workload& w, std::vector<RunResult>& runs, bool last) {
+  fprintf(f, "    {\n");
+  fprintf(f, "      \"name\": %s,\n", jsonString(w.name).c_str());
+
+  // A failed run is reported instead of any median.  The repeat loop
+  // stops at the first failure, so it is always the last run.
+  const RunResult& failed = runs.back();
+  if (failed.batch.status != BATCH_PASS) {
+    fprintf(f, "      \"status\": %s,\n", jsonString(batch_status_name(failed.batch.status)).c_str());
+    fprintf(f, "      \"message\": %s,\n",
+            jsonString("line " + std::to_string(failed.batch.failed_line) + ": " +
+                       failed.batch.message).c_str());
+    fprintf(f, "      \"output\": %s\n", jsonString(lastLine(failed.batch.transcript)).c_str());
+    fprintf(f, "    }%s\n", last ? "" : ",");
+    return;
+  }
+
+  // Median by host time
+  std::sort(runs.begin(), runs.end(), [](const RunResult& a, const RunResult& b) {
+    return a.host_ms < b.host_ms;
+  });
+  const RunResult& r = runs[runs.size() / 2];
+  fprintf(f, "      \"status\": %s,\n", jsonString(batch_status_name(r.batch.status)).c_str());
+
+  fprintf(f, "      \"runs\": %zu,\n", runs.size());
+  fprintf(f, "      \"instructions\": %lld,\n", r.instructions);
+  fprintf(f, "      \"host_ms\": %.3f,\n", r.host_ms);
+  fprintf(f, "      \"host_ms_min\": %.3f,\n", runs.front().host_ms);
+  fprintf(f, "      \"host_ms_max\": %.3f,\n", runs.back().host_ms);
+  if (w.bytes > 0) {
+    fprintf(f, "      \"bytes\": %zu,\n", w.bytes);
+    fprintf(f, "      \"bytes_per_sec\": %.0f,\n", r.host_ms > 0 ? w.bytes * 1000.0 / r.host_ms : 0.0);
+  }
+  if (w.name.compare(0, 5, "boot/") == 0) {
+    fprintf(f, "      \"prompt\": %s,\n", jsonString(lastLine(r.batch.transcript)).c_str());
+  }
+  if (!r.hbios_calls.empty()) {
+    fprintf(f, "      \"hbios_calls\": {");
+    const char* sep = "\n";
+    for (int fn = 0; fn < (int)r.hbios_calls.size(); fn++) {
+      const HBIOSCallStat& s = r.hbios_calls[fn];
+      if (s.calls == 0) continue;
+      fprintf(f, "%s        %s: { \"calls\": %llu, \"host_ms\": %.3f, \"guest_instructions\": %llu }",
+              sep, jsonString(HBIOSCallStats::functionName((uint8_t)fn)).c_str(),
+              (unsigned long long)s.calls, s.host_ns / 1e6, (unsigned long long)s.guest_instructions);
+      sep = ",\n";
+    }
+    fprintf(f, "\n      },\n");
+  }
+  if (r.bdos_native || r.bdos_passed) {
+    fprintf(f, "      \"bdos_calls\": { \"native\": %llu, \"guest\": %llu },\n",
+            (unsigned long long)r.bdos_native, (unsigned long long)r.bdos_passed);
+  }
+  if (!r.natives.empty()) {
+    fprintf(f, "      \"native_routines\": {");
+    const char* sep = "\n";
+    for (int n = 0; n < (int)r.natives.size(); n++) {
+      const HBIOSNativeStat& s = r.natives[n];
+      if (s.calls == 0) continue;
+      fprintf(f, "%s        %s: { \"calls\": %llu, \"native\": %llu, \"verified\": %llu, \"mismatches\": %llu }",
+              sep, jsonString(HBIOSNative::routineName(n)).c_str(), (unsigned long long)s.calls,
+              (unsigned long long)s.native, (unsigned long long)s.verified, (unsigned long long)s.mismatches);
+      sep = ",\n";
+    }
+    fprintf(f, "\n      },\n");
+  }
+  if (!r.fused.empty()) {
+    fprintf(f, "      \"fused\": {");
+    const char* sep = "\n";
+    for (int h = 0; h < (int)r.fused.size(); h++) {
+      if (r.fused[h] == 0) continue;
+      fprintf(f, "%s        %s: %llu", sep, jsonString(HBIOSFusion::handlerName(h)).c_str(),
+              (unsigned long long)r.fused[h]);
+      sep = ",\n";
+    }
+    fprintf(f, "\n      },\n");
+  }
+  fprintf(f, "      \"mips\": %.2f\n", r.host_ms > 0 ? r.instructions / (r.host_ms * 1000.0) : 0.0);
+  fprintf(f, "    }%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+  std::string rom_path = "../iOSCPM/Resources/emu_avw.rom";
+  std::string assets = "../release_assets";
+  std::string only;
+  std::string label;
+  std::string out_path;
+  std::string opstats_path;
+  int repeat = 1;
+  bool hbios_stats = false;
+  bool bdos = false;
+  HBIOSNative::Mode natives = HBIOSNative::OFF;
+  bool fusion = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--rom") && i + 1 < argc) rom_path = argv[++i];
+    else if (!strcmp(argv[i], "--assets") && i + 1 < argc) assets = argv[++i];
+    else if (!strcmp(argv[i], "--only") && i + 1 < argc) only = argv[++i];
+    else if (!strcmp(argv[i], "--label") && i + 1 < argc) label = argv[++i];
+    else if (!strcmp(argv[i], "--out") && i + 1 < argc) out_path = argv[++i];
+    else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) repeat = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--hbios-stats")) hbios_stats = true;
+    else if (!strcmp(argv[i], "--bdos")) bdos = true;
+    else if (!strcmp(argv[i], "--native")) natives = HBIOSNative::ON;
+    else if (!strcmp(argv[i], "--native-verify")) natives = HBIOSNative::VERIFY;
+    else if (!strcmp(argv[i], "--fusion")) fusion = true;
+    else if (!strcmp(argv[i], "--opcode-stats") && i + 1 < argc) opstats_path = argv[++i];
+    else usage();
+  }
+  if (repeat < 1) repeat = 1;
+
+  std::vector<uint8_t> rom;
+  if (!emu_file_load(rom_path, rom)) {
+    fprintf(stderr, "Cannot read ROM %s\n", rom_path.c_str());
+    return 2;
+  }
+
+  std::vector<Workload> all;
+  if (!buildWorkloads(assets, all)) return 2;
+  std::vector<Workload> workloads;
+  for (Workload& w : all) {
+    if (only.empty() || w.name.find(only) != std::string::npos) workloads.push_back(std::move(w));
+  }
+  if (workloads.empty()) {
+    fprintf(stderr, "No workloads selected\n");
+    return 2;
+  }
+
+  FILE* f = out_path.empty() ? stdout : fopen(out_path.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "Cannot write %s\n", out_path.c_str());
+    return 2;
+  }
+
+  emu_io_init();
+
+  char date[32];
+  time_t now = time(nullptr);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"label\": %s,\n", jsonString(label).c_str());
+  fprintf(f, "  \"date\": %s,\n", jsonString(date).c_str());
+  fprintf(f, "  \"rom\": %s,\n", jsonString(rom_path).c_str());
+  fprintf(f, "  \"host_threads\": %u,\n", std::thread::hardware_concurrency());
+  fprintf(f, "  \"bdos_trap\": %s,\n", bdos ? "true" : "false");
+  fprintf(f, "  \"native_routines\": %s,\n",
+          natives == HBIOSNative::OFF ? "\"off\"" : natives == HBIOSNative::ON ? "\"on\"" : "\"verify\"");
+  fprintf(f, "  \"fusion\": %s,\n", fusion ? "true" : "false");
+  fprintf(f, "  \"workloads\": [\n");
+
+  HBIOSOpStats opstats;
+  int failures = 0;
+  for (size_t i = 0; i < workloads.size(); i++) {
+    const Workload& w = workloads[i];
+    std::vector<RunResult> runs;
+    for (int n = 0; n < repeat; n++) {
+      runs.push_back(runWorkload(w, rom, hbios_stats, bdos, natives, fusion,
+                                 opstats_path.empty() ? nullptr : &opstats));
+      if (runs.back().batch.status != BATCH_PASS) break;
+    }
+    if (runs.back().batch.status != BATCH_PASS) failures++;
+    for (const RunResult& r : runs) {
+      for (const HBIOSNativeStat& s : r.natives) {
+        if (s.mismatches) failures++;
+      }
+    }
+    fprintf(stderr, "%-20s %s\n", w.name.c_str(), batch_status_name(runs.back().batch.status));
+    writeResult(f, w, runs, i + 1 == workloads.size());
+    fflush(f);
+  }
+
+  fprintf(f, "  ]\n}\n");
+  if (f != stdout) fclose(f);
+  if (!opstats_path.empty() && !opstats.saveReport(opstats_path)) {
+    fprintf(stderr, "Cannot write %s\n", opstats_path.c_str());
+    failures++;
+  }
+  return failures > 0 ? 1 : 0;
+}
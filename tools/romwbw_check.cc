@@ -0,0 +1,356 @@
+/*
+ * RomWBW Core Checks - Emulator Core Regression Scenarios
+ *
+ * Runs short scenarios against HBIOSEmulator that exercise behaviour the
+ * batch scripts cannot pin down (replay determinism, interrupt timing,
+ * fused handlers against the interpreter) and reports each as PASS or
+ * FAIL.
+ *
+ * Usage:
+ *   romwbw_check [--rom FILE] [--assets DIR] [--only TEXT]
+ *
+ * Checks that boot CP/M use DIR/hd1k_cpm22.img (DIR defaults to
+ * ../release_assets).  Exit status is 0 when every selected check
+ * passes, 1 otherwise, 2 for usage errors.
+ */
+
+#include "emu_io.h"
+#include "emu_session.h"
+#include "hbios_core.h"
+#include "hbios_fusion.h"
+#include "qkz80.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static void usage() {
+  fprintf(stderr, "usage: romwbw_check [--rom FILE] [--assets DIR] [--only TEXT]\n");
+  exit(2);
+}
+
+struct CheckEnv {
+  std::vector<uint8_t> rom;
+  std::vector<uint8_t> disk;  // hd1k_cpm22.img
+};
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+// Run until the guest blocks on console input with nothing queued
+static bool runToIdle(HBIOSEmulator& emu, long long budget) {
+  long long limit = emu.getInstructionCount() + budget;
+  while (emu.isRunning() && emu.getInstructionCount() < limit) {
+    emu.runBatch(100000);
+    if (emu.isWaitingForInput() && !emu.hasInput()) return true;
+  }
+  return false;
+}
+
+// Host polls while the guest waits: none of them may reach the log
+static void idlePolls(HBIOSEmulator& emu, int count) {
+  for (int i = 0; i < count; i++) emu.runBatch(100000);
+}
+
+static void typeLine(HBIOSEmulator& emu, const char* text) {
+  for (; *text; text++) emu.queueInput((uint8_t)*text);
+  emu.queueInput('\r');
+}
+
+//=============================================================================
+// Checks
+//=============================================================================
+
+// Record a boot to the CCP and a DIR with host polls at every input wait,
+// then replay it without any: the guest must see the same console calls
+static bool checkReplayIdlePolls(const CheckEnv& env, std::string& error) {
+  std::string recorded, replayed;
+  std::vector<uint8_t> log;
+  long long end = 0;
+  {
+    EmuConsoleChannel channel;
+    channel.output = [&recorded](uint8_t ch) { recorded += (char)ch; };
+    EmuConsoleScope scope(&channel);
+
+    HBIOSEmulator emu;
+    if (!emu.loadROM(env.rom.data(), env.rom.size()) ||
+        !emu.loadDisk(0, env.disk.data(), env.disk.size())) {
+      error = "cannot load ROM or disk";
+      return false;
+    }
+    emu.start();
+    if (!runToIdle(emu, 200000000)) {
+      error = "no boot menu";
+      return false;
+    }
+    if (!emu.startRecording()) {
+      error = "cannot start recording";
+      return false;
+    }
+    recorded.clear();
+    idlePolls(emu, 25);
+    typeLine(emu, "2");
+    if (!runToIdle(emu, 500000000)) {
+      error = "no CCP prompt while recording";
+      return false;
+    }
+    idlePolls(emu, 40);
+    typeLine(emu, "DIR");
+    if (!runToIdle(emu, 500000000)) {
+      error = "DIR did not finish while recording";
+      return false;
+    }
+    idlePolls(emu, 10);
+    end = emu.getInstructionCount();
+    emu.stopRecording(log);
+  }
+  {
+    EmuConsoleChannel channel;
+    channel.output = [&replayed](uint8_t ch) { replayed += (char)ch; };
+    EmuConsoleScope scope(&channel);
+
+    HBIOSEmulator emu;
+    if (!emu.loadROM(env.rom.data(), env.rom.size()) || !emu.startReplay(log.data(), log.size())) {
+      error = "cannot start replay";
+      return false;
+    }
+    for (int i = 0; i < 100000 && emu.isReplaying() && emu.isRunning(); i++) emu.runBatch(100000);
+    if (emu.isReplaying()) {
+      error = "replay stalled at instruction " + std::to_string(emu.getInstructionCount());
+      return false;
+    }
+    if (emu.replayDiverged()) {
+      error = "replay diverged at instruction " + std::to_string(emu.replayDivergedAt());
+      return false;
+    }
+    if (emu.getInstructionCount() != end) {
+      error = "replay ended at instruction " + std::to_string(emu.getInstructionCount()) +
+              ", recording at " + std::to_string(end);
+      return false;
+    }
+  }
+  if (replayed != recorded) {
+    error = "replay output differs from the recording";
+    return false;
+  }
+  return true;
+}
+
+// EI as the last instruction of a batch with the guest tick landing
+// between batches: the instruction after EI must run before the
+// interrupt is taken.  The program runs from RAM bank 0 without a boot.
+static bool checkInterruptAfterEI(const CheckEnv& env, std::string& error) {
+  static const uint8_t program[] = {
+    0xF3,              // 0000  DI
+    0xED, 0x56,        // 0001  IM 1
+    0x31, 0x00, 0xF0,  // 0003  LD SP,F000h
+    0x3E, 0x01,        // 0006  LD A,1
+    0xFB,              // 0008  EI           (5th instruction, ends the batch)
+    0x32, 0x00, 0x90,  // 0009  LD (9000h),A (must run before the interrupt)
+    0x18, 0xFE,        // 000C  JR $
+  };
+  static const uint8_t handler[] = {
+    0x3A, 0x00, 0x90,  // 0038  LD A,(9000h)
+    0x32, 0x01, 0x90,  // 003B  LD (9001h),A
+    0x18, 0xFE,        // 003E  JR $
+  };
+  const int ticks_at = 5;
+
+  HBIOSEmulator emu;
+  if (!emu.loadROM(env.rom.data(), env.rom.size())) {
+    error = "cannot load ROM";
+    return false;
+  }
+  emu.start();
+  banked_mem* mem = emu.getMemory();
+  mem->select_bank(0x80);
+  for (size_t i = 0; i < sizeof(program); i++) mem->store_mem((uint16_t)i, program[i]);
+  for (size_t i = 0; i < sizeof(handler); i++) mem->store_mem((uint16_t)(0x38 + i), handler[i]);
+  mem->store_mem(0x9000, 0);
+  mem->store_mem(0x9001, 0);
+
+  emu.setTimerInterrupt(1000);
+  emu.setTickSource(HBIOSEmulator::TICK_GUEST, ticks_at * 1000);
+  emu.runBatch(100);
+  if (emu.getInstructionCount() != ticks_at) {
+    error = "first batch ran " + std::to_string(emu.getInstructionCount()) + " instructions, expected " +
+            std::to_string(ticks_at);
+    return false;
+  }
+  for (int i = 0; i < 4; i++) emu.runBatch(100);
+
+  if (emu.getMetrics().interrupts == 0) {
+    error = "no interrupt delivered";
+    return false;
+  }
+  if (mem->fetch_mem(0x9001) != 1) {
+    error = "interrupt taken before the instruction after EI";
+    return false;
+  }
+  return true;
+}
+
+// Flat 64KB that remembers where it was stored to
+class TrackedMem : public qkz80_cpu_mem {
+public:
+  void store_mem(uint16_t addr, uint8_t value) override {
+    written.push_back(addr);
+    qkz80_cpu_mem::store_mem(addr, value);
+  }
+  std::vector<uint16_t> written;
+};
+
+static std::string hex16(uint16_t v) {
+  char buf[8];
+  snprintf(buf, sizeof(buf), "%04X", v);
+  return buf;
+}
+
+// First register pair that differs, or empty
+static std::string regDiff(const qkz80_reg_set& fused, const qkz80_reg_set& interp) {
+  static const char* NAMES[] = { "AF", "BC", "DE", "HL", "SP", "PC" };
+  const uint16_t a[] = { fused.AF.get_pair16(), fused.BC.get_pair16(), fused.DE.get_pair16(),
+                         fused.HL.get_pair16(), fused.SP.get_pair16(), fused.PC.get_pair16() };
+  const uint16_t b[] = { interp.AF.get_pair16(), interp.BC.get_pair16(), interp.DE.get_pair16(),
+                         interp.HL.get_pair16(), interp.SP.get_pair16(), interp.PC.get_pair16() };
+  for (int i = 0; i < 6; i++) {
+    if (a[i] != b[i]) return std::string(NAMES[i]) + " " + hex16(a[i]) + ", interpreter " + hex16(b[i]);
+  }
+  return std::string();
+}
+
+// Every fused handler (hbios_fusion.h) against the interpreter: random
+// registers and memory, the pattern at a random PC, and a quarter of the
+// time HL or DE aimed into the sequence itself so stores can land on its
+// own bytes.  Whatever HBIOSFusion::step() runs is compared with as many
+// cpu.execute() calls on a copy of the state; the refresh register,
+// which the handlers leave alone, is not compared.
+static bool checkFusionHandlers(const CheckEnv& env, std::string& error) {
+  const int trials = 20000;
+  std::mt19937 rng(0x2F05E);
+  std::vector<uint8_t> image(0x10000);
+  for (uint8_t& b : image) b = (uint8_t)rng();
+
+  TrackedMem fused_mem, interp_mem;
+  for (int a = 0; a < 0x10000; a++) {
+    fused_mem.store_mem((uint16_t)a, image[a]);
+    interp_mem.store_mem((uint16_t)a, image[a]);
+  }
+  qkz80 cpu(&interp_mem);
+  cpu.set_cpu_mode(qkz80::MODE_Z80);
+  HBIOSFusion fusion;
+  fusion.setEnabled(true);
+
+  for (int h = 0; h < HBIOSFusion::handlerCount(); h++) {
+    int16_t pattern[HBIOSFusion::MAX_BYTES];
+    int length = HBIOSFusion::handlerPattern(h, pattern);
+    for (int t = 0; t < trials; t++) {
+      uint16_t pc = (uint16_t)(0x0100 + rng() % 0xEE00);
+      for (int i = 0; i < length; i++) {
+        uint8_t b = pattern[i] < 0 ? (uint8_t)rng() : (uint8_t)pattern[i];
+        fused_mem.store_mem((uint16_t)(pc + i), b);
+        interp_mem.store_mem((uint16_t)(pc + i), b);
+      }
+      qkz80_reg_set regs = cpu.regs;
+      regs.AF.set_pair16((uint16_t)rng());
+      regs.BC.set_pair16((uint16_t)rng());
+      regs.DE.set_pair16((uint16_t)rng());
+      regs.HL.set_pair16((uint16_t)rng());
+      regs.SP.set_pair16((uint16_t)rng());
+      regs.PC.set_pair16(pc);
+      if (rng() % 4 == 0) regs.HL.set_pair16((uint16_t)(pc + rng() % HBIOSFusion::MAX_BYTES));
+      if (rng() % 4 == 0) regs.DE.set_pair16((uint16_t)(pc + rng() % HBIOSFusion::MAX_BYTES));
+      fused_mem.written.clear();
+      interp_mem.written.clear();
+
+      qkz80_reg_set fused = regs;
+      int count = fusion.step(fused, fused_mem);
+      if (count > 0) {
+        cpu.regs = regs;
+        for (int i = 0; i < count; i++) cpu.execute();
+        std::string diff = regDiff(fused, cpu.regs);
+        for (const std::vector<uint16_t>* list : { &fused_mem.written, &interp_mem.written }) {
+          for (uint16_t a : *list) {
+            if (diff.empty() && fused_mem.fetch_mem(a) != interp_mem.fetch_mem(a)) {
+              diff = "(" + hex16(a) + ") differs";
+            }
+          }
+        }
+        if (!diff.empty()) {
+          error = std::string(HBIOSFusion::handlerName(h)) + " at " + hex16(pc) + ": " + diff;
+          return false;
+        }
+      }
+
+      // Back to the shared image for the next trial
+      std::vector<uint16_t> touched(fused_mem.written);
+      touched.insert(touched.end(), interp_mem.written.begin(), interp_mem.written.end());
+      for (int i = 0; i < length; i++) touched.push_back((uint16_t)(pc + i));
+      for (uint16_t a : touched) {
+        fused_mem.store_mem(a, image[a]);
+        interp_mem.store_mem(a, image[a]);
+      }
+    }
+    if (fusion.hits(h) == 0) {
+      error = std::string(HBIOSFusion::handlerName(h)) + " never ran";
+      return false;
+    }
+  }
+  return true;
+}
+
+struct Check {
+  const char* name;
+  bool (*run)(const CheckEnv& env, std::string& error);
+};
+
+static const Check CHECKS[] = {
+  { "replay/idle-polls", checkReplayIdlePolls },
+  { "interrupt/after-ei", checkInterruptAfterEI },
+  { "fusion/handlers", checkFusionHandlers },
+};
+
+int main(int argc, char** argv) {
+  std::string rom_path = "../iOSCPM/Resources/emu_avw.rom";
+  std::string assets = "../release_assets";
+  std::string only;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--rom") && i + 1 < argc) rom_path = argv[++i];
+    else if (!strcmp(argv[i], "--assets") && i + 1 < argc) assets = argv[++i];
+    else if (!strcmp(argv[i], "--only") && i + 1 < argc) only = argv[++i];
+    else usage();
+  }
+
+  CheckEnv env;
+  if (!emu_file_load(rom_path, env.rom)) {
+    fprintf(stderr, "Cannot read ROM %s\n", rom_path.c_str());
+    return 2;
+  }
+  std::string disk_path = assets + "/hd1k_cpm22.img";
+  if (!emu_file_load(disk_path, env.disk)) {
+    fprintf(stderr, "Cannot read %s\n", disk_path.c_str());
+    return 2;
+  }
+
+  emu_io_init();
+
+  int failures = 0;
+  int selected = 0;
+  for (const Check& c : CHECKS) {
+    if (!only.empty() && std::string(c.name).find(only) == std::string::npos) continue;
+    selected++;
+    std::string error;
+    bool passed = c.run(env, error);
+    if (!passed) failures++;
+    printf("%-24s %s%s%s\n", c.name, passed ? "PASS" : "FAIL", passed ? "" : "  ", error.c_str());
+  }
+  if (selected == 0) {
+    fprintf(stderr, "No checks selected\n");
+    return 2;
+  }
+  return failures > 0 ? 1 : 0;
+}
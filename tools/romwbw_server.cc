@@ -0,0 +1,184 @@
+/*
+ * RomWBW Headless Server
+ *
+ * Runs N CP/M sessions on a fixed worker pool (see session_scheduler.h).
+ *
+ * Usage:
+ *   romwbw_server --rom FILE [--disk UNIT:FILE[:SLICES]]... [--boot STR]
+ *                 [--sessions N] [--workers M] [--slice-us US] [--metrics FILE]
+ *                 [--host-dir DIR]
+ *
+ * Commands on stdin:
+ *   <id> <text>   Type text (plus CR) into session id
+ *   stats         Per-session state, instructions and CPU share
+ *   metrics       Per-session metrics in Prometheus text format
+ *   quit          Stop all sessions and exit
+ *
+ * Session output is written to stdout as "[id] text" lines.  With
+ * --metrics, the Prometheus text is also rewritten to FILE every second
+ * (for a node_exporter textfile collector or similar).  R8/W8 host file
+ * transfer is off unless --host-dir names the directory they use; each
+ * session has its own transfer.
+ */
+
+#include "session_scheduler.h"
+#include "headless_setup.h"
+#include "emu_io.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/select.h>
+#include <unistd.h>
+
+static void usage() {
+  fprintf(stderr,
+          "usage: romwbw_server --rom FILE [--disk UNIT:FILE[:SLICES]]... [--boot STR]\n"
+          "                     [--sessions N] [--workers M] [--slice-us US] [--metrics FILE]\n"
+          "                     [--host-dir DIR]\n");
+  exit(2);
+}
+
+// Print complete lines of session output, keeping partial lines buffered
+static void drainOutput(SessionScheduler& sched, std::vector<std::string>& partial) {
+  size_t n = sched.sessionCount();
+  if (partial.size() < n) partial.resize(n);
+  for (size_t id = 0; id < n; id++) {
+    partial[id] += sched.takeOutput((int)id);
+    size_t pos;
+    while ((pos = partial[id].find('\n')) != std::string::npos) {
+      std::string line = partial[id].substr(0, pos);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      printf("[%zu] %s\n", id, line.c_str());
+      partial[id].erase(0, pos + 1);
+    }
+  }
+  fflush(stdout);
+}
+
+static void printStats(SessionScheduler& sched) {
+  static const char* names[] = { "runnable", "running", "parked", "done" };
+  printf("%-6s %-9s %14s %12s %8s\n", "id", "state", "instructions", "cpu_ms", "share");
+  for (const SessionStats& st : sched.stats()) {
+    printf("%-6d %-9s %14lld %12.1f %7.1f%%\n", st.id, names[st.state], st.instructions,
+           st.cpu_ns / 1e6, st.cpu_share * 100.0);
+  }
+  fflush(stdout);
+}
+
+static std::string metricsText(SessionScheduler& sched) {
+  std::vector<HBIOSMetricsSample> samples;
+  for (const SessionStats& st : sched.stats()) {
+    HBIOSMetricsSample sample;
+    sample.labels = "session=\"" + std::to_string(st.id) + "\"";
+    sample.metrics = st.metrics;
+    samples.push_back(sample);
+  }
+  return hbios_metrics_prometheus(samples);
+}
+
+// Write then rename, so a scraper never sees a partial file
+static void writeMetrics(SessionScheduler& sched, const std::string& path) {
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "w");
+  if (!f) return;
+  std::string text = metricsText(sched);
+  bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+  if (fclose(f) != 0) ok = false;
+  if (ok) rename(tmp.c_str(), path.c_str());
+  else remove(tmp.c_str());
+}
+
+int main(int argc, char** argv) {
+  std::string rom_path;
+  std::string metrics_path;
+  HeadlessImages images;
+  int sessions = 1;
+  int workers = (int)std::thread::hardware_concurrency();
+  int slice_us = 2000;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--rom") && i + 1 < argc) rom_path = argv[++i];
+    else if (!strcmp(argv[i], "--boot") && i + 1 < argc) images.boot = argv[++i];
+    else if (!strcmp(argv[i], "--sessions") && i + 1 < argc) sessions = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--workers") && i + 1 < argc) workers = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--slice-us") && i + 1 < argc) slice_us = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--metrics") && i + 1 < argc) metrics_path = argv[++i];
+    else if (!strcmp(argv[i], "--host-dir") && i + 1 < argc) emu_host_files_set_dir(argv[++i]);
+    else if (!strcmp(argv[i], "--disk") && i + 1 < argc) {
+      DiskSpec spec;
+      if (!headless_parse_disk(argv[++i], spec)) return 1;
+      images.disks.push_back(std::move(spec));
+    } else {
+      usage();
+    }
+  }
+  if (rom_path.empty()) usage();
+
+  if (!headless_load_rom(rom_path, images)) return 1;
+
+  emu_io_init();
+  SessionScheduler sched(workers > 0 ? workers : 1, slice_us);
+
+  for (int i = 0; i < sessions; i++) {
+    int id = sched.addSession([&](HBIOSEmulator& emu) {
+      return headless_start(emu, images);
+    });
+    if (id < 0) {
+      fprintf(stderr, "Failed to start session %d\n", i);
+      return 1;
+    }
+  }
+
+  std::vector<std::string> partial;
+  std::string command;
+  bool quit = false;
+  std::chrono::steady_clock::time_point next_metrics = std::chrono::steady_clock::now();
+  while (!quit) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    struct timeval tv = { 0, 20000 };
+    if (select(STDIN_FILENO + 1, &fds, nullptr, nullptr, &tv) > 0) {
+      char buf[512];
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n <= 0) quit = true;
+      for (ssize_t i = 0; i < n; i++) {
+        if (buf[i] != '\n') {
+          command += buf[i];
+          continue;
+        }
+        if (command == "quit") {
+          quit = true;
+        } else if (command == "stats") {
+          printStats(sched);
+        } else if (command == "metrics") {
+          fputs(metricsText(sched).c_str(), stdout);
+        } else {
+          char* end = nullptr;
+          long id = strtol(command.c_str(), &end, 10);
+          if (end != command.c_str()) {
+            std::string text = (*end == ' ') ? std::string(end + 1) : std::string(end);
+            sched.sendInput((int)id, text + "\r");
+          }
+        }
+        command.clear();
+      }
+    }
+    drainOutput(sched, partial);
+    if (!metrics_path.empty() && std::chrono::steady_clock::now() >= next_metrics) {
+      writeMetrics(sched, metrics_path);
+      next_metrics += std::chrono::seconds(1);
+    }
+    if (sched.allDone()) quit = true;
+  }
+
+  sched.shutdown();
+  drainOutput(sched, partial);
+  printStats(sched);
+  if (!metrics_path.empty()) writeMetrics(sched, metrics_path);
+  return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * RomWBW ZEX Harness - Z80 Instruction Exerciser Conformance
+ *
+ * Runs ZEXDOC (documented flags) and ZEXALL (all flags) directly on the
+ * CPU core under a minimal CP/M shim - no ROM, no HBIOS, no disks - and
+ * reports every test group as PASS or FAIL along with runtime and MIPS.
+ * Any change to instruction execution should keep both at zero failures.
+ *
+ * Usage:
+ *   romwbw_zex [--assets DIR] [--engine NAME] [--quiet] [PROGRAM.COM]...
+ *
+ * With no programs, ZEXDOC.COM and ZEXALL.COM are read from user 2 of
+ * DIR/hd1k_cpm22.img (DIR defaults to ../release_assets).
+ *
+ * The shim loads the program at 0100h, points the BDOS entry at 0005h
+ * to a trap and answers console output (functions 2 and 9).  Reaching
+ * 0000h (warm boot) ends the run.
+ *
+ * Every execution engine the core offers is listed in ENGINES and run
+ * in turn unless --engine picks one.  Exit status is 0 when every group
+ * passes on every engine, 1 otherwise, 2 for usage errors.
+ */
+
+#include "cpm_disk.h"
+#include "emu_io.h"
+#include "hbios_fusion.h"
+#include "qkz80.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const uint16_t TPA = 0x0100;
+static const uint16_t BDOS_ENTRY = 0x0005;
+static const uint16_t BDOS_TRAP = 0xFE00;   // Also the top of the TPA for (0006h)
+
+static void usage() {
+  fprintf(stderr, "usage: romwbw_zex [--assets DIR] [--engine NAME] [--quiet] [PROGRAM.COM]...\n");
+  exit(2);
+}
+
+//=============================================================================
+// CP/M Shim
+//=============================================================================
+
+struct ZexGroup {
+  std::string name;
+  bool passed;
+  std::string detail;  // CRC line on failure
+};
+
+struct ZexRun {
+  std::vector<ZexGroup> groups;
+  bool finished;       // Program returned to CP/M
+  long long instructions;
+  double host_ms;
+};
+
+class ZexShim {
+public:
+  ZexShim(ZexRun& run, bool quiet) : run(run), quiet(quiet) {}
+
+  // Console output from BDOS functions 2 and 9
+  void put(char c) {
+    if (!quiet) {
+      putchar(c);
+      if (c == '\n') fflush(stdout);
+    }
+    if (c == '\r') return;
+    if (c != '\n') {
+      line += c;
+      return;
+    }
+    // Group results end in "OK" or carry "ERROR **** crc expected:..."
+    size_t dots = line.find("..");
+    if (dots != std::string::npos) {
+      ZexGroup g;
+      g.name = line.substr(0, dots);
+      g.passed = line.find("ERROR") == std::string::npos;
+      if (!g.passed) g.detail = line.substr(line.find("ERROR"));
+      run.groups.push_back(g);
+    }
+    line.clear();
+  }
+
+  // Called with PC at the BDOS entry; performs the call and returns to
+  // the caller
+  void bdos(qkz80& cpu, qkz80_cpu_mem& mem) {
+    uint8_t fn = cpu.regs.BC.get_low();
+    uint16_t de = cpu.regs.DE.get_pair16();
+    if (fn == 2) {
+      put((char)cpu.regs.DE.get_low());
+    } else if (fn == 9) {
+      for (uint16_t a = de; mem.fetch_mem(a) != '$'; a++) put((char)mem.fetch_mem(a));
+    }
+    uint16_t sp = cpu.regs.SP.get_pair16();
+    uint16_t ret = mem.fetch_mem(sp) | (mem.fetch_mem((uint16_t)(sp + 1)) << 8);
+    cpu.regs.SP.set_pair16((uint16_t)(sp + 2));
+    cpu.regs.PC.set_pair16(ret);
+  }
+
+private:
+  ZexRun& run;
+  bool quiet;
+  std::string line;
+};
+
+//=============================================================================
+// Engines
+//=============================================================================
+
+// Runs a loaded program until it warm boots or exceeds the budget
+typedef bool (*ZexEngineFn)(qkz80_cpu_mem& mem, ZexShim& shim, long long budget, long long& count);
+
+static bool runInterpreter(qkz80_cpu_mem& mem, ZexShim& shim, long long budget, long long& count) {
+  qkz80 cpu(&mem);
+  cpu.set_cpu_mode(qkz80::MODE_Z80);
+  cpu.regs.PC.set_pair16(TPA);
+  cpu.regs.SP.set_pair16(BDOS_TRAP);
+  count = 0;
+  while (count < budget) {
+    uint16_t pc = cpu.regs.PC.get_pair16();
+    if (pc == 0x0000) return true;
+    if (pc == BDOS_ENTRY) {
+      shim.bdos(cpu, mem);
+      continue;
+    }
+    cpu.execute();
+    count++;
+  }
+  return false;
+}
+
+// The interpreter behind the fused sequence handlers (hbios_fusion.h)
+static bool runFused(qkz80_cpu_mem& mem, ZexShim& shim, long long budget, long long& count) {
+  qkz80 cpu(&mem);
+  cpu.set_cpu_mode(qkz80::MODE_Z80);
+  cpu.regs.PC.set_pair16(TPA);
+  cpu.regs.SP.set_pair16(BDOS_TRAP);
+  HBIOSFusion fusion;
+  fusion.setEnabled(true);
+  count = 0;
+  while (count < budget) {
+    uint16_t pc = cpu.regs.PC.get_pair16();
+    if (pc == 0x0000) return true;
+    if (pc == BDOS_ENTRY) {
+      shim.bdos(cpu, mem);
+      continue;
+    }
+    int fused = fusion.step(cpu.regs, mem);
+    if (fused) {
+      count += fused;
+      continue;
+    }
+    cpu.execute();
+    count++;
+  }
+  return false;
+}
+
+struct ZexEngine {
+  const char* name;
+  ZexEngineFn run;
+};
+
+static const ZexEngine ENGINES[] = {
+  { "interpreter", runInterpreter },
+  { "fused", runFused },
+};
+
+// Roughly 3x the instruction count of a full ZEXALL run
+static const long long ZEX_BUDGET = 20000000000LL;
+
+static ZexRun runProgram(const ZexEngine& engine, const std::vector<uint8_t>& program, bool quiet) {
+  ZexRun run;
+  ZexShim shim(run, quiet);
+  qkz80_cpu_mem mem;
+  for (int a = 0; a < 0x10000; a++) mem.store_mem((uint16_t)a, 0);
+  for (size_t i = 0; i < program.size() && TPA + i < BDOS_TRAP; i++) {
+    mem.store_mem((uint16_t)(TPA + i), program[i]);
+  }
+  // JP BDOS_TRAP at 0005h: programs read the TPA top from 0006h
+  mem.store_mem(BDOS_ENTRY, 0xC3);
+  mem.store_mem(BDOS_ENTRY + 1, BDOS_TRAP & 0xFF);
+  mem.store_mem(BDOS_ENTRY + 2, BDOS_TRAP >> 8);
+  mem.store_mem(BDOS_TRAP, 0xC9);
+
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point started = Clock::now();
+  run.finished = engine.run(mem, shim, ZEX_BUDGET, run.instructions);
+  run.host_ms = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+  return run;
+}
+
+//=============================================================================
+// Main
+//=============================================================================
+
+struct ZexProgram {
+  std::string name;
+  std::vector<uint8_t> data;
+};
+
+static bool loadFromImage(const std::string& assets, std::vector<ZexProgram>& programs) {
+  std::string path = assets + "/hd1k_cpm22.img";
+  std::vector<uint8_t> image;
+  if (!emu_file_load(path, image)) {
+    fprintf(stderr, "Cannot read %s\n", path.c_str());
+    return false;
+  }
+  CpmSlice slice(image.data(), image.size());
+  for (const char* name : { "ZEXDOC.COM", "ZEXALL.COM" }) {
+    ZexProgram p;
+    p.name = name;
+    if (!slice.readFile(2, name, p.data)) {
+      fprintf(stderr, "%s not found in user 2 of %s\n", name, path.c_str());
+      return false;
+    }
+    programs.push_back(std::move(p));
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  std::string assets = "../release_assets";
+  std::string engine_name;
+  bool quiet = false;
+  std::vector<ZexProgram> programs;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--assets") && i + 1 < argc) assets = argv[++i];
+    else if (!strcmp(argv[i], "--engine") && i + 1 < argc) engine_name = argv[++i];
+    else if (!strcmp(argv[i], "--quiet")) quiet = true;
+    else if (argv[i][0] == '-') usage();
+    else {
+      ZexProgram p;
+      p.name = argv[i];
+      if (!emu_file_load(p.name, p.data)) {
+        fprintf(stderr, "Cannot read %s\n", argv[i]);
+        return 2;
+      }
+      programs.push_back(std::move(p));
+    }
+  }
+  if (programs.empty() && !loadFromImage(assets, programs)) return 2;
+
+  std::vector<const ZexEngine*> engines;
+  for (const ZexEngine& e : ENGINES) {
+    if (engine_name.empty() || engine_name == e.name) engines.push_back(&e);
+  }
+  if (engines.empty()) {
+    fprintf(stderr, "Unknown engine %s; available:", engine_name.c_str());
+    for (const ZexEngine& e : ENGINES) fprintf(stderr, " %s", e.name);
+    fprintf(stderr, "\n");
+    return 2;
+  }
+
+  emu_io_init();
+
+  int failures = 0;
+  for (const ZexEngine* engine : engines) {
+    for (const ZexProgram& program : programs) {
+      if (!quiet) printf("==== %s on %s ====\n", program.name.c_str(), engine->name);
+      ZexRun run = runProgram(*engine, program.data, quiet);
+
+      int failed = 0;
+      for (const ZexGroup& g : run.groups) {
+        if (!g.passed) failed++;
+        if (quiet || !g.passed) {
+          printf("%-6s %s %s %s\n", g.passed ? "PASS" : "FAIL", program.name.c_str(),
+                 g.name.c_str(), g.detail.c_str());
+        }
+      }
+      bool ok = run.finished && failed == 0 && !run.groups.empty();
+      if (!ok) failures++;
+      printf("%s %s [%s]: %zu groups, %d failed%s, %lld instructions, %.0f ms, %.2f MIPS\n",
+             ok ? "PASS" : "FAIL", program.name.c_str(), engine->name, run.groups.size(), failed,
+             run.finished ? "" : ", did not finish", run.instructions, run.host_ms,
+             run.host_ms > 0 ? run.instructions / (run.host_ms * 1000.0) : 0.0);
+      fflush(stdout);
+    }
+  }
+  return failures > 0 ? 1 : 0;
+}
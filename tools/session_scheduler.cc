@@ -0,0 +1,218 @@
+/*
+ * Session Scheduler - Work-Stealing Worker Pool Implementation
+ */
+
+#include "session_scheduler.h"
+#include <chrono>
+
+typedef std::chrono::steady_clock SchedClock;
+
+SessionScheduler::SessionScheduler(int worker_count, int slice, int batch_size)
+  : stopping(false), next_worker(0), slice_us(slice), batch(batch_size)
+{
+  if (worker_count < 1) worker_count = 1;
+  for (int i = 0; i < worker_count; i++) {
+    workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for (int i = 0; i < worker_count; i++) {
+    workers[i]->thread = std::thread(&SessionScheduler::workerLoop, this, i);
+  }
+}
+
+SessionScheduler::~SessionScheduler() {
+  shutdown();
+}
+
+void SessionScheduler::shutdown() {
+  if (stopping.exchange(true)) return;
+  idle_cv.notify_all();
+  for (auto& w : workers) {
+    if (w->thread.joinable()) w->thread.join();
+  }
+}
+
+//=============================================================================
+// Sessions
+//=============================================================================
+
+int SessionScheduler::addSession(const std::function<bool(HBIOSEmulator&)>& setup) {
+  std::unique_ptr<Session> s(new Session());
+  s->state = SESSION_RUNNABLE;
+  s->wake_pending = false;
+  s->cpu_ns = 0;
+  s->instructions = 0;
+  s->slices = 0;
+
+  Session* raw = s.get();
+  s->channel.output = [raw](uint8_t ch) {
+    std::lock_guard<std::mutex> guard(raw->output_lock);
+    raw->output.push_back((char)ch);
+  };
+  s->channel.on_input = [this, raw]() { wake(raw); };
+
+  {
+    // The emulator clears and fills its console queue during setup
+    EmuConsoleScope scope(&s->channel);
+    s->emu.reset(new HBIOSEmulator());
+    if (!setup(*s->emu) || !s->emu->isRunning()) return -1;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(sessions_lock);
+    s->id = (int)sessions.size();
+    sessions.push_back(std::move(s));
+  }
+  enqueue(raw);
+  return raw->id;
+}
+
+SessionScheduler::Session* SessionScheduler::find(int id) const {
+  std::lock_guard<std::mutex> guard(sessions_lock);
+  if (id < 0 || id >= (int)sessions.size()) return nullptr;
+  return sessions[id].get();
+}
+
+size_t SessionScheduler::sessionCount() const {
+  std::lock_guard<std::mutex> guard(sessions_lock);
+  return sessions.size();
+}
+
+bool SessionScheduler::allDone() const {
+  std::lock_guard<std::mutex> guard(sessions_lock);
+  for (const auto& s : sessions) {
+    if (s->state != SESSION_DONE) return false;
+  }
+  return true;
+}
+
+void SessionScheduler::sendInput(int id, const std::string& text) {
+  Session* s = find(id);
+  if (s) s->channel.pushString(text.c_str());
+}
+
+std::string SessionScheduler::takeOutput(int id) {
+  Session* s = find(id);
+  if (!s) return std::string();
+  std::lock_guard<std::mutex> guard(s->output_lock);
+  std::string out;
+  out.swap(s->output);
+  return out;
+}
+
+std::vector<SessionStats> SessionScheduler::stats() const {
+  std::vector<SessionStats> result;
+  uint64_t total_ns = 0;
+  {
+    std::lock_guard<std::mutex> guard(sessions_lock);
+    for (const auto& s : sessions) {
+      SessionStats st;
+      st.id = s->id;
+      st.state = (SessionState)s->state.load();
+      st.instructions = s->instructions;
+      st.cpu_ns = s->cpu_ns;
+      st.slices = s->slices;
+      st.metrics = s->emu->getMetrics();
+      st.cpu_share = 0;
+      total_ns += st.cpu_ns;
+      result.push_back(st);
+    }
+  }
+  for (SessionStats& st : result) {
+    st.cpu_share = total_ns ? (double)st.cpu_ns / (double)total_ns : 0.0;
+  }
+  return result;
+}
+
+//=============================================================================
+// Queues
+//=============================================================================
+
+void SessionScheduler::enqueue(Session* s) {
+  Worker& w = *workers[next_worker++ % workers.size()];
+  {
+    std::lock_guard<std::mutex> guard(w.lock);
+    w.runnable.push_back(s);
+  }
+  idle_cv.notify_one();
+}
+
+// Called from the channel when input arrives.  wake_pending closes the
+// race with a worker that is about to park the session.
+void SessionScheduler::wake(Session* s) {
+  s->wake_pending = true;
+  int expected = SESSION_PARKED;
+  if (s->state.compare_exchange_strong(expected, SESSION_RUNNABLE)) {
+    s->wake_pending = false;
+    enqueue(s);
+  }
+}
+
+SessionScheduler::Session* SessionScheduler::popLocal(int index) {
+  Worker& w = *workers[index];
+  std::lock_guard<std::mutex> guard(w.lock);
+  if (w.runnable.empty()) return nullptr;
+  Session* s = w.runnable.front();
+  w.runnable.pop_front();
+  return s;
+}
+
+SessionScheduler::Session* SessionScheduler::steal(int thief) {
+  int n = (int)workers.size();
+  for (int i = 1; i < n; i++) {
+    Worker& victim = *workers[(thief + i) % n];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (victim.runnable.empty()) continue;
+    Session* s = victim.runnable.back();
+    victim.runnable.pop_back();
+    return s;
+  }
+  return nullptr;
+}
+
+//=============================================================================
+// Workers
+//=============================================================================
+
+void SessionScheduler::workerLoop(int index) {
+  while (!stopping) {
+    Session* s = popLocal(index);
+    if (!s) s = steal(index);
+    if (!s) {
+      std::unique_lock<std::mutex> lock(idle_lock);
+      idle_cv.wait_for(lock, std::chrono::milliseconds(10));
+      continue;
+    }
+
+    s->state = SESSION_RUNNING;
+    runSlice(s);
+
+    if (!s->emu->isRunning()) {
+      s->state = SESSION_DONE;
+    } else if (s->emu->isWaitingForInput()) {
+      s->state = SESSION_PARKED;
+      if (s->wake_pending.exchange(false)) {
+        int expected = SESSION_PARKED;
+        if (s->state.compare_exchange_strong(expected, SESSION_RUNNABLE)) enqueue(s);
+      }
+    } else {
+      s->state = SESSION_RUNNABLE;
+      Worker& w = *workers[index];
+      std::lock_guard<std::mutex> guard(w.lock);
+      w.runnable.push_back(s);
+    }
+  }
+}
+
+void SessionScheduler::runSlice(Session* s) {
+  EmuConsoleScope scope(&s->channel);
+  HBIOSEmulator& emu = *s->emu;
+
+  SchedClock::time_point start = SchedClock::now();
+  emu.runFor(slice_us, false, batch);  // Input queued on the channel resumes a suspended read
+
+  uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      SchedClock::now() - start).count();
+  s->cpu_ns += ns;
+  s->instructions = emu.getInstructionCount();
+  s->slices++;
+}
@@ -0,0 +1,106 @@
+/*
+ * Session Scheduler - Many HBIOSEmulator Sessions on a Worker Pool
+ *
+ * Each worker owns a deque of runnable sessions.  A worker takes the
+ * oldest session from its own deque, runs runBatch() until the time
+ * slice expires or the guest blocks on console input, then requeues it
+ * at the back.  Idle workers steal from the back of other workers'
+ * deques.  Sessions waiting for input are parked off every queue and
+ * cost nothing until input arrives on their console channel.
+ */
+
+#ifndef SESSION_SCHEDULER_H
+#define SESSION_SCHEDULER_H
+
+#include "hbios_core.h"
+#include "emu_session.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum SessionState {
+  SESSION_RUNNABLE = 0,  // On a worker deque
+  SESSION_RUNNING = 1,   // Executing a time slice
+  SESSION_PARKED = 2,    // Waiting for console input
+  SESSION_DONE = 3       // Guest halted or stopped
+};
+
+struct SessionStats {
+  int id;
+  SessionState state;
+  long long instructions;
+  uint64_t cpu_ns;       // Host time spent in this session's slices
+  double cpu_share;      // Fraction of all session CPU time
+  uint64_t slices;
+  HBIOSMetricsSnapshot metrics;  // Read lock-free from the running emulator
+};
+
+class SessionScheduler {
+public:
+  // slice_us: target host time per slice; batch: instructions per runBatch()
+  explicit SessionScheduler(int workers, int slice_us = 2000, int batch = 10000);
+  ~SessionScheduler();
+
+  // Create a session; setup runs with the session's console bound and
+  // should load ROM/disks and call start().  Returns the id or -1.
+  int addSession(const std::function<bool(HBIOSEmulator&)>& setup);
+
+  // Console I/O (thread-safe)
+  void sendInput(int id, const std::string& text);
+  std::string takeOutput(int id);
+
+  std::vector<SessionStats> stats() const;
+  size_t sessionCount() const;
+  bool allDone() const;
+
+  void shutdown();
+
+private:
+  struct Session {
+    int id;
+    std::unique_ptr<HBIOSEmulator> emu;
+    EmuConsoleChannel channel;
+    std::mutex output_lock;
+    std::string output;
+    std::atomic<int> state;
+    std::atomic<bool> wake_pending;
+    std::atomic<uint64_t> cpu_ns;
+    std::atomic<long long> instructions;
+    std::atomic<uint64_t> slices;
+  };
+
+  struct Worker {
+    std::mutex lock;
+    std::deque<Session*> runnable;
+    std::thread thread;
+  };
+
+  void workerLoop(int index);
+  Session* popLocal(int index);
+  Session* steal(int thief);
+  void runSlice(Session* s);
+  void enqueue(Session* s);
+  void wake(Session* s);
+  Session* find(int id) const;
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  mutable std::mutex sessions_lock;
+  std::vector<std::unique_ptr<Session>> sessions;
+
+  std::mutex idle_lock;
+  std::condition_variable idle_cv;
+  std::atomic<bool> stopping;
+  std::atomic<unsigned> next_worker;
+
+  const int slice_us;
+  const int batch;
+};
+
+#endif // SESSION_SCHEDULER_H